@@ -0,0 +1,144 @@
+/*
+ * checksum.h, Yehen Yan, CS5600 Practicum II
+ * Content checksums for stored files
+ * Last modified: Dec 2025
+ */
+
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Extend a CRC32C (Castagnoli) checksum with more bytes
+ *
+ * Start with crc = 0; feeding data in pieces gives the same result as
+ * feeding it at once. Uses the SSE4.2 crc32 instruction when the CPU has it.
+ *
+ * @param crc checksum of the bytes so far
+ * @param data next bytes
+ * @param len number of bytes
+ * @return uint32_t checksum including data
+ */
+uint32_t crc32c_update(uint32_t crc, const void *data, size_t len);
+
+/**
+ * @brief CRC32C of two runs of bytes laid end to end
+ *
+ * Lets pieces that were checksummed separately, in any order, be joined
+ * without reading them again.
+ *
+ * @param crc1 checksum of the first run
+ * @param crc2 checksum of the second run
+ * @param len2 length of the second run
+ * @return uint32_t checksum of the first run followed by the second
+ */
+uint32_t crc32c_combine(uint32_t crc1, uint32_t crc2, uint64_t len2);
+
+/**
+ * @brief Whether crc32c_update() runs on the CPU's CRC instruction
+ *
+ * @return int 1 for the hardware path, 0 for the table-driven one
+ */
+int crc32c_hardware(void);
+
+#define SHA256_DIGEST_SIZE 32
+#define SHA256_HEX_SIZE (2 * SHA256_DIGEST_SIZE + 1) // hex digits plus the terminator
+
+// Running SHA-256 state
+typedef struct
+{
+    uint32_t state[8];
+    uint64_t length; // bytes hashed so far
+    unsigned char block[64];
+    size_t block_len;
+} Sha256;
+
+/**
+ * @brief Start a SHA-256 hash
+ *
+ * @param ctx state to initialise
+ */
+void sha256_init(Sha256 *ctx);
+
+/**
+ * @brief Hash more bytes
+ *
+ * @param ctx state from sha256_init()
+ * @param data next bytes
+ * @param len number of bytes
+ */
+void sha256_update(Sha256 *ctx, const void *data, size_t len);
+
+/**
+ * @brief Finish a SHA-256 hash
+ *
+ * @param ctx state from sha256_init(); not usable afterwards
+ * @param digest receives the 32-byte digest
+ */
+void sha256_final(Sha256 *ctx, unsigned char digest[SHA256_DIGEST_SIZE]);
+
+/**
+ * @brief SHA-256 of a buffer in one call
+ *
+ * @param data bytes to hash
+ * @param len number of bytes
+ * @param digest receives the 32-byte digest
+ */
+void sha256(const void *data, size_t len, unsigned char digest[SHA256_DIGEST_SIZE]);
+
+/**
+ * @brief Format a SHA-256 digest as lowercase hex
+ *
+ * @param digest 32-byte digest
+ * @param out receives 64 hex digits and a terminator
+ */
+void sha256_hex(const unsigned char digest[SHA256_DIGEST_SIZE], char out[SHA256_HEX_SIZE]);
+
+// CRC32C and, optionally, SHA-256 of bytes that go past one piece at a time
+typedef struct
+{
+    uint32_t crc32c;
+    int strong; // also hash SHA-256
+    Sha256 sha256;
+} ContentDigest;
+
+/**
+ * @brief Start checksumming a run of bytes
+ *
+ * @param digest state to initialise
+ * @param strong also compute SHA-256
+ */
+void content_digest_init(ContentDigest *digest, int strong);
+
+/**
+ * @brief Checksum more bytes
+ *
+ * @param digest state from content_digest_init()
+ * @param data next bytes
+ * @param len number of bytes
+ */
+void content_digest_update(ContentDigest *digest, const void *data, size_t len);
+
+/**
+ * @brief Checksum a file's bytes from offset to its end
+ *
+ * @param digest state from content_digest_init()
+ * @param path file to read
+ * @param offset first byte to read
+ * @return int 0 on success, -1 if the file could not be read
+ */
+int content_digest_file(ContentDigest *digest, const char *path, uint64_t offset);
+
+/**
+ * @brief CRC32C and, optionally, SHA-256 of a whole file in one read pass
+ *
+ * @param path file to read
+ * @param crc receives the CRC32C
+ * @param sha256_digest receives the SHA-256, or NULL to skip it
+ * @return int 0 on success, -1 if the file could not be read
+ */
+int checksum_file(const char *path, uint32_t *crc, unsigned char sha256_digest[SHA256_DIGEST_SIZE]);
+
+#endif // CHECKSUM_H
@@ -0,0 +1,671 @@
+/*
+ * chunk_store.c, Yehen Yan, CS5600 Practicum II
+ * Content-addressed chunk store for file versions
+ * Last modified: Dec 2025
+ */
+#define _POSIX_C_SOURCE 200809L // O_CLOEXEC
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "chunk_store.h"
+#include "checksum.h"
+#include "config.h"
+
+// Recipe file: magic, u64 total size, u32 chunk count, then the chunks
+#define RECIPE_MAGIC "RFSRCP1\n"
+#define RECIPE_MAGIC_LEN 8
+
+// Reference log, a sequence of RefRecords in native byte order
+#define REFS_LOG "refs.log"
+
+// File bytes buffered while chunking (at least two maximal chunks)
+#define CHUNK_BUFFER (4 * 1024 * 1024)
+
+typedef struct
+{
+    unsigned char hash[SHA256_DIGEST_SIZE];
+    uint32_t len;
+} RecipeEntry;
+
+typedef struct
+{
+    unsigned char hash[SHA256_DIGEST_SIZE];
+    int32_t delta; // +1/-1 while running, the full count after compaction
+} RefRecord;
+
+typedef struct ChunkRef
+{
+    unsigned char hash[SHA256_DIGEST_SIZE];
+    uint32_t refs;
+    struct ChunkRef *next;
+} ChunkRef;
+
+static char store_dir[512];
+static int store_open = 0;
+static int store_enabled = 0;
+
+// Reference counts by hash; everything below is guarded by store_lock
+static ChunkRef **ref_table = NULL;
+static size_t ref_buckets = 0; // power of two
+static size_t ref_count = 0;
+static FILE *ref_log = NULL;
+static unsigned int temp_counter = 0;
+static pthread_mutex_t store_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Gear table for the rolling hash; fixed, so cut points are stable across runs
+static uint64_t gear[256];
+static pthread_once_t gear_once = PTHREAD_ONCE_INIT;
+
+static void build_gear(void)
+{
+    // splitmix64
+    uint64_t x = 0x5246535f43444321ULL;
+    for (int i = 0; i < 256; i++)
+    {
+        uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        gear[i] = z ^ (z >> 31);
+    }
+}
+
+// Length of the chunk starting at p, given n available bytes (all of the
+// rest of the file if fewer than CHUNK_MAX_SIZE)
+static size_t cut_point(const unsigned char *p, size_t n)
+{
+    if (n <= CHUNK_MIN_SIZE)
+        return n;
+    if (n > CHUNK_MAX_SIZE)
+        n = CHUNK_MAX_SIZE;
+
+    // A cut after byte i happens when the hash of the 64 bytes up to i has
+    // its top CHUNK_AVG_BITS bits clear, so it depends on content only
+    const uint64_t mask = ((1ULL << CHUNK_AVG_BITS) - 1) << (64 - CHUNK_AVG_BITS);
+    uint64_t h = 0;
+    for (size_t i = CHUNK_MIN_SIZE - 64; i < n; i++)
+    {
+        h = (h << 1) + gear[p[i]];
+        if (i >= CHUNK_MIN_SIZE && (h & mask) == 0)
+            return i + 1;
+    }
+    return n;
+}
+
+// Returns 0 once all len bytes are written, -1 on error
+static int write_full(int fd, const unsigned char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, data, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        data += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// Returns 0 once all len bytes are read, -1 on error or early end of file
+static int read_full(int fd, unsigned char *buffer, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = read(fd, buffer, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        buffer += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static void chunk_path(const unsigned char *hash, char *out, size_t size)
+{
+    char hex[SHA256_HEX_SIZE];
+    sha256_hex(hash, hex);
+    snprintf(out, size, "%s/%.2s/%s", store_dir, hex, hex);
+}
+
+static size_t bucket_of(const unsigned char *hash)
+{
+    uint64_t v;
+    memcpy(&v, hash, sizeof(v));
+    return (size_t)v & (ref_buckets - 1);
+}
+
+// Caller holds store_lock
+static ChunkRef **find_ref(const unsigned char *hash)
+{
+    ChunkRef **link = &ref_table[bucket_of(hash)];
+    while (*link && memcmp((*link)->hash, hash, SHA256_DIGEST_SIZE) != 0)
+        link = &(*link)->next;
+    return link;
+}
+
+// Caller holds store_lock
+static void grow_table(void)
+{
+    size_t buckets = ref_buckets * 2;
+    ChunkRef **table = calloc(buckets, sizeof(ChunkRef *));
+    if (!table)
+        return; // Longer chains, still correct
+
+    for (size_t i = 0; i < ref_buckets; i++)
+    {
+        ChunkRef *r = ref_table[i];
+        while (r)
+        {
+            ChunkRef *next = r->next;
+            uint64_t v;
+            memcpy(&v, r->hash, sizeof(v));
+            size_t b = (size_t)v & (buckets - 1);
+            r->next = table[b];
+            table[b] = r;
+            r = next;
+        }
+    }
+    free(ref_table);
+    ref_table = table;
+    ref_buckets = buckets;
+}
+
+// Add delta to a chunk's count; returns the new count, or -1 if a new entry
+// could not be allocated. Caller holds store_lock.
+static long adjust_ref(const unsigned char *hash, long delta)
+{
+    ChunkRef **link = find_ref(hash);
+    ChunkRef *r = *link;
+
+    if (!r)
+    {
+        if (delta <= 0)
+            return 0;
+        r = calloc(1, sizeof(ChunkRef));
+        if (!r)
+            return -1;
+        memcpy(r->hash, hash, SHA256_DIGEST_SIZE);
+        *link = r;
+        if (++ref_count > ref_buckets * 2)
+            grow_table();
+    }
+
+    long refs = (long)r->refs + delta;
+    if (refs > 0)
+    {
+        r->refs = (uint32_t)refs;
+        return refs;
+    }
+
+    // Unlink by hash again: grow_table() may have moved it
+    link = find_ref(hash);
+    *link = r->next;
+    free(r);
+    ref_count--;
+    return 0;
+}
+
+// Caller holds store_lock
+static void log_ref(const unsigned char *hash, int32_t delta)
+{
+    RefRecord rec;
+    memcpy(rec.hash, hash, SHA256_DIGEST_SIZE);
+    rec.delta = delta;
+    if (ref_log && fwrite(&rec, sizeof(rec), 1, ref_log) != 1)
+        perror("Failed to append to chunk reference log");
+}
+
+// Replay the reference log, then rewrite it with one record per live chunk
+static int load_refs(void)
+{
+    char log_path[640], temp_path[660];
+    snprintf(log_path, sizeof(log_path), "%s/%s", store_dir, REFS_LOG);
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", log_path);
+
+    FILE *fp = fopen(log_path, "rb");
+    if (fp)
+    {
+        RefRecord rec;
+        while (fread(&rec, sizeof(rec), 1, fp) == 1)
+            adjust_ref(rec.hash, rec.delta);
+        fclose(fp);
+    }
+
+    FILE *out = fopen(temp_path, "wb");
+    if (!out)
+    {
+        perror("Failed to compact chunk reference log");
+        return -1;
+    }
+    for (size_t i = 0; i < ref_buckets; i++)
+    {
+        for (ChunkRef *r = ref_table[i]; r; r = r->next)
+        {
+            RefRecord rec;
+            memcpy(rec.hash, r->hash, SHA256_DIGEST_SIZE);
+            rec.delta = (int32_t)r->refs;
+            fwrite(&rec, sizeof(rec), 1, out);
+        }
+    }
+    if (fclose(out) != 0 || rename(temp_path, log_path) != 0)
+    {
+        perror("Failed to compact chunk reference log");
+        return -1;
+    }
+
+    ref_log = fopen(log_path, "ab");
+    if (!ref_log)
+    {
+        perror("Failed to open chunk reference log");
+        return -1;
+    }
+    return 0;
+}
+
+int chunk_store_init(const char *root, int enable)
+{
+    snprintf(store_dir, sizeof(store_dir), "%s/%schunks", root, RFS_INTERNAL_PREFIX);
+
+    struct stat st;
+    if (stat(store_dir, &st) != 0)
+    {
+        if (!enable)
+            return 0; // Nothing was ever chunked
+
+        if (mkdir(store_dir, 0755) != 0 && errno != EEXIST)
+        {
+            perror("Failed to create chunk store");
+            return -1;
+        }
+    }
+
+    // Chunks are spread over 256 directories by the first hash byte
+    for (int i = 0; enable && i < 256; i++)
+    {
+        char sub[540];
+        snprintf(sub, sizeof(sub), "%s/%02x", store_dir, i);
+        if (mkdir(sub, 0755) != 0 && errno != EEXIST)
+        {
+            perror("Failed to create chunk store");
+            return -1;
+        }
+    }
+
+    ref_buckets = 1024;
+    ref_table = calloc(ref_buckets, sizeof(ChunkRef *));
+    if (!ref_table)
+    {
+        perror("Failed to allocate chunk table");
+        return -1;
+    }
+
+    if (load_refs() != 0)
+        return -1;
+
+    store_open = 1;
+    store_enabled = enable;
+    printf("Chunk store %s: %zu chunk(s)\n", enable ? "enabled" : "opened", ref_count);
+    return 0;
+}
+
+int chunk_store_enabled(void)
+{
+    return store_enabled;
+}
+
+// Take a reference to a chunk, writing it first if it is new. Returns 1 if
+// the chunk was new, 0 if it was already stored, -1 on failure.
+static int store_chunk(const unsigned char *hash, const unsigned char *data, size_t len)
+{
+    pthread_mutex_lock(&store_lock);
+    ChunkRef *r = *find_ref(hash);
+    if (r)
+    {
+        r->refs++;
+        log_ref(hash, 1);
+        pthread_mutex_unlock(&store_lock);
+        return 0;
+    }
+    unsigned int temp_id = temp_counter++;
+    pthread_mutex_unlock(&store_lock);
+
+    // Written outside the lock; two uploads racing on the same new chunk
+    // both rename identical contents into place
+    char path[640], temp_path[680];
+    chunk_path(hash, path, sizeof(path));
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp%u", path, temp_id);
+
+    int fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        perror("Failed to create chunk");
+        return -1;
+    }
+    if (write_full(fd, data, len) != 0)
+    {
+        perror("Failed to write chunk");
+        close(fd);
+        unlink(temp_path);
+        return -1;
+    }
+    close(fd);
+    if (rename(temp_path, path) != 0)
+    {
+        perror("Failed to store chunk");
+        unlink(temp_path);
+        return -1;
+    }
+
+    pthread_mutex_lock(&store_lock);
+    long refs = adjust_ref(hash, 1);
+    if (refs > 0)
+        log_ref(hash, 1);
+    pthread_mutex_unlock(&store_lock);
+    return refs > 0 ? (refs == 1) : -1;
+}
+
+// Drop one reference per entry, deleting chunks nobody uses any more
+static void release_entries(const RecipeEntry *entries, size_t count)
+{
+    pthread_mutex_lock(&store_lock);
+    for (size_t i = 0; i < count; i++)
+    {
+        if (!*find_ref(entries[i].hash))
+            continue;
+
+        log_ref(entries[i].hash, -1);
+        if (adjust_ref(entries[i].hash, -1) == 0)
+        {
+            char path[640];
+            chunk_path(entries[i].hash, path, sizeof(path));
+            unlink(path);
+        }
+    }
+    if (ref_log)
+        fflush(ref_log);
+    pthread_mutex_unlock(&store_lock);
+}
+
+static int write_recipe(const char *recipe_path, const RecipeEntry *entries, uint32_t count,
+                        uint64_t size)
+{
+    FILE *fp = fopen(recipe_path, "wb");
+    if (!fp)
+        return -1;
+
+    int ok = fwrite(RECIPE_MAGIC, RECIPE_MAGIC_LEN, 1, fp) == 1 &&
+             fwrite(&size, sizeof(size), 1, fp) == 1 &&
+             fwrite(&count, sizeof(count), 1, fp) == 1 &&
+             (count == 0 || fwrite(entries, sizeof(RecipeEntry), count, fp) == count);
+
+    if (fclose(fp) != 0 || !ok)
+    {
+        unlink(recipe_path);
+        return -1;
+    }
+    return 0;
+}
+
+// Returns 0 and a malloc'd entry array (caller frees), or -1
+static int read_recipe(const char *recipe_path, RecipeEntry **entries, uint32_t *count,
+                       uint64_t *size)
+{
+    FILE *fp = fopen(recipe_path, "rb");
+    if (!fp)
+        return -1;
+
+    char magic[RECIPE_MAGIC_LEN];
+    *entries = NULL;
+    int ok = fread(magic, RECIPE_MAGIC_LEN, 1, fp) == 1 &&
+             memcmp(magic, RECIPE_MAGIC, RECIPE_MAGIC_LEN) == 0 &&
+             fread(size, sizeof(*size), 1, fp) == 1 && fread(count, sizeof(*count), 1, fp) == 1;
+
+    if (ok && *count > 0)
+    {
+        *entries = malloc((size_t)*count * sizeof(RecipeEntry));
+        ok = *entries && fread(*entries, sizeof(RecipeEntry), *count, fp) == *count;
+    }
+    fclose(fp);
+
+    if (!ok)
+    {
+        fprintf(stderr, "Damaged recipe: %s\n", recipe_path);
+        free(*entries);
+        *entries = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+int chunk_store_put_file(const char *path, const char *recipe_path)
+{
+    if (!store_enabled)
+        return -1;
+
+    pthread_once(&gear_once, build_gear);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    unsigned char *buffer = malloc(CHUNK_BUFFER);
+    RecipeEntry *entries = NULL;
+    uint32_t count = 0, cap = 0;
+    uint64_t size = 0, new_bytes = 0;
+    size_t have = 0, pos = 0;
+    int eof = 0, ok = buffer != NULL;
+
+    while (ok)
+    {
+        // Keep at least one maximal chunk buffered until the file ends
+        if (!eof && have - pos < CHUNK_MAX_SIZE)
+        {
+            memmove(buffer, buffer + pos, have - pos);
+            have -= pos;
+            pos = 0;
+            while (!eof && have < CHUNK_BUFFER)
+            {
+                ssize_t n = read(fd, buffer + have, CHUNK_BUFFER - have);
+                if (n < 0)
+                {
+                    ok = 0;
+                    break;
+                }
+                if (n == 0)
+                    eof = 1;
+                have += (size_t)n;
+            }
+        }
+        if (!ok || pos == have)
+            break;
+
+        size_t len = cut_point(buffer + pos, have - pos);
+
+        if (count == cap)
+        {
+            cap = cap ? cap * 2 : 64;
+            RecipeEntry *grown = realloc(entries, (size_t)cap * sizeof(RecipeEntry));
+            if (!grown)
+            {
+                ok = 0;
+                break;
+            }
+            entries = grown;
+        }
+
+        RecipeEntry *e = &entries[count];
+        sha256(buffer + pos, len, e->hash);
+        e->len = (uint32_t)len;
+
+        int stored = store_chunk(e->hash, buffer + pos, len);
+        if (stored < 0)
+        {
+            ok = 0;
+            break;
+        }
+        if (stored == 1)
+            new_bytes += len;
+
+        count++;
+        size += len;
+        pos += len;
+    }
+
+    close(fd);
+    free(buffer);
+
+    if (ok && write_recipe(recipe_path, entries, count, size) == 0)
+    {
+        pthread_mutex_lock(&store_lock);
+        fflush(ref_log);
+        pthread_mutex_unlock(&store_lock);
+
+        printf("Chunked %s: %u chunk(s), %llu of %llu bytes new\n", path, count,
+               (unsigned long long)new_bytes, (unsigned long long)size);
+        free(entries);
+        return 0;
+    }
+
+    perror("Failed to chunk file");
+    release_entries(entries, count);
+    free(entries);
+    return -1;
+}
+
+int chunk_store_release(const char *recipe_path)
+{
+    if (!store_open)
+    {
+        fprintf(stderr, "Chunk store not open; keeping %s\n", recipe_path);
+        return -1;
+    }
+
+    RecipeEntry *entries;
+    uint32_t count;
+    uint64_t size;
+    if (read_recipe(recipe_path, &entries, &count, &size) != 0)
+        return -1;
+
+    unlink(recipe_path);
+    release_entries(entries, count);
+    free(entries);
+    return 0;
+}
+
+// A recipe being read back while it is sent
+typedef struct
+{
+    RecipeEntry *entries;
+    uint32_t count;
+    uint32_t next; // chunk to load once the buffer is used up
+    size_t have;
+    size_t pos;
+    unsigned char buffer[CHUNK_MAX_SIZE];
+} RecipeReader;
+
+// Hold (delta 1) or let go of (delta -1) the chunks of a recipe being read,
+// so releasing the recipe meanwhile does not delete them. Only the counts in
+// memory change; a crash ends the read as well. Returns 0 if every chunk is
+// in the store.
+static int hold_entries(const RecipeEntry *entries, uint32_t count, long delta)
+{
+    pthread_mutex_lock(&store_lock);
+    for (uint32_t i = 0; delta > 0 && i < count; i++)
+    {
+        if (!*find_ref(entries[i].hash))
+        {
+            pthread_mutex_unlock(&store_lock);
+            return -1;
+        }
+    }
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (adjust_ref(entries[i].hash, delta) == 0)
+        {
+            char path[640];
+            chunk_path(entries[i].hash, path, sizeof(path));
+            unlink(path);
+        }
+    }
+    pthread_mutex_unlock(&store_lock);
+    return 0;
+}
+
+void *chunk_store_open_recipe(const char *recipe_path, uint64_t *size)
+{
+    RecipeEntry *entries;
+    uint32_t count;
+    if (!store_open || read_recipe(recipe_path, &entries, &count, size) != 0)
+        return NULL;
+
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (entries[i].len > CHUNK_MAX_SIZE)
+            break;
+        total += entries[i].len;
+    }
+
+    RecipeReader *r = malloc(sizeof(RecipeReader));
+    if (!r || total != *size || hold_entries(entries, count, 1) != 0)
+    {
+        fprintf(stderr, "Cannot read %s: damaged recipe or missing chunks\n", recipe_path);
+        free(r);
+        free(entries);
+        return NULL;
+    }
+
+    r->entries = entries;
+    r->count = count;
+    r->next = 0;
+    r->have = r->pos = 0;
+    return r;
+}
+
+ssize_t chunk_store_read(void *reader, void *buf, size_t cap)
+{
+    RecipeReader *r = reader;
+    if (r->pos == r->have)
+    {
+        if (r->next == r->count)
+            return 0;
+
+        const RecipeEntry *e = &r->entries[r->next];
+        char path[640];
+        chunk_path(e->hash, path, sizeof(path));
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        int ok = fd >= 0 && read_full(fd, r->buffer, e->len) == 0;
+        if (fd >= 0)
+            close(fd);
+        if (!ok)
+        {
+            fprintf(stderr, "Failed to read chunk %s\n", path);
+            return -1;
+        }
+        r->next++;
+        r->have = e->len;
+        r->pos = 0;
+    }
+
+    size_t n = r->have - r->pos < cap ? r->have - r->pos : cap;
+    memcpy(buf, r->buffer + r->pos, n);
+    r->pos += n;
+    return (ssize_t)n;
+}
+
+void chunk_store_close_recipe(void *reader)
+{
+    RecipeReader *r = reader;
+    hold_entries(r->entries, r->count, -1);
+    free(r->entries);
+    free(r);
+}
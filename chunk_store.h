@@ -0,0 +1,96 @@
+/*
+ * chunk_store.h, Yehen Yan, CS5600 Practicum II
+ * Content-addressed chunk store for file versions
+ * Last modified: Dec 2025
+ */
+
+#ifndef CHUNK_STORE_H
+#define CHUNK_STORE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * With the chunk store enabled, every upload is cut into content-defined
+ * chunks (a gear rolling hash picks the cut points, so an edit only changes
+ * the chunks around it). Each distinct chunk is stored once under
+ * STORAGE_ROOT/.rfs_chunks, named by its SHA-256, and a recipe file lists
+ * the chunks that make up the upload.
+ *
+ * The live file stays a plain file so GET can sendfile() it; its recipe is
+ * kept beside it and becomes the version when the file is replaced, so a
+ * version costs only the chunks no other version shares.
+ *
+ * Chunk reference counts are kept in memory and in an append-only log that
+ * is compacted at startup. A chunk is deleted when its last recipe is
+ * released. Crashes can leak chunks but never drop one still referenced.
+ */
+
+/**
+ * @brief Open the chunk store under a storage root
+ *
+ * The reference counts of an existing store are loaded even when new
+ * uploads are not chunked, so versions stored earlier can still be read and
+ * deleted.
+ *
+ * @param root storage root
+ * @param enable chunk new uploads (creates the store if missing)
+ * @return int 0 on success, -1 if the store could not be opened
+ */
+int chunk_store_init(const char *root, int enable);
+
+/**
+ * @brief Whether new uploads are chunked
+ *
+ * @return int 1 if enabled, 0 otherwise
+ */
+int chunk_store_enabled(void);
+
+/**
+ * @brief Store the chunks of a file and write its recipe
+ *
+ * @param path file to chunk
+ * @param recipe_path new file to write the recipe to
+ * @return int 0 on success, -1 on failure (no references are kept)
+ */
+int chunk_store_put_file(const char *path, const char *recipe_path);
+
+/**
+ * @brief Delete a recipe and release its chunks
+ *
+ * @param recipe_path recipe from chunk_store_put_file()
+ * @return int 0 on success, -1 if the recipe could not be read
+ */
+int chunk_store_release(const char *recipe_path);
+
+/**
+ * @brief Start reading back the contents a recipe describes
+ *
+ * The chunks stay in the store until the reader is closed, even if the
+ * recipe is released meanwhile.
+ *
+ * @param recipe_path recipe from chunk_store_put_file()
+ * @param size receives the size of the contents
+ * @return void* reader for chunk_store_read(), NULL if the recipe is damaged
+ *               or refers to missing chunks
+ */
+void *chunk_store_open_recipe(const char *recipe_path, uint64_t *size);
+
+/**
+ * @brief Read the next bytes of the contents
+ *
+ * @param reader reader from chunk_store_open_recipe()
+ * @param buf receives the contents
+ * @param cap size of buf
+ * @return ssize_t bytes read, 0 at the end, -1 if a chunk could not be read
+ */
+ssize_t chunk_store_read(void *reader, void *buf, size_t cap);
+
+/**
+ * @brief Close a reader, letting go of its chunks
+ *
+ * @param reader reader from chunk_store_open_recipe()
+ */
+void chunk_store_close_recipe(void *reader);
+
+#endif // CHUNK_STORE_H
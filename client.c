@@ -2,89 +2,435 @@
  * Client program for remote file system, Yehen Yan, CS5600 Practicum II
  * Last modified: Dec 2025
  */
+#define _POSIX_C_SOURCE 200809L // sigaction, clock_gettime
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <signal.h>
+#include <time.h>
 #include "operations.h"
+#include "ranged_transfer.h"
+#include "dedup_transfer.h"
+#include "tree_transfer.h"
 #include "config.h"
 
-int main(int argc, char *argv[])
+#define MAX_SESSION_ARGS 8
+
+static void print_usage(const char *prog)
 {
-  if (argc < 2)
-  {
-    fprintf(stderr, "Usage: %s <OPERATION> <args...>\n", argv[0]);
-    fprintf(stderr, "Operations:\n");
-    fprintf(stderr, "  WRITE <local_file> [remote_file]\n");
-    fprintf(stderr, "  GET <remote_file> [local_file]\n");
-    fprintf(stderr, "  GETVERSION <remote_file> <version_number> [local_file]\n");
-    fprintf(stderr, "  RM <remote_file>\n");
-    fprintf(stderr, "  LS <path>\n");
-    fprintf(stderr, "  STOP\n");
-    fprintf(stderr, "\nServer: %s:%d (configured in config.h)\n",
-            SERVER_IP, SERVER_PORT);
-    return 1;
-  }
+  fprintf(stderr, "Usage: %s <OPERATION> <args...>\n", prog);
+  fprintf(stderr, "Operations:\n");
+  fprintf(stderr, "  WRITE [-j connections] <local_file> [remote_file]\n");
+  fprintf(stderr, "  GET [-j connections] <remote_file> [local_file]\n");
+  fprintf(stderr, "  WRITE -r [-j connections] <local_dir> [remote_dir]   (whole tree)\n");
+  fprintf(stderr, "  GET -r [-j connections] <remote_dir> [local_dir]     (whole tree)\n");
+  fprintf(stderr, "  GETVERSION <remote_file> <version_number> [local_file]\n");
+  fprintf(stderr, "  RM <remote_file>\n");
+  fprintf(stderr, "  LS <path>\n");
+  fprintf(stderr, "  STOP\n");
+  fprintf(stderr, "  STATS   (lock contention on the server)\n");
+  fprintf(stderr, "  SESSION   (pipeline one operation per stdin line over one connection)\n");
+  fprintf(stderr, "  BATCH [-j connections] [manifest]   (independent operations, one per line,\n"
+                  "        from a file or stdin, over a pool of connections)\n");
+  fprintf(stderr, "\nFiles of at least %llu MB are moved in ranges over %d connections\n"
+                  "(-j 1 for a single stream). Broken WRITE/GET transfers of such files\n"
+                  "resume where they stopped when the same command is run again.\n",
+          PARALLEL_MIN_SIZE / (1024 * 1024), TRANSFER_STREAMS);
+  fprintf(stderr, "A WRITE of at least %llu MB to an existing file sends only the\n"
+                  "changes when most of the stored copy can be reused.\n",
+          DELTA_MIN_SIZE / (1024 * 1024));
+  fprintf(stderr, "A WRITE of at least %llu KB whose contents the server already stores\n"
+                  "(server --dedup) is linked there without sending them.\n",
+          DEDUP_MIN_SIZE / 1024);
+  fprintf(stderr, "\nServer: %s:%d (configured in config.h)\n",
+          SERVER_IP, SERVER_PORT);
+}
 
-  Operation op = parse_operation(argv[1]);
+/*
+ * Build a request from command-line style arguments. argv[0] is the
+ * operation name. Returns 0 on success, -1 on a usage error.
+ */
+static int build_request(RfsRequest *req, const char *prog, int argc, char *argv[])
+{
+  Operation op = parse_operation(argv[0]);
 
   switch (op)
   {
   case OP_WRITE:
-    if (argc < 3)
+    if (argc < 2 || argc > 3)
     {
-      fprintf(stderr, "Usage: %s WRITE <local_file> [remote_file]\n", argv[0]);
-      return 1;
+      fprintf(stderr, "Usage: %s WRITE <local_file> [remote_file]\n", prog);
+      return -1;
     }
-    write_file(argv[2], argc >= 4 ? argv[3] : NULL);
-    break;
+    prepare_write(req, argv[1], argc >= 3 ? argv[2] : NULL);
+    return 0;
 
   case OP_GET:
-    if (argc < 3)
+    if (argc < 2 || argc > 3)
     {
-      fprintf(stderr, "Usage: %s GET <remote_file> [local_file]\n", argv[0]);
-      return 1;
+      fprintf(stderr, "Usage: %s GET <remote_file> [local_file]\n", prog);
+      return -1;
     }
-    get_file(argv[2], argc >= 4 ? argv[3] : NULL);
-    break;
+    prepare_get(req, argv[1], argc >= 3 ? argv[2] : NULL);
+    return 0;
 
   case OP_GETVERSION:
-    if (argc < 4)
+    if (argc < 3 || argc > 4)
     {
-      fprintf(stderr, "Usage: %s GETVERSION <remote_file> <version_number> [local_file]\n", argv[0]);
-      fprintf(stderr, "Example: %s GETVERSION file.txt 2 old_file.txt\n", argv[0]);
-      return 1;
+      fprintf(stderr, "Usage: %s GETVERSION <remote_file> <version_number> [local_file]\n", prog);
+      fprintf(stderr, "Example: %s GETVERSION file.txt 2 old_file.txt\n", prog);
+      return -1;
     }
-    get_version(argv[2], atoi(argv[3]), argc >= 5 ? argv[4] : NULL);
-    break;
+    prepare_getversion(req, argv[1], atoi(argv[2]), argc >= 4 ? argv[3] : NULL);
+    return 0;
 
   case OP_RM:
-    if (argc != 3)
+    if (argc != 2)
     {
-      fprintf(stderr, "Usage: %s RM <remote_file>\n", argv[0]);
-      return 1;
+      fprintf(stderr, "Usage: %s RM <remote_file>\n", prog);
+      return -1;
     }
-    remove_file(argv[2]);
-    break;
+    prepare_simple(req, OP_RM, argv[1]);
+    return 0;
 
   case OP_LS:
-    if (argc != 3)
+    if (argc != 2)
     {
-      fprintf(stderr, "Usage: %s LS <path>\n", argv[0]);
-      return 1;
+      fprintf(stderr, "Usage: %s LS <path>\n", prog);
+      return -1;
     }
-    list_directory(argv[2]);
-    break;
+    prepare_simple(req, OP_LS, argv[1]);
+    return 0;
 
   case OP_STOP:
-    stop_server();
-    break;
+    prepare_simple(req, OP_STOP, NULL);
+    return 0;
+
+  case OP_STATS:
+    prepare_simple(req, OP_STATS, NULL);
+    return 0;
 
+  case OP_SESSION:
+  case OP_BATCH:
+  case OP_BYE:
   case OP_UNKNOWN:
   default:
-    fprintf(stderr, "Unknown operation: %s\n", argv[1]);
+    fprintf(stderr, "Unknown operation: %s\n", argv[0]);
+    return -1;
+  }
+}
+
+/*
+ * Read one operation per line (blank lines and #-comments skipped) into a
+ * growing request array. Returns the number of lines that could not be
+ * turned into a request, or -1 if memory ran out.
+ */
+static int read_requests(FILE *in, const char *prog, RfsRequest **out, size_t *out_count)
+{
+  RfsRequest *reqs = NULL;
+  size_t count = 0, capacity = 0;
+  char line[1024];
+  int failures = 0;
+
+  while (fgets(line, sizeof(line), in) != NULL)
+  {
+    char *args[MAX_SESSION_ARGS];
+    int argc = 0;
+
+    for (char *tok = strtok(line, " \t\r\n"); tok && argc < MAX_SESSION_ARGS;
+         tok = strtok(NULL, " \t\r\n"))
+    {
+      args[argc++] = tok;
+    }
+
+    // Skip blank lines and comments
+    if (argc == 0 || args[0][0] == '#')
+    {
+      continue;
+    }
+
+    if (count == capacity)
+    {
+      capacity = capacity ? capacity * 2 : 64;
+      RfsRequest *grown = realloc(reqs, capacity * sizeof(RfsRequest));
+      if (!grown)
+      {
+        perror("Failed to allocate requests");
+        free(reqs);
+        return -1;
+      }
+      reqs = grown;
+    }
+
+    if (build_request(&reqs[count], prog, argc, args) != 0)
+    {
+      failures++;
+      continue;
+    }
+    count++;
+  }
+
+  *out = reqs;
+  *out_count = count;
+  return failures;
+}
+
+// Read operations from stdin and pipeline them all over one session connection
+static int run_session(const char *prog)
+{
+  RfsRequest *reqs;
+  size_t count;
+  int failures = read_requests(stdin, prog, &reqs, &count);
+  if (failures < 0)
+  {
+    return 1;
+  }
+
+  int sock = session_open();
+  if (sock < 0)
+  {
+    free(reqs);
+    return 1;
+  }
+
+  int failed = run_requests(sock, reqs, count);
+  session_close(sock);
+  free(reqs);
+
+  failures += failed < 0 ? (int)count : failed;
+  printf("Session: %zu request(s), %d failed\n", count, failures);
+  return failures == 0 ? 0 : 1;
+}
+
+// One result line per request: status, operation, and what was moved where
+static void print_batch_result(const RfsRequest *req)
+{
+  const char *status = req->result == 0 ? "OK  " : "FAIL";
+
+  switch (req->op)
+  {
+  case OP_WRITE:
+    printf("%s %-10s %s -> %s  %lld bytes\n", status, operation_to_string(req->op),
+           req->local_path, req->remote_path, (long long)req->bytes);
+    break;
+
+  case OP_GET:
+  case OP_GETVERSION:
+    printf("%s %-10s %s -> %s  %lld bytes\n", status, operation_to_string(req->op),
+           req->remote_path, req->local_path, (long long)req->bytes);
+    break;
+
+  default:
+    printf("%s %-10s %s\n", status, operation_to_string(req->op), req->remote_path);
+    break;
+  }
+}
+
+// Run independent operations from a manifest (or stdin) over a pool of
+// connections and report per-file results and aggregate throughput
+static int run_batch_mode(const char *prog, int argc, char *argv[])
+{
+  int connections = BATCH_CONNECTIONS;
+  const char *manifest = NULL;
+
+  for (int i = 0; i < argc; i++)
+  {
+    if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+    {
+      connections = atoi(argv[++i]);
+      if (connections < 1)
+      {
+        fprintf(stderr, "Invalid connection count: %s\n", argv[i]);
+        return 1;
+      }
+    }
+    else if (!manifest)
+    {
+      manifest = argv[i];
+    }
+    else
+    {
+      fprintf(stderr, "Usage: %s BATCH [-j connections] [manifest]\n", prog);
+      return 1;
+    }
+  }
+
+  FILE *in = stdin;
+  if (manifest && strcmp(manifest, "-") != 0)
+  {
+    in = fopen(manifest, "r");
+    if (!in)
+    {
+      perror("Failed to open manifest");
+      return 1;
+    }
+  }
+
+  RfsRequest *reqs;
+  size_t count;
+  int failures = read_requests(in, prog, &reqs, &count);
+  if (in != stdin)
+  {
+    fclose(in);
+  }
+  if (failures < 0)
+  {
+    return 1;
+  }
+
+  // Per-request chatter would drown the report
+  set_verbose(0);
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  failures += run_batch(reqs, count, connections);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  long long total_bytes = 0;
+  for (size_t i = 0; i < count; i++)
+  {
+    print_batch_result(&reqs[i]);
+    if (reqs[i].result == 0)
+    {
+      total_bytes += reqs[i].bytes;
+    }
+  }
+
+  double mb = total_bytes / (1024.0 * 1024.0);
+  printf("Batch: %zu request(s), %d failed, %.2f MB in %.2f s (%.2f MB/s, %.0f requests/s)\n",
+         count, failures, mb, seconds, seconds > 0 ? mb / seconds : 0.0,
+         seconds > 0 ? count / seconds : 0.0);
+
+  free(reqs);
+  return failures == 0 ? 0 : 1;
+}
+
+// WRITE -r / GET -r: a whole directory tree. The other side's directory
+// defaults to the last component of the given one.
+static int run_tree(const char *prog, int argc, char *argv[], int connections)
+{
+  Operation op = parse_operation(argv[0]);
+  if ((op != OP_WRITE && op != OP_GET) || argc < 2 || argc > 3)
+  {
+    fprintf(stderr, "Usage: %s WRITE -r [-j connections] <local_dir> [remote_dir]\n", prog);
+    fprintf(stderr, "       %s GET -r [-j connections] <remote_dir> [local_dir]\n", prog);
+    return 1;
+  }
+
+  char source[256];
+  snprintf(source, sizeof(source), "%s", argv[1]);
+  size_t len = strlen(source);
+  while (len > 1 && source[len - 1] == '/')
+  {
+    source[--len] = '\0';
+  }
+  const char *name = strrchr(source, '/') ? strrchr(source, '/') + 1 : source;
+  const char *dest = argc == 3 ? argv[2] : name;
+
+  if (op == OP_WRITE)
+  {
+    return tree_write(source, dest, connections);
+  }
+  return tree_get(source, dest, connections);
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc < 2)
+  {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  // Uploads use sendfile(), which raises SIGPIPE if the server goes away
+  struct sigaction ignore;
+  memset(&ignore, 0, sizeof(ignore));
+  ignore.sa_handler = SIG_IGN;
+  sigemptyset(&ignore.sa_mask);
+  sigaction(SIGPIPE, &ignore, NULL);
+
+  if (parse_operation(argv[1]) == OP_SESSION)
+  {
+    return run_session(argv[0]);
+  }
+
+  if (parse_operation(argv[1]) == OP_BATCH)
+  {
+    return run_batch_mode(argv[0], argc - 2, argv + 2);
+  }
+
+  // WRITE/GET -j N: connections used for a large file, or the pool for a
+  // tree; -r: the operands are directories
+  int streams = TRANSFER_STREAMS;
+  int tree = 0;
+  while (argc >= 3 && (strcmp(argv[2], "-r") == 0 || (argc >= 4 && strcmp(argv[2], "-j") == 0)))
+  {
+    int used = 1;
+    if (strcmp(argv[2], "-r") == 0)
+    {
+      tree = 1;
+    }
+    else
+    {
+      streams = atoi(argv[3]);
+      if (streams < 1)
+      {
+        fprintf(stderr, "Invalid connection count: %s\n", argv[3]);
+        return 1;
+      }
+      used = 2;
+    }
+    // Drop the option so the operation parses as usual
+    memmove(&argv[2], &argv[2 + used], (argc - 2 - used + 1) * sizeof(char *));
+    argc -= used;
+  }
+
+  if (tree)
+  {
+    return run_tree(argv[0], argc - 1, argv + 1, streams);
+  }
+
+  RfsRequest req;
+  if (build_request(&req, argv[0], argc - 1, argv + 1) != 0)
+  {
     return 1;
   }
 
+  // Contents the server already stores under any name are linked by
+  // digest, so nothing is sent. A large file the server already has is
+  // usually sent as a delta; a first upload, or one that changed too much,
+  // goes as a full WRITE.
+  if (req.op == OP_WRITE && req.result == 0 && req.file_size >= DEDUP_MIN_SIZE)
+  {
+    int r = reuse_write(&req);
+    if (r <= 0)
+    {
+      return r == 0 ? 0 : 1;
+    }
+    req.result = 0;
+  }
+
+  // Large files go in ranges over several connections, and can be resumed
+  // after a failure. A GET learns the size from its first range, so it
+  // always starts out as a ranged read.
+  if (req.op == OP_WRITE && req.result == 0 && req.file_size >= PARALLEL_MIN_SIZE)
+  {
+    return ranged_write(&req, streams) == 0 ? 0 : 1;
+  }
+  if (req.op == OP_GET && req.result == 0)
+  {
+    return ranged_get(&req, streams) == 0 ? 0 : 1;
+  }
+
+  if (run_requests(-1, &req, 1) != 0)
+  {
+    if (req.op == OP_GETVERSION)
+    {
+      fprintf(stderr, "✗ Version %d not found or failed to retrieve\n", req.version_number);
+    }
+    return 1;
+  }
   return 0;
-}
\ No newline at end of file
+}
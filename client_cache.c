@@ -0,0 +1,273 @@
+/*
+ * client_cache.c, Yehen Yan, CS5600 Practicum II
+ * Client-side cache of downloaded files for conditional GETs
+ * Last modified: Dec 2025
+ */
+#define _GNU_SOURCE // copy_file_range
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include "client_cache.h"
+#include "config.h"
+
+// Extended attribute of an entry: "<size> <tag> <crc32c> <version> <remote path>"
+#define CACHE_XATTR "user.rfs.cache"
+
+// Entries still being written start with this; nothing reads them
+#define CACHE_TEMP_PREFIX ".tmp."
+
+// Bytes per read when the kernel cannot copy a file by itself
+#define COPY_BUFFER (256 * 1024)
+
+static char cache_dir[512];
+static pthread_once_t dir_once = PTHREAD_ONCE_INIT;
+
+// Makes temp names unique between the threads of a BATCH
+static unsigned int next_temp_id = 0;
+
+static void resolve_cache_dir(void)
+{
+    const char *dir = getenv("RFS_CACHE_DIR");
+    const char *home = getenv("HOME");
+    if (dir)
+        snprintf(cache_dir, sizeof(cache_dir), "%s", dir);
+    else if (home && home[0])
+        snprintf(cache_dir, sizeof(cache_dir), "%s/%s", home, CLIENT_CACHE_DIR);
+}
+
+// Returns 0 if the cache is in use
+static int cache_ready(void)
+{
+    pthread_once(&dir_once, resolve_cache_dir);
+    return cache_dir[0] ? 0 : -1;
+}
+
+// Entries are named by an FNV-1a hash of the key; the attribute holds the
+// full key, so a collision is a miss rather than the wrong file
+static void entry_path(const char *remote_path, int version, char *out, size_t size)
+{
+    uint64_t h = 1469598103934665603ULL;
+    for (const unsigned char *p = (const unsigned char *)remote_path; *p; p++)
+        h = (h ^ *p) * 1099511628211ULL;
+    h = (h ^ (uint32_t)version) * 1099511628211ULL;
+    snprintf(out, size, "%s/%016" PRIx64, cache_dir, h);
+}
+
+// Returns 0 if the open entry is a complete copy stored for this key
+static int read_entry(int fd, const char *remote_path, int version, CacheValidator *v)
+{
+    char tag[1024];
+    ssize_t n = fgetxattr(fd, CACHE_XATTR, tag, sizeof(tag) - 1);
+    if (n <= 0)
+        return -1;
+    tag[n] = '\0';
+
+    unsigned long long size, id;
+    unsigned int crc;
+    int stored_version, path_at = 0;
+    if (sscanf(tag, "%llu %llu %x %d %n", &size, &id, &crc, &stored_version, &path_at) != 4 ||
+        path_at == 0 || stored_version != version || strcmp(tag + path_at, remote_path) != 0)
+        return -1;
+
+    // A copy changed behind our back is no use
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (uint64_t)st.st_size != size)
+        return -1;
+
+    v->size = size;
+    v->tag = id;
+    v->crc32c = crc;
+    return 0;
+}
+
+// Copy a whole file, in the kernel where it can (file systems that share
+// extents make that a reflink). Returns the bytes copied, -1 on failure.
+static int64_t copy_fd(int in_fd, int out_fd)
+{
+    int64_t total = 0;
+    ssize_t n;
+    while ((n = copy_file_range(in_fd, NULL, out_fd, NULL, 1 << 30, 0)) > 0)
+        total += n;
+    if (n == 0)
+        return total;
+    if (total > 0)
+        return -1;
+
+    // Not possible between these files; copy through a buffer
+    char *buffer = malloc(COPY_BUFFER);
+    if (!buffer)
+        return -1;
+    while ((n = read(in_fd, buffer, COPY_BUFFER)) > 0)
+    {
+        if (write(out_fd, buffer, (size_t)n) != n)
+        {
+            n = -1;
+            break;
+        }
+        total += n;
+    }
+    free(buffer);
+    return n < 0 ? -1 : total;
+}
+
+typedef struct
+{
+    char name[32];
+    uint64_t size;
+    time_t used;
+} CacheFile;
+
+static int compare_used(const void *a, const void *b)
+{
+    const CacheFile *x = a, *y = b;
+    return (x->used > y->used) - (x->used < y->used);
+}
+
+// Drop the least recently used entries until the cache fits CLIENT_CACHE_BYTES
+static void trim_cache(void)
+{
+    DIR *dir = opendir(cache_dir);
+    if (!dir)
+        return;
+
+    CacheFile *files = NULL;
+    size_t count = 0, cap = 0;
+    uint64_t total = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        char path[800];
+        struct stat st;
+        size_t name_len = strlen(entry->d_name);
+        snprintf(path, sizeof(path), "%s/%s", cache_dir, entry->d_name);
+        if (entry->d_name[0] == '.' || name_len >= sizeof(files->name) ||
+            stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+            continue;
+
+        if (count == cap)
+        {
+            size_t grown_cap = cap ? cap * 2 : 64;
+            CacheFile *grown = realloc(files, grown_cap * sizeof(CacheFile));
+            if (!grown)
+                break;
+            files = grown;
+            cap = grown_cap;
+        }
+        memcpy(files[count].name, entry->d_name, name_len + 1); // length checked above
+        files[count].size = (uint64_t)st.st_size;
+        files[count].used = st.st_mtime;
+        total += files[count].size;
+        count++;
+    }
+    closedir(dir);
+
+    if (total > CLIENT_CACHE_BYTES)
+    {
+        qsort(files, count, sizeof(CacheFile), compare_used);
+        for (size_t i = 0; i < count && total > CLIENT_CACHE_BYTES; i++)
+        {
+            char path[800];
+            snprintf(path, sizeof(path), "%s/%s", cache_dir, files[i].name);
+            if (unlink(path) == 0)
+                total -= files[i].size;
+        }
+    }
+    free(files);
+}
+
+int client_cache_lookup(const char *remote_path, int version, CacheValidator *v)
+{
+    if (cache_ready() != 0)
+        return -1;
+
+    char path[600];
+    entry_path(remote_path, version, path, sizeof(path));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    int result = read_entry(fd, remote_path, version, v);
+    close(fd);
+    return result;
+}
+
+int64_t client_cache_restore(const char *remote_path, int version, const char *local_path)
+{
+    if (cache_ready() != 0)
+        return -1;
+
+    char path[600];
+    entry_path(remote_path, version, path, sizeof(path));
+    int in_fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (in_fd < 0)
+        return -1;
+
+    CacheValidator v;
+    char temp_path[600];
+    snprintf(temp_path, sizeof(temp_path), "%s.rfs_cached", local_path);
+    int out_fd = -1;
+    int64_t copied = -1;
+    if (read_entry(in_fd, remote_path, version, &v) == 0 &&
+        (out_fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) >= 0)
+        copied = copy_fd(in_fd, out_fd);
+
+    // Entries are trimmed least recently used first
+    if (copied >= 0)
+        futimens(in_fd, NULL);
+    close(in_fd);
+
+    if (out_fd < 0)
+        return -1;
+    if (close(out_fd) != 0 || copied != (int64_t)v.size || rename(temp_path, local_path) != 0)
+    {
+        unlink(temp_path);
+        return -1;
+    }
+    return copied;
+}
+
+void client_cache_store(const char *remote_path, int version, const char *local_path,
+                        const CacheValidator *v)
+{
+    if (cache_ready() != 0 || v->size > CLIENT_CACHE_BYTES)
+        return;
+    if (mkdir(cache_dir, 0700) != 0 && errno != EEXIST)
+        return;
+
+    char path[600], temp_path[640];
+    entry_path(remote_path, version, path, sizeof(path));
+    snprintf(temp_path, sizeof(temp_path), "%s/" CACHE_TEMP_PREFIX "%d.%u", cache_dir,
+             (int)getpid(), __atomic_fetch_add(&next_temp_id, 1, __ATOMIC_RELAXED));
+
+    int in_fd = open(local_path, O_RDONLY | O_CLOEXEC);
+    if (in_fd < 0)
+        return;
+    int out_fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (out_fd < 0)
+    {
+        close(in_fd);
+        return;
+    }
+
+    char tag[1024];
+    int len = snprintf(tag, sizeof(tag), "%llu %llu %08x %d %s", (unsigned long long)v->size,
+                       (unsigned long long)v->tag, v->crc32c, version, remote_path);
+    int ok = copy_fd(in_fd, out_fd) == (int64_t)v->size && len < (int)sizeof(tag) &&
+             fsetxattr(out_fd, CACHE_XATTR, tag, (size_t)len, 0) == 0;
+    close(in_fd);
+    if (close(out_fd) != 0 || !ok || rename(temp_path, path) != 0)
+    {
+        unlink(temp_path);
+        return;
+    }
+    trim_cache();
+}
@@ -0,0 +1,68 @@
+/*
+ * client_cache.h, Yehen Yan, CS5600 Practicum II
+ * Client-side cache of downloaded files for conditional GETs
+ * Last modified: Dec 2025
+ */
+
+#ifndef CLIENT_CACHE_H
+#define CLIENT_CACHE_H
+
+#include <stdint.h>
+
+/*
+ * Every GET and GETVERSION leaves a copy of what it downloaded in the
+ * cache directory, together with the validator the server sent with it.
+ * The next request for the same file and version sends the validator
+ * along (RFS_FLAG_IF_CHANGED); when the server answers RFS_NOT_MODIFIED
+ * the local file is copied from the cache instead.
+ *
+ * Entries are plain files named by a hash of the remote path and version;
+ * the validator and the full key are kept in an extended attribute, so an
+ * entry is one file and a crash never leaves a half-described one.
+ */
+
+// What identifies the contents of a downloaded file to the server
+typedef struct
+{
+    uint64_t size;
+    uint64_t tag;    // GET: file identity; GETVERSION: when the version was written
+    uint32_t crc32c; // recorded checksum, 0 if the server had none
+} CacheValidator;
+
+/**
+ * @brief Find the cached copy of a remote file
+ *
+ * @param remote_path path on the server
+ * @param version version number, 0 for the current file
+ * @param v receives the validator of the cached copy
+ * @return int 0 if there is a usable copy, -1 otherwise
+ */
+int client_cache_lookup(const char *remote_path, int version, CacheValidator *v);
+
+/**
+ * @brief Copy a cached file to a local path
+ *
+ * The copy is made next to local_path and renamed over it, so a failed
+ * copy leaves local_path as it was.
+ *
+ * @param remote_path path on the server
+ * @param version version number, 0 for the current file
+ * @param local_path destination
+ * @return int bytes copied, or -1 on failure
+ */
+int64_t client_cache_restore(const char *remote_path, int version, const char *local_path);
+
+/**
+ * @brief Keep a copy of a finished download
+ *
+ * Failures are not reported; the next GET just downloads again.
+ *
+ * @param remote_path path on the server
+ * @param version version number, 0 for the current file
+ * @param local_path the downloaded file
+ * @param v validator the server sent with it
+ */
+void client_cache_store(const char *remote_path, int version, const char *local_path,
+                        const CacheValidator *v);
+
+#endif // CLIENT_CACHE_H
@@ -0,0 +1,377 @@
+/*
+ * compression.c, Yehen Yan, CS5600 Practicum II
+ * Background compression of stored versions
+ * Last modified: Dec 2025
+ */
+#define _XOPEN_SOURCE 700 // pread
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include "compression.h"
+#include "version_manifest.h"
+#include "lock_table.h"
+#include "meta_cache.h"
+#include "config.h"
+
+// One version waiting to be compressed
+typedef struct Job
+{
+    char path[512];
+    uint32_t id;
+    struct Job *next;
+} Job;
+
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_ready = PTHREAD_COND_INITIALIZER;
+static Job *queue_head;
+static Job *queue_tail;
+static int enabled;
+static int stopping;
+static pthread_t thread;
+static char storage_root[512];
+
+int compression_enabled(void)
+{
+    return enabled;
+}
+
+static int is_stopping(void)
+{
+    return __atomic_load_n(&stopping, __ATOMIC_RELAXED);
+}
+
+void compression_enqueue(const char *full_path, uint32_t id)
+{
+    if (!enabled)
+        return;
+
+    Job *job = calloc(1, sizeof(Job));
+    if (!job)
+        return; // the version simply stays uncompressed
+    snprintf(job->path, sizeof(job->path), "%s", full_path);
+    job->id = id;
+
+    pthread_mutex_lock(&queue_lock);
+    if (queue_tail)
+        queue_tail->next = job;
+    else
+        queue_head = job;
+    queue_tail = job;
+    pthread_cond_signal(&queue_ready);
+    pthread_mutex_unlock(&queue_lock);
+}
+
+// ========== CODEC ==========
+
+static int write_full(int fd, const unsigned char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, data, len);
+        if (n <= 0)
+            return -1;
+        data += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// Deflate in_fd into out_fd; returns 0 on success, -1 on failure or stop
+static int deflate_file(int in_fd, int out_fd, uint64_t *stored)
+{
+    unsigned char *in = malloc(COMPRESS_BUFFER);
+    unsigned char *out = malloc(COMPRESS_BUFFER);
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (!in || !out || deflateInit(&zs, COMPRESS_LEVEL) != Z_OK)
+    {
+        free(in);
+        free(out);
+        return -1;
+    }
+
+    int ok = 1, flush = Z_NO_FLUSH;
+    *stored = 0;
+    while (ok && flush != Z_FINISH)
+    {
+        ssize_t n = read(in_fd, in, COMPRESS_BUFFER);
+        if (n < 0 || is_stopping())
+        {
+            ok = 0;
+            break;
+        }
+        flush = n == 0 ? Z_FINISH : Z_NO_FLUSH;
+        zs.next_in = in;
+        zs.avail_in = (uInt)n;
+
+        do
+        {
+            zs.next_out = out;
+            zs.avail_out = COMPRESS_BUFFER;
+            deflate(&zs, flush);
+            size_t have = COMPRESS_BUFFER - zs.avail_out;
+            if (write_full(out_fd, out, have) != 0)
+            {
+                ok = 0;
+                break;
+            }
+            *stored += have;
+        } while (zs.avail_out == 0);
+    }
+
+    deflateEnd(&zs);
+    free(in);
+    free(out);
+    return ok ? 0 : -1;
+}
+
+// A compressed version being read back while it is sent
+typedef struct
+{
+    int fd;
+    uint64_t offset; // next compressed byte to read
+    uint64_t end;
+    z_stream zs;
+    int ended;
+    unsigned char in[COMPRESS_BUFFER];
+} InflateStream;
+
+void *compression_stream_open(int in_fd, uint64_t offset, uint64_t length)
+{
+    InflateStream *s = malloc(sizeof(InflateStream));
+    if (s)
+        memset(&s->zs, 0, sizeof(s->zs));
+    if (!s || inflateInit(&s->zs) != Z_OK)
+    {
+        perror("Failed to read compressed version");
+        free(s);
+        close(in_fd);
+        return NULL;
+    }
+
+    s->fd = in_fd;
+    s->offset = offset;
+    s->end = offset + length;
+    s->ended = 0;
+    return s;
+}
+
+ssize_t compression_stream_read(void *stream, void *buf, size_t cap)
+{
+    InflateStream *s = stream;
+    s->zs.next_out = buf;
+    s->zs.avail_out = (uInt)cap;
+
+    while (s->zs.avail_out > 0 && !s->ended)
+    {
+        if (s->zs.avail_in == 0)
+        {
+            uint64_t left = s->end - s->offset;
+            size_t want = left < COMPRESS_BUFFER ? (size_t)left : COMPRESS_BUFFER;
+            ssize_t n = want > 0 ? pread(s->fd, s->in, want, (off_t)s->offset) : 0;
+            if (n <= 0)
+            {
+                fprintf(stderr, "Damaged compressed version: ends before its last block\n");
+                return -1;
+            }
+            s->offset += (uint64_t)n;
+            s->zs.next_in = s->in;
+            s->zs.avail_in = (uInt)n;
+        }
+
+        int status = inflate(&s->zs, Z_NO_FLUSH);
+        if (status == Z_STREAM_END)
+        {
+            s->ended = 1;
+        }
+        else if (status != Z_OK && status != Z_BUF_ERROR)
+        {
+            fprintf(stderr, "Damaged compressed version: %s\n", s->zs.msg ? s->zs.msg : "bad data");
+            return -1;
+        }
+    }
+    return (ssize_t)(cap - s->zs.avail_out);
+}
+
+void compression_stream_close(void *stream)
+{
+    InflateStream *s = stream;
+    inflateEnd(&s->zs);
+    close(s->fd);
+    free(s);
+}
+
+// ========== BACKGROUND STAGE ==========
+
+// Look a version up; fills version_path and entry. Caller holds the path lock.
+static int find_version(const char *full_path, uint32_t id, char *version_path, size_t size,
+                        VersionEntry *entry)
+{
+    VersionManifest m;
+    if (manifest_snapshot(full_path, &m) != 0)
+        return -1;
+
+    const VersionEntry *v = manifest_find_version(&m, id);
+    if (v)
+    {
+        *entry = *v;
+        const char *slash = strrchr(full_path, '/');
+        int dir_len = slash ? (int)(slash - full_path) : 1;
+        snprintf(version_path, size, "%.*s/%s", dir_len, slash ? full_path : ".", v->name);
+    }
+    manifest_free(&m);
+    return v ? 0 : -1;
+}
+
+static void compress_version(const char *full_path, uint32_t id)
+{
+    char version_path[768];
+    VersionEntry v;
+
+    path_lock_shared(full_path);
+    int found = find_version(full_path, id, version_path, sizeof(version_path), &v) == 0;
+    // Opened under the lock, so an RM cannot delete it first
+    int in_fd = found && !v.chunked && !v.pack && v.compressed == 0
+                    ? open(version_path, O_RDONLY | O_CLOEXEC)
+                    : -1;
+    path_unlock(full_path);
+    if (in_fd < 0)
+        return;
+
+    // Version files are never modified, so the work needs no lock
+    char temp_path[800];
+    const char *slash = strrchr(version_path, '/');
+    snprintf(temp_path, sizeof(temp_path), "%.*s/%szip_%u", (int)(slash - version_path),
+             version_path, RFS_TEMP_PREFIX, id);
+    int out_fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    uint64_t stored = 0;
+    int ok = out_fd >= 0 && deflate_file(in_fd, out_fd, &stored) == 0 && fsync(out_fd) == 0;
+    close(in_fd);
+    if (out_fd >= 0)
+        close(out_fd);
+    if (!ok)
+    {
+        unlink(temp_path);
+        return;
+    }
+
+    int worth = stored * 100 <= v.content.size * (100 - COMPRESS_MIN_SAVING_PERCENT);
+
+    // Swap only if the version is still the one that was read
+    path_lock_exclusive(full_path);
+    VersionEntry now;
+    if (find_version(full_path, id, version_path, sizeof(version_path), &now) != 0 ||
+        strcmp(now.name, v.name) != 0 || now.compressed != 0)
+    {
+        unlink(temp_path);
+    }
+    else if (!worth)
+    {
+        unlink(temp_path);
+        manifest_set_compressed(full_path, id, -1);
+    }
+    else if (rename(temp_path, version_path) != 0 ||
+             manifest_set_compressed(full_path, id, 1) != 0)
+    {
+        perror("Failed to store compressed version");
+        unlink(temp_path);
+    }
+    else
+    {
+        meta_cache_refresh(version_path);
+        printf("Compressed %s: %llu -> %llu bytes\n", version_path,
+               (unsigned long long)v.content.size, (unsigned long long)stored);
+    }
+    path_unlock(full_path);
+}
+
+// Queue the versions of one manifest that were never tried
+static int sweep_manifest(const char *full_path, const char *dir)
+{
+    (void)dir;
+    VersionManifest m;
+    path_lock_shared(full_path);
+    int loaded = manifest_snapshot(full_path, &m) == 0;
+    path_unlock(full_path);
+    if (!loaded)
+        return is_stopping();
+
+    for (size_t i = 0; i < m.count; i++)
+    {
+        if (!m.versions[i].chunked && !m.versions[i].pack && m.versions[i].compressed == 0)
+            compression_enqueue(full_path, m.versions[i].id);
+    }
+    manifest_free(&m);
+    return is_stopping();
+}
+
+static void *compression_thread(void *arg)
+{
+    (void)arg;
+    manifest_walk(storage_root, sweep_manifest);
+
+    for (;;)
+    {
+        pthread_mutex_lock(&queue_lock);
+        while (!queue_head && !stopping)
+            pthread_cond_wait(&queue_ready, &queue_lock);
+        if (stopping)
+        {
+            pthread_mutex_unlock(&queue_lock);
+            break;
+        }
+        Job *job = queue_head;
+        queue_head = job->next;
+        if (!queue_head)
+            queue_tail = NULL;
+        pthread_mutex_unlock(&queue_lock);
+
+        compress_version(job->path, job->id);
+        free(job);
+    }
+    return NULL;
+}
+
+int compression_start(const char *root, int enable)
+{
+    if (!enable)
+        return 0;
+
+    snprintf(storage_root, sizeof(storage_root), "%s", root);
+    enabled = 1;
+    if (pthread_create(&thread, NULL, compression_thread, NULL) != 0)
+    {
+        perror("Failed to start compression thread");
+        enabled = 0;
+        return -1;
+    }
+    return 0;
+}
+
+void compression_stop(void)
+{
+    if (!enabled)
+        return;
+
+    pthread_mutex_lock(&queue_lock);
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELAXED);
+    pthread_cond_signal(&queue_ready);
+    pthread_mutex_unlock(&queue_lock);
+    pthread_join(thread, NULL);
+    enabled = 0;
+
+    while (queue_head)
+    {
+        Job *job = queue_head;
+        queue_head = job->next;
+        free(job);
+    }
+    queue_tail = NULL;
+}
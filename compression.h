@@ -0,0 +1,85 @@
+/*
+ * compression.h, Yehen Yan, CS5600 Practicum II
+ * Background compression of stored versions
+ * Last modified: Dec 2025
+ */
+
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * With compression enabled, a background thread deflates every full-copy
+ * version (zlib, fast level) into a temp file and, if it saved enough,
+ * renames it over the version file and marks the version compressed in the
+ * manifest. Versions that compress poorly are marked so they are not tried
+ * again. At startup the thread also works through the versions already on
+ * disk. Live files are never compressed, so GET, ranges and delta uploads
+ * keep reading them directly.
+ */
+
+/**
+ * @brief Start the compression thread
+ *
+ * @param root storage root to sweep for versions not yet compressed
+ * @param enable 0 leaves compression off; compressed versions stay readable
+ * @return int 0 on success, -1 if the thread could not be started
+ */
+int compression_start(const char *root, int enable);
+
+/**
+ * @brief Whether new versions are being compressed
+ */
+int compression_enabled(void);
+
+/**
+ * @brief Queue a new version for compression
+ *
+ * Does nothing if compression is off.
+ *
+ * @param full_path storage path of the file
+ * @param id version id
+ */
+void compression_enqueue(const char *full_path, uint32_t id);
+
+/**
+ * @brief Stop the compression thread, dropping queued work
+ *
+ * A version being compressed is left as it was.
+ */
+void compression_stop(void);
+
+/**
+ * @brief Start decompressing a compressed version as it is read
+ *
+ * Takes ownership of in_fd, even on failure.
+ *
+ * @param in_fd file holding the version (the version file, or a pack
+ *              segment); read with pread()
+ * @param offset where the compressed bytes start
+ * @param length number of compressed bytes
+ * @return void* stream for compression_stream_read(), NULL on failure
+ */
+void *compression_stream_open(int in_fd, uint64_t offset, uint64_t length);
+
+/**
+ * @brief Decompress the next bytes of a version
+ *
+ * @param stream stream from compression_stream_open()
+ * @param buf receives the contents
+ * @param cap size of buf
+ * @return ssize_t bytes produced, 0 at the end, -1 if the data is damaged
+ *                 or could not be read
+ */
+ssize_t compression_stream_read(void *stream, void *buf, size_t cap);
+
+/**
+ * @brief Close a stream and the file it reads
+ *
+ * @param stream stream from compression_stream_open()
+ */
+void compression_stream_close(void *stream);
+
+#endif // COMPRESSION_H
@@ -10,10 +10,148 @@
 // to prevent excessively deep paths
 #define MAX_PATH_DEPTH 10
 
-// Hash table size for tracking file versions
-#define HASH_SIZE 256
+// Path lock stripes (lock_table.h), rounded up to a power of two.
+// 0 sizes the table from the worker count: LOCK_STRIPES_PER_WORKER per
+// worker thread, at least LOCK_STRIPES_MIN.
+#define LOCK_STRIPES 0
+#define LOCK_STRIPES_PER_WORKER 64
+#define LOCK_STRIPES_MIN 256
+
+// Stripes listed by STATS, longest total wait first
+#define STATS_TOP_STRIPES 10
 
 // Buffer size for network operations
 #define BUFFER_SIZE 8196
 
+// Largest chunk handed to a single sendfile() call
+#define SENDFILE_CHUNK (16 * 1024 * 1024)
+
+// Pipe capacity used when splicing uploads from a socket into a file
+#define SPLICE_PIPE_SIZE (1024 * 1024)
+
+// Block size of reply bodies generated while they are sent (versions
+// decompressed or assembled from chunks)
+#define REPLY_STREAM_BUFFER (256 * 1024)
+
+// Names starting with this prefix are server-internal (e.g. uploads in
+// flight); clients cannot address them and LS does not show them
+#define RFS_INTERNAL_PREFIX ".rfs_"
+#define RFS_TEMP_PREFIX ".rfs_tmp_"
+#define RFS_PART_PREFIX ".rfs_part_"
+#define RFS_MANIFEST_PREFIX ".rfs_ver_"
+#define RFS_RECIPE_PREFIX ".rfs_recipe_"
+
+// Pending-connection queue length for listen() (capped by net.core.somaxconn)
+#define LISTEN_BACKLOG 4096
+
+// Worker threads serving requests (0 = one per online CPU)
+#define WORKER_THREADS 0
+
+// Open connections served at once; further clients get RFS_ERR_BUSY
+#define MAX_CONNECTIONS 1024
+
+// Most events handled per epoll_wait() call
+#define MAX_EVENTS 256
+
+// Client BATCH mode: default parallel connections, and requests claimed
+// (and pipelined) per turn on a connection
+#define BATCH_CONNECTIONS 4
+#define BATCH_CHUNK 16
+
+// Client ranged transfers: files of at least PARALLEL_MIN_SIZE bytes are
+// split into TRANSFER_RANGE_SIZE ranges moved over TRANSFER_STREAMS
+// connections at once
+#define PARALLEL_MIN_SIZE (64ULL * 1024 * 1024)
+#define TRANSFER_RANGE_SIZE (32ULL * 1024 * 1024)
+#define TRANSFER_STREAMS 4
+
+// Times a ranged transfer reconnects and resumes after losing connections
+#define TRANSFER_RETRIES 5
+
+// Client delta WRITE: files of at least DELTA_MIN_SIZE bytes that already
+// exist on the server are sent as a delta against the stored version,
+// unless more than DELTA_MAX_LITERAL_PERCENT of the file would be new bytes.
+// Blocks are about sqrt(size) bytes, at least DELTA_MIN_BLOCK, and a
+// signature has at most DELTA_MAX_BLOCKS entries.
+#define DELTA_MIN_SIZE (1024ULL * 1024)
+#define DELTA_MAX_LITERAL_PERCENT 50
+#define DELTA_MIN_BLOCK 2048
+#define DELTA_MAX_BLOCKS 65536
+
+// Client deduplicated WRITE: files of at least DEDUP_MIN_SIZE bytes are
+// offered by digest first; smaller ones cost less to send than to hash
+#define DEDUP_MIN_SIZE (256ULL * 1024)
+
+// Client validation cache: GET and GETVERSION keep what they download under
+// $HOME/CLIENT_CACHE_DIR (or $RFS_CACHE_DIR, where an empty value turns the
+// cache off) and later only ask the server whether it changed. The least
+// recently used files go once the cache holds more than CLIENT_CACHE_BYTES.
+#define CLIENT_CACHE_DIR ".rfs_cache"
+#define CLIENT_CACHE_BYTES (4ULL * 1024 * 1024 * 1024)
+
+// Seconds a ranged upload may sit unfinished before the server drops it;
+// until then a restarted client can resume it
+#define STAGING_IDLE_TIMEOUT 3600
+
+// Chunk store (--chunk-store): content-defined chunks of CHUNK_MIN_SIZE to
+// CHUNK_MAX_SIZE bytes, cut on average every 2^CHUNK_AVG_BITS bytes past the minimum
+#define CHUNK_MIN_SIZE (16 * 1024)
+#define CHUNK_MAX_SIZE (256 * 1024)
+#define CHUNK_AVG_BITS 16
+
+// Background version compression (server --compress): zlib level, read
+// and write buffer, and the saving below which a version is kept as it was
+#define COMPRESS_LEVEL 1
+#define COMPRESS_BUFFER (256 * 1024)
+#define COMPRESS_MIN_SAVING_PERCENT 10
+
+// Version retention (server --keep-last/--keep-days/--thin): seconds between
+// passes, versions dropped per exclusive lock hold, and the deletion rate.
+// --thin keeps one version per hour for THIN_HOURLY_SECONDS, then one per
+// day up to THIN_DAILY_SECONDS
+#define RETENTION_INTERVAL 60
+#define RETENTION_BATCH 64
+#define RETENTION_DELETES_PER_SECOND 500
+#define THIN_HOURLY_SECONDS (24 * 3600)
+#define THIN_DAILY_SECONDS (30 * 24 * 3600)
+
+// Pack segments (server --pack): versions older than PACK_COLD_SECONDS are
+// appended to segments of about PACK_SEGMENT_SIZE bytes every PACK_INTERVAL
+// seconds, PACK_BATCH per sync. A sealed segment whose live records make up
+// less than PACK_REPACK_LIVE_PERCENT of it is repacked.
+#define PACK_SEGMENT_SIZE (256ULL * 1024 * 1024)
+#define PACK_COLD_SECONDS 3600
+#define PACK_INTERVAL 60
+#define PACK_BATCH 64
+#define PACK_BUFFER (1024 * 1024)
+#define PACK_REPACK_LIVE_PERCENT 50
+
+// Directory listings kept in memory for LS (0 = no cache), and the size of
+// its hash table
+#define META_CACHE_BYTES (64 * 1024 * 1024)
+#define META_CACHE_BUCKETS 4096
+
+// Directory entries per LS reply: the client asks for pages of
+// LS_PAGE_SIZE, and the server caps a page at LS_MAX_PAGE_SIZE
+#define LS_PAGE_SIZE 1000
+#define LS_MAX_PAGE_SIZE 10000
+
+// Small-file contents kept in memory for GET (0 = no cache): total bytes,
+// the largest file cached, and the size of its hash table
+#define CONTENT_CACHE_BYTES (64 * 1024 * 1024)
+#define CONTENT_CACHE_MAX_OBJECT (64 * 1024)
+#define CONTENT_CACHE_BUCKETS 4096
+
+// Deduplicated WRITE (server --dedup): buckets in each hash table of the
+// index from SHA-256 to stored files
+#define DEDUP_INDEX_BUCKETS 65536
+
+// Version manifests kept in memory: MANIFEST_CACHE_STRIPES independently
+// locked lists of up to MANIFEST_CACHE_PER_STRIPE manifests each
+#define MANIFEST_CACHE_STRIPES 256
+#define MANIFEST_CACHE_PER_STRIPE 16
+
+// Seconds an idle session connection may wait for its next request
+#define SESSION_IDLE_TIMEOUT 30
+
 #endif
\ No newline at end of file
@@ -0,0 +1,469 @@
+/*
+ * connection.c, Yehen Yan, CS5600 Practicum II
+ * Per-connection state machine driven by the server's epoll reactor
+ * Last modified: Dec 2025
+ */
+#define _GNU_SOURCE // pipe2, F_SETPIPE_SZ
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include "connection.h"
+#include "server_handlers.h"
+#include "operations.h"
+#include "network.h"
+#include "config.h"
+
+Connection *connection_create(int sock, unsigned int id)
+{
+    Connection *conn = calloc(1, sizeof(Connection));
+    if (!conn)
+    {
+        perror("Failed to allocate connection");
+        return NULL;
+    }
+
+    conn->sock = sock;
+    conn->id = id;
+    conn->state = CONN_READ_HEADER;
+    conn->last_active = time(NULL);
+    conn->body_fd = -1;
+    conn->send_fd = -1;
+    conn->pipefd[0] = conn->pipefd[1] = -1;
+    conn->tap_pipefd[0] = conn->tap_pipefd[1] = -1;
+    return conn;
+}
+
+void connection_destroy(Connection *conn)
+{
+    // Let the handler clean up a half-received upload
+    if (conn->body_done)
+    {
+        BodyDoneFn done = conn->body_done;
+        conn->body_done = NULL;
+        done(conn, 0);
+    }
+
+    if (conn->body_fd >= 0)
+        close(conn->body_fd);
+    if (conn->send_fd >= 0)
+        close(conn->send_fd);
+    if (conn->send_buf_release)
+        conn->send_buf_release(conn->send_buf_owner);
+    if (conn->stream_release)
+        conn->stream_release(conn->stream_source);
+    if (conn->pipefd[0] >= 0)
+    {
+        close(conn->pipefd[0]);
+        close(conn->pipefd[1]);
+    }
+    if (conn->tap_pipefd[0] >= 0)
+    {
+        close(conn->tap_pipefd[0]);
+        close(conn->tap_pipefd[1]);
+    }
+
+    close(conn->sock);
+    free(conn->meta);
+    free(conn->out);
+    free(conn->stream_buf);
+    free(conn);
+}
+
+int connection_wants_write(const Connection *conn)
+{
+    return conn->state == CONN_SEND_REPLY;
+}
+
+int connection_is_idle(const Connection *conn)
+{
+    return conn->state == CONN_READ_HEADER && conn->hdr_got == 0;
+}
+
+// ========== HANDLER API ==========
+
+// Make room for n more bytes in the reply buffer
+static int out_reserve(Connection *conn, size_t n)
+{
+    if (conn->out_len + n <= conn->out_cap)
+        return 0;
+
+    size_t cap = conn->out_cap ? conn->out_cap : BUFFER_SIZE;
+    while (conn->out_len + n > cap)
+        cap *= 2;
+
+    unsigned char *grown = realloc(conn->out, cap);
+    if (!grown)
+    {
+        perror("Failed to grow reply buffer");
+        return -1;
+    }
+    conn->out = grown;
+    conn->out_cap = cap;
+    return 0;
+}
+
+int conn_reply(Connection *conn, int32_t status, const void *meta, size_t meta_len,
+               uint64_t body_len)
+{
+    if (out_reserve(conn, RFS_HEADER_SIZE + meta_len) != 0)
+        return -1;
+
+    FrameHeader reply;
+    memset(&reply, 0, sizeof(reply));
+    reply.version = RFS_PROTOCOL_VERSION;
+    reply.opcode = conn->req.opcode;
+    reply.request_id = conn->req.request_id;
+    reply.status = status;
+    reply.meta_len = (uint32_t)meta_len;
+    reply.payload_len = meta_len + body_len;
+
+    frame_encode_header(&reply, conn->out + conn->out_len);
+    conn->out_len += RFS_HEADER_SIZE;
+    if (meta_len > 0)
+    {
+        memcpy(conn->out + conn->out_len, meta, meta_len);
+        conn->out_len += meta_len;
+    }
+    return 0;
+}
+
+int conn_reply_data(Connection *conn, const void *data, size_t len)
+{
+    if (out_reserve(conn, len) != 0)
+        return -1;
+
+    memcpy(conn->out + conn->out_len, data, len);
+    conn->out_len += len;
+    return 0;
+}
+
+void conn_reply_buffer(Connection *conn, const void *data, size_t len,
+                       void (*release)(void *owner), void *owner)
+{
+    conn->send_buf = data;
+    conn->send_buf_len = len;
+    conn->send_buf_sent = 0;
+    conn->send_buf_release = release;
+    conn->send_buf_owner = owner;
+}
+
+void conn_reply_file(Connection *conn, int fd, uint64_t offset, uint64_t len)
+{
+    conn->send_fd = fd;
+    conn->send_off = offset;
+    conn->send_left = len;
+}
+
+int conn_reply_stream(Connection *conn, uint64_t len, ReplyReadFn read,
+                      void (*release)(void *source), void *source)
+{
+    if (!conn->stream_buf && !(conn->stream_buf = malloc(REPLY_STREAM_BUFFER)))
+    {
+        perror("Failed to allocate reply buffer");
+        return -1;
+    }
+
+    conn->stream_read = read;
+    conn->stream_release = release;
+    conn->stream_source = source;
+    conn->stream_left = len;
+    return 0;
+}
+
+int conn_reply_error(Connection *conn, int32_t status, const char *message)
+{
+    size_t len = strlen(message);
+    if (conn_reply(conn, status, NULL, 0, len) != 0)
+        return -1;
+    return conn_reply_data(conn, message, len);
+}
+
+void conn_receive_body(Connection *conn, int fd, uint64_t offset, BodyDoneFn done)
+{
+    conn->body_fd = fd;
+    conn->body_off = offset;
+    conn->body_done = done;
+
+    // One pipe per connection, kept for later uploads. Without it the body
+    // is received with plain recv/pwrite.
+    if (conn->pipefd[0] < 0 && pipe2(conn->pipefd, O_CLOEXEC) == 0)
+    {
+        fcntl(conn->pipefd[1], F_SETPIPE_SZ, SPLICE_PIPE_SIZE);
+    }
+}
+
+void conn_digest_body(Connection *conn, const ContentDigest *start)
+{
+    conn->body_hashed = 1;
+    conn->body_digest = *start;
+
+    // The copy pipe matches the splice pipe, so one tee(2) takes everything
+    // in flight. Without it the bytes are copied out of the splice pipe.
+    if (conn->pipefd[0] >= 0 && conn->tap_pipefd[0] < 0 &&
+        pipe2(conn->tap_pipefd, O_CLOEXEC) == 0)
+    {
+        fcntl(conn->tap_pipefd[1], F_SETPIPE_SZ, SPLICE_PIPE_SIZE);
+    }
+}
+
+static void digest_tap(void *ctx, const void *data, size_t len)
+{
+    content_digest_update((ContentDigest *)ctx, data, len);
+}
+
+// ========== STATE MACHINE ==========
+
+// Read into buf until it holds want bytes. Returns 1 when complete,
+// 0 if the socket would block, -1 on EOF or error.
+static int read_exact(Connection *conn, unsigned char *buf, size_t want, size_t *got)
+{
+    while (*got < want)
+    {
+        ssize_t n = recv_nb(conn->sock, buf + *got, want - *got);
+        if (n == NET_AGAIN)
+            return 0;
+        if (n <= 0)
+            return -1;
+        *got += n;
+        conn->last_active = time(NULL);
+    }
+    return 1;
+}
+
+// Hand a fully read request to its handler and pick the next state
+static int start_request(Connection *conn)
+{
+    conn->body_left = frame_body_len(&conn->req);
+
+    if (conn->req.version != RFS_PROTOCOL_VERSION)
+    {
+        printf("[Conn %u] Unsupported protocol version %u\n", conn->id, conn->req.version);
+        conn_reply_error(conn, RFS_ERR_UNSUPPORTED, "Unsupported protocol version");
+        conn->close_after_reply = 1;
+        conn->body_left = 0;
+        conn->state = CONN_SEND_REPLY;
+        return 0;
+    }
+
+    if (conn->req.opcode == OP_BYE)
+        return -1;
+
+    printf("[Conn %u] Request %u: %s\n", conn->id, conn->req.request_id,
+           operation_to_string((Operation)conn->req.opcode));
+    conn->served++;
+    conn->body_hashed = 0;
+
+    MetaReader reader;
+    meta_reader_init(&reader, conn->meta, conn->req.meta_len);
+    handle_request(conn, &reader);
+
+    // An unclaimed body is discarded before the reply goes out
+    conn->state = (conn->body_left > 0 || conn->body_done) ? CONN_RECV_BODY : CONN_SEND_REPLY;
+    return 0;
+}
+
+// Move body bytes off the socket. Returns 1 when complete, 0 if the socket
+// would block, -1 on EOF or error.
+static int receive_body(Connection *conn)
+{
+    while (conn->body_left > 0)
+    {
+        int64_t n;
+        if (conn->body_fd >= 0)
+        {
+            RecvTap tap = {digest_tap, &conn->body_digest,
+                           {conn->tap_pipefd[0], conn->tap_pipefd[1]}};
+            n = recv_fd_nb(conn->sock, conn->pipefd, conn->body_fd, &conn->body_off,
+                           conn->body_left, conn->body_hashed ? &tap : NULL);
+        }
+        else
+        {
+            char scratch[BUFFER_SIZE];
+            n = recv_nb(conn->sock, scratch, conn->body_left < sizeof(scratch)
+                                                 ? conn->body_left
+                                                 : sizeof(scratch));
+        }
+
+        if (n == NET_AGAIN)
+            return 0;
+        if (n <= 0)
+        {
+            fprintf(stderr, "[Conn %u] Request body ended early (%llu bytes missing)\n",
+                    conn->id, (unsigned long long)conn->body_left);
+            return -1;
+        }
+        conn->body_left -= n;
+        conn->last_active = time(NULL);
+    }
+
+    if (conn->body_fd >= 0)
+    {
+        close(conn->body_fd);
+        conn->body_fd = -1;
+    }
+    if (conn->body_done)
+    {
+        BodyDoneFn done = conn->body_done;
+        conn->body_done = NULL;
+        done(conn, 1);
+    }
+    return 1;
+}
+
+// Flush the queued reply. Returns 1 when complete, 0 if the socket would
+// block, -1 on error.
+static int send_reply_step(Connection *conn)
+{
+    // Reply bytes and a borrowed body leave in one call; a generated body
+    // is borrowed a block at a time from the stream buffer
+    for (;;)
+    {
+        if (conn->out_sent == conn->out_len && conn->send_buf_sent == conn->send_buf_len)
+        {
+            if (conn->stream_left == 0)
+                break;
+
+            size_t want = conn->stream_left < REPLY_STREAM_BUFFER ? (size_t)conn->stream_left
+                                                                  : REPLY_STREAM_BUFFER;
+            ssize_t made = conn->stream_read(conn->stream_source, conn->stream_buf, want);
+            if (made <= 0)
+            {
+                fprintf(stderr, "[Conn %u] Reply body ended early (%llu bytes missing)\n",
+                        conn->id, (unsigned long long)conn->stream_left);
+                return -1;
+            }
+            conn->stream_left -= (uint64_t)made;
+            conn->send_buf = conn->stream_buf;
+            conn->send_buf_len = (size_t)made;
+            conn->send_buf_sent = 0;
+        }
+
+        struct iovec iov[2];
+        int count = 0;
+        if (conn->out_sent < conn->out_len)
+        {
+            iov[count].iov_base = conn->out + conn->out_sent;
+            iov[count++].iov_len = conn->out_len - conn->out_sent;
+        }
+        if (conn->send_buf_sent < conn->send_buf_len)
+        {
+            iov[count].iov_base = (void *)(conn->send_buf + conn->send_buf_sent);
+            iov[count++].iov_len = conn->send_buf_len - conn->send_buf_sent;
+        }
+
+        ssize_t n = sendv_nb(conn->sock, iov, count);
+        if (n == NET_AGAIN)
+            return 0;
+        if (n < 0)
+            return -1;
+
+        size_t from_out = conn->out_len - conn->out_sent;
+        if ((size_t)n < from_out)
+            from_out = (size_t)n;
+        conn->out_sent += from_out;
+        conn->send_buf_sent += (size_t)n - from_out;
+        conn->last_active = time(NULL);
+    }
+
+    if (conn->send_buf_release)
+    {
+        conn->send_buf_release(conn->send_buf_owner);
+        conn->send_buf_release = NULL;
+    }
+    if (conn->stream_release)
+    {
+        conn->stream_release(conn->stream_source);
+        conn->stream_release = NULL;
+    }
+    conn->send_buf = NULL;
+    conn->send_buf_len = conn->send_buf_sent = 0;
+
+    while (conn->send_left > 0)
+    {
+        int64_t n = send_fd_nb(conn->sock, conn->send_fd, &conn->send_off, conn->send_left);
+        if (n == NET_AGAIN)
+            return 0;
+        if (n <= 0)
+        {
+            fprintf(stderr, "[Conn %u] File transfer broke with %llu bytes left\n",
+                    conn->id, (unsigned long long)conn->send_left);
+            return -1;
+        }
+        conn->send_left -= n;
+        conn->last_active = time(NULL);
+    }
+
+    if (conn->send_fd >= 0)
+    {
+        close(conn->send_fd);
+        conn->send_fd = -1;
+    }
+    conn->out_len = conn->out_sent = 0;
+    return 1;
+}
+
+int connection_process(Connection *conn)
+{
+    for (;;)
+    {
+        int r;
+        switch (conn->state)
+        {
+        case CONN_READ_HEADER:
+            r = read_exact(conn, conn->hdr_buf, RFS_HEADER_SIZE, &conn->hdr_got);
+            if (r <= 0)
+                return r;
+
+            if (frame_decode_header(conn->hdr_buf, &conn->req) != 0 ||
+                conn->req.meta_len > RFS_MAX_META)
+            {
+                fprintf(stderr, "[Conn %u] Malformed frame header\n", conn->id);
+                return -1;
+            }
+
+            if (conn->req.meta_len > conn->meta_cap)
+            {
+                unsigned char *grown = realloc(conn->meta, conn->req.meta_len);
+                if (!grown)
+                {
+                    perror("Failed to allocate request buffer");
+                    return -1;
+                }
+                conn->meta = grown;
+                conn->meta_cap = conn->req.meta_len;
+            }
+            conn->meta_got = 0;
+            conn->state = CONN_READ_META;
+            break;
+
+        case CONN_READ_META:
+            r = read_exact(conn, conn->meta, conn->req.meta_len, &conn->meta_got);
+            if (r <= 0)
+                return r;
+            if (start_request(conn) != 0)
+                return -1;
+            break;
+
+        case CONN_RECV_BODY:
+            r = receive_body(conn);
+            if (r <= 0)
+                return r;
+            conn->state = CONN_SEND_REPLY;
+            break;
+
+        case CONN_SEND_REPLY:
+            r = send_reply_step(conn);
+            if (r <= 0)
+                return r;
+            if (conn->close_after_reply)
+                return -1;
+            conn->hdr_got = 0;
+            conn->state = CONN_READ_HEADER;
+            break;
+        }
+    }
+}
@@ -0,0 +1,261 @@
+/*
+ * connection.h, Yehen Yan, CS5600 Practicum II
+ * Per-connection state machine driven by the server's epoll reactor
+ * Last modified: Dec 2025
+ */
+
+#ifndef CONNECTION_H
+#define CONNECTION_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+#include "checksum.h"
+#include "protocol.h"
+
+/*
+ * A connection moves through these states for every request frame:
+ *
+ *   READ_HEADER -> READ_META -> (handler) -> [RECV_BODY] -> SEND_REPLY -> READ_HEADER
+ *
+ * Each state makes as much progress as the non-blocking socket allows and
+ * returns when it would block; the reactor calls connection_process() again
+ * on the next readiness edge. Nothing here ever waits on the network.
+ */
+typedef enum
+{
+    CONN_READ_HEADER,
+    CONN_READ_META,
+    CONN_RECV_BODY,
+    CONN_SEND_REPLY
+} ConnState;
+
+typedef struct Connection Connection;
+
+// Called once a claimed request body has been fully received (ok = 1), or
+// could not be (ok = 0: the connection is being closed mid-body)
+typedef void (*BodyDoneFn)(Connection *conn, int ok);
+
+// Produces the next bytes of a reply body generated while it is sent:
+// returns how many were written to buf (at most cap), 0 at the end, -1 on error
+typedef ssize_t (*ReplyReadFn)(void *source, void *buf, size_t cap);
+
+// Scratch state for a WRITE upload or upload range in progress
+typedef struct
+{
+    char target_path[512]; // final storage path
+    char temp_path[640];   // hidden file the body is received into
+    uint64_t size;
+    uint64_t transfer_id; // UPLOAD_RANGE: staged upload and where the range starts
+    uint64_t offset;
+    uint64_t base_identity; // DELTA_WRITE: stored file the delta applies to,
+    uint32_t block_size;    // its signature's block size, and the expected
+    uint32_t crc32c;        // checksum of the result
+} UploadState;
+
+struct Connection
+{
+    int sock;
+    unsigned int id;
+    ConnState state;
+    time_t last_active;
+    int close_after_reply;
+
+    // Request being read / served
+    unsigned char hdr_buf[RFS_HEADER_SIZE];
+    size_t hdr_got;
+    FrameHeader req;
+    unsigned char *meta;
+    size_t meta_cap;
+    size_t meta_got;
+
+    // Request body: streamed into body_fd, or discarded when body_fd is -1
+    uint64_t body_left;
+    uint64_t body_off;
+    int body_fd;
+    int pipefd[2];
+    BodyDoneFn body_done;
+    int body_hashed;           // body_digest follows the bytes stored
+    ContentDigest body_digest; // of the bytes stored so far
+    int tap_pipefd[2];         // tee(2) copies for body_digest; kept for later uploads
+
+    // Queued reply: out buffer first, then an optional borrowed buffer
+    // (sent together with it), file range or generated body
+    unsigned char *out;
+    size_t out_len;
+    size_t out_sent;
+    size_t out_cap;
+    const unsigned char *send_buf;
+    size_t send_buf_len;
+    size_t send_buf_sent;
+    void (*send_buf_release)(void *owner);
+    void *send_buf_owner;
+    int send_fd;
+    uint64_t send_off;
+    uint64_t send_left;
+    ReplyReadFn stream_read;
+    void (*stream_release)(void *source);
+    void *stream_source;
+    uint64_t stream_left;
+    unsigned char *stream_buf; // kept for later replies
+
+    UploadState upload;
+
+    unsigned int served;
+
+    // Reactor bookkeeping, guarded by the server's connection list lock
+    int queued; // handed to a worker, which owns it until re-armed
+    Connection *prev, *next;
+};
+
+/**
+ * @brief Allocate state for an accepted, non-blocking socket
+ *
+ * @param sock accepted socket
+ * @param id connection number for log messages
+ * @return Connection* new connection, or NULL on allocation failure
+ */
+Connection *connection_create(int sock, unsigned int id);
+
+/**
+ * @brief Close the socket and release everything the connection owns
+ *
+ * A body still being received is reported to its handler as failed.
+ *
+ * @param conn connection to destroy
+ */
+void connection_destroy(Connection *conn);
+
+/**
+ * @brief Advance the connection until its socket would block
+ *
+ * @param conn connection with pending readiness
+ * @return int 0 to keep the connection, -1 to close it
+ */
+int connection_process(Connection *conn);
+
+/**
+ * @brief Check whether the connection is blocked on sending rather than receiving
+ *
+ * @param conn connection after connection_process() returned 0
+ * @return int 1 if it waits for the socket to become writable
+ */
+int connection_wants_write(const Connection *conn);
+
+/**
+ * @brief Check whether the connection sits between requests
+ *
+ * @param conn connection
+ * @return int 1 if no request is partially read or being answered
+ */
+int connection_is_idle(const Connection *conn);
+
+// ========== HANDLER API ==========
+
+/**
+ * @brief Queue the reply frame for the current request
+ *
+ * @param conn connection
+ * @param status RfsStatus value
+ * @param meta metadata bytes, may be NULL
+ * @param meta_len metadata length
+ * @param body_len body bytes that follow (conn_reply_data / conn_reply_file)
+ * @return int 0 on success, -1 on allocation failure
+ */
+int conn_reply(Connection *conn, int32_t status, const void *meta, size_t meta_len,
+               uint64_t body_len);
+
+/**
+ * @brief Append in-memory body bytes to the queued reply
+ *
+ * @param conn connection
+ * @param data body bytes
+ * @param len body length
+ * @return int 0 on success, -1 on allocation failure
+ */
+int conn_reply_data(Connection *conn, const void *data, size_t len);
+
+/**
+ * @brief Send a buffer owned by someone else after the queued reply bytes
+ *
+ * The header and the buffer go out in one vectored send, without copying
+ * the buffer. release(owner) is called once it is sent or the connection
+ * is closed.
+ *
+ * @param conn connection
+ * @param data body bytes, valid until release is called
+ * @param len body length
+ * @param release called with owner when the buffer is no longer needed
+ * @param owner passed to release
+ */
+void conn_reply_buffer(Connection *conn, const void *data, size_t len,
+                       void (*release)(void *owner), void *owner);
+
+/**
+ * @brief Stream a file range after the queued reply bytes
+ *
+ * The connection takes ownership of fd and closes it when done.
+ *
+ * @param conn connection
+ * @param fd file open for reading
+ * @param offset first byte to send
+ * @param len bytes to send
+ */
+void conn_reply_file(Connection *conn, int fd, uint64_t offset, uint64_t len);
+
+/**
+ * @brief Generate the body after the queued reply bytes as it is sent
+ *
+ * read(source, ...) is called for the next block whenever the socket has
+ * room, so the body never has to exist in full. If it ends or fails short
+ * of len bytes the connection is closed. On success the connection takes
+ * ownership of source and calls release(source) once it is done with it.
+ *
+ * @param conn connection
+ * @param len body bytes promised by conn_reply()
+ * @param read produces the body in order
+ * @param release called with source when the body is sent or abandoned
+ * @param source passed to read and release
+ * @return int 0 on success, -1 on allocation failure
+ */
+int conn_reply_stream(Connection *conn, uint64_t len, ReplyReadFn read,
+                      void (*release)(void *source), void *source);
+
+/**
+ * @brief Queue an error reply whose body is a short text message
+ *
+ * @param conn connection
+ * @param status RfsStatus error value
+ * @param message text explaining the error
+ * @return int 0 on success, -1 on allocation failure
+ */
+int conn_reply_error(Connection *conn, int32_t status, const char *message);
+
+/**
+ * @brief Claim the request body: receive it into fd, then call done
+ *
+ * Without a claim the body is discarded. The connection takes ownership
+ * of fd. done must queue the reply.
+ *
+ * @param conn connection
+ * @param fd file open for writing
+ * @param offset file position of the first body byte
+ * @param done completion callback
+ */
+void conn_receive_body(Connection *conn, int fd, uint64_t offset, BodyDoneFn done);
+
+/**
+ * @brief Checksum the claimed body as it is stored
+ *
+ * The bytes are hashed as they pass on their way into the file, so the
+ * done callback finds their checksums in conn->body_digest without reading
+ * the file back. Also after a broken body, body_digest covers exactly the
+ * bytes that were stored.
+ *
+ * @param conn connection with a claimed body
+ * @param start digest to continue, e.g. from content_digest_init()
+ */
+void conn_digest_body(Connection *conn, const ContentDigest *start);
+
+#endif // CONNECTION_H
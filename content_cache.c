@@ -0,0 +1,208 @@
+/*
+ * content_cache.c, Yehen Yan, CS5600 Practicum II
+ * In-memory cache of small, frequently read files
+ * Last modified: Dec 2025
+ */
+#define _XOPEN_SOURCE 700 // pread
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "content_cache.h"
+#include "lock_table.h"
+#include "config.h"
+
+typedef struct CachedObject
+{
+    int refs;      // the cache's own reference while cached, plus one per reply
+    char *path;    // stored after the contents
+    size_t len;
+    uint64_t identity;
+    size_t charge; // bytes counted against the budget
+    struct CachedObject *hash_next;
+    struct CachedObject *newer;
+    struct CachedObject *older;
+    unsigned char data[];
+} CachedObject;
+
+// Everything below is guarded by cache_lock; refs is atomic
+static CachedObject *buckets[CONTENT_CACHE_BUCKETS];
+static CachedObject *newest;
+static CachedObject *oldest;
+static size_t budget;
+static ContentCacheStats stats;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void content_cache_init(size_t bytes)
+{
+    budget = bytes;
+}
+
+static size_t bucket_of(const char *path)
+{
+    return (size_t)(path_hash(path) % CONTENT_CACHE_BUCKETS);
+}
+
+static void unlink_lru(CachedObject *o)
+{
+    if (o->newer)
+        o->newer->older = o->older;
+    else
+        newest = o->older;
+    if (o->older)
+        o->older->newer = o->newer;
+    else
+        oldest = o->newer;
+    o->newer = o->older = NULL;
+}
+
+static void push_newest(CachedObject *o)
+{
+    o->older = newest;
+    o->newer = NULL;
+    if (newest)
+        newest->newer = o;
+    newest = o;
+    if (!oldest)
+        oldest = o;
+}
+
+static CachedObject *find_object(const char *path, CachedObject ***link_out)
+{
+    CachedObject **link = &buckets[bucket_of(path)];
+    for (; *link; link = &(*link)->hash_next)
+    {
+        if (strcmp((*link)->path, path) == 0)
+        {
+            if (link_out)
+                *link_out = link;
+            return *link;
+        }
+    }
+    return NULL;
+}
+
+void content_cache_release(void *ref)
+{
+    CachedObject *o = ref;
+    if (o && __atomic_sub_fetch(&o->refs, 1, __ATOMIC_ACQ_REL) == 0)
+        free(o);
+}
+
+// Caller holds cache_lock
+static void remove_object(CachedObject *o)
+{
+    CachedObject **link;
+    if (find_object(o->path, &link) == o)
+        *link = o->hash_next;
+    unlink_lru(o);
+    stats.objects--;
+    stats.bytes -= o->charge;
+    content_cache_release(o);
+}
+
+void *content_cache_get(const char *path, const unsigned char **data, size_t *len,
+                        uint64_t *identity)
+{
+    if (budget == 0)
+        return NULL;
+
+    pthread_mutex_lock(&cache_lock);
+    CachedObject *o = find_object(path, NULL);
+    if (o)
+    {
+        unlink_lru(o);
+        push_newest(o);
+        __atomic_add_fetch(&o->refs, 1, __ATOMIC_RELAXED);
+        stats.hits++;
+        *data = o->data;
+        *len = o->len;
+        *identity = o->identity;
+    }
+    else
+    {
+        stats.misses++;
+    }
+    pthread_mutex_unlock(&cache_lock);
+    return o;
+}
+
+void *content_cache_fill(const char *path, int fd, uint64_t size, uint64_t identity,
+                         const unsigned char **data, size_t *len)
+{
+    if (budget == 0 || size > CONTENT_CACHE_MAX_OBJECT)
+        return NULL;
+
+    size_t path_len = strlen(path) + 1;
+    CachedObject *o = malloc(sizeof(CachedObject) + size + path_len);
+    if (!o)
+        return NULL;
+
+    // Read outside the cache lock; the shared path lock keeps the file as it is
+    size_t got = 0;
+    while (got < size)
+    {
+        ssize_t n = pread(fd, o->data + got, size - got, (off_t)got);
+        if (n <= 0)
+        {
+            free(o);
+            return NULL;
+        }
+        got += (size_t)n;
+    }
+
+    memset(o, 0, sizeof(*o));
+    o->path = (char *)o->data + size;
+    memcpy(o->path, path, path_len);
+    o->len = size;
+    o->identity = identity;
+    o->charge = sizeof(CachedObject) + size + path_len;
+    o->refs = 2; // the cache's and the caller's
+
+    pthread_mutex_lock(&cache_lock);
+    CachedObject *old = find_object(path, NULL);
+    if (old)
+        remove_object(old); // filled by a concurrent reader; keep the newer copy
+
+    size_t b = bucket_of(path);
+    o->hash_next = buckets[b];
+    buckets[b] = o;
+    push_newest(o);
+    stats.objects++;
+    stats.bytes += o->charge;
+
+    while (stats.bytes > budget && oldest && oldest != o)
+    {
+        remove_object(oldest);
+        stats.evictions++;
+    }
+    pthread_mutex_unlock(&cache_lock);
+
+    *data = o->data;
+    *len = o->len;
+    return o;
+}
+
+void content_cache_invalidate(const char *path)
+{
+    if (budget == 0)
+        return;
+
+    pthread_mutex_lock(&cache_lock);
+    CachedObject *o = find_object(path, NULL);
+    if (o)
+    {
+        remove_object(o);
+        stats.invalidations++;
+    }
+    pthread_mutex_unlock(&cache_lock);
+}
+
+void content_cache_stats(ContentCacheStats *out)
+{
+    pthread_mutex_lock(&cache_lock);
+    *out = stats;
+    pthread_mutex_unlock(&cache_lock);
+}
@@ -0,0 +1,94 @@
+/*
+ * content_cache.h, Yehen Yan, CS5600 Practicum II
+ * In-memory cache of small, frequently read files
+ * Last modified: Dec 2025
+ */
+
+#ifndef CONTENT_CACHE_H
+#define CONTENT_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * GET keeps the contents of files up to CONTENT_CACHE_MAX_OBJECT bytes in
+ * memory, least recently used first out once the cache holds
+ * CONTENT_CACHE_BYTES. A hit is sent straight from the cached bytes,
+ * together with the reply header, in one vectored send.
+ *
+ * Objects are reference counted: an evicted or invalidated object stays
+ * alive until the replies sending it are done. Files are filled under the
+ * shared path lock and invalidated under the exclusive one (WRITE, RM), so
+ * the cache never serves contents older than the last publish.
+ */
+
+typedef struct
+{
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t invalidations;
+    size_t objects;
+    size_t bytes;
+} ContentCacheStats;
+
+/**
+ * @brief Set the byte budget
+ *
+ * @param budget bytes the cache may hold; 0 disables it
+ */
+void content_cache_init(size_t budget);
+
+/**
+ * @brief Look a file up
+ *
+ * @param path storage path of the file
+ * @param data receives the contents
+ * @param len receives the length
+ * @param identity receives the identity given to content_cache_fill()
+ * @return void* reference to release with content_cache_release(), NULL on a miss
+ */
+void *content_cache_get(const char *path, const unsigned char **data, size_t *len,
+                        uint64_t *identity);
+
+/**
+ * @brief Read a small file into the cache
+ *
+ * Call with the shared path lock held.
+ *
+ * @param path storage path of the file
+ * @param fd the file, open for reading
+ * @param size its size
+ * @param identity identity reported with the contents (file_identity())
+ * @param data receives the contents
+ * @param len receives the length
+ * @return void* reference to release with content_cache_release(), NULL if
+ *               the file is too large or could not be read
+ */
+void *content_cache_fill(const char *path, int fd, uint64_t size, uint64_t identity,
+                         const unsigned char **data, size_t *len);
+
+/**
+ * @brief Drop a reference from content_cache_get() or content_cache_fill()
+ *
+ * @param ref reference
+ */
+void content_cache_release(void *ref);
+
+/**
+ * @brief Forget a file after it was replaced or deleted
+ *
+ * Call with the exclusive path lock held.
+ *
+ * @param path storage path of the file
+ */
+void content_cache_invalidate(const char *path);
+
+/**
+ * @brief Read the counters
+ *
+ * @param out receives them
+ */
+void content_cache_stats(ContentCacheStats *out);
+
+#endif // CONTENT_CACHE_H
@@ -0,0 +1,375 @@
+/*
+ * dedup_index.c, Yehen Yan, CS5600 Practicum II
+ * Index of stored contents by SHA-256, for deduplicated WRITEs
+ * Last modified: Dec 2025
+ */
+#define _GNU_SOURCE // copy_file_range, nftw
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "dedup_index.h"
+#include "lock_table.h"
+#include "content_cache.h"
+#include "config.h"
+
+// Bytes per read when the kernel cannot copy a file by itself
+#define COPY_BUFFER (256 * 1024)
+
+typedef struct DedupEntry
+{
+    ContentInfo content;
+    // The file the digest was recorded for. Stored files are replaced,
+    // never rewritten, so a file that still has this identity still holds
+    // the contents.
+    dev_t dev;
+    ino_t ino;
+    int64_t mtime_ns;
+    char *path;
+    struct DedupEntry *next_digest;
+    struct DedupEntry *next_path;
+} DedupEntry;
+
+static DedupEntry **by_digest;
+static DedupEntry **by_path;
+static pthread_mutex_t index_lock = PTHREAD_MUTEX_INITIALIZER;
+static int enabled;
+
+static char storage_root[512];
+static pthread_t thread;
+static int running;
+static int stopping;
+
+static size_t digest_bucket(const unsigned char *sha256)
+{
+    uint64_t h;
+    memcpy(&h, sha256, sizeof(h));
+    return (size_t)(h % DEDUP_INDEX_BUCKETS);
+}
+
+static size_t path_bucket(const char *path)
+{
+    return (size_t)(path_hash(path) % DEDUP_INDEX_BUCKETS);
+}
+
+static int64_t mtime_ns(const struct stat *st)
+{
+    return (int64_t)st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+}
+
+static int same_file(const DedupEntry *e, const struct stat *st)
+{
+    return S_ISREG(st->st_mode) && e->dev == st->st_dev && e->ino == st->st_ino &&
+           e->mtime_ns == mtime_ns(st) && (uint64_t)st->st_size == e->content.size;
+}
+
+// Caller holds index_lock
+static DedupEntry **find_path(const char *path)
+{
+    DedupEntry **link = &by_path[path_bucket(path)];
+    while (*link && strcmp((*link)->path, path) != 0)
+        link = &(*link)->next_path;
+    return link;
+}
+
+// Take an entry out of the digest chain. Caller holds index_lock.
+static void unchain_digest(DedupEntry *e)
+{
+    DedupEntry **link = &by_digest[digest_bucket(e->content.sha256)];
+    while (*link != e)
+        link = &(*link)->next_digest;
+    *link = e->next_digest;
+}
+
+// Caller holds index_lock
+static void remove_path(const char *path)
+{
+    DedupEntry **link = find_path(path);
+    DedupEntry *e = *link;
+    if (!e)
+        return;
+    *link = e->next_path;
+    unchain_digest(e);
+    free(e->path);
+    free(e);
+}
+
+// Record the file at path, which holds content. Caller holds the file's path
+// lock, so the file cannot be replaced between being read and being stat'd.
+static void add_file(const char *path, const ContentInfo *content)
+{
+    struct stat st;
+    if (!content->has_sha256 || stat(path, &st) != 0 || !S_ISREG(st.st_mode) ||
+        (uint64_t)st.st_size != content->size)
+        return;
+
+    DedupEntry *e = malloc(sizeof(DedupEntry));
+    char *copy = strdup(path);
+    if (!e || !copy)
+    {
+        free(e);
+        free(copy);
+        return;
+    }
+    e->content = *content;
+    e->dev = st.st_dev;
+    e->ino = st.st_ino;
+    e->mtime_ns = mtime_ns(&st);
+    e->path = copy;
+
+    pthread_mutex_lock(&index_lock);
+    remove_path(path);
+    size_t d = digest_bucket(content->sha256);
+    size_t p = path_bucket(path);
+    e->next_digest = by_digest[d];
+    by_digest[d] = e;
+    e->next_path = by_path[p];
+    by_path[p] = e;
+    pthread_mutex_unlock(&index_lock);
+}
+
+// Drop an entry that turned out to be stale, unless it was replaced since
+static void evict(const char *path, ino_t ino)
+{
+    pthread_mutex_lock(&index_lock);
+    DedupEntry *e = *find_path(path);
+    if (e && e->ino == ino)
+        remove_path(path);
+    pthread_mutex_unlock(&index_lock);
+}
+
+void dedup_index_publish(const char *full_path, const char *backup_path,
+                         const ContentInfo *content)
+{
+    if (!enabled)
+        return;
+
+    // The backup is a hard link to the previous contents, so the entry
+    // moves over with its identity unchanged
+    pthread_mutex_lock(&index_lock);
+    DedupEntry **link = find_path(full_path);
+    DedupEntry *e = *link;
+    char *moved = e && backup_path ? strdup(backup_path) : NULL;
+    if (moved)
+    {
+        *link = e->next_path;
+        free(e->path);
+        e->path = moved;
+        remove_path(backup_path);
+        size_t p = path_bucket(backup_path);
+        e->next_path = by_path[p];
+        by_path[p] = e;
+    }
+    else
+    {
+        remove_path(full_path);
+    }
+    pthread_mutex_unlock(&index_lock);
+
+    if (content)
+        add_file(full_path, content);
+}
+
+void dedup_index_forget(const char *path)
+{
+    if (!enabled)
+        return;
+
+    pthread_mutex_lock(&index_lock);
+    remove_path(path);
+    pthread_mutex_unlock(&index_lock);
+}
+
+// Copy source into a new file at dest_path; for when a hard link is not
+// possible. Returns 0 if dest_path now holds the indexed contents.
+static int copy_file(const DedupEntry *e, const char *source, const char *dest_path)
+{
+    int in_fd = open(source, O_RDONLY | O_CLOEXEC);
+    if (in_fd < 0)
+        return -1;
+
+    struct stat st;
+    int out_fd = -1;
+    if (fstat(in_fd, &st) != 0 || !same_file(e, &st) ||
+        (out_fd = open(dest_path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644)) < 0)
+    {
+        close(in_fd);
+        return -1;
+    }
+
+    uint64_t total = 0;
+    ssize_t n;
+    while ((n = copy_file_range(in_fd, NULL, out_fd, NULL, 1 << 30, 0)) > 0)
+        total += (uint64_t)n;
+    if (n < 0 && total == 0)
+    {
+        char *buffer = malloc(COPY_BUFFER);
+        n = buffer ? 0 : -1;
+        while (buffer && (n = read(in_fd, buffer, COPY_BUFFER)) > 0)
+        {
+            if (write(out_fd, buffer, (size_t)n) != n)
+            {
+                n = -1;
+                break;
+            }
+            total += (uint64_t)n;
+        }
+        free(buffer);
+    }
+    close(in_fd);
+
+    if (close(out_fd) != 0 || n < 0 || total != e->content.size)
+    {
+        unlink(dest_path);
+        return -1;
+    }
+    return 0;
+}
+
+int dedup_index_link(const unsigned char sha256[SHA256_DIGEST_SIZE], uint64_t size,
+                     const char *dest_path, ContentInfo *content)
+{
+    if (!enabled)
+        return -1;
+
+    // Every candidate that fails is evicted, so this ends
+    for (;;)
+    {
+        DedupEntry found;
+        char path[768];
+
+        pthread_mutex_lock(&index_lock);
+        DedupEntry *e = by_digest[digest_bucket(sha256)];
+        while (e && (e->content.size != size ||
+                     memcmp(e->content.sha256, sha256, SHA256_DIGEST_SIZE) != 0))
+            e = e->next_digest;
+        if (e)
+        {
+            found = *e;
+            snprintf(path, sizeof(path), "%s", e->path);
+        }
+        pthread_mutex_unlock(&index_lock);
+        if (!e)
+            return -1;
+
+        // Linking changes the source's ctime and so the identity GET reports
+        // for it. Its cached copy is dropped under the exclusive lock, so no
+        // reader caches it again with the old identity.
+        struct stat st;
+        path_lock_exclusive(path);
+        int linked = link(path, dest_path) == 0;
+        int saved_errno = errno;
+        if (linked)
+            content_cache_invalidate(path);
+        path_unlock(path);
+
+        if (linked)
+        {
+            if (stat(dest_path, &st) == 0 && same_file(&found, &st))
+            {
+                *content = found.content;
+                return 0;
+            }
+            unlink(dest_path);
+        }
+        else if ((saved_errno == EMLINK || saved_errno == EXDEV) &&
+                 copy_file(&found, path, dest_path) == 0)
+        {
+            *content = found.content;
+            return 0;
+        }
+        evict(path, found.ino);
+    }
+}
+
+static int is_stopping(void)
+{
+    return __atomic_load_n(&stopping, __ATOMIC_RELAXED);
+}
+
+// Add the current contents and the full-copy versions of one file
+static void index_file(const char *full_path, const char *dir)
+{
+    path_lock_shared(full_path);
+    VersionManifest m;
+    if (manifest_snapshot(full_path, &m) == 0)
+    {
+        if (m.has_current)
+            add_file(full_path, &m.current);
+
+        // Chunked, compressed and packed versions are not the contents as-is
+        for (size_t i = 0; i < m.count; i++)
+        {
+            const VersionEntry *v = &m.versions[i];
+            if (v->chunked || v->compressed > 0 || v->pack)
+                continue;
+            char path[768];
+            snprintf(path, sizeof(path), "%s/%s", dir, v->name);
+            add_file(path, &v->content);
+        }
+        manifest_free(&m);
+    }
+    path_unlock(full_path);
+}
+
+static int index_manifest(const char *full_path, const char *dir)
+{
+    index_file(full_path, dir);
+    return is_stopping();
+}
+
+// Files stored before this start are found through their manifests; until
+// the scan reaches them, WRITEs of their contents are uploaded as usual
+static void *scan_thread(void *arg)
+{
+    (void)arg;
+    manifest_walk(storage_root, index_manifest);
+    return NULL;
+}
+
+int dedup_index_start(const char *root, int enable)
+{
+    if (!enable)
+        return 0;
+
+    by_digest = calloc(DEDUP_INDEX_BUCKETS, sizeof(DedupEntry *));
+    by_path = calloc(DEDUP_INDEX_BUCKETS, sizeof(DedupEntry *));
+    if (!by_digest || !by_path)
+    {
+        free(by_digest);
+        free(by_path);
+        fprintf(stderr, "Failed to allocate the dedup index\n");
+        return -1;
+    }
+    enabled = 1;
+
+    snprintf(storage_root, sizeof(storage_root), "%s", root);
+    if (pthread_create(&thread, NULL, scan_thread, NULL) != 0)
+    {
+        perror("Failed to start dedup index thread");
+        return -1;
+    }
+    running = 1;
+    return 0;
+}
+
+void dedup_index_stop(void)
+{
+    if (!running)
+        return;
+
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELAXED);
+    pthread_join(thread, NULL);
+    running = 0;
+}
+
+int dedup_index_enabled(void)
+{
+    return enabled;
+}
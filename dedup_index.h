@@ -0,0 +1,86 @@
+/*
+ * dedup_index.h, Yehen Yan, CS5600 Practicum II
+ * Index of stored contents by SHA-256, for deduplicated WRITEs
+ * Last modified: Dec 2025
+ */
+
+#ifndef DEDUP_INDEX_H
+#define DEDUP_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "version_manifest.h"
+
+/*
+ * Maps the SHA-256 of stored contents to files that hold them: live files
+ * and full-copy versions. A WRITE whose digest is in the index becomes a
+ * hard link to one of those files instead of an upload.
+ *
+ * Entries are only hints. Each one remembers the inode it was made for,
+ * and a file is only reused if the link made from its path still has that
+ * inode, so an entry that went stale (the file was replaced, compressed,
+ * packed or deleted) is dropped when it is found rather than trusted.
+ */
+
+/**
+ * @brief Start the index
+ *
+ * A background thread fills it from the version manifests under root.
+ *
+ * @param root storage root
+ * @param enable 0 to leave deduplication off
+ * @return int 0 on success, -1 if the thread could not be started
+ */
+int dedup_index_start(const char *root, int enable);
+
+/**
+ * @brief Stop the scanning thread, if it is still running
+ */
+void dedup_index_stop(void);
+
+/**
+ * @brief Whether deduplicated WRITEs are served
+ *
+ * @return int 1 if the index is in use
+ */
+int dedup_index_enabled(void);
+
+/**
+ * @brief Record that a file was replaced
+ *
+ * The previous contents, now the backup at backup_path (a hard link to
+ * them), keep their entry under the new name; the new contents get one
+ * for full_path. Caller holds the file's path lock exclusively.
+ *
+ * @param full_path storage path of the file
+ * @param backup_path where the previous contents were saved, or NULL
+ * @param content size and checksums of the new contents
+ */
+void dedup_index_publish(const char *full_path, const char *backup_path,
+                         const ContentInfo *content);
+
+/**
+ * @brief Drop the entry for a file that is being deleted
+ *
+ * @param path storage path of a live file or version file
+ */
+void dedup_index_forget(const char *path);
+
+/**
+ * @brief Hard-link stored contents with a given digest to a new name
+ *
+ * The new name shares the stored file's inode, so it also shares its
+ * identity and modification time. Its times are left alone: changing them
+ * would change them for every name of the inode, and make the index drop
+ * its entries for them.
+ *
+ * @param sha256 digest of the contents
+ * @param size size of the contents
+ * @param dest_path new name; must not exist
+ * @param content receives the size and checksums recorded for the contents
+ * @return int 0 if dest_path now holds the contents, -1 if none are stored
+ */
+int dedup_index_link(const unsigned char sha256[SHA256_DIGEST_SIZE], uint64_t size,
+                     const char *dest_path, ContentInfo *content);
+
+#endif // DEDUP_INDEX_H
@@ -0,0 +1,123 @@
+/*
+ * dedup_transfer.c, Yehen Yan, CS5600 Practicum II
+ * WRITE of contents the server already stores, offered by digest
+ * Last modified: Dec 2025
+ *
+ * The same file is often pushed under several names, or pushed again
+ * after a revert. Hashing it locally is much cheaper than sending it, so
+ * the client first asks the server to link the contents by digest and
+ * only uploads them when the server does not have them.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "dedup_transfer.h"
+#include "delta_transfer.h"
+#include "checksum.h"
+#include "network.h"
+#include "protocol.h"
+#include "config.h"
+
+// Request ids only need to be unique per connection
+static uint32_t next_request_id = 1;
+
+// Whether the server deduplicates; -1 until it has been asked
+static int server_dedups = -1;
+
+// Ask the server once per run whether it deduplicates. Returns 1 or 0,
+// -1 if the connection broke.
+static int probe_server(int sock)
+{
+    if (server_dedups >= 0)
+        return server_dedups;
+
+    FrameHeader hdr;
+    unsigned char meta[64];
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.opcode = OP_DEDUP_WRITE;
+    hdr.flags = RFS_FLAG_PROBE;
+    hdr.request_id = next_request_id++;
+    if (send_frame(sock, &hdr, NULL, 0, 0) < 0 || recv_frame(sock, &hdr, meta, sizeof(meta)) < 0 ||
+        discard_data(sock, frame_body_len(&hdr)) < 0)
+    {
+        fprintf(stderr, "Connection to server lost\n");
+        return -1;
+    }
+
+    server_dedups = hdr.status == RFS_OK;
+    return server_dedups;
+}
+
+int dedup_write(RfsRequest *req, int sock)
+{
+    req->result = -1;
+
+    int dedups = probe_server(sock);
+    if (dedups <= 0)
+        return dedups < 0 ? -1 : 1;
+
+    uint32_t crc;
+    unsigned char sha256[SHA256_DIGEST_SIZE];
+    if (checksum_file(req->local_path, &crc, sha256) != 0)
+    {
+        perror("Failed to checksum file");
+        return 1;
+    }
+    req->crc32c = crc;
+    req->has_crc = 1;
+
+    unsigned char meta[RFS_MAX_META];
+    MetaWriter w;
+    meta_writer_init(&w, meta, sizeof(meta));
+    meta_put_str(&w, req->remote_path);
+    meta_put_u64(&w, req->file_size);
+    meta_put_u32(&w, crc);
+    meta_put_bytes(&w, sha256, sizeof(sha256));
+
+    FrameHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.opcode = OP_DEDUP_WRITE;
+    hdr.request_id = next_request_id++;
+    if (send_frame(sock, &hdr, meta, w.len, 0) < 0 ||
+        recv_frame(sock, &hdr, meta, sizeof(meta)) < 0 ||
+        discard_data(sock, frame_body_len(&hdr)) < 0)
+    {
+        fprintf(stderr, "Connection to server lost\n");
+        return -1;
+    }
+
+    // Not stored: the normal case for new contents, so nothing is printed
+    if (hdr.status != RFS_OK)
+        return 1;
+
+    char digest[SHA256_HEX_SIZE];
+    sha256_hex(sha256, digest);
+    req->bytes = 0;
+    req->result = 0;
+    printf("Server already stores the contents of '%s' (SHA-256 %.16s...); "
+           "linked as '%s' without sending them\n",
+           req->local_path, digest, req->remote_path);
+    return 0;
+}
+
+int reuse_write(RfsRequest *req)
+{
+    int sock = session_open();
+    if (sock < 0)
+        return -1;
+
+    int r = dedup_write(req, sock);
+    if (r > 0 && req->file_size >= DELTA_MIN_SIZE)
+    {
+        req->result = 0;
+        r = delta_write(req, sock);
+    }
+
+    if (r < 0)
+        close(sock);
+    else
+        session_close(sock);
+    return r;
+}
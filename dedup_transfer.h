@@ -0,0 +1,44 @@
+/*
+ * dedup_transfer.h, Yehen Yan, CS5600 Practicum II
+ * WRITE of contents the server already stores, offered by digest
+ * Last modified: Dec 2025
+ */
+
+#ifndef DEDUP_TRANSFER_H
+#define DEDUP_TRANSFER_H
+
+#include "operations.h"
+
+/**
+ * @brief Offer a prepared WRITE request to the server by digest
+ *
+ * Sends the local file's size, CRC32C and SHA-256 instead of its contents.
+ * If the server already stores those bytes, under any name or as any
+ * version, it links them to the remote path, with the usual backup of the
+ * previous version, and nothing else is sent.
+ *
+ * The first call asks the server whether it deduplicates at all; if it
+ * does not, the file is never hashed. The CRC32C computed along with the
+ * SHA-256 is kept in the request for a delta WRITE.
+ *
+ * @param req Prepared WRITE request; result, bytes and crc32c are filled in
+ * @param sock Open session; left open
+ * @return int 0 on success, 1 if the contents should be sent after all
+ *         (the server does not have them, or does not deduplicate), -1 on
+ *         failure (the session is then unusable)
+ */
+int dedup_write(RfsRequest *req, int sock);
+
+/**
+ * @brief Send a prepared WRITE without its full contents, if the server allows
+ *
+ * Over one session, offers the contents by digest (dedup_write), then,
+ * for a file of at least DELTA_MIN_SIZE bytes, as a delta against the
+ * stored copy (delta_write).
+ *
+ * @param req Prepared WRITE request of at least DEDUP_MIN_SIZE bytes
+ * @return int 0 on success, 1 if the whole file should be sent, -1 on failure
+ */
+int reuse_write(RfsRequest *req);
+
+#endif // DEDUP_TRANSFER_H
@@ -0,0 +1,404 @@
+/*
+ * delta.c, Yehen Yan, CS5600 Practicum II
+ * Rolling-checksum delta encoding for uploads of files the server already has
+ * Last modified: Dec 2025
+ */
+#define _POSIX_C_SOURCE 200809L // pread, pwrite
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "delta.h"
+#include "checksum.h"
+#include "protocol.h"
+#include "config.h"
+
+// Bytes moved per read/write while building signatures and applying deltas
+#define DELTA_IO_BUFFER (1024 * 1024)
+
+// Largest DATA op; longer runs of new bytes are split
+#define DELTA_MAX_DATA (1024 * 1024)
+
+// Weak checksum state: a = sum of bytes, b = sum of running a (rsync style)
+typedef struct
+{
+    uint32_t a;
+    uint32_t b;
+} Weak;
+
+static Weak weak_init(const unsigned char *p, size_t len)
+{
+    Weak w = {0, 0};
+    for (size_t i = 0; i < len; i++)
+    {
+        w.a += p[i];
+        w.b += (uint32_t)(len - i) * p[i];
+    }
+    return w;
+}
+
+// Slide a window of len bytes forward by one byte
+static void weak_roll(Weak *w, unsigned char out, unsigned char in, uint32_t len)
+{
+    w->a += (uint32_t)in - out;
+    w->b += w->a - len * (uint32_t)out;
+}
+
+static uint32_t weak_value(const Weak *w)
+{
+    return (w->a & 0xFFFF) | (w->b << 16);
+}
+
+static void strong_hash(const unsigned char *p, size_t len, unsigned char out[DELTA_STRONG_SIZE])
+{
+    unsigned char digest[SHA256_DIGEST_SIZE];
+    sha256(p, len, digest);
+    memcpy(out, digest, DELTA_STRONG_SIZE);
+}
+
+static uint64_t isqrt(uint64_t n)
+{
+    uint64_t x = n, y = (x + 1) / 2;
+    while (y < x)
+    {
+        x = y;
+        y = (x + n / x) / 2;
+    }
+    return x;
+}
+
+uint32_t delta_block_size(uint64_t size)
+{
+    uint64_t block = isqrt(size);
+    if (block < size / DELTA_MAX_BLOCKS)
+        block = size / DELTA_MAX_BLOCKS;
+    block = (block + 1023) / 1024 * 1024;
+    return block < DELTA_MIN_BLOCK ? DELTA_MIN_BLOCK : (uint32_t)block;
+}
+
+int delta_signature(int fd, uint64_t size, uint32_t block_size, unsigned char *out)
+{
+    uint64_t count = size / block_size;
+    size_t per_read = DELTA_IO_BUFFER / block_size > 0 ? DELTA_IO_BUFFER / block_size : 1;
+    unsigned char *buffer = malloc(per_read * block_size);
+    if (!buffer)
+        return -1;
+
+    MetaWriter w;
+    meta_writer_init(&w, out, count * DELTA_SIG_ENTRY_SIZE);
+
+    for (uint64_t first = 0; first < count; first += per_read)
+    {
+        size_t blocks = count - first < per_read ? (size_t)(count - first) : per_read;
+        size_t want = blocks * block_size;
+        size_t got = 0;
+        while (got < want)
+        {
+            ssize_t n = pread(fd, buffer + got, want - got, (off_t)(first * block_size + got));
+            if (n <= 0)
+            {
+                free(buffer);
+                return -1;
+            }
+            got += (size_t)n;
+        }
+
+        for (size_t i = 0; i < blocks; i++)
+        {
+            const unsigned char *p = buffer + i * block_size;
+            Weak weak = weak_init(p, block_size);
+            unsigned char strong[DELTA_STRONG_SIZE];
+            strong_hash(p, block_size, strong);
+
+            meta_put_u32(&w, weak_value(&weak));
+            memcpy(out + w.len, strong, DELTA_STRONG_SIZE);
+            w.len += DELTA_STRONG_SIZE;
+        }
+    }
+
+    free(buffer);
+    return 0;
+}
+
+// ========== ENCODING ==========
+
+typedef struct
+{
+    const unsigned char *sig;
+    int32_t *heads; // first block per bucket, -1 if none
+    int32_t *next;  // next block with the same bucket
+    uint32_t bits;
+    FILE *out;
+    uint32_t run_first; // pending COPY run
+    uint32_t run_count;
+    int error;
+} Encoder;
+
+static uint32_t sig_weak(const Encoder *e, uint32_t block)
+{
+    const unsigned char *p = e->sig + (size_t)block * DELTA_SIG_ENTRY_SIZE;
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint32_t bucket_of(const Encoder *e, uint32_t weak)
+{
+    return (weak * 0x9E3779B1u) >> (32 - e->bits);
+}
+
+static void put_op(Encoder *e, uint8_t tag, uint32_t x, int with_y, uint32_t y)
+{
+    unsigned char op[9];
+    MetaWriter w;
+    meta_writer_init(&w, op, sizeof(op));
+    meta_put_u8(&w, tag);
+    meta_put_u32(&w, x);
+    if (with_y)
+        meta_put_u32(&w, y);
+    if (fwrite(op, 1, w.len, e->out) != w.len)
+        e->error = 1;
+}
+
+static void flush_run(Encoder *e)
+{
+    if (e->run_count > 0)
+        put_op(e, DELTA_OP_COPY, e->run_first, 1, e->run_count);
+    e->run_count = 0;
+}
+
+static void emit_data(Encoder *e, const unsigned char *p, uint64_t len)
+{
+    if (len == 0)
+        return;
+    flush_run(e);
+    while (len > 0)
+    {
+        uint32_t piece = len < DELTA_MAX_DATA ? (uint32_t)len : DELTA_MAX_DATA;
+        put_op(e, DELTA_OP_DATA, piece, 0, 0);
+        if (fwrite(p, 1, piece, e->out) != piece)
+            e->error = 1;
+        p += piece;
+        len -= piece;
+    }
+}
+
+static void emit_copy(Encoder *e, uint32_t block)
+{
+    if (e->run_count > 0 && e->run_first + e->run_count == block)
+    {
+        e->run_count++;
+        return;
+    }
+    flush_run(e);
+    e->run_first = block;
+    e->run_count = 1;
+}
+
+// Find a block matching the window at p; -1 if none. The block after the
+// pending run is preferred, so unchanged stretches become one COPY.
+static int64_t find_block(const Encoder *e, uint32_t weak, const unsigned char *p,
+                          uint32_t block_size)
+{
+    unsigned char strong[DELTA_STRONG_SIZE];
+    int have_strong = 0;
+    int64_t found = -1;
+
+    for (int32_t b = e->heads[bucket_of(e, weak)]; b >= 0; b = e->next[b])
+    {
+        if (sig_weak(e, (uint32_t)b) != weak)
+            continue;
+
+        // The strong hash is only worth computing once a weak checksum matched
+        if (!have_strong)
+        {
+            strong_hash(p, block_size, strong);
+            have_strong = 1;
+        }
+        if (memcmp(e->sig + (size_t)b * DELTA_SIG_ENTRY_SIZE + 4, strong, DELTA_STRONG_SIZE) != 0)
+            continue;
+
+        if (e->run_count > 0 && (uint32_t)b == e->run_first + e->run_count)
+            return b;
+        if (found < 0)
+            found = b;
+    }
+    return found;
+}
+
+int delta_encode(const unsigned char *data, uint64_t size, uint32_t block_size,
+                 const unsigned char *sig, uint32_t count, FILE *out, uint64_t *literal)
+{
+    Encoder e;
+    memset(&e, 0, sizeof(e));
+    e.sig = sig;
+    e.out = out;
+    e.bits = 4;
+    while ((1u << e.bits) < count * 2u && e.bits < 30)
+        e.bits++;
+
+    e.heads = malloc(sizeof(int32_t) << e.bits);
+    e.next = malloc(sizeof(int32_t) * (count ? count : 1));
+    if (!e.heads || !e.next)
+    {
+        free(e.heads);
+        free(e.next);
+        return -1;
+    }
+    memset(e.heads, 0xFF, sizeof(int32_t) << e.bits);
+
+    // Insert in reverse so each chain lists blocks in file order
+    for (uint32_t b = count; b-- > 0;)
+    {
+        uint32_t bucket = bucket_of(&e, sig_weak(&e, b));
+        e.next[b] = e.heads[bucket];
+        e.heads[bucket] = (int32_t)b;
+    }
+
+    uint64_t pos = 0, data_start = 0;
+    *literal = 0;
+
+    if (count > 0 && size >= block_size)
+    {
+        Weak weak = weak_init(data, block_size);
+        while (1)
+        {
+            int64_t b = find_block(&e, weak_value(&weak), data + pos, block_size);
+            if (b >= 0)
+            {
+                emit_data(&e, data + data_start, pos - data_start);
+                *literal += pos - data_start;
+                emit_copy(&e, (uint32_t)b);
+
+                pos += block_size;
+                data_start = pos;
+                if (pos + block_size > size)
+                    break;
+                weak = weak_init(data + pos, block_size);
+            }
+            else
+            {
+                if (pos + block_size >= size)
+                    break;
+                weak_roll(&weak, data[pos], data[pos + block_size], block_size);
+                pos++;
+            }
+        }
+    }
+
+    emit_data(&e, data + data_start, size - data_start);
+    *literal += size - data_start;
+    flush_run(&e);
+
+    free(e.heads);
+    free(e.next);
+    return e.error || fflush(out) != 0 ? -1 : 0;
+}
+
+// ========== APPLYING ==========
+
+static int read_exact(int fd, unsigned char *buffer, size_t len, uint64_t offset)
+{
+    while (len > 0)
+    {
+        ssize_t n = pread(fd, buffer, len, (off_t)offset);
+        if (n <= 0)
+            return -1;
+        buffer += n;
+        len -= (size_t)n;
+        offset += (uint64_t)n;
+    }
+    return 0;
+}
+
+static int write_exact(int fd, const unsigned char *buffer, size_t len, uint64_t offset)
+{
+    while (len > 0)
+    {
+        ssize_t n = pwrite(fd, buffer, len, (off_t)offset);
+        if (n <= 0)
+            return -1;
+        buffer += n;
+        len -= (size_t)n;
+        offset += (uint64_t)n;
+    }
+    return 0;
+}
+
+// Copy len bytes from in_fd at in_off to out_fd at *out_off, extending digest
+static int copy_bytes(int in_fd, uint64_t in_off, uint64_t len, int out_fd, uint64_t *out_off,
+                      ContentDigest *digest, unsigned char *buffer)
+{
+    while (len > 0)
+    {
+        size_t piece = len < DELTA_IO_BUFFER ? (size_t)len : DELTA_IO_BUFFER;
+        if (read_exact(in_fd, buffer, piece, in_off) != 0 ||
+            write_exact(out_fd, buffer, piece, *out_off) != 0)
+            return -1;
+        content_digest_update(digest, buffer, piece);
+        in_off += piece;
+        *out_off += piece;
+        len -= piece;
+    }
+    return 0;
+}
+
+int delta_apply(int base_fd, uint64_t base_size, uint32_t block_size, int delta_fd,
+                uint64_t delta_len, int out_fd, uint64_t *out_size, ContentDigest *digest)
+{
+    unsigned char *buffer = malloc(DELTA_IO_BUFFER);
+    if (!buffer)
+        return -1;
+
+    uint64_t pos = 0, out_off = 0;
+    int ok = 1;
+
+    while (ok && pos < delta_len)
+    {
+        unsigned char op[9];
+        if (delta_len - pos < 5 || read_exact(delta_fd, op, 5, pos) != 0)
+        {
+            ok = 0;
+            break;
+        }
+
+        MetaReader r;
+        meta_reader_init(&r, op, 5);
+        uint8_t tag = meta_get_u8(&r);
+        uint32_t x = meta_get_u32(&r);
+        pos += 5;
+
+        if (tag == DELTA_OP_COPY)
+        {
+            if (delta_len - pos < 4 || read_exact(delta_fd, op, 4, pos) != 0)
+            {
+                ok = 0;
+                break;
+            }
+            meta_reader_init(&r, op, 4);
+            uint32_t n = meta_get_u32(&r);
+            pos += 4;
+
+            // Only whole blocks of the base are ever referenced
+            uint64_t start = (uint64_t)x * block_size;
+            uint64_t len = (uint64_t)n * block_size;
+            ok = start <= base_size && len <= base_size - start &&
+                 copy_bytes(base_fd, start, len, out_fd, &out_off, digest, buffer) == 0;
+        }
+        else if (tag == DELTA_OP_DATA)
+        {
+            ok = x <= delta_len - pos &&
+                 copy_bytes(delta_fd, pos, x, out_fd, &out_off, digest, buffer) == 0;
+            pos += x;
+        }
+        else
+        {
+            ok = 0;
+        }
+    }
+
+    free(buffer);
+    if (!ok)
+        return -1;
+
+    *out_size = out_off;
+    return 0;
+}
@@ -0,0 +1,87 @@
+/*
+ * delta.h, Yehen Yan, CS5600 Practicum II
+ * Rolling-checksum delta encoding for uploads of files the server already has
+ * Last modified: Dec 2025
+ */
+
+#ifndef DELTA_H
+#define DELTA_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "checksum.h"
+
+/*
+ * The server cuts its copy of a file into fixed-size blocks and sends a
+ * signature: a weak rolling checksum and a strong hash per block. The client
+ * slides a window over its new file; wherever the window's weak checksum,
+ * and then its strong hash, matches a block, it sends "copy block n" instead
+ * of the bytes. Everything else is sent as data.
+ *
+ * Signature entry: u32 weak, then DELTA_STRONG_SIZE bytes of strong hash.
+ * Delta stream, a sequence of:
+ *   DELTA_OP_COPY u32 first_block u32 block_count
+ *   DELTA_OP_DATA u32 length, then length bytes
+ * Integers are little-endian, as in frame metadata.
+ */
+
+#define DELTA_STRONG_SIZE 16
+#define DELTA_SIG_ENTRY_SIZE (4 + DELTA_STRONG_SIZE)
+
+#define DELTA_OP_COPY 1
+#define DELTA_OP_DATA 2
+
+/**
+ * @brief Block size used for a base file of the given size
+ *
+ * Roughly the square root of the size, so the signature and the unmatched
+ * bytes around each edit stay small together.
+ *
+ * @param size base file size
+ * @return uint32_t block size in bytes
+ */
+uint32_t delta_block_size(uint64_t size);
+
+/**
+ * @brief Signature of a base file: one entry per full block
+ *
+ * @param fd base file
+ * @param size base file size
+ * @param block_size from delta_block_size()
+ * @param out receives size / block_size entries of DELTA_SIG_ENTRY_SIZE bytes
+ * @return int 0 on success, -1 if the file could not be read
+ */
+int delta_signature(int fd, uint64_t size, uint32_t block_size, unsigned char *out);
+
+/**
+ * @brief Encode a new file against a base file's signature
+ *
+ * @param data new file contents
+ * @param size new file size
+ * @param block_size block size of the signature
+ * @param sig signature entries
+ * @param count number of entries
+ * @param out receives the delta stream
+ * @param literal receives the number of bytes sent as data
+ * @return int 0 on success, -1 on failure
+ */
+int delta_encode(const unsigned char *data, uint64_t size, uint32_t block_size,
+                 const unsigned char *sig, uint32_t count, FILE *out, uint64_t *literal);
+
+/**
+ * @brief Rebuild a new file from its base and a delta stream
+ *
+ * @param base_fd base file
+ * @param base_size base file size
+ * @param block_size block size of the signature the delta was made against
+ * @param delta_fd delta stream, read from offset 0
+ * @param delta_len delta stream length
+ * @param out_fd receives the new file from offset 0
+ * @param out_size receives the new file size
+ * @param digest started by the caller; fed the new file as it is written
+ * @return int 0 on success, -1 if the delta is malformed or a file could not be accessed
+ */
+int delta_apply(int base_fd, uint64_t base_size, uint32_t block_size, int delta_fd,
+                uint64_t delta_len, int out_fd, uint64_t *out_size, ContentDigest *digest);
+
+#endif // DELTA_H
@@ -0,0 +1,218 @@
+/*
+ * delta_transfer.c, Yehen Yan, CS5600 Practicum II
+ * WRITE of a changed file as a delta against the server's copy
+ * Last modified: Dec 2025
+ *
+ * Large files are usually pushed again with only a few KB changed. The
+ * client asks for the signature of the stored file, finds which of its
+ * blocks the new file still contains, and sends a delta instead of the
+ * file. Anything that makes a delta pointless (no stored file, mostly new
+ * contents, the stored file replaced meanwhile) falls back to a full WRITE.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "delta_transfer.h"
+#include "delta.h"
+#include "checksum.h"
+#include "network.h"
+#include "protocol.h"
+#include "config.h"
+
+// Request ids only need to be unique per connection
+static uint32_t next_request_id = 1;
+
+// Send one request frame; the caller streams body_len bytes of body
+static int send_request(int sock, Operation op, const unsigned char *meta, size_t meta_len,
+                        uint64_t body_len)
+{
+    FrameHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.opcode = op;
+    hdr.request_id = next_request_id++;
+    return send_frame(sock, &hdr, meta, meta_len, body_len);
+}
+
+// Read a reply. An error reply has its body consumed and, unless quiet, is
+// printed. Returns 0 for an OK reply (body still unread), 1 for an error
+// reply, -1 if the connection broke.
+static int read_reply(int sock, const RfsRequest *req, FrameHeader *hdr, unsigned char *meta,
+                      size_t meta_cap, int quiet)
+{
+    if (recv_frame(sock, hdr, meta, meta_cap) < 0)
+    {
+        fprintf(stderr, "Connection to server lost\n");
+        return -1;
+    }
+    if (hdr->status == RFS_OK)
+        return 0;
+
+    char message[512];
+    uint64_t body_len = frame_body_len(hdr);
+    size_t take = body_len < sizeof(message) - 1 ? (size_t)body_len : sizeof(message) - 1;
+    if (recv_all(sock, message, take) < 0 || discard_data(sock, body_len - take) < 0)
+        return -1;
+    message[take] = '\0';
+
+    if (!quiet)
+        fprintf(stderr, "%s '%s' as delta failed: %s%s%s\n", operation_to_string(req->op),
+                req->remote_path, status_to_string(hdr->status), take > 0 ? ": " : "",
+                message);
+    return 1;
+}
+
+// Fetch the stored file's signature. Returns 0 on success (*sig allocated),
+// 1 if the server has nothing to diff against, -1 if the connection broke.
+static int fetch_signature(int sock, const RfsRequest *req, uint64_t *identity,
+                           uint32_t *block_size, uint32_t *count, unsigned char **sig)
+{
+    unsigned char meta[RFS_MAX_META];
+    MetaWriter w;
+    meta_writer_init(&w, meta, sizeof(meta));
+    meta_put_str(&w, req->remote_path);
+
+    FrameHeader hdr;
+    if (send_request(sock, OP_SIGNATURE, meta, w.len, 0) < 0)
+        return -1;
+
+    // A missing file is the normal case for a first WRITE
+    int r = read_reply(sock, req, &hdr, meta, sizeof(meta), 1);
+    if (r != 0)
+        return r;
+
+    MetaReader mr;
+    meta_reader_init(&mr, meta, hdr.meta_len);
+    meta_get_u64(&mr); // stored size
+    *identity = meta_get_u64(&mr);
+    *block_size = meta_get_u32(&mr);
+    *count = meta_get_u32(&mr);
+
+    uint64_t body_len = frame_body_len(&hdr);
+    if (mr.error || *block_size == 0 || body_len != (uint64_t)*count * DELTA_SIG_ENTRY_SIZE)
+    {
+        fprintf(stderr, "Malformed signature from server\n");
+        return -1;
+    }
+
+    *sig = malloc(body_len ? (size_t)body_len : 1);
+    if (!*sig)
+    {
+        perror("Failed to allocate signature");
+        return discard_data(sock, body_len) < 0 ? -1 : 1;
+    }
+    if (recv_all(sock, *sig, (size_t)body_len) < 0)
+    {
+        free(*sig);
+        return -1;
+    }
+    return 0;
+}
+
+// Encode the local file against sig into an anonymous temp file. Its
+// CRC32C is taken from the mapping unless the request already has it.
+static FILE *encode_delta(const RfsRequest *req, uint32_t block_size, const unsigned char *sig,
+                          uint32_t count, uint32_t *crc, uint64_t *literal)
+{
+    int fd = open(req->local_path, O_RDONLY);
+    if (fd < 0)
+    {
+        perror("Failed to open file");
+        return NULL;
+    }
+
+    size_t size = (size_t)req->file_size;
+    unsigned char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        perror("Failed to map file");
+        return NULL;
+    }
+
+    FILE *delta = tmpfile();
+    if (!delta || delta_encode(data, size, block_size, sig, count, delta, literal) != 0)
+    {
+        perror("Failed to encode delta");
+        if (delta)
+            fclose(delta);
+        munmap(data, size);
+        return NULL;
+    }
+    *crc = req->has_crc ? req->crc32c : crc32c_update(0, data, size);
+    munmap(data, size);
+    return delta;
+}
+
+int delta_write(RfsRequest *req, int sock)
+{
+    req->result = -1;
+
+    uint64_t identity;
+    uint32_t block_size, count;
+    unsigned char *sig = NULL;
+    int r = fetch_signature(sock, req, &identity, &block_size, &count, &sig);
+    if (r != 0)
+        return r;
+
+    uint32_t crc = 0;
+    uint64_t literal = 0;
+    FILE *delta = encode_delta(req, block_size, sig, count, &crc, &literal);
+    free(sig);
+    if (!delta)
+        return 1;
+
+    // Mostly new contents: the delta would only add overhead
+    if (literal * 100 > req->file_size * DELTA_MAX_LITERAL_PERCENT)
+    {
+        printf("'%s' changed too much for a delta (%llu of %llu bytes new)\n", req->local_path,
+               (unsigned long long)literal, (unsigned long long)req->file_size);
+        fclose(delta);
+        return 1;
+    }
+
+    struct stat st;
+    fstat(fileno(delta), &st);
+    uint64_t delta_len = (uint64_t)st.st_size;
+
+    unsigned char meta[RFS_MAX_META];
+    MetaWriter w;
+    meta_writer_init(&w, meta, sizeof(meta));
+    meta_put_str(&w, req->remote_path);
+    meta_put_u64(&w, identity);
+    meta_put_u64(&w, req->file_size);
+    meta_put_u32(&w, crc);
+    meta_put_u32(&w, block_size);
+
+    FrameHeader hdr;
+    r = send_request(sock, OP_DELTA_WRITE, meta, w.len, delta_len);
+    if (r == 0 && send_fd_data(sock, fileno(delta), 0, delta_len) != (int64_t)delta_len)
+        r = -1;
+    fclose(delta);
+    if (r == 0)
+        r = read_reply(sock, req, &hdr, meta, sizeof(meta), 1);
+    if (r == 0)
+        r = discard_data(sock, frame_body_len(&hdr)) < 0 ? -1 : 0;
+
+    if (r < 0)
+        return -1;
+    if (r > 0)
+    {
+        // Usually another WRITE replaced the stored file meanwhile
+        printf("Delta of '%s' not applied (%s); sending the whole file\n", req->local_path,
+               status_to_string(hdr.status));
+        return 1;
+    }
+
+    req->bytes = (int64_t)delta_len;
+    req->result = 0;
+    printf("Sent '%s' to server as '%s' in a %llu-byte delta (%llu of %llu bytes new)\n",
+           req->local_path, req->remote_path, (unsigned long long)delta_len,
+           (unsigned long long)literal, (unsigned long long)req->file_size);
+    return 0;
+}
@@ -0,0 +1,29 @@
+/*
+ * delta_transfer.h, Yehen Yan, CS5600 Practicum II
+ * WRITE of a changed file as a delta against the server's copy
+ * Last modified: Dec 2025
+ */
+
+#ifndef DELTA_TRANSFER_H
+#define DELTA_TRANSFER_H
+
+#include "operations.h"
+
+/**
+ * @brief Upload a prepared WRITE request as a delta against the stored file
+ *
+ * Fetches the stored file's block signature, encodes the local file against
+ * it and sends only the copy instructions and new bytes. The server rebuilds
+ * the file, checks it against the local file's CRC32C, and publishes it with
+ * the usual backup of the previous version.
+ *
+ * @param req Prepared WRITE request; result and bytes are filled in. A
+ *            CRC32C already in it (has_crc) is used instead of computing one.
+ * @param sock Open session; left open
+ * @return int 0 on success, 1 if a full WRITE should be sent instead
+ *         (no stored file, or too little of it is reusable), -1 on failure
+ *         (the session is then unusable)
+ */
+int delta_write(RfsRequest *req, int sock);
+
+#endif // DELTA_TRANSFER_H
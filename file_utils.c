@@ -2,17 +2,19 @@
  * File utility functions for remote file system, Yehen Yan, CS5600 Practicum II
  * Last modified: Dec 2025
  */
+#define _GNU_SOURCE // fallocate
 
 #include <stdio.h>
 #include <string.h>
 #include <sys/stat.h>
-#include <dirent.h>
 #include <time.h>
-#include <sys/file.h>
-#include <sys/socket.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <ftw.h>
 #include "file_utils.h"
 #include "config.h"
-#include "network.h"
+#include "uring.h"
 
 int file_exists(const char *filename)
 {
@@ -38,111 +40,161 @@ int delete_single_file(const char *filepath)
     return 0; // Didn't exist
 }
 
-int delete_file_versions(const char *full_path, int *deleted, int *failed)
+time_t get_file_mtime(const char *filename)
 {
-    char pattern[512];
-    snprintf(pattern, sizeof(pattern), "%s.v", full_path);
-
-    // Extract directory
-    char dir_path[512];
-    strncpy(dir_path, full_path, sizeof(dir_path) - 1);
-    char *last_slash = strrchr(dir_path, '/');
-    if (last_slash)
+    struct stat st;
+    if (stat(filename, &st) == 0)
     {
-        *last_slash = '\0';
+        return st.st_mtime;
     }
-    else
+    return 0;
+}
+
+uint64_t file_identity(const struct stat *st)
+{
+    uint64_t fields[5] = {(uint64_t)st->st_ino, (uint64_t)st->st_mtim.tv_sec,
+                          (uint64_t)st->st_mtim.tv_nsec, (uint64_t)st->st_ctim.tv_sec,
+                          (uint64_t)st->st_ctim.tv_nsec};
+
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    const unsigned char *bytes = (const unsigned char *)fields;
+    for (size_t i = 0; i < sizeof(fields); i++)
+        hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    return hash ? hash : 1;
+}
+
+void format_timestamp(time_t timestamp, char *buffer, size_t size)
+{
+    struct tm *tm_info = localtime(&timestamp);
+    strftime(buffer, size, "%Y-%m-%d %H:%M:%S", tm_info);
+}
+
+void preallocate_file(int fd, uint64_t size)
+{
+    if (size == 0)
     {
-        strcpy(dir_path, ".");
+        return;
     }
 
-    DIR *dir = opendir(dir_path);
-    if (!dir)
+    // One contiguous reservation up front instead of growing chunk by chunk
+    if (fallocate(fd, 0, 0, (off_t)size) != 0 && errno != EOPNOTSUPP && errno != ENOSYS)
     {
-        return 0;
+        perror("fallocate failed");
     }
-    // Iterate and delete matching versions in directory
-    struct dirent *entry;
-    while ((entry = readdir(dir)) != NULL)
-    {
-        char full_entry_path[512];
-        snprintf(full_entry_path, sizeof(full_entry_path), "%s/%s",
-                 dir_path, entry->d_name);
+}
 
-        if (strncmp(full_entry_path, pattern, strlen(pattern)) == 0)
-        {
-            printf("Deleting version: %s\n", full_entry_path);
-            if (remove(full_entry_path) == 0)
-            {
-                (*deleted)++;
-            }
-            else
-            {
-                perror("Failed to delete version");
-                (*failed)++;
-            }
-        }
+int sync_file(const char *path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || fsync(fd) != 0)
+    {
+        perror("Failed to sync file");
+        if (fd >= 0)
+            close(fd);
+        return -1;
     }
+    close(fd);
+    return 0;
+}
+
+int sync_parent_dir(const char *path)
+{
+    char dir[512];
+    const char *slash = strrchr(path, '/');
+    snprintf(dir, sizeof(dir), "%.*s", slash ? (int)(slash - path) : 1, slash ? path : ".");
 
-    closedir(dir);
-    return 1;
+    int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0 || fsync(fd) != 0)
+    {
+        perror("Failed to sync directory");
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    close(fd);
+    return 0;
 }
 
-time_t get_file_mtime(const char *filename)
+static int stale_removed;
+
+static int remove_if_stale(const char *path, const struct stat *st, int type, struct FTW *ftw)
 {
-    struct stat st;
-    if (stat(filename, &st) == 0)
+    (void)st;
+    const char *name = path + ftw->base;
+    if (type == FTW_F && (strncmp(name, RFS_TEMP_PREFIX, strlen(RFS_TEMP_PREFIX)) == 0 ||
+                          strncmp(name, RFS_PART_PREFIX, strlen(RFS_PART_PREFIX)) == 0))
     {
-        return st.st_mtime;
+        if (unlink(path) == 0)
+            stale_removed++;
+        else
+            perror("Failed to remove stale upload");
     }
     return 0;
 }
 
-void format_timestamp(time_t timestamp, char *buffer, size_t size)
+int remove_stale_uploads(const char *root)
 {
-    struct tm *tm_info = localtime(&timestamp);
-    strftime(buffer, size, "%Y-%m-%d %H:%M:%S", tm_info);
+    stale_removed = 0;
+    if (nftw(root, remove_if_stale, 16, FTW_PHYS) != 0)
+    {
+        perror("Failed to scan storage");
+        return -1;
+    }
+    return stale_removed;
 }
 
-long send_file_with_lock(int client_sock, const char *filepath)
+int open_file_for_send(const char *filepath, uint64_t *size)
 {
-    // Open file for reading
-    FILE *file = fopen(filepath, "rb");
-    if (!file)
+    // Uploads are published with rename(), so an open descriptor always sees
+    // one complete version of the file and no read lock is needed
+    int fd = open(filepath, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
     {
         perror("Failed to open file");
-        long error = -1;
-        send_all(client_sock, &error, sizeof(long)); // Use send_all
         return -1;
     }
 
-    // Lock file for reading (shared lock)
-    int fd = fileno(file);
-    if (flock(fd, LOCK_SH) != 0)
+    struct stat st;
+    if (fstat(fd, &st) != 0)
     {
-        perror("Failed to lock file");
-        fclose(file);
-        long error = -1;
-        send_all(client_sock, &error, sizeof(long)); // Use send_all
+        perror("Failed to stat file");
+        close(fd);
         return -1;
     }
-    printf("[LOCKED] %s for reading\n", filepath);
-
-    // Get file size
-    fseek(file, 0, SEEK_END);
-    long file_size = ftell(file);
-    fseek(file, 0, SEEK_SET);
 
-    // Send file size
-    send_all(client_sock, &file_size, sizeof(long)); // Use send_all
+    *size = (uint64_t)st.st_size;
+    return fd;
+}
 
-    // Send file data using shared function
-    long total_sent = send_file_data(client_sock, file, file_size);
+void stat_dir_entries(const char *dir_path, char *const names[], EntryStat *out, size_t count)
+{
+    if (count == 0)
+        return;
 
-    // Unlock and close
-    flock(fd, LOCK_UN);
-    printf("[UNLOCKED] %s\n", filepath);
-    fclose(file);
+    // One submission stats the whole batch
+    if (uring_enabled() && uring_stat_entries(dir_path, names, out, count) == 0)
+        return;
 
-    return total_sent;
-}
\ No newline at end of file
+    int dirfd = open(dir_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    for (size_t i = 0; i < count; i++)
+    {
+        struct stat st;
+        if (dirfd >= 0 && fstatat(dirfd, names[i], &st, 0) == 0)
+        {
+            out[i].result = 0;
+            out[i].size = (int64_t)st.st_size;
+            out[i].mtime = st.st_mtime;
+            out[i].is_dir = S_ISDIR(st.st_mode);
+        }
+        else
+        {
+            out[i].result = -errno;
+            out[i].size = 0;
+            out[i].mtime = 0;
+            out[i].is_dir = 0;
+        }
+    }
+    if (dirfd >= 0)
+        close(dirfd);
+}
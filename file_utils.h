@@ -8,6 +8,9 @@
 #define FILE_UTILS_H
 
 #include <time.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include "uring.h"
 
 /**
  * @brief check if a file exists
@@ -24,15 +27,6 @@ int file_exists(const char *filename);
  */
 int delete_single_file(const char *filepath);
 
-/**
- * @brief delete all versions of a file
- * @param full_path full path to the main file
- * @param deleted pointer to count of deleted files
- * @param failed pointer to count of failed deletions
- * @return int 1 on success
- */
-int delete_file_versions(const char *full_path, int *deleted, int *failed);
-
 /**
  * @brief get file modification time
  *
@@ -41,6 +35,17 @@ int delete_file_versions(const char *full_path, int *deleted, int *failed);
  */
 time_t get_file_mtime(const char *filename);
 
+/**
+ * @brief identity of a stored file's contents, as GET and SIGNATURE report it
+ *
+ * A hash of the inode and the modification and change times, so a file
+ * edited in place, or a new file that reuses a freed inode, gets a new one.
+ *
+ * @param st the file's stat
+ * @return uint64_t identity, never 0
+ */
+uint64_t file_identity(const struct stat *st);
+
 /**
  * @brief format timestamp as readable string
  *
@@ -51,12 +56,62 @@ time_t get_file_mtime(const char *filename);
 void format_timestamp(time_t timestamp, char *buffer, size_t size);
 
 /**
- * @brief send a file over socket with locking
+ * @brief reserve disk blocks for a file that is about to be written
+ *
+ * Best effort: file systems without fallocate() support are left as they are.
+ *
+ * @param fd file descriptor open for writing
+ * @param size expected final size in bytes
+ */
+void preallocate_file(int fd, uint64_t size);
+
+/**
+ * @brief flush a file's contents to disk
+ *
+ * @param path path to the file
+ * @return int 0 on success, -1 on failure
+ */
+int sync_file(const char *path);
+
+/**
+ * @brief flush the directory holding a path, making renames in it durable
+ *
+ * @param path path of an entry in the directory
+ * @return int 0 on success, -1 on failure
+ */
+int sync_parent_dir(const char *path);
+
+/**
+ * @brief delete uploads a previous server run left unfinished
+ *
+ * Removes every hidden temp and part file under the storage root. Call it
+ * at startup only, before any upload can be in flight.
+ *
+ * @param root storage root
+ * @return int number of files removed, -1 if the root could not be scanned
+ */
+int remove_stale_uploads(const char *root);
+
+/**
+ * @brief open a stored file so that it can be sent as a reply body
  *
- * @param client_sock socket descriptor
  * @param filepath path to the file
- * @return long number of bytes sent, -1 on error
+ * @param size receives the file size
+ * @return int file descriptor, or -1 if the file cannot be opened
+ */
+int open_file_for_send(const char *filepath, uint64_t *size);
+
+/**
+ * @brief stat many entries of one directory
+ *
+ * Uses one io_uring submission per batch when that backend is enabled,
+ * fstatat() otherwise.
+ *
+ * @param dir_path directory the names are relative to
+ * @param names entry names
+ * @param out per-entry results (result is 0 or -errno)
+ * @param count number of entries
  */
-long send_file_with_lock(int client_sock, const char *filepath);
+void stat_dir_entries(const char *dir_path, char *const names[], EntryStat *out, size_t count);
 
-#endif // FILE_UTILS_H
\ No newline at end of file
+#endif // FILE_UTILS_H
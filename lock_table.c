@@ -0,0 +1,166 @@
+/*
+ * lock_table.c, Yehen Yan, CS5600 Practicum II
+ * Striped reader/writer locks on storage paths
+ * Last modified: Dec 2025
+ */
+#define _GNU_SOURCE // pthread_rwlockattr_setkind_np
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "lock_table.h"
+#include "config.h"
+
+// One stripe per cache line, so neighbouring stripes do not share one
+typedef struct
+{
+    pthread_rwlock_t lock;
+    uint64_t acquired;
+    uint64_t waits;
+    uint64_t wait_ns;
+} __attribute__((aligned(64))) Stripe;
+
+static Stripe *stripes;
+static size_t stripe_mask;
+
+int lock_table_init(size_t count, int workers)
+{
+    if (count == 0)
+    {
+        // Few workers hold locks at once; enough stripes that two of them
+        // rarely meet on one by chance
+        count = (size_t)(workers > 0 ? workers : 1) * LOCK_STRIPES_PER_WORKER;
+        if (count < LOCK_STRIPES_MIN)
+            count = LOCK_STRIPES_MIN;
+    }
+    size_t size = 1;
+    while (size < count)
+        size <<= 1;
+
+    stripes = aligned_alloc(64, size * sizeof(Stripe));
+    if (!stripes)
+    {
+        perror("Failed to allocate lock table");
+        return -1;
+    }
+    memset(stripes, 0, size * sizeof(Stripe));
+
+    // Writers go first, so a stream of GETs cannot hold off a publish
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    for (size_t i = 0; i < size; i++)
+        pthread_rwlock_init(&stripes[i].lock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+
+    stripe_mask = size - 1;
+    return 0;
+}
+
+size_t lock_table_size(void)
+{
+    return stripe_mask + 1;
+}
+
+uint64_t path_hash(const char *path)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (const unsigned char *p = (const unsigned char *)path; *p; p++)
+        h = (h ^ *p) * 1099511628211ULL;
+
+    // MurmurHash3 finalizer: every input bit affects the low bits used
+    // to pick a stripe
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static Stripe *stripe_of(const char *path)
+{
+    return &stripes[path_hash(path) & stripe_mask];
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// The clock is only read when the lock is contended
+static void count_wait(Stripe *s, uint64_t started)
+{
+    __atomic_fetch_add(&s->waits, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s->wait_ns, now_ns() - started, __ATOMIC_RELAXED);
+}
+
+void path_lock_shared(const char *path)
+{
+    Stripe *s = stripe_of(path);
+    if (pthread_rwlock_tryrdlock(&s->lock) != 0)
+    {
+        uint64_t started = now_ns();
+        pthread_rwlock_rdlock(&s->lock);
+        count_wait(s, started);
+    }
+    __atomic_fetch_add(&s->acquired, 1, __ATOMIC_RELAXED);
+}
+
+void path_lock_exclusive(const char *path)
+{
+    Stripe *s = stripe_of(path);
+    if (pthread_rwlock_trywrlock(&s->lock) != 0)
+    {
+        uint64_t started = now_ns();
+        pthread_rwlock_wrlock(&s->lock);
+        count_wait(s, started);
+    }
+    __atomic_fetch_add(&s->acquired, 1, __ATOMIC_RELAXED);
+}
+
+void path_unlock(const char *path)
+{
+    pthread_rwlock_unlock(&stripe_of(path)->lock);
+}
+
+size_t lock_table_stats(StripeStats *out, size_t max, StripeStats *total)
+{
+    size_t n = 0;
+    memset(total, 0, sizeof(*total));
+
+    for (size_t i = 0; i <= stripe_mask; i++)
+    {
+        StripeStats st;
+        st.stripe = i;
+        st.acquired = __atomic_load_n(&stripes[i].acquired, __ATOMIC_RELAXED);
+        st.waits = __atomic_load_n(&stripes[i].waits, __ATOMIC_RELAXED);
+        st.wait_ns = __atomic_load_n(&stripes[i].wait_ns, __ATOMIC_RELAXED);
+
+        total->acquired += st.acquired;
+        total->waits += st.waits;
+        total->wait_ns += st.wait_ns;
+        if (st.waits == 0 || max == 0)
+            continue;
+
+        // Insertion into the top-max list, longest wait first
+        size_t at;
+        if (n < max)
+            at = n++;
+        else if (out[max - 1].wait_ns >= st.wait_ns)
+            continue;
+        else
+            at = max - 1;
+        while (at > 0 && out[at - 1].wait_ns < st.wait_ns)
+        {
+            out[at] = out[at - 1];
+            at--;
+        }
+        out[at] = st;
+    }
+    return n;
+}
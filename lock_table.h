@@ -0,0 +1,87 @@
+/*
+ * lock_table.h, Yehen Yan, CS5600 Practicum II
+ * Striped reader/writer locks on storage paths
+ * Last modified: Dec 2025
+ */
+
+#ifndef LOCK_TABLE_H
+#define LOCK_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Every storage path maps to one of a power-of-two number of stripes by a
+ * 64-bit hash. Readers (GET, GETVERSION, LS, SIGNATURE) hold a stripe shared
+ * while they resolve and open what they send; writers (WRITE publish, RM)
+ * hold it exclusive. A stripe is never held across network I/O, and a
+ * thread holds at most one stripe at a time.
+ */
+
+// Wait counters of one stripe
+typedef struct
+{
+    size_t stripe;
+    uint64_t acquired; // locks taken
+    uint64_t waits;    // locks that had to wait
+    uint64_t wait_ns;  // total time spent waiting
+} StripeStats;
+
+/**
+ * @brief Create the lock table
+ *
+ * @param stripes number of stripes, rounded up to a power of two;
+ *                0 sizes the table from the worker count
+ * @param workers worker threads that may hold locks
+ * @return int 0 on success, -1 if out of memory
+ */
+int lock_table_init(size_t stripes, int workers);
+
+/**
+ * @brief Number of stripes in the table
+ */
+size_t lock_table_size(void);
+
+/**
+ * @brief 64-bit hash of a path
+ *
+ * FNV-1a with a final avalanche step, so paths that differ only in their
+ * last characters still spread over all stripes.
+ *
+ * @param path path to hash
+ * @return uint64_t hash
+ */
+uint64_t path_hash(const char *path);
+
+/**
+ * @brief Lock a path for reading
+ *
+ * @param path storage path
+ */
+void path_lock_shared(const char *path);
+
+/**
+ * @brief Lock a path for writing
+ *
+ * @param path storage path
+ */
+void path_lock_exclusive(const char *path);
+
+/**
+ * @brief Release a lock taken by path_lock_shared() or path_lock_exclusive()
+ *
+ * @param path storage path
+ */
+void path_unlock(const char *path);
+
+/**
+ * @brief Copy the counters of the stripes that waited longest
+ *
+ * @param out receives up to max stripes, longest total wait first
+ * @param max capacity of out
+ * @param total receives the counters summed over every stripe (stripe unset)
+ * @return size_t number of stripes written to out
+ */
+size_t lock_table_stats(StripeStats *out, size_t max, StripeStats *total);
+
+#endif // LOCK_TABLE_H
@@ -0,0 +1,392 @@
+/*
+ * meta_cache.c, Yehen Yan, CS5600 Practicum II
+ * In-memory cache of directory listings and file metadata
+ * Last modified: Dec 2025
+ */
+#define _POSIX_C_SOURCE 200809L // strdup
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "meta_cache.h"
+#include "path_utils.h"
+#include "lock_table.h"
+#include "config.h"
+
+// Change counters that tickets are checked against, by directory hash
+#define CHANGE_SLOTS 1024
+
+typedef struct CachedDir
+{
+    char path[512];
+    ListedEntry *entries; // ascending by name
+    size_t count;
+    size_t cap;
+    size_t bytes; // charged against the cap
+    struct CachedDir *hash_next;
+    struct CachedDir *newer;
+    struct CachedDir *older;
+} CachedDir;
+
+// Everything below is guarded by cache_lock
+static CachedDir *buckets[META_CACHE_BUCKETS];
+static CachedDir *newest;
+static CachedDir *oldest;
+static size_t cache_bytes;
+static size_t cache_max;
+static uint64_t changes[CHANGE_SLOTS];
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void meta_cache_init(size_t max_bytes)
+{
+    cache_max = max_bytes;
+}
+
+// Split "<dir>/<name>"; returns -1 for a path without a directory
+static int split_path(const char *path, char *dir, size_t size, const char **name)
+{
+    const char *slash = strrchr(path, '/');
+    if (!slash)
+        return -1;
+    snprintf(dir, size, "%.*s", (int)(slash - path), path);
+    *name = slash + 1;
+    return 0;
+}
+
+static size_t bucket_of(const char *dir_path)
+{
+    return (size_t)(path_hash(dir_path) % META_CACHE_BUCKETS);
+}
+
+static uint64_t *change_counter(const char *dir_path)
+{
+    return &changes[path_hash(dir_path) % CHANGE_SLOTS];
+}
+
+static void unlink_lru(CachedDir *d)
+{
+    if (d->newer)
+        d->newer->older = d->older;
+    else
+        newest = d->older;
+    if (d->older)
+        d->older->newer = d->newer;
+    else
+        oldest = d->newer;
+    d->newer = d->older = NULL;
+}
+
+static void push_newest(CachedDir *d)
+{
+    d->older = newest;
+    d->newer = NULL;
+    if (newest)
+        newest->newer = d;
+    newest = d;
+    if (!oldest)
+        oldest = d;
+}
+
+static CachedDir *find_dir(const char *dir_path)
+{
+    for (CachedDir *d = buckets[bucket_of(dir_path)]; d; d = d->hash_next)
+    {
+        if (strcmp(d->path, dir_path) == 0)
+            return d;
+    }
+    return NULL;
+}
+
+static void free_dir(CachedDir *d)
+{
+    CachedDir **link = &buckets[bucket_of(d->path)];
+    while (*link != d)
+        link = &(*link)->hash_next;
+    *link = d->hash_next;
+    unlink_lru(d);
+
+    cache_bytes -= d->bytes;
+    for (size_t i = 0; i < d->count; i++)
+        free(d->entries[i].name);
+    free(d->entries);
+    free(d);
+}
+
+// Evict least recently used directories, never the one just used
+static void enforce_cap(void)
+{
+    while (cache_bytes > cache_max && oldest && oldest != newest)
+        free_dir(oldest);
+}
+
+// Index of name, or where it would be inserted
+static size_t find_entry(const CachedDir *d, const char *name, int *found)
+{
+    size_t lo = 0, hi = d->count;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(d->entries[mid].name, name);
+        if (cmp == 0)
+        {
+            *found = 1;
+            return mid;
+        }
+        if (cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    *found = 0;
+    return lo;
+}
+
+static void set_entry(CachedDir *d, const char *name, const EntryStat *st)
+{
+    int found;
+    size_t i = find_entry(d, name, &found);
+
+    if (st->result != 0)
+    {
+        // Gone: drop the entry
+        if (found)
+        {
+            size_t freed = sizeof(ListedEntry) + strlen(d->entries[i].name) + 1;
+            free(d->entries[i].name);
+            memmove(&d->entries[i], &d->entries[i + 1], (d->count - i - 1) * sizeof(ListedEntry));
+            d->count--;
+            d->bytes -= freed;
+            cache_bytes -= freed;
+        }
+        return;
+    }
+
+    if (found)
+    {
+        d->entries[i].st = *st;
+        return;
+    }
+
+    if (d->count == d->cap)
+    {
+        size_t cap = d->cap ? d->cap * 2 : 16;
+        ListedEntry *grown = realloc(d->entries, cap * sizeof(ListedEntry));
+        if (!grown)
+        {
+            free_dir(d); // a listing missing an entry must not be served
+            return;
+        }
+        d->entries = grown;
+        d->cap = cap;
+    }
+    char *copy = strdup(name);
+    if (!copy)
+    {
+        free_dir(d);
+        return;
+    }
+
+    memmove(&d->entries[i + 1], &d->entries[i], (d->count - i) * sizeof(ListedEntry));
+    d->entries[i].name = copy;
+    d->entries[i].st = *st;
+    d->count++;
+    size_t added = sizeof(ListedEntry) + strlen(name) + 1;
+    d->bytes += added;
+    cache_bytes += added;
+}
+
+int meta_cache_page(const char *dir_path, const char *after, size_t max, ListedEntry **entries,
+                    size_t *count, int *more)
+{
+    if (cache_max == 0)
+        return -1;
+
+    pthread_mutex_lock(&cache_lock);
+    CachedDir *d = find_dir(dir_path);
+    if (!d)
+    {
+        pthread_mutex_unlock(&cache_lock);
+        return -1;
+    }
+    unlink_lru(d);
+    push_newest(d);
+
+    // The cursor need not still exist; the page starts at whatever sorts after it
+    int found;
+    size_t start = after[0] ? find_entry(d, after, &found) : 0;
+    if (after[0] && found)
+        start++;
+    size_t n = d->count - start;
+    if (max > 0 && n > max)
+        n = max;
+
+    int result = 0;
+    *entries = n ? malloc(n * sizeof(ListedEntry)) : NULL;
+    size_t copied = 0;
+    while (copied < n && *entries)
+    {
+        (*entries)[copied].name = strdup(d->entries[start + copied].name);
+        if (!(*entries)[copied].name)
+            break;
+        (*entries)[copied].st = d->entries[start + copied].st;
+        copied++;
+    }
+    *count = n;
+    *more = start + n < d->count;
+    if (copied != n)
+    {
+        listed_entries_free(*entries, copied);
+        *entries = NULL;
+        *count = 0;
+        result = -1;
+    }
+
+    pthread_mutex_unlock(&cache_lock);
+    return result;
+}
+
+void listed_entries_free(ListedEntry *entries, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        free(entries[i].name);
+    free(entries);
+}
+
+int meta_cache_stat(const char *path, EntryStat *out)
+{
+    char dir[512];
+    const char *name;
+    if (cache_max == 0 || split_path(path, dir, sizeof(dir), &name) != 0)
+        return -1;
+
+    pthread_mutex_lock(&cache_lock);
+    CachedDir *d = find_dir(dir);
+    int result = -1;
+    if (d)
+    {
+        int found;
+        size_t i = find_entry(d, name, &found);
+        if (found)
+        {
+            *out = d->entries[i].st;
+        }
+        else
+        {
+            memset(out, 0, sizeof(*out));
+            out->result = -ENOENT;
+        }
+        result = 0;
+    }
+    pthread_mutex_unlock(&cache_lock);
+    return result;
+}
+
+uint64_t meta_cache_begin(const char *dir_path)
+{
+    pthread_mutex_lock(&cache_lock);
+    uint64_t ticket = *change_counter(dir_path);
+    pthread_mutex_unlock(&cache_lock);
+    return ticket;
+}
+
+void meta_cache_store(const char *dir_path, uint64_t ticket, char *const names[],
+                      const EntryStat *stats, size_t count)
+{
+    if (cache_max == 0)
+        return;
+
+    CachedDir *d = calloc(1, sizeof(CachedDir));
+    ListedEntry *entries = count ? malloc(count * sizeof(ListedEntry)) : NULL;
+    if (!d || (count && !entries))
+    {
+        free(d);
+        free(entries);
+        return;
+    }
+
+    // Copied outside the lock; entries that could not be stat'ed are listed by name
+    snprintf(d->path, sizeof(d->path), "%s", dir_path);
+    d->bytes = sizeof(CachedDir);
+    size_t kept = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        entries[kept].name = strdup(names[i]);
+        if (!entries[kept].name)
+            continue;
+        entries[kept].st = stats[i];
+        d->bytes += sizeof(ListedEntry) + strlen(names[i]) + 1;
+        kept++;
+    }
+    d->entries = entries;
+    d->count = d->cap = kept;
+
+    pthread_mutex_lock(&cache_lock);
+    if (kept != count || d->bytes > cache_max || *change_counter(dir_path) != ticket)
+    {
+        pthread_mutex_unlock(&cache_lock);
+        for (size_t i = 0; i < kept; i++)
+            free(entries[i].name);
+        free(entries);
+        free(d);
+        return;
+    }
+
+    CachedDir *old = find_dir(dir_path);
+    if (old)
+        free_dir(old);
+
+    size_t b = bucket_of(dir_path);
+    d->hash_next = buckets[b];
+    buckets[b] = d;
+    push_newest(d);
+    cache_bytes += d->bytes;
+    enforce_cap();
+    pthread_mutex_unlock(&cache_lock);
+}
+
+static void stat_path(const char *path, EntryStat *out)
+{
+    struct stat st;
+    memset(out, 0, sizeof(*out));
+    if (stat(path, &st) != 0)
+    {
+        out->result = -errno;
+        return;
+    }
+    out->size = (int64_t)st.st_size;
+    out->mtime = st.st_mtime;
+    out->is_dir = S_ISDIR(st.st_mode);
+}
+
+// Caller holds cache_lock. Stats under the lock, so two refreshes of one
+// path cannot store their results in the wrong order.
+static void update_entry(const char *dir, const char *name, const char *path)
+{
+    (*change_counter(dir))++;
+    CachedDir *d = find_dir(dir);
+    if (d)
+    {
+        EntryStat st;
+        stat_path(path, &st);
+        set_entry(d, name, &st);
+    }
+}
+
+void meta_cache_refresh(const char *path)
+{
+    char dir[512], parent[512];
+    const char *name, *dir_name;
+    if (cache_max == 0 || split_path(path, dir, sizeof(dir), &name) != 0 ||
+        is_internal_name(name))
+        return;
+    int has_parent = split_path(dir, parent, sizeof(parent), &dir_name) == 0;
+
+    pthread_mutex_lock(&cache_lock);
+    update_entry(dir, name, path);
+    if (has_parent)
+        update_entry(parent, dir_name, dir);
+    pthread_mutex_unlock(&cache_lock);
+}
@@ -0,0 +1,107 @@
+/*
+ * meta_cache.h, Yehen Yan, CS5600 Practicum II
+ * In-memory cache of directory listings and file metadata
+ * Last modified: Dec 2025
+ */
+
+#ifndef META_CACHE_H
+#define META_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "uring.h"
+
+/*
+ * LS of a directory reads it once and keeps the size, mtime and type of
+ * every visible entry, sorted by name. Later LS requests for the directory,
+ * and for any file in it, are answered from memory, a page at a time.
+ *
+ * The server keeps the cache coherent itself: every code path that creates,
+ * replaces or deletes a visible file calls meta_cache_refresh(), which
+ * re-stats that one path. Changes made to the storage root behind the
+ * server's back are not seen until the directory is evicted. Directories
+ * are evicted least recently used first once the cache holds more than
+ * its memory cap.
+ */
+
+/**
+ * @brief Set the memory cap
+ *
+ * @param max_bytes bytes the cache may hold; 0 disables it
+ */
+void meta_cache_init(size_t max_bytes);
+
+// One entry of a directory listing
+typedef struct
+{
+    char *name;
+    EntryStat st;
+} ListedEntry;
+
+/**
+ * @brief Copy one page of a cached directory
+ *
+ * @param dir_path directory
+ * @param after the page starts with the first name that sorts after this
+ *              one ("" for the first page)
+ * @param max most entries to copy, 0 for all of them
+ * @param entries receives the entries in name order; free with listed_entries_free()
+ * @param count receives the number of entries
+ * @param more receives 1 if entries follow the page
+ * @return int 0 on a hit, -1 if the directory is not cached
+ */
+int meta_cache_page(const char *dir_path, const char *after, size_t max, ListedEntry **entries,
+                    size_t *count, int *more);
+
+/**
+ * @brief Free entries returned by meta_cache_page()
+ *
+ * @param entries entries, may be NULL
+ * @param count number of entries
+ */
+void listed_entries_free(ListedEntry *entries, size_t count);
+
+/**
+ * @brief Look a path up in its cached parent directory
+ *
+ * @param path file or directory
+ * @param out receives the entry; result is -ENOENT if the parent is cached
+ *            and has no such entry
+ * @return int 0 if the parent is cached, -1 otherwise
+ */
+int meta_cache_stat(const char *path, EntryStat *out);
+
+/**
+ * @brief Start reading a directory from disk
+ *
+ * @param dir_path directory
+ * @return uint64_t ticket for meta_cache_store()
+ */
+uint64_t meta_cache_begin(const char *dir_path);
+
+/**
+ * @brief Cache a directory read since meta_cache_begin()
+ *
+ * Ignored if anything in the directory changed since the ticket was taken,
+ * since the entries may predate the change.
+ *
+ * @param dir_path directory
+ * @param ticket from meta_cache_begin()
+ * @param names visible entry names, ascending
+ * @param stats per-entry results
+ * @param count number of entries
+ */
+void meta_cache_store(const char *dir_path, uint64_t ticket, char *const names[],
+                      const EntryStat *stats, size_t count);
+
+/**
+ * @brief Re-read one path after the server created, replaced or deleted it
+ *
+ * Also refreshes the entry of its directory in the directory above, whose
+ * mtime changed with it. Internal names are ignored.
+ *
+ * @param path file or directory that changed
+ */
+void meta_cache_refresh(const char *path);
+
+#endif // META_CACHE_H
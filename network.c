@@ -3,6 +3,8 @@
  * Network communication functions for remote file system
  * Last modified: Dec 2025
  */
+#define _GNU_SOURCE // splice, F_SETPIPE_SZ
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,6 +12,9 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/sendfile.h>
 #include "network.h"
 #include "config.h"
 
@@ -22,7 +27,8 @@ int send_all(int sock, const void *data, size_t len)
 
     while (total_sent < len)
     {
-        ssize_t sent = send(sock, ptr + total_sent, len - total_sent, 0);
+        // MSG_NOSIGNAL: a vanished peer is an error return, not a SIGPIPE
+        ssize_t sent = send(sock, ptr + total_sent, len - total_sent, MSG_NOSIGNAL);
         if (sent <= 0)
         {
             if (sent < 0)
@@ -57,62 +63,33 @@ int recv_all(int sock, void *buffer, size_t len)
     return 0;
 }
 
-// ========== STRING HELPERS ==========
-
-int recv_string(int sock, char *buffer, size_t max_len)
-{
-    int str_len;
-
-    // Receive length
-    if (recv_all(sock, &str_len, sizeof(int)) < 0)
-    {
-        fprintf(stderr, "Failed to receive string length\n");
-        return -1;
-    }
-
-    // Check bounds
-    if (str_len < 0 || (size_t)str_len >= max_len)
-    {
-        fprintf(stderr, "Invalid string length: %d (max: %zu)\n", str_len, max_len);
-        return -1;
-    }
-
-    // Receive string data
-    if (recv_all(sock, buffer, str_len) < 0)
-    {
-        fprintf(stderr, "Failed to receive string data\n");
-        return -1;
-    }
-
-    buffer[str_len] = '\0';
-    return str_len;
-}
-
 // ========== FILE DATA TRANSFER ==========
 
-long send_file_data(int sock, FILE *fp, long file_size)
+// Buffered fallback for send_fd_data: one copy into user space per chunk
+static int64_t send_fd_data_buffered(int sock, int fd, uint64_t offset, uint64_t len)
 {
     char buffer[BUFFER_SIZE];
-    long total_sent = 0;
-    size_t bytes_read;
+    uint64_t total_sent = 0;
 
-    while (total_sent < file_size)
+    while (total_sent < len)
     {
         size_t to_read = BUFFER_SIZE;
-        if (file_size - total_sent < BUFFER_SIZE)
+        if (len - total_sent < BUFFER_SIZE)
         {
-            to_read = file_size - total_sent;
+            to_read = len - total_sent;
         }
 
-        bytes_read = fread(buffer, 1, to_read, fp);
+        ssize_t bytes_read = pread(fd, buffer, to_read, (off_t)(offset + total_sent));
+        if (bytes_read < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("File read error");
+            return -1;
+        }
         if (bytes_read == 0)
         {
-            if (ferror(fp))
-            {
-                perror("File read error");
-                return -1;
-            }
-            break; // EOF
+            break; // EOF: file shrank
         }
 
         if (send_all(sock, buffer, bytes_read) < 0)
@@ -124,188 +101,430 @@ long send_file_data(int sock, FILE *fp, long file_size)
         total_sent += bytes_read;
     }
 
-    return total_sent;
+    return (int64_t)total_sent;
+}
+
+int64_t send_fd_data(int sock, int fd, uint64_t offset, uint64_t len)
+{
+    uint64_t total_sent = 0;
+    off_t pos = (off_t)offset;
+
+    while (total_sent < len)
+    {
+        size_t chunk = len - total_sent > SENDFILE_CHUNK ? SENDFILE_CHUNK : (size_t)(len - total_sent);
+        ssize_t sent = sendfile(sock, fd, &pos, chunk);
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            // Not supported for this fd pair: finish the rest the buffered way
+            if (errno == EINVAL || errno == ENOSYS)
+            {
+                int64_t rest = send_fd_data_buffered(sock, fd, offset + total_sent,
+                                                     len - total_sent);
+                return rest < 0 ? -1 : (int64_t)(total_sent + rest);
+            }
+
+            perror("sendfile failed");
+            return -1;
+        }
+        if (sent == 0)
+        {
+            break; // EOF: file shrank
+        }
+
+        total_sent += sent;
+    }
+
+    return (int64_t)total_sent;
 }
 
-long recv_file_data(int sock, FILE *fp, long file_size)
+// Buffered fallback for recv_fd_data: one copy out of the kernel per chunk
+static int64_t recv_fd_data_buffered(int sock, int fd, uint64_t offset, uint64_t len,
+                                     const RecvTap *tap)
 {
     char buffer[BUFFER_SIZE];
-    long total_received = 0;
-    ssize_t bytes_received;
+    uint64_t total_received = 0;
 
-    while (total_received < file_size)
+    while (total_received < len)
     {
         size_t to_receive = BUFFER_SIZE;
-        if (file_size - total_received < BUFFER_SIZE)
+        if (len - total_received < BUFFER_SIZE)
         {
-            to_receive = file_size - total_received;
+            to_receive = len - total_received;
         }
 
-        bytes_received = recv(sock, buffer, to_receive, 0);
+        ssize_t bytes_received = recv(sock, buffer, to_receive, 0);
         if (bytes_received <= 0)
         {
             if (bytes_received < 0)
             {
+                if (errno == EINTR)
+                    continue;
                 perror("recv failed");
             }
             return -1;
         }
 
-        size_t written = fwrite(buffer, 1, bytes_received, fp);
-        if (written != (size_t)bytes_received)
+        ssize_t written = pwrite(fd, buffer, bytes_received, (off_t)(offset + total_received));
+        if (written != bytes_received)
         {
             perror("File write error");
             return -1;
         }
+        if (tap)
+            tap->fn(tap->ctx, buffer, (size_t)bytes_received);
 
         total_received += bytes_received;
     }
 
-    return total_received;
+    return (int64_t)total_received;
 }
 
-// ========== EXISTING FUNCTIONS (keep as-is) ==========
+// Copy len bytes already sitting in a pipe into the file at *pos, showing
+// them to tap (if not NULL) once written. *pos advances past every byte written.
+static int drain_pipe_to_file(int pipe_rd, int fd, loff_t *pos, size_t len, const RecvTap *tap)
+{
+    char buffer[BUFFER_SIZE];
 
-int connect_to_server(const char *server_ip, int port)
+    while (len > 0)
+    {
+        ssize_t n = read(pipe_rd, buffer, len < sizeof(buffer) ? len : sizeof(buffer));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0 || pwrite(fd, buffer, n, (off_t)*pos) != n)
+        {
+            perror("File write error");
+            return -1;
+        }
+        if (tap)
+            tap->fn(tap->ctx, buffer, (size_t)n);
+        *pos += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Show the tap len bytes waiting in its own pipe
+static int drain_tap(const RecvTap *tap, size_t len)
 {
-    int sock;
-    struct sockaddr_in server_addr;
-    sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (sock < 0)
+    char buffer[BUFFER_SIZE];
+
+    while (len > 0)
     {
-        perror("Socket creation failed");
-        return -1;
+        ssize_t n = read(tap->pipefd[0], buffer, len < sizeof(buffer) ? len : sizeof(buffer));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            perror("Failed to read tapped data");
+            return -1;
+        }
+        tap->fn(tap->ctx, buffer, (size_t)n);
+        len -= n;
     }
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(port);
-    server_addr.sin_addr.s_addr = inet_addr(server_ip);
-    if (connect(sock, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
+    return 0;
+}
+
+// Move len bytes sitting in a pipe into the file at *pos, showing them to
+// tap (if not NULL) once written. The tap gets a tee(2) copy, so the file
+// side stays zero-copy; without a tap pipe the bytes are copied through
+// user space instead. *pos advances past every byte written.
+static int pipe_to_file(int pipe_rd, int fd, loff_t *pos, size_t len, const RecvTap *tap)
+{
+    while (len > 0)
     {
-        perror("Connection failed");
-        close(sock);
-        return -1;
+        size_t step = len;
+        if (tap)
+        {
+            ssize_t copied = tap->pipefd[1] >= 0 ? tee(pipe_rd, tap->pipefd[1], len, 0) : -1;
+            if (copied < 0 && errno == EINTR)
+                continue;
+            if (copied <= 0)
+                return drain_pipe_to_file(pipe_rd, fd, pos, len, tap);
+            step = (size_t)copied;
+        }
+
+        loff_t start = *pos;
+        size_t left = step;
+        int failed = 0;
+        while (left > 0 && !failed)
+        {
+            ssize_t out = splice(pipe_rd, NULL, fd, pos, left, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (out < 0 && errno == EINTR)
+                continue;
+            if (out < 0 && errno == EINVAL)
+            {
+                // File system cannot splice: copy what is in the pipe
+                failed = drain_pipe_to_file(pipe_rd, fd, pos, left, NULL) != 0;
+                break;
+            }
+            if (out <= 0)
+            {
+                perror("splice to file failed");
+                failed = 1;
+                break;
+            }
+            left -= out;
+        }
+
+        // The tap sees exactly the bytes that were written
+        if (tap && drain_tap(tap, (size_t)(*pos - start)) != 0)
+            return -1;
+        if (failed)
+            return -1;
+        len -= step;
     }
-    return sock;
+    return 0;
 }
 
-int send_operation(int sock, const char *operation)
+int64_t recv_fd_data(int sock, int fd, uint64_t offset, uint64_t len, RecvTapFn tap_fn,
+                     void *tap_ctx)
 {
-    int op_len = strlen(operation);
+    int pipefd[2];
+    if (len == 0)
+    {
+        return 0;
+    }
+
+    RecvTap tap = {tap_fn, tap_ctx, {-1, -1}};
+    const RecvTap *tapped = tap_fn ? &tap : NULL;
 
-    // Use send_all for reliability
-    if (send_all(sock, &op_len, sizeof(int)) < 0)
+    if (pipe(pipefd) != 0)
     {
-        fprintf(stderr, "Failed to send operation length\n");
-        return -1;
+        return recv_fd_data_buffered(sock, fd, offset, len, tapped);
     }
 
-    if (send_all(sock, operation, op_len) < 0)
+    // A larger pipe means fewer splice round trips per megabyte (best effort);
+    // the tap's pipe matches it so one tee(2) copies everything in flight
+    fcntl(pipefd[1], F_SETPIPE_SZ, SPLICE_PIPE_SIZE);
+    if (tapped && pipe(tap.pipefd) == 0)
+        fcntl(tap.pipefd[1], F_SETPIPE_SZ, SPLICE_PIPE_SIZE);
+
+    uint64_t total_received = 0;
+    loff_t pos = (loff_t)offset;
+
+    while (total_received < len)
     {
-        fprintf(stderr, "Failed to send operation\n");
-        return -1;
+        size_t chunk = len - total_received > SPLICE_PIPE_SIZE ? SPLICE_PIPE_SIZE
+                                                               : (size_t)(len - total_received);
+
+        // socket -> pipe
+        ssize_t in_pipe = splice(sock, NULL, pipefd[1], NULL, chunk, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (in_pipe < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            // Nothing is buffered in the pipe yet, so switching paths is safe
+            if (errno == EINVAL || errno == ENOSYS)
+            {
+                int64_t rest = recv_fd_data_buffered(sock, fd, offset + total_received,
+                                                     len - total_received, tapped);
+                total_received = rest < 0 ? 0 : total_received + rest;
+                break;
+            }
+
+            perror("splice from socket failed");
+            break;
+        }
+        if (in_pipe == 0)
+        {
+            break; // peer closed early
+        }
+
+        // pipe -> file, until the pipe is drained
+        if (pipe_to_file(pipefd[0], fd, &pos, (size_t)in_pipe, tapped) != 0)
+        {
+            total_received = 0;
+            break;
+        }
+        total_received += in_pipe;
     }
 
-    return 0;
+    close(pipefd[0]);
+    close(pipefd[1]);
+    if (tap.pipefd[0] >= 0)
+    {
+        close(tap.pipefd[0]);
+        close(tap.pipefd[1]);
+    }
+
+    return total_received == len ? (int64_t)total_received : -1;
 }
 
-int send_string(int sock, const char *str)
+int discard_data(int sock, uint64_t len)
 {
-    int len = strlen(str);
+    char buffer[BUFFER_SIZE];
 
-    // Use send_all for reliability
-    if (send_all(sock, &len, sizeof(int)) < 0)
+    while (len > 0)
     {
-        fprintf(stderr, "Failed to send string length\n");
-        return -1;
+        size_t chunk = len < BUFFER_SIZE ? (size_t)len : BUFFER_SIZE;
+        if (recv_all(sock, buffer, chunk) < 0)
+        {
+            return -1;
+        }
+        len -= chunk;
     }
+    return 0;
+}
 
-    if (send_all(sock, str, len) < 0)
+// ========== NON-BLOCKING STEPS (server reactor) ==========
+
+ssize_t recv_nb(int sock, void *buffer, size_t len)
+{
+    for (;;)
     {
-        fprintf(stderr, "Failed to send string\n");
+        ssize_t n = recv(sock, buffer, len, 0);
+        if (n >= 0)
+            return n;
+        if (errno == EINTR)
+            continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return NET_AGAIN;
         return -1;
     }
-
-    return 0;
 }
 
-long send_file(int sock, const char *filename)
+ssize_t send_nb(int sock, const void *data, size_t len)
 {
-    FILE *file = fopen(filename, "rb");
-    if (!file)
+    for (;;)
     {
-        perror("Failed to open file");
+        ssize_t n = send(sock, data, len, MSG_NOSIGNAL);
+        if (n >= 0)
+            return n;
+        if (errno == EINTR)
+            continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return NET_AGAIN;
         return -1;
     }
+}
 
-    // Get file size
-    fseek(file, 0, SEEK_END);
-    long file_size = ftell(file);
-    fseek(file, 0, SEEK_SET);
+ssize_t sendv_nb(int sock, const struct iovec *iov, int count)
+{
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = (struct iovec *)iov;
+    msg.msg_iovlen = (size_t)count;
 
-    // Send file size
-    if (send_all(sock, &file_size, sizeof(long)) < 0)
+    for (;;)
     {
-        fprintf(stderr, "Failed to send file size\n");
-        fclose(file);
+        ssize_t n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+        if (n >= 0)
+            return n;
+        if (errno == EINTR)
+            continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return NET_AGAIN;
         return -1;
     }
-
-    // Send file data using shared function
-    long bytes_sent = send_file_data(sock, file, file_size);
-    fclose(file);
-
-    return bytes_sent;
 }
 
-long receive_file(int sock, const char *filename)
+int64_t send_fd_nb(int sock, int fd, uint64_t *offset, uint64_t len)
 {
-    long file_size;
+    size_t chunk = len > SENDFILE_CHUNK ? SENDFILE_CHUNK : (size_t)len;
+    off_t pos = (off_t)*offset;
 
-    // Receive file size
-    if (recv_all(sock, &file_size, sizeof(long)) < 0)
+    ssize_t sent = sendfile(sock, fd, &pos, chunk);
+    if (sent >= 0)
     {
-        fprintf(stderr, "Failed to receive file size\n");
-        return -1;
+        *offset = (uint64_t)pos;
+        return sent;
     }
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+        return NET_AGAIN;
+    if (errno != EINVAL && errno != ENOSYS)
+        return -1;
 
-    if (file_size < 0)
+    // Buffered fallback: whatever the socket does not take is re-read next time
+    char buffer[BUFFER_SIZE];
+    ssize_t bytes_read = pread(fd, buffer, chunk < sizeof(buffer) ? chunk : sizeof(buffer),
+                               (off_t)*offset);
+    if (bytes_read <= 0)
+        return bytes_read < 0 ? -1 : 0;
+
+    ssize_t n = send_nb(sock, buffer, bytes_read);
+    if (n > 0)
+        *offset += n;
+    return n;
+}
+
+int64_t recv_fd_nb(int sock, const int pipefd[2], int fd, uint64_t *offset, uint64_t len,
+                   const RecvTap *tap)
+{
+    if (pipefd[0] < 0)
     {
-        fprintf(stderr, "File not found on server\n");
-        return -1;
+        char buffer[BUFFER_SIZE];
+        ssize_t n = recv_nb(sock, buffer, len < sizeof(buffer) ? len : sizeof(buffer));
+        if (n <= 0)
+            return n;
+        if (pwrite(fd, buffer, n, (off_t)*offset) != n)
+        {
+            perror("File write error");
+            return -1;
+        }
+        if (tap)
+            tap->fn(tap->ctx, buffer, (size_t)n);
+        *offset += n;
+        return n;
     }
 
-    // Open local file
-    FILE *file = fopen(filename, "wb");
-    if (!file)
+    size_t chunk = len > SPLICE_PIPE_SIZE ? SPLICE_PIPE_SIZE : (size_t)len;
+    ssize_t in_pipe = splice(sock, NULL, pipefd[1], NULL, chunk,
+                             SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (in_pipe < 0)
     {
-        perror("Failed to create local file");
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            return NET_AGAIN;
+        perror("splice from socket failed");
         return -1;
     }
+    if (in_pipe == 0)
+        return 0;
+
+    // Drain the pipe completely so it is empty for the next call. Bytes
+    // written before a failure still count, so *offset is kept exact.
+    loff_t pos = (loff_t)*offset;
+    int failed = pipe_to_file(pipefd[0], fd, &pos, (size_t)in_pipe, tap) != 0;
+    *offset = (uint64_t)pos;
+    return failed ? -1 : in_pipe;
+}
 
-    // Receive file data using shared function
-    long bytes_received = recv_file_data(sock, file, file_size);
-    fclose(file);
+// ========== CONNECTION SETUP ==========
 
-    if (bytes_received != file_size)
+int connect_to_server(const char *server_ip, int port)
+{
+    int sock;
+    struct sockaddr_in server_addr;
+    sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0)
     {
-        fprintf(stderr, "Incomplete file received: %ld/%ld bytes\n",
-                bytes_received, file_size);
-        remove(filename); // Clean up partial file
+        perror("Socket creation failed");
         return -1;
     }
-
-    return bytes_received;
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+    server_addr.sin_addr.s_addr = inet_addr(server_ip);
+    if (connect(sock, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
+    {
+        perror("Connection failed");
+        close(sock);
+        return -1;
+    }
+    return sock;
 }
 
-int receive_response(int sock, char *buffer, size_t buffer_size)
+int set_nonblocking(int fd)
 {
-    int bytes = recv(sock, buffer, buffer_size - 1, 0);
-    if (bytes > 0)
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
     {
-        buffer[bytes] = '\0';
-        return bytes;
+        perror("fcntl O_NONBLOCK failed");
+        return -1;
     }
-    return -1;
+    return 0;
 }
 
 int create_server_socket(const char *ip, int port)
@@ -353,8 +572,8 @@ int create_server_socket(const char *ip, int port)
         return -1;
     }
 
-    // Listen for connections (backlog of 5)
-    if (listen(socket_desc, 5) < 0)
+    // Listen for connections; a deep backlog absorbs connection storms
+    if (listen(socket_desc, LISTEN_BACKLOG) < 0)
     {
         perror("Listen failed");
         close(socket_desc);
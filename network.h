@@ -7,6 +7,9 @@
 #define NETWORK_H
 
 #include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
 
 /**
  * @brief Reliably send all data (handles partial sends)
@@ -26,81 +29,135 @@ int send_all(int sock, const void *data, size_t len);
  */
 int recv_all(int sock, void *buffer, size_t len);
 
+// Returned by the non-blocking helpers when the socket has no room or no data
+#define NET_AGAIN -2
+
 /**
- * @brief Create and connect socket to server
- * @param server_ip Server IP address
- * @param port Port number
- * @return int Socket file descriptor on success, -1 on failure
+ * @brief Receive whatever is available on a non-blocking socket
+ * @param sock Socket file descriptor
+ * @param buffer Buffer to store received data
+ * @param len Buffer size
+ * @return ssize_t Bytes received, 0 on EOF, NET_AGAIN if nothing is available, -1 on error
  */
-int connect_to_server(const char *server_ip, int port);
+ssize_t recv_nb(int sock, void *buffer, size_t len);
 
 /**
- * @brief Send operation type
+ * @brief Send as much as the non-blocking socket accepts
  * @param sock Socket file descriptor
- * @param operation Operation string
- * @return int 0 on success, -1 on failure
+ * @param data Data to send
+ * @param len Length of data
+ * @return ssize_t Bytes sent, NET_AGAIN if the socket is full, -1 on error
  */
-int send_operation(int sock, const char *operation);
+ssize_t send_nb(int sock, const void *data, size_t len);
 
 /**
- * @brief Send a string with length prefix
+ * @brief Send as much of several buffers as the non-blocking socket accepts
  * @param sock Socket file descriptor
- * @param str String to send
- * @return int 0 on success, -1 on failure
+ * @param iov Buffers, sent in order by one call
+ * @param count Number of buffers
+ * @return ssize_t Bytes sent, NET_AGAIN if the socket is full, -1 on error
  */
-int send_string(int sock, const char *str);
+ssize_t sendv_nb(int sock, const struct iovec *iov, int count);
 
 /**
- * @brief Receive a string with length prefix
- * @param sock Socket file descriptor
- * @param buffer Buffer to store received string
- * @param max_len Maximum buffer size
- * @return int Length of string received, -1 on failure
+ * @brief Non-blocking counterpart of send_fd_data: send part of a file range
+ *
+ * Advances *offset by the number of bytes sent. Uses sendfile(2), falling
+ * back to pread/send when unsupported (unsent bytes are simply re-read).
+ *
+ * @param sock Non-blocking socket
+ * @param fd Open file descriptor
+ * @param offset In/out file offset
+ * @param len Bytes left in the range
+ * @return int64_t Bytes sent (0 if the file ended early), NET_AGAIN, or -1 on error
  */
-int recv_string(int sock, char *buffer, size_t max_len);
+int64_t send_fd_nb(int sock, int fd, uint64_t *offset, uint64_t len);
+
+// Sees received bytes in order, each once it has been written to the file
+typedef void (*RecvTapFn)(void *ctx, const void *data, size_t len);
+
+// A tap on recv_fd_nb(): its pipe receives a tee(2) copy of the splice
+// pipe, so the bytes reach the file zero-copy and only the tap reads them
+typedef struct
+{
+    RecvTapFn fn;
+    void *ctx;
+    int pipefd[2]; // {-1, -1}: copy the bytes out of the splice pipe instead
+} RecvTap;
 
 /**
- * @brief Send file data from an open FILE pointer
- * @param sock Socket file descriptor
- * @param fp Open file pointer (must be positioned at start of data)
- * @param file_size Size of data to send
- * @return long Number of bytes sent, -1 on failure
+ * @brief Non-blocking counterpart of recv_fd_data: move available socket data into a file
+ *
+ * Splices socket -> pipe -> file. A pipe is passed in so that it can be
+ * reused across calls; pipefd[0] == -1 selects the buffered recv/pwrite path.
+ * Advances *offset by the number of bytes written, also when it fails.
+ *
+ * @param sock Non-blocking socket
+ * @param pipefd Pipe used for splicing, or {-1, -1}
+ * @param fd File descriptor open for writing
+ * @param offset In/out file offset
+ * @param len Bytes left to receive
+ * @param tap sees the written bytes, or NULL
+ * @return int64_t Bytes received, 0 on EOF, NET_AGAIN, or -1 on error
  */
-long send_file_data(int sock, FILE *fp, long file_size);
+int64_t recv_fd_nb(int sock, const int pipefd[2], int fd, uint64_t *offset, uint64_t len,
+                   const RecvTap *tap);
 
 /**
- * @brief Receive file data into an open FILE pointer
- * @param sock Socket file descriptor
- * @param fp Open file pointer for writing
- * @param file_size Size of data to receive
- * @return long Number of bytes received, -1 on failure
+ * @brief Create and connect socket to server
+ * @param server_ip Server IP address
+ * @param port Port number
+ * @return int Socket file descriptor on success, -1 on failure
  */
-long recv_file_data(int sock, FILE *fp, long file_size);
+int connect_to_server(const char *server_ip, int port);
 
 /**
- * @brief Send a file (opens file, sends size + data)
+ * @brief Send a byte range of an open file descriptor
+ *
+ * Uses sendfile(2) so the bytes go from the page cache to the socket without
+ * passing through user space. Falls back to a buffered pread/send loop when
+ * the file system or socket does not support sendfile.
+ *
  * @param sock Socket file descriptor
- * @param filename Name of the file to send
- * @return long Number of bytes sent, -1 on failure
+ * @param fd Open file descriptor (its file offset is not used or changed)
+ * @param offset Offset of the first byte to send
+ * @param len Number of bytes to send
+ * @return int64_t Number of bytes sent (short if the file shrank), -1 on failure
  */
-long send_file(int sock, const char *filename);
+int64_t send_fd_data(int sock, int fd, uint64_t offset, uint64_t len);
 
 /**
- * @brief Receive a file (receives size + data, creates file)
+ * @brief Receive a byte range from a socket into an open file descriptor
+ *
+ * Uses splice(2) through a pipe so the data moves from the socket buffer to
+ * the page cache without passing through user space. Falls back to a
+ * buffered recv/pwrite loop when splice is not supported for the pair.
+ *
  * @param sock Socket file descriptor
- * @param filename Name of the file to receive
- * @return long Number of bytes received, -1 on failure
+ * @param fd File descriptor open for writing (its file offset is not used)
+ * @param offset File offset where the first received byte is written
+ * @param len Number of bytes to receive
+ * @param tap_fn sees the written bytes (through a tee(2) copy), or NULL
+ * @param tap_ctx passed to tap_fn
+ * @return int64_t Number of bytes received, -1 on failure
  */
-long receive_file(int sock, const char *filename);
+int64_t recv_fd_data(int sock, int fd, uint64_t offset, uint64_t len, RecvTapFn tap_fn,
+                     void *tap_ctx);
 
 /**
- * @brief Receive a response
+ * @brief Read and throw away data the peer already sent (keeps a session in sync)
  * @param sock Socket file descriptor
- * @param buffer Buffer to store the received response
- * @param buffer_size Size of the buffer
- * @return int Number of bytes received, -1 on failure
+ * @param len Number of bytes to discard
+ * @return int 0 on success, -1 on failure
+ */
+int discard_data(int sock, uint64_t len);
+
+/**
+ * @brief Put a file descriptor into non-blocking mode
+ * @param fd File descriptor
+ * @return int 0 on success, -1 on failure
  */
-int receive_response(int sock, char *buffer, size_t buffer_size);
+int set_nonblocking(int fd);
 
 /**
  * @brief Create a server socket, bind it to the specified IP and port, and start listening
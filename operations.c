@@ -4,6 +4,8 @@
  * Last modified: Dec 2025
  */
 
+#define _POSIX_C_SOURCE 200809L // strdup
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -12,10 +14,36 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
 #include "operations.h"
+#include "client_cache.h"
+#include "checksum.h"
 #include "network.h"
+#include "protocol.h"
 #include "config.h"
 
+// Request ids only need to be unique per connection; a process-wide
+// counter keeps them unique across sessions too. Batch threads take
+// blocks of ids from it, so it is only touched atomically.
+static uint32_t next_request_id = 1;
+
+// Progress messages for successful operations (errors are always shown)
+static int verbose = 1;
+
+// Reserve n consecutive request ids and return the first
+static uint32_t reserve_request_ids(uint32_t n)
+{
+    return __atomic_fetch_add(&next_request_id, n, __ATOMIC_RELAXED);
+}
+
+void set_verbose(int enabled)
+{
+    verbose = enabled;
+}
+
 Operation parse_operation(const char *op_str)
 {
     if (strcmp(op_str, "WRITE") == 0)
@@ -30,6 +58,12 @@ Operation parse_operation(const char *op_str)
         return OP_LS;
     if (strcmp(op_str, "STOP") == 0)
         return OP_STOP;
+    if (strcmp(op_str, "STATS") == 0)
+        return OP_STATS;
+    if (strcmp(op_str, "SESSION") == 0)
+        return OP_SESSION;
+    if (strcmp(op_str, "BATCH") == 0)
+        return OP_BATCH;
     return OP_UNKNOWN;
 }
 
@@ -49,238 +83,982 @@ const char *operation_to_string(Operation op)
         return "LS";
     case OP_STOP:
         return "STOP";
+    case OP_STATS:
+        return "STATS";
+    case OP_SESSION:
+        return "SESSION";
+    case OP_BATCH:
+        return "BATCH";
+    case OP_BYE:
+        return "BYE";
+    case OP_UPLOAD_OPEN:
+        return "UPLOAD_OPEN";
+    case OP_UPLOAD_RANGE:
+        return "UPLOAD_RANGE";
+    case OP_UPLOAD_COMMIT:
+        return "UPLOAD_COMMIT";
+    case OP_UPLOAD_ABORT:
+        return "UPLOAD_ABORT";
+    case OP_UPLOAD_STATUS:
+        return "UPLOAD_STATUS";
+    case OP_SIGNATURE:
+        return "SIGNATURE";
+    case OP_DELTA_WRITE:
+        return "DELTA_WRITE";
+    case OP_DEDUP_WRITE:
+        return "DEDUP_WRITE";
+    case OP_MKDIRS:
+        return "MKDIRS";
     default:
         return "UNKNOWN";
     }
 }
 
-void write_file(char *local_file, char *remote_file)
+// ========== CONNECTION HANDLING ==========
+
+int session_open(void)
 {
-    char remote_path[256];
+    // Every protocol v2 connection is a session; nothing to negotiate
+    return connect_to_server(SERVER_IP, SERVER_PORT);
+}
+
+void session_close(int sock)
+{
+    if (sock < 0)
+        return;
+
+    FrameHeader bye;
+    memset(&bye, 0, sizeof(bye));
+    bye.opcode = OP_BYE;
+    bye.request_id = reserve_request_ids(1);
+    send_frame(sock, &bye, NULL, 0, 0);
+    close(sock);
+}
+
+// ========== REQUEST PREPARATION ==========
+
+static void init_request(RfsRequest *req, Operation op)
+{
+    memset(req, 0, sizeof(*req));
+    req->op = op;
+}
+
+// Copy a path into a request field, rejecting paths that would be truncated
+static int copy_path(char *dst, size_t size, const char *src)
+{
+    if (strlen(src) >= size)
+    {
+        fprintf(stderr, "Path too long: %s\n", src);
+        return -1;
+    }
+    strcpy(dst, src);
+    return 0;
+}
+
+int prepare_write(RfsRequest *req, const char *local_file, const char *remote_file)
+{
+    init_request(req, OP_WRITE);
+    req->result = -1;
+
+    if (copy_path(req->local_path, sizeof(req->local_path), local_file) < 0)
+        return -1;
 
     // Determine remote path to send
+    char *temp = strdup(local_file);
+    char *filename = basename(temp);
     if (remote_file == NULL)
     {
-        // Extract just the filename
-        char *temp = strdup(local_file);
-        char *filename = basename(temp);
-        strncpy(remote_path, filename, sizeof(remote_path) - 1);
-        remote_path[sizeof(remote_path) - 1] = '\0';
-        free(temp);
+        // Just the filename
+        snprintf(req->remote_path, sizeof(req->remote_path), "%s", filename);
     }
     else if (remote_file[strlen(remote_file) - 1] == '/')
     {
         // Trailing slash - append local filename
-        char *temp = strdup(local_file);
-        char *filename = basename(temp);
-        snprintf(remote_path, sizeof(remote_path), "%s%s", remote_file, filename);
-        free(temp);
+        snprintf(req->remote_path, sizeof(req->remote_path), "%s%s", remote_file, filename);
     }
     else
     {
         // Use as-is
-        strncpy(remote_path, remote_file, sizeof(remote_path) - 1);
-        remote_path[sizeof(remote_path) - 1] = '\0';
+        snprintf(req->remote_path, sizeof(req->remote_path), "%s", remote_file);
     }
+    free(temp);
 
-    printf("Writing '%s' to %s:%d as '%s'\n",
-           local_file, SERVER_IP, SERVER_PORT, remote_path);
-
-    int sock = connect_to_server(SERVER_IP, SERVER_PORT);
-    if (sock < 0)
-        return;
-
-    if (send_operation(sock, "WRITE") < 0)
+    struct stat st;
+    if (stat(local_file, &st) != 0 || !S_ISREG(st.st_mode))
     {
-        close(sock);
-        return;
+        fprintf(stderr, "Cannot read local file '%s'\n", local_file);
+        return -1;
     }
 
-    if (send_string(sock, remote_path) < 0)
+    req->file_size = (uint64_t)st.st_size;
+    req->result = 0;
+    return 0;
+}
+
+int prepare_get(RfsRequest *req, const char *remote_file, const char *local_file)
+{
+    init_request(req, OP_GET);
+    req->result = -1;
+
+    if (copy_path(req->remote_path, sizeof(req->remote_path), remote_file) < 0)
+        return -1;
+
+    // Determine what local path to use
+    if (local_file == NULL)
     {
-        close(sock);
-        return;
+        // Extract just the filename from remote path
+        char *temp = strdup(remote_file);
+        snprintf(req->local_path, sizeof(req->local_path), "%s", basename(temp));
+        free(temp);
     }
-
-    long bytes_sent = send_file(sock, local_file);
-    if (bytes_sent >= 0)
+    else if (copy_path(req->local_path, sizeof(req->local_path), local_file) < 0)
     {
-        printf("Sent %ld bytes to server\n", bytes_sent);
+        return -1;
     }
 
-    close(sock);
+    req->result = 0;
+    return 0;
 }
 
-void get_file(char *remote_file, char *local_file)
+int prepare_getversion(RfsRequest *req, const char *remote_file, int version_number,
+                       const char *local_file)
 {
-    char local_path[256];
+    if (prepare_get(req, remote_file, local_file) < 0)
+    {
+        req->op = OP_GETVERSION;
+        return -1;
+    }
 
-    // Determine what local path to use
+    req->op = OP_GETVERSION;
+    req->version_number = version_number;
+
+    // Default local filename: "<basename>.v<version>"
     if (local_file == NULL)
     {
-        // Extract just the filename from remote path
         char *temp = strdup(remote_file);
-        char *filename = basename(temp);
-        strncpy(local_path, filename, sizeof(local_path) - 1);
-        local_path[sizeof(local_path) - 1] = '\0';
+        snprintf(req->local_path, sizeof(req->local_path), "%s.v%d",
+                 basename(temp), version_number);
         free(temp);
     }
-    else
+
+    if (version_number <= 0)
     {
-        // Use the provided local path
-        strncpy(local_path, local_file, sizeof(local_path) - 1);
-        local_path[sizeof(local_path) - 1] = '\0';
+        fprintf(stderr, "Invalid version number: %d\n", version_number);
+        req->result = -1;
+        return -1;
     }
+    return 0;
+}
 
-    printf("Downloading '%s' from %s:%d to '%s'\n",
-           remote_file, SERVER_IP, SERVER_PORT, local_path);
+int prepare_simple(RfsRequest *req, Operation op, const char *remote_file)
+{
+    init_request(req, op);
 
-    int sock = connect_to_server(SERVER_IP, SERVER_PORT);
-    if (sock < 0)
+    if (op != OP_STOP && op != OP_STATS &&
+        copy_path(req->remote_path, sizeof(req->remote_path), remote_file) < 0)
+    {
+        req->result = -1;
+        return -1;
+    }
+    return 0;
+}
+
+// ========== REQUEST / REPLY ==========
+
+// Make a GET/GETVERSION conditional on the cached copy, if there is one
+static void add_cache_condition(MetaWriter *w, FrameHeader *hdr, const RfsRequest *req)
+{
+    CacheValidator v;
+    if (client_cache_lookup(req->remote_path, req->version_number, &v) != 0)
         return;
 
-    if (send_operation(sock, "GET") < 0)
+    hdr->flags |= RFS_FLAG_IF_CHANGED;
+    meta_put_u64(w, v.size);
+    meta_put_u64(w, v.tag);
+    meta_put_u32(w, v.crc32c);
+}
+
+// Checksums the server recorded for the file a GET/GETVERSION reply sends
+typedef struct
+{
+    uint8_t present; // RFS_DIGEST_* bits
+    uint32_t crc32c;
+    unsigned char sha256[SHA256_DIGEST_SIZE];
+} ReplyDigests;
+
+// Read the description of the file a GET/GETVERSION reply sends.
+// Returns 0 if the reply has one; d then holds its checksums.
+static int read_validator(MetaReader *r, CacheValidator *v, ReplyDigests *d)
+{
+    v->size = meta_get_u64(r);
+    v->tag = meta_get_u64(r);
+    d->present = meta_get_u8(r);
+    d->crc32c = meta_get_u32(r);
+    if (d->present & RFS_DIGEST_SHA256)
+        meta_get_bytes(r, d->sha256, SHA256_DIGEST_SIZE);
+    v->crc32c = (d->present & RFS_DIGEST_CRC32C) ? d->crc32c : 0;
+    if (r->error)
     {
-        close(sock);
-        return;
+        d->present = 0;
+        return -1;
     }
+    return 0;
+}
+
+// Send one request frame (and the file body for WRITE)
+static int send_request(int sock, RfsRequest *req)
+{
+    unsigned char meta[1024];
+    MetaWriter w;
+    meta_writer_init(&w, meta, sizeof(meta));
 
-    if (send_string(sock, remote_file) < 0)
+    FrameHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.opcode = req->op;
+    hdr.request_id = req->request_id;
+
+    uint64_t body_len = 0;
+    switch (req->op)
     {
-        close(sock);
-        return;
+    case OP_WRITE:
+        if (verbose)
+            printf("Writing '%s' to %s:%d as '%s'\n",
+                   req->local_path, SERVER_IP, SERVER_PORT, req->remote_path);
+        meta_put_str(&w, req->remote_path);
+        body_len = req->file_size;
+        break;
+
+    case OP_GET:
+        if (verbose)
+            printf("Downloading '%s' from %s:%d to '%s'\n",
+                   req->remote_path, SERVER_IP, SERVER_PORT, req->local_path);
+        meta_put_str(&w, req->remote_path);
+        add_cache_condition(&w, &hdr, req);
+        break;
+
+    case OP_GETVERSION:
+        if (verbose)
+            printf("Requesting version %d of '%s' from %s:%d, saving to '%s'\n",
+                   req->version_number, req->remote_path, SERVER_IP, SERVER_PORT,
+                   req->local_path);
+        meta_put_str(&w, req->remote_path);
+        meta_put_u32(&w, (uint32_t)req->version_number);
+        add_cache_condition(&w, &hdr, req);
+        break;
+
+    case OP_RM:
+        meta_put_str(&w, req->remote_path);
+        break;
+
+    case OP_LS:
+        meta_put_str(&w, req->remote_path);
+        if (req->page_size > 0)
+        {
+            hdr.flags |= RFS_FLAG_PAGED;
+            meta_put_u32(&w, req->page_size);
+            meta_put_str(&w, req->cursor);
+        }
+        break;
+
+    default:
+        break;
     }
 
-    long bytes_received = receive_file(sock, local_path);
-    if (bytes_received >= 0)
+    if (send_frame(sock, &hdr, meta, w.len, body_len) < 0)
     {
-        printf("Received %ld bytes, saved to '%s'\n", bytes_received, local_path);
+        return -1;
     }
 
-    close(sock);
+    if (req->op == OP_WRITE)
+    {
+        int fd = open(req->local_path, O_RDONLY);
+        if (fd < 0)
+        {
+            perror("Failed to open file");
+            return -1;
+        }
+
+        // The frame announced file_size bytes; anything else breaks the stream
+        int64_t sent = send_fd_data(sock, fd, 0, body_len);
+        close(fd);
+        if (sent != (int64_t)body_len)
+        {
+            fprintf(stderr, "'%s' changed while sending (%lld/%llu bytes)\n",
+                    req->local_path, (long long)sent, (unsigned long long)body_len);
+            return -1;
+        }
+    }
+
+    return 0;
 }
 
-void get_version(char *remote_file, int version_number, char *local_file)
+// Print (part of) an error reply body and discard the rest
+static int report_error_reply(int sock, RfsRequest *req, const FrameHeader *hdr)
 {
-    char local_path[256];
-    char request[512];
+    char message[512];
+    uint64_t body_len = frame_body_len(hdr);
+    size_t take = body_len < sizeof(message) - 1 ? (size_t)body_len : sizeof(message) - 1;
+
+    if (recv_all(sock, message, take) < 0 || discard_data(sock, body_len - take) < 0)
+    {
+        return -1;
+    }
+    message[take] = '\0';
 
-    // Build request: "filename:version_number"
-    snprintf(request, sizeof(request), "%s:%d", remote_file, version_number);
+    fprintf(stderr, "✗ %s '%s' failed: %s%s%s\n", operation_to_string(req->op),
+            req->remote_path, status_to_string(hdr->status),
+            take > 0 ? ": " : "", message);
+    return 0;
+}
 
-    // Determine local filename
-    if (local_file == NULL)
+static void digest_tap(void *ctx, const void *data, size_t len)
+{
+    content_digest_update((ContentDigest *)ctx, data, len);
+}
+
+// Compare a received body with the checksums the server recorded.
+// Returns 0 if it matches or there is nothing to check against.
+static int verify_body(const RfsRequest *req, const ReplyDigests *expected, ContentDigest *digest)
+{
+    unsigned char sha[SHA256_DIGEST_SIZE];
+    if (digest->strong)
+        sha256_final(&digest->sha256, sha);
+
+    if (((expected->present & RFS_DIGEST_CRC32C) && digest->crc32c != expected->crc32c) ||
+        (digest->strong && memcmp(sha, expected->sha256, SHA256_DIGEST_SIZE) != 0))
     {
-        char *temp = strdup(remote_file);
-        char *filename = basename(temp);
-        snprintf(local_path, sizeof(local_path), "%s.v%d", filename, version_number);
-        free(temp);
-        local_file = local_path;
+        fprintf(stderr, "✗ %s '%s' failed: checksum mismatch (CRC32C %08x, expected %08x)\n",
+                operation_to_string(req->op), req->remote_path, digest->crc32c,
+                expected->crc32c);
+        return -1;
     }
+    return 0;
+}
 
-    printf("Requesting version %d of '%s' from %s:%d, saving to '%s'\n",
-           version_number, remote_file, SERVER_IP, SERVER_PORT, local_file);
+// Save a GET/GETVERSION body to the request's local path, checksumming it
+// as it lands
+static int receive_body_to_file(int sock, RfsRequest *req, uint64_t body_len,
+                                const ReplyDigests *expected)
+{
+    int fd = open(req->local_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        perror("Failed to create local file");
+        req->result = -1;
+        return discard_data(sock, body_len);
+    }
 
-    int sock = connect_to_server(SERVER_IP, SERVER_PORT);
-    if (sock < 0)
-        return;
+    ContentDigest digest;
+    content_digest_init(&digest, (expected->present & RFS_DIGEST_SHA256) != 0);
+    int64_t received = recv_fd_data(sock, fd, 0, body_len, digest_tap, &digest);
+    close(fd);
 
-    if (send_operation(sock, "GETVERSION") < 0)
+    if (received != (int64_t)body_len)
     {
-        close(sock);
-        return;
+        fprintf(stderr, "Incomplete file received: %lld/%llu bytes\n",
+                (long long)received, (unsigned long long)body_len);
+        remove(req->local_path); // Clean up partial file
+        req->result = -1;
+        return -1;
     }
 
-    // Send request (filename:version)
-    if (send_string(sock, request) < 0)
+    // The whole body was read, so the connection is still usable
+    if (verify_body(req, expected, &digest) != 0)
     {
-        close(sock);
+        remove(req->local_path);
+        req->result = -1;
+        return 0;
+    }
+
+    req->bytes = received;
+    if (!verbose)
+    {
+        return 0;
+    }
+    if (req->op == OP_GETVERSION)
+    {
+        printf("✓ Received version %d: %lld bytes, saved to '%s'\n",
+               req->version_number, (long long)received, req->local_path);
+    }
+    else
+    {
+        printf("Received %lld bytes, saved to '%s'\n", (long long)received, req->local_path);
+    }
+    return 0;
+}
+
+// Complete a GET/GETVERSION the server answered RFS_NOT_MODIFIED
+static void restore_from_cache(RfsRequest *req)
+{
+    int64_t copied = client_cache_restore(req->remote_path, req->version_number, req->local_path);
+    if (copied < 0)
+    {
+        // Only if the cache changed since the request was sent; a retry downloads it
+        fprintf(stderr, "✗ %s '%s' failed: cached copy is gone, run it again\n",
+                operation_to_string(req->op), req->remote_path);
+        req->result = -1;
         return;
     }
 
-    long bytes_received = receive_file(sock, local_file);
-    if (bytes_received >= 0)
+    // Nothing came over the network
+    req->bytes = 0;
+    if (verbose)
+        printf("Not modified; copied %lld cached bytes to '%s'\n", (long long)copied,
+               req->local_path);
+}
+
+// Print a text body to stdout as it arrives
+static int print_text_body(int sock, uint64_t body_len)
+{
+    char buffer[BUFFER_SIZE];
+
+    while (body_len > 0)
+    {
+        size_t chunk = body_len < sizeof(buffer) - 1 ? (size_t)body_len : sizeof(buffer) - 1;
+        if (recv_all(sock, buffer, chunk) < 0)
+        {
+            return -1;
+        }
+        buffer[chunk] = '\0';
+        printf("%s", buffer);
+        body_len -= chunk;
+    }
+    return 0;
+}
+
+// Render the version listing of a file: the file, then its versions
+static int print_versions(int sock, uint64_t body_len, uint32_t count, const char *remote_path)
+{
+    unsigned char *body = body_len ? malloc((size_t)body_len) : NULL;
+    if (body_len && !body)
+    {
+        perror("Failed to allocate listing");
+        return discard_data(sock, body_len);
+    }
+    if (recv_all(sock, body, (size_t)body_len) < 0)
+    {
+        free(body);
+        return -1;
+    }
+
+    // Version files sit next to the file
+    const char *slash = strrchr(remote_path, '/');
+    int dir_len = slash ? (int)(slash - remote_path + 1) : 0;
+
+    MetaReader r;
+    meta_reader_init(&r, body, (size_t)body_len);
+    uint32_t versions = 0;
+    for (uint32_t i = 0; i < count; i++)
     {
-        printf("✓ Received version %d: %ld bytes, saved to '%s'\n",
-               version_number, bytes_received, local_file);
+        char name[256], time_str[64];
+        unsigned char sha256[SHA256_DIGEST_SIZE];
+        uint8_t type = meta_get_u8(&r);
+        uint32_t id = meta_get_u32(&r);
+        uint64_t size = meta_get_u64(&r);
+        time_t when = (time_t)(int64_t)meta_get_u64(&r);
+        uint8_t digests = meta_get_u8(&r);
+        uint32_t crc = meta_get_u32(&r);
+        if (digests & RFS_DIGEST_SHA256)
+            meta_get_bytes(&r, sha256, sizeof(sha256));
+        uint8_t stored = meta_get_u8(&r);
+        uint64_t stored_len = meta_get_u64(&r);
+        uint32_t pack = meta_get_u32(&r);
+        if (meta_get_str(&r, name, sizeof(name)) < 0)
+        {
+            fprintf(stderr, "Malformed listing from server\n");
+            break;
+        }
+
+        struct tm tm_info;
+        localtime_r(&when, &tm_info);
+        strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", &tm_info);
+        if (type == RFS_ENTRY_VERSION)
+        {
+            printf("[VERSION %u] %.*s%s\n  Size: %llu bytes\n  Written: %s\n", id, dir_len,
+                   remote_path, name, (unsigned long long)size, time_str);
+            versions++;
+        }
+        else
+        {
+            printf("[CURRENT] %s\n  Size: %llu bytes\n  Last Modified: %s\n", name,
+                   (unsigned long long)size, time_str);
+        }
+
+        // Sizes are of the contents; a compressed version also shows its footprint
+        if (stored & RFS_STORED_PACK)
+            printf("  Stored: %llu bytes (%spack segment %u)\n", (unsigned long long)stored_len,
+                   (stored & RFS_STORED_ZLIB) ? "zlib, " : "", pack);
+        else if (stored & RFS_STORED_ZLIB)
+            printf("  Stored: %llu bytes (zlib)\n", (unsigned long long)stored_len);
+        if (digests & RFS_DIGEST_CRC32C)
+            printf("  CRC32C: %08x\n", crc);
+        if (digests & RFS_DIGEST_SHA256)
+        {
+            char hex[SHA256_HEX_SIZE];
+            sha256_hex(sha256, hex);
+            printf("  SHA-256: %s\n", hex);
+        }
+        printf("\n");
     }
+
+    if (versions == 0)
+        printf("(No previous versions)\n");
     else
+        printf("Total: 1 current + %u version(s)\n", versions);
+    free(body);
+    return 0;
+}
+
+// Render the directory records of an LS reply, one line per entry
+static int print_entries(int sock, uint64_t body_len, uint32_t count)
+{
+    unsigned char *body = body_len ? malloc((size_t)body_len) : NULL;
+    if (body_len && !body)
     {
-        fprintf(stderr, "✗ Version %d not found or failed to retrieve\n", version_number);
+        perror("Failed to allocate listing");
+        return discard_data(sock, body_len);
+    }
+    if (recv_all(sock, body, (size_t)body_len) < 0)
+    {
+        free(body);
+        return -1;
     }
 
-    close(sock);
+    MetaReader r;
+    meta_reader_init(&r, body, (size_t)body_len);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        char name[256], time_str[64];
+        uint8_t type = meta_get_u8(&r);
+        uint64_t size = meta_get_u64(&r);
+        time_t mtime = (time_t)(int64_t)meta_get_u64(&r);
+        uint32_t versions = meta_get_u32(&r);
+        if (meta_get_str(&r, name, sizeof(name)) < 0)
+        {
+            fprintf(stderr, "Malformed listing from server\n");
+            break;
+        }
+
+        struct tm tm_info;
+        localtime_r(&mtime, &tm_info);
+        strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", &tm_info);
+        if (type == RFS_ENTRY_DIR)
+            printf("%s/  %16s  %s\n", name, "directory", time_str);
+        else if (type == RFS_ENTRY_FILE && versions > 0)
+            printf("%s  %10llu bytes  %s  %u version(s)\n", name, (unsigned long long)size,
+                   time_str, versions);
+        else if (type == RFS_ENTRY_FILE)
+            printf("%s  %10llu bytes  %s\n", name, (unsigned long long)size, time_str);
+        else if (type == RFS_ENTRY_VERSION)
+            printf("%s  %10llu bytes  %s  (version)\n", name, (unsigned long long)size,
+                   time_str);
+        else
+            printf("%s\n", name);
+    }
+    free(body);
+    return 0;
 }
 
-void remove_file(char *remote_file)
+/*
+ * Read one reply and complete the request it answers. Request ids in reqs
+ * are consecutive, so the id maps straight to an index.
+ * Returns 0 if the connection is still usable, -1 otherwise.
+ */
+static int handle_reply(int sock, RfsRequest *reqs, size_t count)
 {
-    int sock = connect_to_server(SERVER_IP, SERVER_PORT);
-    if (sock < 0)
-        return;
+    unsigned char meta[RFS_MAX_META];
+    FrameHeader hdr;
 
-    if (send_operation(sock, "RM") < 0)
+    if (recv_frame(sock, &hdr, meta, sizeof(meta)) < 0)
     {
-        close(sock);
-        return;
+        fprintf(stderr, "Connection to server lost\n");
+        return -1;
     }
 
-    if (send_string(sock, remote_file) < 0)
+    // Id 0: the server refused the whole connection (e.g. it is at capacity)
+    if (hdr.request_id == 0 && hdr.status != RFS_OK)
     {
-        close(sock);
-        return;
+        char message[256];
+        uint64_t body_len = frame_body_len(&hdr);
+        size_t take = body_len < sizeof(message) - 1 ? (size_t)body_len : sizeof(message) - 1;
+        if (recv_all(sock, message, take) < 0)
+            take = 0;
+        message[take] = '\0';
+        fprintf(stderr, "✗ Server refused connection: %s%s%s\n", status_to_string(hdr.status),
+                take > 0 ? ": " : "", message);
+        return -1;
     }
 
-    char response[256];
-    if (receive_response(sock, response, sizeof(response)) > 0)
+    uint32_t index = hdr.request_id - reqs[0].request_id;
+    if (index >= count || reqs[index].request_id != hdr.request_id)
     {
-        printf("%s\n", response);
+        fprintf(stderr, "Reply for unknown request id %u\n", hdr.request_id);
+        return -1;
     }
 
-    close(sock);
+    RfsRequest *req = &reqs[index];
+    uint64_t body_len = frame_body_len(&hdr);
+    MetaReader r;
+    meta_reader_init(&r, meta, hdr.meta_len);
+
+    if (hdr.status == RFS_NOT_MODIFIED && (req->op == OP_GET || req->op == OP_GETVERSION))
+    {
+        req->result = 0;
+        restore_from_cache(req);
+        return discard_data(sock, body_len);
+    }
+
+    if (hdr.status != RFS_OK)
+    {
+        req->result = -1;
+        return report_error_reply(sock, req, &hdr);
+    }
+
+    req->result = 0;
+    switch (req->op)
+    {
+    case OP_WRITE:
+        req->bytes = (int64_t)meta_get_u64(&r);
+        if (verbose)
+            printf("Sent %lld bytes to server as '%s'\n", (long long)req->bytes, req->remote_path);
+        return discard_data(sock, body_len);
+
+    case OP_GET:
+    case OP_GETVERSION:
+    {
+        // Keep a verified copy, so that the next request for it can be conditional
+        CacheValidator v;
+        ReplyDigests digests;
+        int described = read_validator(&r, &v, &digests) == 0;
+        int rc = receive_body_to_file(sock, req, body_len, &digests);
+        if (rc == 0 && req->result == 0 && described)
+            client_cache_store(req->remote_path, req->version_number, req->local_path, &v);
+        return rc;
+    }
+
+    case OP_RM:
+    {
+        uint32_t deleted = meta_get_u32(&r);
+        uint32_t failed = meta_get_u32(&r);
+        if (verbose)
+            printf("Successfully deleted %u file(s) (main file + %u version(s))\n",
+                   deleted, deleted > 0 ? deleted - 1 : 0);
+        if (failed > 0)
+        {
+            fprintf(stderr, "Warning: Failed to delete %u file(s)\n", failed);
+            req->result = -1;
+        }
+        return discard_data(sock, body_len);
+    }
+
+    case OP_LS:
+    {
+        // A file lists itself and its versions; a directory comes in pages
+        uint8_t format = meta_get_u8(&r);
+        if (format == RFS_LS_VERSIONS)
+        {
+            uint32_t records = meta_get_u32(&r);
+            if (r.error)
+            {
+                fprintf(stderr, "Malformed listing from server\n");
+                req->result = -1;
+                return discard_data(sock, body_len);
+            }
+            return print_versions(sock, body_len, records, req->remote_path);
+        }
+
+        uint32_t entries = meta_get_u32(&r);
+        int more = meta_get_u8(&r);
+        meta_get_str(&r, req->cursor, sizeof(req->cursor));
+        if (r.error)
+        {
+            fprintf(stderr, "Malformed listing from server\n");
+            req->result = -1;
+            return discard_data(sock, body_len);
+        }
+
+        int rc = print_entries(sock, body_len, entries);
+        if (rc == 0 && more && req->page_size > 0)
+            req->result = 1; // pending until the last page arrives
+        return rc;
+    }
+
+    case OP_STATS:
+        return print_text_body(sock, body_len);
+
+    case OP_STOP:
+        printf("Server stop signal sent\n");
+        return discard_data(sock, body_len);
+
+    default:
+        return discard_data(sock, body_len);
+    }
 }
 
-void list_directory(char *remote_dir)
+typedef struct
 {
-    int sock = connect_to_server(SERVER_IP, SERVER_PORT);
-    if (sock < 0)
-        return;
+    int sock;
+    RfsRequest *reqs;
+    size_t count;
+} sender_args_t;
+
+// Sender half of a pipeline: write every prepared request without waiting
+static void *pipeline_sender(void *arg)
+{
+    sender_args_t *args = (sender_args_t *)arg;
 
-    if (send_operation(sock, "LS") < 0)
+    for (size_t i = 0; i < args->count; i++)
     {
-        close(sock);
-        return;
+        if (args->reqs[i].result != 1)
+            continue; // preparation failed
+
+        if (send_request(args->sock, &args->reqs[i]) < 0)
+        {
+            // Stream is broken; no more requests follow. The reader still
+            // collects what the server sent before it hung up.
+            shutdown(args->sock, SHUT_WR);
+            break;
+        }
     }
+    return NULL;
+}
+
+int run_requests(int sock, RfsRequest *reqs, size_t count)
+{
+    int own = 0;
+    size_t expected = 0;
+
+    if (count == 0)
+        return 0;
+
+    // Consecutive ids let handle_reply map a reply back by index
+    uint32_t first_id = reserve_request_ids((uint32_t)count);
+    for (size_t i = 0; i < count; i++)
+    {
+        reqs[i].request_id = first_id + (uint32_t)i;
+        if (reqs[i].result == 0)
+            expected++;
+    }
+
+    // Only a request sent on its own can go back for the next page; a
+    // pipelined LS gets the whole directory in one reply
+    for (size_t i = 0; i < count; i++)
+    {
+        if (reqs[i].op == OP_LS)
+            reqs[i].page_size = expected == 1 ? LS_PAGE_SIZE : 0;
+    }
+
+    if (expected > 0 && sock < 0)
+    {
+        sock = connect_to_server(SERVER_IP, SERVER_PORT);
+        if (sock < 0)
+            return -1;
+        own = 1;
+    }
+
+    // Pending until a reply arrives
+    for (size_t i = 0; i < count; i++)
+    {
+        if (reqs[i].result == 0)
+            reqs[i].result = 1;
+    }
+
+    if (expected == 1)
+    {
+        // Nothing to overlap with; send and wait inline
+        for (size_t i = 0; i < count; i++)
+        {
+            if (reqs[i].result != 1)
+                continue;
 
-    if (send_string(sock, remote_dir) < 0)
+            // Read a reply even if sending failed: a server that refused
+            // the connection says why before it hangs up. A paged LS is
+            // sent again with its cursor until the last page arrives.
+            do
+            {
+                if (send_request(sock, &reqs[i]) < 0)
+                    shutdown(sock, SHUT_WR);
+            } while (handle_reply(sock, reqs, count) == 0 && reqs[i].result == 1);
+        }
+    }
+    else if (expected > 1)
     {
+        sender_args_t args = {sock, reqs, count};
+        pthread_t sender;
+        if (pthread_create(&sender, NULL, pipeline_sender, &args) != 0)
+        {
+            perror("Failed to create sender thread");
+        }
+        else
+        {
+            for (size_t done = 0; done < expected; done++)
+            {
+                if (handle_reply(sock, reqs, count) < 0)
+                    break;
+            }
+            pthread_join(sender, NULL);
+        }
+    }
+
+    if (own)
         close(sock);
-        return;
+
+    int failures = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (reqs[i].result != 0)
+        {
+            reqs[i].result = -1; // never answered
+            failures++;
+        }
     }
+    return failures;
+}
+
+// ========== BATCH ==========
 
-    char buffer[4096];
-    int bytes;
-    while ((bytes = recv(sock, buffer, sizeof(buffer) - 1, 0)) > 0)
+typedef struct
+{
+    RfsRequest *reqs;
+    size_t count;
+    size_t next; // first request not yet claimed, guarded by lock
+    pthread_mutex_t lock;
+} batch_t;
+
+// Claim the next chunk of requests; returns its size, 0 when none are left
+static size_t claim_chunk(batch_t *batch, size_t *start)
+{
+    pthread_mutex_lock(&batch->lock);
+    *start = batch->next;
+    size_t n = batch->count - batch->next;
+    if (n > BATCH_CHUNK)
+        n = BATCH_CHUNK;
+    batch->next += n;
+    pthread_mutex_unlock(&batch->lock);
+    return n;
+}
+
+// One batch connection: keep pulling chunks and pipelining them
+static void *batch_worker(void *arg)
+{
+    batch_t *batch = (batch_t *)arg;
+    int sock = -1;
+    size_t start, n;
+
+    while ((n = claim_chunk(batch, &start)) > 0)
     {
-        buffer[bytes] = '\0';
-        printf("%s", buffer);
+        if (sock < 0)
+        {
+            sock = session_open();
+            if (sock < 0)
+            {
+                for (size_t i = start; i < start + n; i++)
+                    batch->reqs[i].result = -1;
+                continue;
+            }
+        }
+
+        // After failures the stream may be broken; start the next chunk on
+        // a fresh connection rather than find out the hard way
+        if (run_requests(sock, batch->reqs + start, n) != 0)
+        {
+            close(sock);
+            sock = -1;
+        }
     }
 
-    close(sock);
+    session_close(sock);
+    return NULL;
 }
 
-void stop_server(void)
+int run_batch(RfsRequest *reqs, size_t count, int connections)
 {
-    int sock = connect_to_server(SERVER_IP, SERVER_PORT);
-    if (sock < 0)
-        return;
+    if (connections < 1)
+        connections = 1;
+    if ((size_t)connections > (count + BATCH_CHUNK - 1) / BATCH_CHUNK)
+        connections = (int)((count + BATCH_CHUNK - 1) / BATCH_CHUNK);
+
+    batch_t batch;
+    batch.reqs = reqs;
+    batch.count = count;
+    batch.next = 0;
+    pthread_mutex_init(&batch.lock, NULL);
 
-    if (send_operation(sock, "STOP") < 0)
+    pthread_t *threads = malloc(connections * sizeof(pthread_t));
+    int started = 0;
+    for (int i = 0; threads && i < connections; i++)
     {
-        close(sock);
-        return;
+        if (pthread_create(&threads[started], NULL, batch_worker, &batch) != 0)
+        {
+            perror("Failed to create batch thread");
+            break;
+        }
+        started++;
     }
 
-    printf("Server stop signal sent\n");
+    // With no threads at all, run everything on this one
+    if (started == 0)
+        batch_worker(&batch);
 
-    close(sock);
-}
\ No newline at end of file
+    for (int i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+    free(threads);
+    pthread_mutex_destroy(&batch.lock);
+
+    int failures = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (reqs[i].result != 0)
+            failures++;
+    }
+    return failures;
+}
+
+// ========== SINGLE OPERATIONS ==========
+
+int write_file(int sock, char *local_file, char *remote_file)
+{
+    RfsRequest req;
+    prepare_write(&req, local_file, remote_file);
+    return run_requests(sock, &req, 1) == 0 ? 0 : -1;
+}
+
+int get_file(int sock, char *remote_file, char *local_file)
+{
+    RfsRequest req;
+    prepare_get(&req, remote_file, local_file);
+    return run_requests(sock, &req, 1) == 0 ? 0 : -1;
+}
+
+int get_version(int sock, char *remote_file, int version_number, char *local_file)
+{
+    RfsRequest req;
+    prepare_getversion(&req, remote_file, version_number, local_file);
+    if (run_requests(sock, &req, 1) != 0)
+    {
+        fprintf(stderr, "✗ Version %d not found or failed to retrieve\n", version_number);
+        return -1;
+    }
+    return 0;
+}
+
+int remove_file(int sock, char *remote_file)
+{
+    RfsRequest req;
+    prepare_simple(&req, OP_RM, remote_file);
+    return run_requests(sock, &req, 1) == 0 ? 0 : -1;
+}
+
+int list_directory(int sock, char *remote_dir)
+{
+    RfsRequest req;
+    prepare_simple(&req, OP_LS, remote_dir);
+    return run_requests(sock, &req, 1) == 0 ? 0 : -1;
+}
+
+int stop_server(int sock)
+{
+    RfsRequest req;
+    prepare_simple(&req, OP_STOP, NULL);
+    return run_requests(sock, &req, 1) == 0 ? 0 : -1;
+}
@@ -7,18 +7,53 @@
 #ifndef OPERATIONS_H
 #define OPERATIONS_H
 
-// Operation types
+#include <stddef.h>
+#include <stdint.h>
+
+// Operation types. The numeric values are the wire opcodes of protocol v2,
+// so existing entries must never be renumbered.
 typedef enum
 {
-    OP_WRITE,
-    OP_GET,
-    OP_GETVERSION,
-    OP_RM,
-    OP_LS,
-    OP_STOP,
-    OP_UNKNOWN
+    OP_UNKNOWN = 0,
+    OP_WRITE = 1,
+    OP_GET = 2,
+    OP_GETVERSION = 3,
+    OP_RM = 4,
+    OP_LS = 5,
+    OP_STOP = 6,
+    OP_BYE = 7,
+    OP_UPLOAD_OPEN = 8,    // start a ranged upload, returns a transfer id
+    OP_UPLOAD_RANGE = 9,   // one byte range of a ranged upload
+    OP_UPLOAD_COMMIT = 10, // publish a ranged upload once every byte arrived
+    OP_UPLOAD_ABORT = 11,  // discard a ranged upload
+    OP_UPLOAD_STATUS = 12, // which bytes of a ranged upload have arrived
+    OP_SIGNATURE = 13,     // block checksums of a stored file, for a delta WRITE
+    OP_DELTA_WRITE = 14,   // WRITE sent as a delta against the stored file
+    OP_STATS = 15,         // server lock contention counters, as text
+    OP_DEDUP_WRITE = 16,   // WRITE offered by digest, linked to contents already stored
+    OP_MKDIRS = 17,        // create many directories at once, ahead of a tree upload
+    OP_SESSION = 100,      // client-side modes only, never sent on the wire
+    OP_BATCH = 101
 } Operation;
 
+// One client request and, once its reply is handled, its outcome.
+// Requests are prepared up front so that a session can pipeline them.
+typedef struct
+{
+    Operation op;
+    uint32_t request_id;
+    char remote_path[256];
+    char local_path[256];
+    int version_number;
+    uint64_t file_size; // WRITE: bytes to upload
+    uint32_t crc32c;    // WRITE: CRC32C of the local file, once has_crc is set
+    int has_crc;
+    int result;         // 0 on success, -1 on failure (valid once completed)
+    int64_t bytes;      // bytes transferred by this request
+    uint32_t page_size; // LS: directory entries per reply, 0 for all at once
+    char cursor[256];   // LS: last entry listed so far
+} RfsRequest;
+
 /**
  * @brief Convert string to operation enum
  *
@@ -35,48 +70,157 @@ Operation parse_operation(const char *op_str);
  */
 const char *operation_to_string(Operation op);
 
+/**
+ * @brief Open a persistent session connection to the server
+ *
+ * Every operation below accepts the returned socket so that many requests
+ * share one TCP connection and one server thread.
+ *
+ * @return int Session socket on success, -1 on failure
+ */
+int session_open(void);
+
+/**
+ * @brief Say goodbye to the server and close a session connection
+ *
+ * @param sock Session socket returned by session_open()
+ */
+void session_close(int sock);
+
+/**
+ * @brief Prepare a WRITE request (resolves the remote path and local file size)
+ *
+ * @param req Request to fill in
+ * @param local_file Path to the local file to be sent
+ * @param remote_file Path on the server, NULL for the basename, or a trailing '/' for a directory
+ * @return int 0 on success, -1 if the local file cannot be read
+ */
+int prepare_write(RfsRequest *req, const char *local_file, const char *remote_file);
+
+/**
+ * @brief Prepare a GET request
+ *
+ * @param req Request to fill in
+ * @param remote_file Path to the remote file to be read
+ * @param local_file Local destination, or NULL for the basename in the current directory
+ * @return int 0 on success, -1 on failure
+ */
+int prepare_get(RfsRequest *req, const char *remote_file, const char *local_file);
+
+/**
+ * @brief Prepare a GETVERSION request
+ *
+ * @param req Request to fill in
+ * @param remote_file Path to the remote file to be read
+ * @param version_number Version number to retrieve
+ * @param local_file Local destination, or NULL for "<basename>.v<version>"
+ * @return int 0 on success, -1 on failure
+ */
+int prepare_getversion(RfsRequest *req, const char *remote_file, int version_number,
+                       const char *local_file);
+
+/**
+ * @brief Prepare a request that only carries a remote path (RM, LS) or nothing (STOP)
+ *
+ * @param req Request to fill in
+ * @param op OP_RM, OP_LS or OP_STOP
+ * @param remote_file Remote path, ignored for OP_STOP
+ * @return int 0 on success, -1 on failure
+ */
+int prepare_simple(RfsRequest *req, Operation op, const char *remote_file);
+
+/**
+ * @brief Run prepared requests over one connection
+ *
+ * All requests are pipelined: a sender thread writes every request frame
+ * while replies are read and matched back to their request by id. Requests
+ * whose preparation failed (result == -1) are skipped.
+ *
+ * @param sock Session socket, or -1 to use a one-shot connection
+ * @param reqs Prepared requests
+ * @param count Number of requests
+ * @return int Number of failed requests, or -1 if no connection could be made
+ */
+int run_requests(int sock, RfsRequest *reqs, size_t count);
+
+/**
+ * @brief Run independent requests over a small pool of reused connections
+ *
+ * Each connection repeatedly claims the next BATCH_CHUNK requests and
+ * pipelines them, so requests may complete in any order across
+ * connections. Requests whose preparation failed (result == -1) are skipped.
+ *
+ * @param reqs Prepared requests
+ * @param count Number of requests
+ * @param connections Number of parallel connections
+ * @return int Number of failed requests
+ */
+int run_batch(RfsRequest *reqs, size_t count, int connections);
+
+/**
+ * @brief Show or hide progress messages for successful operations
+ *
+ * Errors are always reported.
+ *
+ * @param enabled 1 to print progress (the default), 0 to stay quiet
+ */
+void set_verbose(int enabled);
+
 /**
  * @brief Write a local file to the remote server
  *
+ * @param sock Session socket, or -1 to use a one-shot connection
  * @param local_file Path to the local file to be sent
  * @param remote_file Path where the file will be stored on the server, or NULL to use basename of local_file
+ * @return int 0 on success, -1 on failure
  */
-void write_file(char *local_file, char *remote_file);
+int write_file(int sock, char *local_file, char *remote_file);
 
 /**
  * @brief Get a remote file from the server and save it locally
  *
+ * @param sock Session socket, or -1 to use a one-shot connection
  * @param remote_file Path to the remote file to be read
  * @param local_file Path where the file will be saved locally, or NULL to use current directory with same basename
+ * @return int 0 on success, -1 on failure
  */
-void get_file(char *remote_file, char *local_file);
+int get_file(int sock, char *remote_file, char *local_file);
 
 /**
  * @brief Get a specific version of a remote file from the server and save it locally
  *
+ * @param sock Session socket, or -1 to use a one-shot connection
  * @param remote_file Path to the remote file to be read
  * @param version_number Version number to retrieve
  * @param local_file Path where the versioned file will be saved locally, or NULL to use current directory with modified basename
+ * @return int 0 on success, -1 on failure
  */
-void get_version(char *remote_file, int version_number, char *local_file);
+int get_version(int sock, char *remote_file, int version_number, char *local_file);
 
 /**
  * @brief Delete a remote file from the server
  *
+ * @param sock Session socket, or -1 to use a one-shot connection
  * @param remote_file Path to the remote file to be deleted
+ * @return int 0 on success, -1 on failure
  */
-void remove_file(char *remote_file);
+int remove_file(int sock, char *remote_file);
 
 /**
  * @brief gets all versioning information about a file
  *
+ * @param sock Session socket, or -1 to use a one-shot connection
  * @param remote_file Path to the remote file to be listed
+ * @return int 0 on success, -1 on failure
  */
-void list_directory(char *remote_file);
+int list_directory(int sock, char *remote_file);
 
 /**
  * @brief Send a STOP command to the server to terminate it
+ *
+ * @param sock Session socket, or -1 to use a one-shot connection
+ * @return int 0 on success, -1 on failure
  */
-void stop_server();
+int stop_server(int sock);
 
-#endif // OPERATIONS_H
\ No newline at end of file
+#endif // OPERATIONS_H
@@ -0,0 +1,563 @@
+/*
+ * pack_store.c, Yehen Yan, CS5600 Practicum II
+ * Append-only pack segments for old versions
+ * Last modified: Dec 2025
+ */
+#define _XOPEN_SOURCE 700 // pread
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include "pack_store.h"
+#include "version_manifest.h"
+#include "compression.h"
+#include "lock_table.h"
+#include "meta_cache.h"
+#include "config.h"
+
+// Segment file: magic, then records of a PackRecord (native byte order),
+// the file's storage path and the stored bytes
+#define PACK_MAGIC "RFSPACK1"
+#define PACK_MAGIC_LEN 8
+#define RECORD_MAGIC 0x52465052u
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t path_len;
+    uint32_t id;
+    uint32_t reserved;
+    int64_t written_us;
+    uint64_t length;
+} PackRecord;
+
+// A version copied into the current segment, waiting for its manifest update
+typedef struct
+{
+    char full_path[512];
+    VersionEntry expected;
+    uint32_t pack;
+    uint64_t offset;
+    uint64_t length;
+} Move;
+
+static char storage_root[512];
+static char pack_dir[512];
+static int store_enabled;
+static pthread_t thread;
+static int running;
+static int stopping;
+static pthread_mutex_t stop_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t stop_signal = PTHREAD_COND_INITIALIZER;
+
+// Used by the packing thread only
+static int active_fd = -1;
+static uint32_t active_id;
+static uint64_t active_size;
+static unsigned char *copy_buffer;
+static Move moves[PACK_BATCH];
+static size_t move_count;
+
+static int is_stopping(void)
+{
+    return __atomic_load_n(&stopping, __ATOMIC_RELAXED);
+}
+
+static void segment_path(uint32_t pack, char *out, size_t size)
+{
+    snprintf(out, size, "%s/pack-%06u", pack_dir, pack);
+}
+
+// Ids of the segments on disk, ascending; returns the count
+static size_t list_segments(uint32_t **ids)
+{
+    size_t count = 0, cap = 0;
+    *ids = NULL;
+
+    DIR *dir = opendir(pack_dir);
+    if (!dir)
+        return 0;
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        unsigned int id;
+        char extra;
+        if (sscanf(entry->d_name, "pack-%u%c", &id, &extra) != 1 || id == 0)
+            continue;
+        if (count == cap)
+        {
+            cap = cap ? cap * 2 : 16;
+            uint32_t *grown = realloc(*ids, cap * sizeof(uint32_t));
+            if (!grown)
+                break;
+            *ids = grown;
+        }
+        size_t i = count++;
+        for (; i > 0 && (*ids)[i - 1] > id; i--)
+            (*ids)[i] = (*ids)[i - 1];
+        (*ids)[i] = id;
+    }
+    closedir(dir);
+    return count;
+}
+
+// Read the record at *at; returns 0 and advances *at past it, -1 at the
+// end of the segment or at a record cut short by a crash
+static int read_record(int fd, uint64_t *at, uint64_t end, PackRecord *rec, char *path,
+                       size_t path_size)
+{
+    if (*at + sizeof(PackRecord) > end ||
+        pread(fd, rec, sizeof(PackRecord), (off_t)*at) != (ssize_t)sizeof(PackRecord) ||
+        rec->magic != RECORD_MAGIC || rec->path_len >= path_size ||
+        *at + sizeof(PackRecord) + rec->path_len + rec->length > end ||
+        pread(fd, path, rec->path_len, (off_t)(*at + sizeof(PackRecord))) !=
+            (ssize_t)rec->path_len)
+        return -1;
+
+    path[rec->path_len] = '\0';
+    *at += sizeof(PackRecord) + rec->path_len + rec->length;
+    return 0;
+}
+
+// Reopen the newest segment for appending if it has room, dropping any
+// record a crash cut short
+static void reopen_last_segment(uint32_t id)
+{
+    char path[768];
+    segment_path(id, path, sizeof(path));
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || (uint64_t)st.st_size >= PACK_SEGMENT_SIZE)
+    {
+        if (fd >= 0)
+            close(fd);
+        return;
+    }
+
+    uint64_t at = PACK_MAGIC_LEN;
+    PackRecord rec;
+    char record_path[512];
+    while (read_record(fd, &at, (uint64_t)st.st_size, &rec, record_path, sizeof(record_path)) == 0)
+        ;
+    if (at != (uint64_t)st.st_size && ftruncate(fd, (off_t)at) != 0)
+    {
+        close(fd);
+        return;
+    }
+    active_fd = fd;
+    active_size = at;
+}
+
+// Seal the current segment and start the next one
+static int open_new_segment(void)
+{
+    if (active_fd >= 0)
+    {
+        if (fsync(active_fd) != 0)
+            perror("Failed to sync pack segment");
+        close(active_fd);
+        active_fd = -1;
+    }
+
+    char path[768];
+    segment_path(active_id + 1, path, sizeof(path));
+    int fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0 || pwrite(fd, PACK_MAGIC, PACK_MAGIC_LEN, 0) != PACK_MAGIC_LEN)
+    {
+        perror("Failed to create pack segment");
+        if (fd >= 0)
+        {
+            close(fd);
+            unlink(path);
+        }
+        return -1;
+    }
+
+    active_fd = fd;
+    active_id++;
+    active_size = PACK_MAGIC_LEN;
+    return 0;
+}
+
+static int write_at(int fd, const void *data, size_t len, uint64_t offset)
+{
+    const unsigned char *p = data;
+    while (len > 0)
+    {
+        ssize_t n = pwrite(fd, p, len, (off_t)offset);
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= (size_t)n;
+        offset += (uint64_t)n;
+    }
+    return 0;
+}
+
+// Append a version copied from in_fd and queue its manifest update
+static int append_version(const char *full_path, const VersionEntry *v, int in_fd,
+                          uint64_t offset, uint64_t length)
+{
+    if ((active_fd < 0 || active_size >= PACK_SEGMENT_SIZE) && open_new_segment() != 0)
+        return -1;
+
+    PackRecord rec = {RECORD_MAGIC, (uint32_t)strlen(full_path), v->id, 0, v->written_us, length};
+    uint64_t start = active_size;
+    uint64_t at = start + sizeof(rec) + rec.path_len;
+    int ok = write_at(active_fd, &rec, sizeof(rec), start) == 0 &&
+             write_at(active_fd, full_path, rec.path_len, start + sizeof(rec)) == 0;
+
+    for (uint64_t done = 0; ok && done < length;)
+    {
+        size_t want = length - done < PACK_BUFFER ? (size_t)(length - done) : PACK_BUFFER;
+        ssize_t n = pread(in_fd, copy_buffer, want, (off_t)(offset + done));
+        ok = n > 0 && write_at(active_fd, copy_buffer, (size_t)n, at + done) == 0;
+        done += n > 0 ? (uint64_t)n : 0;
+    }
+
+    if (!ok)
+    {
+        perror("Failed to append to pack segment");
+        if (ftruncate(active_fd, (off_t)start) != 0)
+            perror("Failed to trim pack segment");
+        return -1;
+    }
+    active_size = at + length;
+
+    Move *mv = &moves[move_count++];
+    snprintf(mv->full_path, sizeof(mv->full_path), "%s", full_path);
+    mv->expected = *v;
+    mv->pack = active_id;
+    mv->offset = at;
+    mv->length = length;
+    return 0;
+}
+
+// Make the queued copies durable, then point the manifests at them.
+// Returns the number moved, -1 if a manifest could not be saved.
+static int commit_moves(void)
+{
+    int moved = 0, failed = 0;
+    if (move_count > 0 && fsync(active_fd) != 0)
+    {
+        perror("Failed to sync pack segment");
+        move_count = 0;
+        return -1;
+    }
+
+    for (size_t i = 0; i < move_count; i++)
+    {
+        Move *mv = &moves[i];
+        path_lock_exclusive(mv->full_path);
+        int result = manifest_set_packed(mv->full_path, &mv->expected, mv->pack, mv->offset,
+                                         mv->length);
+        path_unlock(mv->full_path);
+
+        if (result < 0)
+        {
+            failed = 1;
+            continue;
+        }
+        if (result > 0)
+            continue; // dropped or deleted meanwhile; its copy is dead space
+        moved++;
+
+        // The manifest naming the pack is on disk by now, so a crash cannot
+        // bring back an entry for the loose file. Readers open version
+        // files under the shared lock, so none can still be about to open
+        // it once its entry has moved.
+        if (!mv->expected.pack)
+        {
+            char loose[768];
+            const char *slash = strrchr(mv->full_path, '/');
+            snprintf(loose, sizeof(loose), "%.*s/%s", slash ? (int)(slash - mv->full_path) : 1,
+                     slash ? mv->full_path : ".", mv->expected.name);
+            if (unlink(loose) != 0)
+                perror("Failed to delete packed version file");
+            meta_cache_refresh(loose);
+        }
+    }
+    move_count = 0;
+    return failed ? -1 : moved;
+}
+
+static int64_t now_us(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+// ========== PACKING ==========
+
+static int is_cold(const VersionEntry *v, int64_t now)
+{
+    // Wait for the compressor, so a version is stored the way it will stay
+    return !v->chunked && !v->pack && now - v->written_us >= PACK_COLD_SECONDS * 1000000LL &&
+           (v->compressed != 0 || !compression_enabled());
+}
+
+// Pack the cold versions of one file
+static void pack_file(const char *full_path, const char *dir)
+{
+    VersionManifest m;
+    path_lock_shared(full_path);
+    int loaded = manifest_snapshot(full_path, &m) == 0;
+    path_unlock(full_path);
+    if (!loaded)
+        return;
+
+    int64_t now = now_us();
+    int packed = 0;
+    for (size_t i = 0; i < m.count && !is_stopping(); i++)
+    {
+        const VersionEntry *v = &m.versions[i];
+        if (!is_cold(v, now))
+            continue;
+
+        // Version files are never modified; one deleted meanwhile just fails to open
+        char loose[768];
+        snprintf(loose, sizeof(loose), "%s/%s", dir, v->name);
+        int fd = open(loose, O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0)
+        {
+            if (fd >= 0)
+                close(fd);
+            continue;
+        }
+        append_version(full_path, v, fd, 0, (uint64_t)st.st_size);
+        close(fd);
+
+        if (move_count == PACK_BATCH)
+        {
+            int n = commit_moves();
+            packed += n > 0 ? n : 0;
+        }
+    }
+    int n = commit_moves();
+    packed += n > 0 ? n : 0;
+
+    if (packed > 0)
+        printf("Packed %d version(s) of %s into segment %u\n", packed, full_path, active_id);
+    manifest_free(&m);
+}
+
+static int pack_manifest(const char *full_path, const char *dir)
+{
+    pack_file(full_path, dir);
+    return is_stopping();
+}
+
+// ========== REPACKING ==========
+
+// Manifest of the file the last record belonged to; records of one file
+// sit together, so one snapshot serves a run of them
+static char cached_path[512];
+static VersionManifest cached;
+static int cached_valid;
+
+static const VersionEntry *live_entry(uint32_t pack, uint64_t data_at, const PackRecord *rec,
+                                      const char *full_path)
+{
+    if (!cached_valid || strcmp(cached_path, full_path) != 0)
+    {
+        if (cached_valid)
+            manifest_free(&cached);
+        path_lock_shared(full_path);
+        cached_valid = manifest_snapshot(full_path, &cached) == 0;
+        path_unlock(full_path);
+        snprintf(cached_path, sizeof(cached_path), "%s", full_path);
+        if (!cached_valid)
+            return NULL;
+    }
+
+    const VersionEntry *v = manifest_find_version(&cached, rec->id);
+    return v && v->written_us == rec->written_us && v->pack == pack && v->pack_offset == data_at
+               ? v
+               : NULL;
+}
+
+static void forget_cached(void)
+{
+    if (cached_valid)
+        manifest_free(&cached);
+    cached_valid = 0;
+}
+
+// Copy the live records of a mostly dead segment forward and delete it
+static void repack_segment(uint32_t pack)
+{
+    char path[768];
+    segment_path(pack, path, sizeof(path));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        if (fd >= 0)
+            close(fd);
+        return;
+    }
+
+    uint64_t end = (uint64_t)st.st_size;
+    uint64_t at = PACK_MAGIC_LEN, live = 0;
+    PackRecord rec;
+    char full_path[512];
+    while (read_record(fd, &at, end, &rec, full_path, sizeof(full_path)) == 0)
+    {
+        if (live_entry(pack, at - rec.length, &rec, full_path))
+            live += rec.length;
+    }
+    forget_cached();
+
+    if (live * 100 >= end * PACK_REPACK_LIVE_PERCENT)
+    {
+        close(fd);
+        return;
+    }
+
+    int ok = 1, copied = 0;
+    at = PACK_MAGIC_LEN;
+    while (ok && !is_stopping() && read_record(fd, &at, end, &rec, full_path, sizeof(full_path)) == 0)
+    {
+        uint64_t data_at = at - rec.length;
+        const VersionEntry *v = live_entry(pack, data_at, &rec, full_path);
+        if (!v)
+            continue;
+        ok = append_version(full_path, v, fd, data_at, rec.length) == 0;
+        copied++;
+        if (ok && move_count == PACK_BATCH)
+        {
+            forget_cached(); // the manifests are about to change
+            ok = commit_moves() >= 0;
+        }
+    }
+    forget_cached();
+    ok = commit_moves() >= 0 && ok;
+    close(fd);
+
+    // Every manifest points past the segment now; readers that opened it keep their descriptor
+    if (ok && !is_stopping())
+    {
+        if (unlink(path) == 0)
+            printf("Repacked segment %u: %d live version(s) of %llu bytes moved\n", pack, copied,
+                   (unsigned long long)live);
+        else
+            perror("Failed to delete repacked segment");
+    }
+}
+
+static void repack_segments(void)
+{
+    uint32_t *ids;
+    size_t count = list_segments(&ids);
+    for (size_t i = 0; i < count && !is_stopping(); i++)
+    {
+        // The segment being appended to is not sealed yet
+        if (ids[i] != active_id || active_fd < 0)
+            repack_segment(ids[i]);
+    }
+    free(ids);
+}
+
+static void *pack_thread(void *arg)
+{
+    (void)arg;
+    for (;;)
+    {
+        manifest_walk(storage_root, pack_manifest);
+        repack_segments();
+
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_sec += PACK_INTERVAL;
+
+        pthread_mutex_lock(&stop_lock);
+        while (!stopping && pthread_cond_timedwait(&stop_signal, &stop_lock, &until) == 0)
+            ;
+        int stop = stopping;
+        pthread_mutex_unlock(&stop_lock);
+        if (stop)
+            break;
+    }
+    return NULL;
+}
+
+int pack_store_start(const char *root, int enable)
+{
+    snprintf(storage_root, sizeof(storage_root), "%s", root);
+    snprintf(pack_dir, sizeof(pack_dir), "%s/%spacks", root, RFS_INTERNAL_PREFIX);
+    if (!enable)
+        return 0;
+
+    if (mkdir(pack_dir, 0755) != 0 && errno != EEXIST)
+    {
+        perror("Failed to create pack directory");
+        return -1;
+    }
+
+    uint32_t *ids;
+    size_t count = list_segments(&ids);
+    active_id = count ? ids[count - 1] : 0;
+    free(ids);
+    if (active_id > 0)
+        reopen_last_segment(active_id);
+
+    copy_buffer = malloc(PACK_BUFFER);
+    if (!copy_buffer || pthread_create(&thread, NULL, pack_thread, NULL) != 0)
+    {
+        perror("Failed to start packing thread");
+        free(copy_buffer);
+        copy_buffer = NULL;
+        return -1;
+    }
+    running = 1;
+    store_enabled = 1;
+    return 0;
+}
+
+int pack_store_enabled(void)
+{
+    return store_enabled;
+}
+
+int pack_store_open(uint32_t pack)
+{
+    char path[768];
+    segment_path(pack, path, sizeof(path));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        perror("Failed to open pack segment");
+    return fd;
+}
+
+void pack_store_stop(void)
+{
+    if (!running)
+        return;
+
+    pthread_mutex_lock(&stop_lock);
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELAXED);
+    pthread_cond_signal(&stop_signal);
+    pthread_mutex_unlock(&stop_lock);
+    pthread_join(thread, NULL);
+    running = 0;
+
+    if (active_fd >= 0)
+    {
+        fsync(active_fd);
+        close(active_fd);
+        active_fd = -1;
+    }
+    free(copy_buffer);
+    copy_buffer = NULL;
+}
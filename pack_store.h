@@ -0,0 +1,63 @@
+/*
+ * pack_store.h, Yehen Yan, CS5600 Practicum II
+ * Append-only pack segments for old versions
+ * Last modified: Dec 2025
+ */
+
+#ifndef PACK_STORE_H
+#define PACK_STORE_H
+
+#include <stdint.h>
+
+/*
+ * With packing enabled, a background thread moves versions older than
+ * PACK_COLD_SECONDS out of their own files and appends them to large pack
+ * segments under STORAGE_ROOT/.rfs_packs. The version manifest records the
+ * segment, offset and length of each packed version, so the manifests are
+ * the index and GETVERSION reads a packed version with positional reads.
+ *
+ * Each record in a segment carries the file's storage path, the version id
+ * and its backup time, so a segment can be checked against the manifests on
+ * its own. Deleting a packed version only drops its manifest entry; the
+ * repacker copies the live records of a mostly dead segment into the
+ * current one and deletes the old segment.
+ *
+ * Only full copies (compressed or not) are packed: a chunked version's
+ * recipe is small and its contents already live in the chunk store.
+ */
+
+/**
+ * @brief Open the pack store and start the packing thread
+ *
+ * Packed versions stay readable when packing is off.
+ *
+ * @param root storage root
+ * @param enable pack old versions (creates the pack directory if missing)
+ * @return int 0 on success, -1 if the store or thread could not be set up
+ */
+int pack_store_start(const char *root, int enable);
+
+/**
+ * @brief Whether old versions are being packed
+ */
+int pack_store_enabled(void);
+
+/**
+ * @brief Open a pack segment for reading
+ *
+ * Call with the file's path lock held, so the repacker cannot delete the
+ * segment first; the descriptor stays valid after the lock is released.
+ *
+ * @param pack segment id from a version entry
+ * @return int descriptor, or -1 if the segment could not be opened
+ */
+int pack_store_open(uint32_t pack);
+
+/**
+ * @brief Stop the packing thread
+ *
+ * A version being packed stays in its own file.
+ */
+void pack_store_stop(void);
+
+#endif // PACK_STORE_H
@@ -10,10 +10,16 @@
 #include <errno.h>
 #include <pthread.h>
 #include "path_utils.h"
+#include "meta_cache.h"
 #include "config.h"
 
 static pthread_mutex_t dir_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+int is_internal_name(const char *name)
+{
+    return strncmp(name, RFS_INTERNAL_PREFIX, strlen(RFS_INTERNAL_PREFIX)) == 0;
+}
+
 int validate_path(const char *path)
 {
     // Reject absolute paths
@@ -30,6 +36,16 @@ int validate_path(const char *path)
         return -1;
     }
 
+    // Reject server-internal names in any component
+    for (const char *p = path; *p; p++)
+    {
+        if ((p == path || p[-1] == '/') && is_internal_name(p))
+        {
+            fprintf(stderr, "Rejected: Reserved name\n");
+            return -1;
+        }
+    }
+
     // Check path depth
     int depth = 0;
     for (const char *p = path; *p; p++)
@@ -68,7 +84,11 @@ int create_directories(const char *path)
         if (*p == '/')
         {
             *p = 0;
-            if (mkdir(tmp, 0755) != 0 && errno != EEXIST)
+            if (mkdir(tmp, 0755) == 0)
+            {
+                meta_cache_refresh(tmp);
+            }
+            else if (errno != EEXIST)
             {
                 perror("mkdir failed");
                 return -1;
@@ -77,7 +97,11 @@ int create_directories(const char *path)
         }
     }
 
-    if (mkdir(tmp, 0755) != 0 && errno != EEXIST)
+    if (mkdir(tmp, 0755) == 0)
+    {
+        meta_cache_refresh(tmp);
+    }
+    else if (errno != EEXIST)
     {
         perror("mkdir failed");
         return -1;
@@ -9,6 +9,14 @@
 
 #include <stddef.h>
 
+/**
+ * @brief Check whether a file name is reserved for server-internal files
+ *
+ * @param name file name (a single path component)
+ * @return int 1 if the name is internal, 0 otherwise
+ */
+int is_internal_name(const char *name);
+
 /**
  * @brief Validate a given path for security and correctness
  *
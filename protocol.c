@@ -0,0 +1,333 @@
+/*
+ * protocol.c, Yehen Yan, CS5600 Practicum II
+ * Binary framed wire protocol (version 2) implementation
+ * Last modified: Dec 2025
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "protocol.h"
+#include "network.h"
+
+// ========== LITTLE-ENDIAN HELPERS ==========
+
+static void put_le16(unsigned char *p, uint16_t v)
+{
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+}
+
+static void put_le32(unsigned char *p, uint32_t v)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        p[i] = (unsigned char)(v >> (8 * i));
+    }
+}
+
+static void put_le64(unsigned char *p, uint64_t v)
+{
+    for (int i = 0; i < 8; i++)
+    {
+        p[i] = (unsigned char)(v >> (8 * i));
+    }
+}
+
+static uint16_t get_le16(const unsigned char *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get_le32(const unsigned char *p)
+{
+    uint32_t v = 0;
+    for (int i = 3; i >= 0; i--)
+    {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+static uint64_t get_le64(const unsigned char *p)
+{
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--)
+    {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+// ========== FRAME HEADERS ==========
+
+const char *status_to_string(int32_t status)
+{
+    switch (status)
+    {
+    case RFS_OK:
+        return "OK";
+    case RFS_ERR_NOT_FOUND:
+        return "Not found";
+    case RFS_ERR_INVALID_PATH:
+        return "Invalid path";
+    case RFS_ERR_IO:
+        return "I/O error";
+    case RFS_ERR_BAD_REQUEST:
+        return "Bad request";
+    case RFS_ERR_UNSUPPORTED:
+        return "Unsupported";
+    case RFS_ERR_BUSY:
+        return "Server busy";
+    case RFS_NOT_MODIFIED:
+        return "Not modified";
+    default:
+        return "Unknown status";
+    }
+}
+
+void frame_encode_header(const FrameHeader *hdr, unsigned char *out)
+{
+    put_le32(out, RFS_MAGIC);
+    out[4] = hdr->version;
+    out[5] = hdr->opcode;
+    put_le16(out + 6, hdr->flags);
+    put_le32(out + 8, hdr->request_id);
+    put_le32(out + 12, (uint32_t)hdr->status);
+    put_le32(out + 16, hdr->meta_len);
+    put_le64(out + 20, hdr->payload_len);
+    put_le32(out + 28, 0);
+}
+
+int frame_decode_header(const unsigned char *in, FrameHeader *hdr)
+{
+    if (get_le32(in) != RFS_MAGIC)
+    {
+        return -1;
+    }
+
+    hdr->version = in[4];
+    hdr->opcode = in[5];
+    hdr->flags = get_le16(in + 6);
+    hdr->request_id = get_le32(in + 8);
+    hdr->status = (int32_t)get_le32(in + 12);
+    hdr->meta_len = get_le32(in + 16);
+    hdr->payload_len = get_le64(in + 20);
+
+    if (hdr->meta_len > hdr->payload_len)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+uint64_t frame_body_len(const FrameHeader *hdr)
+{
+    return hdr->payload_len - hdr->meta_len;
+}
+
+int send_frame(int sock, FrameHeader *hdr, const void *meta, size_t meta_len, uint64_t body_len)
+{
+    unsigned char wire[RFS_HEADER_SIZE];
+
+    hdr->version = RFS_PROTOCOL_VERSION;
+    hdr->meta_len = (uint32_t)meta_len;
+    hdr->payload_len = meta_len + body_len;
+    frame_encode_header(hdr, wire);
+
+    if (send_all(sock, wire, sizeof(wire)) < 0)
+    {
+        fprintf(stderr, "Failed to send frame header\n");
+        return -1;
+    }
+
+    if (meta_len > 0 && send_all(sock, meta, meta_len) < 0)
+    {
+        fprintf(stderr, "Failed to send frame metadata\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+int recv_frame(int sock, FrameHeader *hdr, unsigned char *meta, size_t meta_cap)
+{
+    unsigned char wire[RFS_HEADER_SIZE];
+
+    if (recv_all(sock, wire, sizeof(wire)) < 0)
+    {
+        return -1;
+    }
+
+    if (frame_decode_header(wire, hdr) != 0)
+    {
+        fprintf(stderr, "Malformed frame header (bad magic or lengths)\n");
+        return -1;
+    }
+
+    if (hdr->meta_len > meta_cap)
+    {
+        fprintf(stderr, "Frame metadata too large: %u bytes (max: %zu)\n",
+                hdr->meta_len, meta_cap);
+        return -1;
+    }
+
+    if (hdr->meta_len > 0 && recv_all(sock, meta, hdr->meta_len) < 0)
+    {
+        fprintf(stderr, "Failed to receive frame metadata\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+// ========== METADATA ENCODING ==========
+
+void meta_writer_init(MetaWriter *w, unsigned char *buf, size_t cap)
+{
+    w->buf = buf;
+    w->cap = cap;
+    w->len = 0;
+    w->overflow = 0;
+}
+
+// Reserve n bytes in the writer, or flag overflow
+static unsigned char *meta_reserve(MetaWriter *w, size_t n)
+{
+    if (w->overflow || w->len + n > w->cap)
+    {
+        w->overflow = 1;
+        return NULL;
+    }
+
+    unsigned char *p = w->buf + w->len;
+    w->len += n;
+    return p;
+}
+
+void meta_put_u8(MetaWriter *w, uint8_t v)
+{
+    unsigned char *p = meta_reserve(w, 1);
+    if (p)
+        *p = v;
+}
+
+void meta_put_u16(MetaWriter *w, uint16_t v)
+{
+    unsigned char *p = meta_reserve(w, 2);
+    if (p)
+        put_le16(p, v);
+}
+
+void meta_put_u32(MetaWriter *w, uint32_t v)
+{
+    unsigned char *p = meta_reserve(w, 4);
+    if (p)
+        put_le32(p, v);
+}
+
+void meta_put_u64(MetaWriter *w, uint64_t v)
+{
+    unsigned char *p = meta_reserve(w, 8);
+    if (p)
+        put_le64(p, v);
+}
+
+void meta_put_str(MetaWriter *w, const char *s)
+{
+    size_t len = strlen(s);
+    if (len > UINT16_MAX)
+    {
+        w->overflow = 1;
+        return;
+    }
+
+    meta_put_u16(w, (uint16_t)len);
+    unsigned char *p = meta_reserve(w, len);
+    if (p)
+        memcpy(p, s, len);
+}
+
+void meta_put_bytes(MetaWriter *w, const void *data, size_t len)
+{
+    unsigned char *p = meta_reserve(w, len);
+    if (p)
+        memcpy(p, data, len);
+}
+
+void meta_reader_init(MetaReader *r, const unsigned char *buf, size_t len)
+{
+    r->buf = buf;
+    r->len = len;
+    r->pos = 0;
+    r->error = 0;
+}
+
+// Consume n bytes from the reader, or flag an error
+static const unsigned char *meta_take(MetaReader *r, size_t n)
+{
+    if (r->error || r->pos + n > r->len)
+    {
+        r->error = 1;
+        return NULL;
+    }
+
+    const unsigned char *p = r->buf + r->pos;
+    r->pos += n;
+    return p;
+}
+
+uint8_t meta_get_u8(MetaReader *r)
+{
+    const unsigned char *p = meta_take(r, 1);
+    return p ? *p : 0;
+}
+
+uint16_t meta_get_u16(MetaReader *r)
+{
+    const unsigned char *p = meta_take(r, 2);
+    return p ? get_le16(p) : 0;
+}
+
+uint32_t meta_get_u32(MetaReader *r)
+{
+    const unsigned char *p = meta_take(r, 4);
+    return p ? get_le32(p) : 0;
+}
+
+uint64_t meta_get_u64(MetaReader *r)
+{
+    const unsigned char *p = meta_take(r, 8);
+    return p ? get_le64(p) : 0;
+}
+
+int meta_get_str(MetaReader *r, char *out, size_t out_size)
+{
+    uint16_t len = meta_get_u16(r);
+    if (r->error || (size_t)len >= out_size)
+    {
+        r->error = 1;
+        return -1;
+    }
+
+    const unsigned char *p = meta_take(r, len);
+    if (!p)
+    {
+        return -1;
+    }
+
+    memcpy(out, p, len);
+    out[len] = '\0';
+    return len;
+}
+
+int meta_get_bytes(MetaReader *r, void *out, size_t len)
+{
+    const unsigned char *p = meta_take(r, len);
+    if (!p)
+    {
+        return -1;
+    }
+
+    memcpy(out, p, len);
+    return 0;
+}
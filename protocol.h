@@ -0,0 +1,258 @@
+/*
+ * protocol.h, Yehen Yan, CS5600 Practicum II
+ * Binary framed wire protocol (version 2) declarations
+ * Last modified: Dec 2025
+ */
+
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Every request and reply is one frame: a fixed 32-byte header followed by
+ * payload_len bytes of payload. The payload starts with meta_len bytes of
+ * encoded metadata (paths, counters) and the rest is bulk body (file data,
+ * listings). All integers are little-endian and fixed width on the wire.
+ *
+ *   offset  size  field
+ *        0     4  magic "RFS2"
+ *        4     1  protocol version
+ *        5     1  opcode (Operation)
+ *        6     2  flags
+ *        8     4  request id (echoed in the reply)
+ *       12     4  status (RfsStatus, replies only)
+ *       16     4  meta_len
+ *       20     8  payload_len (meta + body)
+ *       28     4  reserved, must be zero
+ *
+ * Request id 0 is never used by clients; a reply with id 0 concerns the
+ * whole connection (e.g. RFS_ERR_BUSY when the server is at capacity).
+ */
+#define RFS_MAGIC 0x32534652u // "RFS2" read as little-endian
+#define RFS_PROTOCOL_VERSION 2
+#define RFS_HEADER_SIZE 32
+
+// Frame flags
+// GET: the request metadata continues with u64 offset and u64 length. Any
+// GET reply carries u64 file size and u64 file identity, so that a client
+// reading one file in several ranges can tell if it was replaced.
+// Then come the checksums recorded for the file: a u8 of RFS_DIGEST_* bits,
+// u32 CRC32C, and the 32-byte SHA-256 if its bit is set. A GETVERSION reply
+// has the same layout with the time the version was written as its tag in
+// place of the identity.
+#define RFS_FLAG_RANGE 0x0001
+// UPLOAD_OPEN: the request metadata continues with a u64 resume key; an
+// unfinished upload of the same file with the same key is resumed
+#define RFS_FLAG_RESUME 0x0002
+
+// GET/GETVERSION: the request metadata continues (after the range, or the
+// version number) with what the client already has: u64 size, u64 tag and
+// u32 CRC32C, as an earlier reply described them. If the file still
+// matches, the reply is RFS_NOT_MODIFIED with no body.
+#define RFS_FLAG_IF_CHANGED 0x0004
+
+// LS: the request metadata continues with a u32 page size and the cursor
+// string from the previous page ("" for the first). Without it, a directory
+// is listed in one reply.
+#define RFS_FLAG_PAGED 0x0008
+
+// DEDUP_WRITE: a probe with no metadata. The reply is RFS_OK if the server
+// deduplicates and RFS_ERR_UNSUPPORTED if not, so the client knows before
+// it hashes anything.
+#define RFS_FLAG_PROBE 0x0010
+
+// Checksums present in a GET or GETVERSION reply
+#define RFS_DIGEST_CRC32C 0x01
+#define RFS_DIGEST_SHA256 0x02
+
+// An LS reply starts with a u8 format. RFS_LS_ENTRIES: the metadata
+// continues with u32 entry count, u8 more (another page follows) and the
+// cursor string for it; the body holds one record per directory entry, in
+// name order: u8 RFS_ENTRY_* type, u64 size, i64 mtime (seconds), u32
+// version count, name string. RFS_ENTRY_VERSION marks a stored version of
+// another file in the same directory; its version count is 0.
+// RFS_LS_VERSIONS: the metadata continues with u32 record count; the body
+// holds the listed file (RFS_ENTRY_FILE, id 0) and then its versions
+// (RFS_ENTRY_VERSION), newest first: u8 type, u32 version id, u64 size, i64
+// time (mtime of the file, when a version was replaced), u8 RFS_DIGEST_*
+// bits, u32 CRC32C, the SHA-256 if its bit is set, u8 RFS_STORED_* bits,
+// u64 stored bytes, u32 pack segment, and the name string (the path of the
+// file, the version file name next to it for a version).
+#define RFS_LS_ENTRIES 1
+#define RFS_LS_VERSIONS 2
+
+#define RFS_ENTRY_FILE 0
+#define RFS_ENTRY_DIR 1
+#define RFS_ENTRY_UNKNOWN 2 // could not be stat'ed; only the name is valid
+#define RFS_ENTRY_VERSION 3
+
+// How a listed version is stored; without either it is a plain copy
+#define RFS_STORED_ZLIB 0x01
+#define RFS_STORED_PACK 0x02
+
+// Upper bound for the metadata section of any frame
+#define RFS_MAX_META 65536
+
+// Reply status codes
+typedef enum
+{
+    RFS_OK = 0,
+    RFS_ERR_NOT_FOUND = 1,
+    RFS_ERR_INVALID_PATH = 2,
+    RFS_ERR_IO = 3,
+    RFS_ERR_BAD_REQUEST = 4,
+    RFS_ERR_UNSUPPORTED = 5,
+    RFS_ERR_BUSY = 6,
+    RFS_NOT_MODIFIED = 7 // conditional GET: the client's copy is current; not an error
+} RfsStatus;
+
+typedef struct
+{
+    uint8_t version;
+    uint8_t opcode;
+    uint16_t flags;
+    uint32_t request_id;
+    int32_t status;
+    uint32_t meta_len;
+    uint64_t payload_len;
+} FrameHeader;
+
+// Cursor for building the metadata section into caller-provided storage
+typedef struct
+{
+    unsigned char *buf;
+    size_t cap;
+    size_t len;
+    int overflow;
+} MetaWriter;
+
+// Cursor for decoding a received metadata section
+typedef struct
+{
+    const unsigned char *buf;
+    size_t len;
+    size_t pos;
+    int error;
+} MetaReader;
+
+/**
+ * @brief Human-readable name of a status code
+ *
+ * @param status RfsStatus value
+ * @return const char*
+ */
+const char *status_to_string(int32_t status);
+
+/**
+ * @brief Encode a header into its 32-byte little-endian wire form
+ *
+ * @param hdr Header to encode
+ * @param out Output buffer of RFS_HEADER_SIZE bytes
+ */
+void frame_encode_header(const FrameHeader *hdr, unsigned char *out);
+
+/**
+ * @brief Decode and sanity-check a 32-byte wire header
+ *
+ * @param in Input buffer of RFS_HEADER_SIZE bytes
+ * @param hdr Decoded header
+ * @return int 0 on success, -1 if the magic or lengths are invalid
+ */
+int frame_decode_header(const unsigned char *in, FrameHeader *hdr);
+
+/**
+ * @brief Send a frame header followed by its metadata section
+ *
+ * The caller streams body_len bytes of body afterwards.
+ *
+ * @param sock Socket file descriptor
+ * @param hdr Header (meta_len and payload_len are filled in here)
+ * @param meta Metadata bytes, may be NULL when meta_len is 0
+ * @param meta_len Metadata length
+ * @param body_len Length of the body that follows
+ * @return int 0 on success, -1 on failure
+ */
+int send_frame(int sock, FrameHeader *hdr, const void *meta, size_t meta_len, uint64_t body_len);
+
+/**
+ * @brief Receive a frame header and its metadata section
+ *
+ * @param sock Socket file descriptor
+ * @param hdr Received header
+ * @param meta Buffer for the metadata section
+ * @param meta_cap Size of the metadata buffer
+ * @return int 0 on success, -1 on EOF, timeout, or malformed frame
+ */
+int recv_frame(int sock, FrameHeader *hdr, unsigned char *meta, size_t meta_cap);
+
+/**
+ * @brief Body length of a frame (payload minus metadata)
+ *
+ * @param hdr Frame header
+ * @return uint64_t
+ */
+uint64_t frame_body_len(const FrameHeader *hdr);
+
+// ========== METADATA ENCODING ==========
+
+/**
+ * @brief Start encoding metadata into caller-provided storage
+ *
+ * @param w Writer to initialise
+ * @param buf Output buffer
+ * @param cap Size of the output buffer
+ */
+void meta_writer_init(MetaWriter *w, unsigned char *buf, size_t cap);
+
+/**
+ * @brief Append little-endian integers; sets w->overflow instead of writing past cap
+ */
+void meta_put_u8(MetaWriter *w, uint8_t v);
+void meta_put_u16(MetaWriter *w, uint16_t v);
+void meta_put_u32(MetaWriter *w, uint32_t v);
+void meta_put_u64(MetaWriter *w, uint64_t v);
+
+/**
+ * @brief Append a string as a u16 length followed by its bytes (no NUL)
+ */
+void meta_put_str(MetaWriter *w, const char *s);
+
+/**
+ * @brief Append a fixed number of raw bytes (the reader must know the length)
+ */
+void meta_put_bytes(MetaWriter *w, const void *data, size_t len);
+
+/**
+ * @brief Start decoding a received metadata section
+ *
+ * @param r Reader to initialise
+ * @param buf Metadata bytes
+ * @param len Metadata length
+ */
+void meta_reader_init(MetaReader *r, const unsigned char *buf, size_t len);
+
+/**
+ * @brief Read little-endian integers; return 0 and set r->error when the section is too short
+ */
+uint8_t meta_get_u8(MetaReader *r);
+uint16_t meta_get_u16(MetaReader *r);
+uint32_t meta_get_u32(MetaReader *r);
+uint64_t meta_get_u64(MetaReader *r);
+
+/**
+ * @brief Read a length-prefixed string into a NUL-terminated buffer
+ *
+ * @return int Length of the string, -1 if truncated or too long for the buffer
+ */
+int meta_get_str(MetaReader *r, char *out, size_t out_size);
+
+/**
+ * @brief Read a fixed number of raw bytes
+ *
+ * @return int 0 on success, -1 (and r->error set) if the section is too short
+ */
+int meta_get_bytes(MetaReader *r, void *out, size_t len);
+
+#endif // PROTOCOL_H
@@ -0,0 +1,1021 @@
+/*
+ * ranged_transfer.c, Yehen Yan, CS5600 Practicum II
+ * Large-file transfers split into byte ranges over parallel connections
+ * Last modified: Dec 2025
+ *
+ * A single TCP stream rarely fills a fast link. A large file is cut into
+ * TRANSFER_RANGE_SIZE ranges; every connection repeatedly claims the next
+ * range and moves it with positional I/O, so the ranges can land in any
+ * order.
+ *
+ * Transfers survive lost connections. Each side knows which bytes already
+ * made it (the server reports it for uploads, the client keeps track for
+ * downloads), so a retry, or a later run of the same command, only moves
+ * the missing ranges.
+ */
+#define _POSIX_C_SOURCE 200809L // st_mtim
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include "ranged_transfer.h"
+#include "client_cache.h"
+#include "checksum.h"
+#include "network.h"
+#include "protocol.h"
+#include "config.h"
+
+// Extended attribute that marks a partial download as resumable:
+// "<remote size> <remote identity> <bytes complete from the start> <their CRC32C>".
+// It is updated as ranges finish, so even a killed client leaves a usable record.
+#define RESUME_XATTR "user.rfs.resume"
+
+// A run of bytes [start, end); for a download also the CRC32C of its bytes
+typedef struct
+{
+    uint64_t start;
+    uint64_t end;
+    uint32_t crc32c;
+} Span;
+
+// Growable list of spans
+typedef struct
+{
+    Span *items;
+    size_t count;
+    size_t cap;
+} SpanList;
+
+// Checksums the server recorded for a file it sends
+typedef struct
+{
+    uint8_t present; // RFS_DIGEST_* bits
+    uint32_t crc32c;
+    unsigned char sha256[SHA256_DIGEST_SIZE];
+} RemoteDigests;
+
+// Shared state of one ranged transfer
+typedef struct
+{
+    RfsRequest *req;
+    int fd;               // local file
+    uint64_t size;        // total file size
+    uint64_t transfer_id; // WRITE: staged upload on the server
+    uint64_t identity;    // GET: file identity reported with the first range
+    RemoteDigests digests; // GET: checksums reported with the first range
+    int unchanged;         // GET: the server says the cached copy is current
+    int skip_cache;        // GET: the first range must not be conditional
+
+    // Guarded by lock
+    SpanList todo;     // ranges still to move, claimed front to back
+    size_t todo_pos;   // index into todo
+    uint64_t todo_off; // next unclaimed byte within todo.items[todo_pos]
+    SpanList done;     // GET: ranges fully written to the local file
+    uint64_t saved;    // GET: complete prefix recorded in RESUME_XATTR
+    Sha256 sha256;     // GET: SHA-256 of the bytes [0, hashed) received in order
+    uint64_t hashed;
+    int hashing;       // GET: the range continuing hashed is being fetched
+    int failed;        // an error no retry can fix
+    int broken;        // a connection was lost; a retry may help
+    pthread_mutex_t lock;
+} ranged_t;
+
+// Request ids only need to be unique per connection
+static uint32_t next_request_id = 1;
+
+static uint32_t new_request_id(void)
+{
+    return __atomic_fetch_add(&next_request_id, 1, __ATOMIC_RELAXED);
+}
+
+// ========== SPANS ==========
+
+static int span_append(SpanList *list, uint64_t start, uint64_t end, uint32_t crc)
+{
+    if (list->count == list->cap)
+    {
+        size_t cap = list->cap ? list->cap * 2 : 16;
+        Span *grown = realloc(list->items, cap * sizeof(Span));
+        if (!grown)
+        {
+            perror("Failed to allocate ranges");
+            return -1;
+        }
+        list->items = grown;
+        list->cap = cap;
+    }
+    list->items[list->count].start = start;
+    list->items[list->count].end = end;
+    list->items[list->count].crc32c = crc;
+    list->count++;
+    return 0;
+}
+
+static int span_compare(const void *a, const void *b)
+{
+    const Span *x = a, *y = b;
+    return x->start < y->start ? -1 : x->start > y->start;
+}
+
+// Sort spans and merge the ones that overlap or touch. The checksums of
+// spans that touch are combined; download spans never overlap.
+static void span_normalize(SpanList *list)
+{
+    if (list->count == 0)
+        return;
+
+    qsort(list->items, list->count, sizeof(Span), span_compare);
+    size_t out = 0;
+    for (size_t i = 1; i < list->count; i++)
+    {
+        Span *merged = &list->items[out];
+        const Span *next = &list->items[i];
+        if (next->start <= merged->end)
+        {
+            if (next->start == merged->end)
+                merged->crc32c = crc32c_combine(merged->crc32c, next->crc32c,
+                                                next->end - next->start);
+            if (next->end > merged->end)
+                merged->end = next->end;
+        }
+        else
+        {
+            list->items[++out] = list->items[i];
+        }
+    }
+    list->count = out + 1;
+}
+
+// Replace todo with the parts of [0, size) that have does not cover
+static int span_complement(SpanList *have, uint64_t size, SpanList *todo)
+{
+    span_normalize(have);
+    todo->count = 0;
+
+    uint64_t pos = 0;
+    for (size_t i = 0; i < have->count && pos < size; i++)
+    {
+        if (have->items[i].start > pos && span_append(todo, pos, have->items[i].start, 0) != 0)
+            return -1;
+        if (have->items[i].end > pos)
+            pos = have->items[i].end;
+    }
+    if (pos < size && span_append(todo, pos, size, 0) != 0)
+        return -1;
+    return 0;
+}
+
+static uint64_t span_total(const SpanList *list)
+{
+    uint64_t total = 0;
+    for (size_t i = 0; i < list->count; i++)
+        total += list->items[i].end - list->items[i].start;
+    return total;
+}
+
+// ========== WORKERS ==========
+
+// Claim the next range; returns its length, 0 when none are left or the
+// transfer already failed
+static uint64_t claim_range(ranged_t *t, uint64_t *offset)
+{
+    pthread_mutex_lock(&t->lock);
+    uint64_t len = 0;
+    while (!t->failed && len == 0 && t->todo_pos < t->todo.count)
+    {
+        Span *span = &t->todo.items[t->todo_pos];
+        if (t->todo_off < span->start)
+            t->todo_off = span->start;
+
+        if (t->todo_off >= span->end)
+        {
+            t->todo_pos++;
+            continue;
+        }
+
+        *offset = t->todo_off;
+        len = span->end - t->todo_off;
+        if (len > TRANSFER_RANGE_SIZE)
+            len = TRANSFER_RANGE_SIZE;
+        t->todo_off += len;
+    }
+    pthread_mutex_unlock(&t->lock);
+    return len;
+}
+
+// Start handing out the todo list from the top
+static void reset_claims(ranged_t *t)
+{
+    t->todo_pos = 0;
+    t->todo_off = 0;
+    t->broken = 0;
+}
+
+static void mark_failed(ranged_t *t, int retryable)
+{
+    pthread_mutex_lock(&t->lock);
+    if (retryable)
+        t->broken = 1;
+    else
+        t->failed = 1;
+    pthread_mutex_unlock(&t->lock);
+}
+
+// Send one request frame; the caller streams body_len bytes of body
+static int send_simple(int sock, Operation op, uint16_t flags, const unsigned char *meta,
+                       size_t meta_len, uint64_t body_len)
+{
+    FrameHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.opcode = op;
+    hdr.flags = flags;
+    hdr.request_id = new_request_id();
+    return send_frame(sock, &hdr, meta, meta_len, body_len);
+}
+
+// Read a reply. An error reply is printed (unless quiet) and its body consumed.
+// Returns 0 for an OK reply (body still unread), 1 for an error reply on a
+// usable connection, -1 if the connection broke.
+static int read_reply(int sock, const RfsRequest *req, FrameHeader *hdr, unsigned char *meta,
+                      size_t meta_cap, int quiet)
+{
+    if (recv_frame(sock, hdr, meta, meta_cap) < 0)
+    {
+        fprintf(stderr, "Connection to server lost\n");
+        return -1;
+    }
+    if (hdr->status == RFS_OK || hdr->status == RFS_NOT_MODIFIED)
+        return 0;
+
+    char message[512];
+    uint64_t body_len = frame_body_len(hdr);
+    size_t take = body_len < sizeof(message) - 1 ? (size_t)body_len : sizeof(message) - 1;
+    if (recv_all(sock, message, take) < 0 || discard_data(sock, body_len - take) < 0)
+        return -1;
+    message[take] = '\0';
+
+    if (!quiet)
+        fprintf(stderr, "✗ %s '%s' failed: %s%s%s\n", operation_to_string(req->op),
+                req->remote_path, status_to_string(hdr->status), take > 0 ? ": " : "",
+                message);
+    return 1;
+}
+
+// Moves one range. Returns 0 on success, 1 on an error no retry can fix
+// (connection still usable), -1 if the connection broke.
+typedef int (*MoveFn)(ranged_t *t, int sock, uint64_t offset, uint64_t len);
+
+// Run one connection of a ranged transfer until no ranges are left.
+// Returns the socket if it is still usable, otherwise closes it and returns -1.
+static int ranged_worker(ranged_t *t, int sock, MoveFn move)
+{
+    uint64_t offset, len;
+
+    while ((len = claim_range(t, &offset)) > 0)
+    {
+        int r = move(t, sock, offset, len);
+        if (r < 0)
+        {
+            // The range goes back on the list when the transfer resumes
+            mark_failed(t, 1);
+            close(sock);
+            return -1;
+        }
+        if (r > 0)
+        {
+            mark_failed(t, 0);
+            break;
+        }
+    }
+    return sock;
+}
+
+typedef struct
+{
+    ranged_t *t;
+    MoveFn move;
+} worker_args_t;
+
+static void *ranged_thread(void *arg)
+{
+    worker_args_t *args = (worker_args_t *)arg;
+
+    int sock = session_open();
+    if (sock < 0)
+    {
+        mark_failed(args->t, 1);
+        return NULL;
+    }
+    session_close(ranged_worker(args->t, sock, args->move));
+    return NULL;
+}
+
+// Spread the todo list over this connection plus streams - 1 more.
+// Returns the control socket if it is still usable, -1 otherwise.
+static int run_ranged(ranged_t *t, int sock, int streams, MoveFn move)
+{
+    uint64_t ranges = 0;
+    for (size_t i = 0; i < t->todo.count; i++)
+    {
+        uint64_t len = t->todo.items[i].end - t->todo.items[i].start;
+        ranges += (len + TRANSFER_RANGE_SIZE - 1) / TRANSFER_RANGE_SIZE;
+    }
+    int extra = streams - 1;
+    if ((uint64_t)extra > ranges)
+        extra = ranges > 0 ? (int)ranges - 1 : 0;
+
+    worker_args_t args = {t, move};
+    pthread_t *threads = extra > 0 ? malloc(extra * sizeof(pthread_t)) : NULL;
+    int started = 0;
+    for (int i = 0; threads && i < extra; i++)
+    {
+        if (pthread_create(&threads[started], NULL, ranged_thread, &args) != 0)
+        {
+            perror("Failed to create transfer thread");
+            break;
+        }
+        started++;
+    }
+
+    // This connection takes its share too
+    if (sock >= 0)
+        sock = ranged_worker(t, sock, move);
+    else if (started == 0)
+        mark_failed(t, 1);
+
+    for (int i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+    free(threads);
+    return sock;
+}
+
+// Wait a little longer before each retry
+static void retry_pause(int attempt)
+{
+    fprintf(stderr, "Connection lost; resuming (attempt %d of %d)\n", attempt, TRANSFER_RETRIES);
+    sleep((unsigned)attempt);
+}
+
+// ========== UPLOAD ==========
+
+// Key under which the server finds this upload again: the same local file,
+// unchanged, sent from the same host
+static uint64_t upload_resume_key(const struct stat *st)
+{
+    char host[256] = "";
+    gethostname(host, sizeof(host) - 1);
+
+    uint64_t fields[5] = {(uint64_t)st->st_dev, (uint64_t)st->st_ino, (uint64_t)st->st_size,
+                          (uint64_t)st->st_mtim.tv_sec, (uint64_t)st->st_mtim.tv_nsec};
+
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    for (const char *p = host; *p; p++)
+        hash = (hash ^ (unsigned char)*p) * 1099511628211ULL;
+    const unsigned char *bytes = (const unsigned char *)fields;
+    for (size_t i = 0; i < sizeof(fields); i++)
+        hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    return hash ? hash : 1; // 0 means "do not resume"
+}
+
+// Upload one range
+static int upload_range(ranged_t *t, int sock, uint64_t offset, uint64_t len)
+{
+    unsigned char meta[16];
+    MetaWriter w;
+    meta_writer_init(&w, meta, sizeof(meta));
+    meta_put_u64(&w, t->transfer_id);
+    meta_put_u64(&w, offset);
+
+    if (send_simple(sock, OP_UPLOAD_RANGE, 0, meta, w.len, len) < 0)
+        return -1;
+
+    // The frame announced len bytes; anything else breaks the stream
+    int64_t sent = send_fd_data(sock, t->fd, offset, len);
+    if (sent != (int64_t)len)
+    {
+        fprintf(stderr, "Range at %llu of '%s' broke off (%lld/%llu bytes)\n",
+                (unsigned long long)offset, t->req->local_path, (long long)sent,
+                (unsigned long long)len);
+        return -1;
+    }
+
+    FrameHeader hdr;
+    unsigned char reply_meta[64];
+    int r = read_reply(sock, t->req, &hdr, reply_meta, sizeof(reply_meta), 0);
+    if (r != 0)
+        return r;
+    return discard_data(sock, frame_body_len(&hdr)) < 0 ? -1 : 0;
+}
+
+// Read an UPLOAD_OPEN / UPLOAD_STATUS reply into the transfer: its id,
+// and as todo, every byte the server does not have yet
+static int parse_upload_status(ranged_t *t, const unsigned char *meta, size_t meta_len)
+{
+    MetaReader r;
+    meta_reader_init(&r, meta, meta_len);
+    t->transfer_id = meta_get_u64(&r);
+    uint64_t size = meta_get_u64(&r);
+    uint32_t count = meta_get_u32(&r);
+
+    SpanList have = {NULL, 0, 0};
+    for (uint32_t i = 0; i < count && !r.error; i++)
+    {
+        uint64_t start = meta_get_u64(&r);
+        uint64_t end = meta_get_u64(&r);
+        if (span_append(&have, start, end, 0) != 0)
+            break;
+    }
+
+    int result = -1;
+    if (r.error || size != t->size)
+        fprintf(stderr, "Malformed upload status from server\n");
+    else
+        result = span_complement(&have, t->size, &t->todo);
+    free(have.items);
+    reset_claims(t);
+    return result;
+}
+
+// Send a request carrying only a transfer id and read its reply metadata.
+// Returns 0 on success, 1 on an error reply (status in *status), -1 if the
+// connection broke.
+static int transfer_request(int sock, ranged_t *t, Operation op, unsigned char *reply_meta,
+                            size_t reply_cap, size_t *reply_len, int32_t *status)
+{
+    unsigned char meta[8];
+    MetaWriter w;
+    meta_writer_init(&w, meta, sizeof(meta));
+    meta_put_u64(&w, t->transfer_id);
+
+    FrameHeader hdr;
+    if (send_simple(sock, op, 0, meta, w.len, 0) < 0)
+        return -1;
+
+    // A busy commit is retried, so it is not worth an error message
+    int r = read_reply(sock, t->req, &hdr, reply_meta, reply_cap, op == OP_UPLOAD_COMMIT);
+    if (status)
+        *status = hdr.status;
+    if (r != 0)
+        return r;
+    if (reply_len)
+        *reply_len = hdr.meta_len;
+    return discard_data(sock, frame_body_len(&hdr)) < 0 ? -1 : 0;
+}
+
+// Publish the upload. A connection that broke mid-range may still be open
+// on the server until it notices; wait that out.
+static int commit_upload(int sock, ranged_t *t, uint64_t *size)
+{
+    unsigned char reply_meta[64];
+    size_t reply_len = 0;
+    int32_t status = RFS_OK;
+
+    for (int waited = 0; waited <= SESSION_IDLE_TIMEOUT; waited++)
+    {
+        int r = transfer_request(sock, t, OP_UPLOAD_COMMIT, reply_meta, sizeof(reply_meta),
+                                 &reply_len, &status);
+        if (r < 0)
+            return -1;
+        if (r == 0)
+        {
+            MetaReader mr;
+            meta_reader_init(&mr, reply_meta, reply_len);
+            *size = meta_get_u64(&mr);
+            return 0;
+        }
+        if (status != RFS_ERR_BUSY)
+            break;
+        sleep(1);
+    }
+
+    fprintf(stderr, "✗ WRITE '%s' failed: %s\n", t->req->remote_path, status_to_string(status));
+    return -1;
+}
+
+int ranged_write(RfsRequest *req, int streams)
+{
+    unsigned char meta[RFS_MAX_META];
+    ranged_t t;
+    memset(&t, 0, sizeof(t));
+    t.req = req;
+    t.size = req->file_size;
+    req->result = -1;
+
+    struct stat st;
+    t.fd = open(req->local_path, O_RDONLY);
+    if (t.fd < 0 || fstat(t.fd, &st) != 0)
+    {
+        perror("Failed to open file");
+        if (t.fd >= 0)
+            close(t.fd);
+        return -1;
+    }
+
+    int sock = session_open();
+    if (sock < 0)
+    {
+        close(t.fd);
+        return -1;
+    }
+
+    printf("Writing '%s' to %s:%d as '%s' over %d connection(s)\n", req->local_path, SERVER_IP,
+           SERVER_PORT, req->remote_path, streams);
+
+    // Ask for a staging object of the full size, or the unfinished one this
+    // same file left behind on an earlier run
+    MetaWriter w;
+    meta_writer_init(&w, meta, sizeof(meta));
+    meta_put_str(&w, req->remote_path);
+    meta_put_u64(&w, t.size);
+    meta_put_u64(&w, upload_resume_key(&st));
+
+    FrameHeader hdr;
+    int r = send_simple(sock, OP_UPLOAD_OPEN, RFS_FLAG_RESUME, meta, w.len, 0) < 0
+                ? -1
+                : read_reply(sock, req, &hdr, meta, sizeof(meta), 0);
+    if (r == 0)
+        r = discard_data(sock, frame_body_len(&hdr)) < 0 ? -1 : 0;
+    if (r == 0)
+        r = parse_upload_status(&t, meta, hdr.meta_len);
+    if (r != 0)
+    {
+        if (r > 0)
+            session_close(sock);
+        else
+            close(sock);
+        close(t.fd);
+        return -1;
+    }
+
+    uint64_t missing = span_total(&t.todo);
+    if (missing < t.size)
+        printf("Resuming upload: %llu of %llu bytes already on the server\n",
+               (unsigned long long)(t.size - missing), (unsigned long long)t.size);
+
+    pthread_mutex_init(&t.lock, NULL);
+    for (int attempt = 1;; attempt++)
+    {
+        sock = run_ranged(&t, sock, streams, upload_range);
+        if (t.failed || !t.broken)
+            break;
+
+        if (attempt > TRANSFER_RETRIES)
+            break;
+        retry_pause(attempt);
+
+        // Only an unchanged file can be continued
+        struct stat now;
+        if (fstat(t.fd, &now) != 0 || now.st_size != st.st_size ||
+            now.st_mtim.tv_sec != st.st_mtim.tv_sec || now.st_mtim.tv_nsec != st.st_mtim.tv_nsec)
+        {
+            fprintf(stderr, "✗ WRITE '%s' failed: local file changed during the upload\n",
+                    req->remote_path);
+            t.failed = 1;
+            break;
+        }
+
+        // Ask the server what arrived, then send the rest
+        if (sock < 0)
+            sock = session_open();
+        size_t reply_len = 0;
+        r = sock < 0 ? -1
+                     : transfer_request(sock, &t, OP_UPLOAD_STATUS, meta, sizeof(meta),
+                                        &reply_len, NULL);
+        if (r > 0)
+        {
+            t.failed = 1; // the server no longer knows the upload
+            break;
+        }
+        if (r < 0)
+        {
+            if (sock >= 0)
+                close(sock);
+            sock = -1;
+            t.broken = 1;
+            continue;
+        }
+        if (parse_upload_status(&t, meta, reply_len) != 0)
+        {
+            t.failed = 1;
+            break;
+        }
+    }
+    pthread_mutex_destroy(&t.lock);
+    close(t.fd);
+    free(t.todo.items);
+
+    // The control connection may have broken while carrying ranges
+    if (sock < 0)
+        sock = session_open();
+
+    if (t.failed || t.broken)
+    {
+        if (t.failed && sock >= 0)
+        {
+            // Best effort: the server also drops abandoned uploads on its own
+            transfer_request(sock, &t, OP_UPLOAD_ABORT, meta, sizeof(meta), NULL, NULL);
+        }
+        else if (t.broken)
+        {
+            fprintf(stderr, "Upload incomplete; run the same WRITE again to resume it\n");
+        }
+        session_close(sock);
+        return -1;
+    }
+
+    uint64_t stored = 0;
+    r = sock < 0 ? -1 : commit_upload(sock, &t, &stored);
+    session_close(sock);
+    if (r != 0)
+        return -1;
+
+    req->bytes = (int64_t)stored;
+    req->result = 0;
+    printf("Sent %lld bytes to server as '%s'\n", (long long)req->bytes, req->remote_path);
+    return 0;
+}
+
+// ========== DOWNLOAD ==========
+
+static void digest_tap(void *ctx, const void *data, size_t len)
+{
+    content_digest_update((ContentDigest *)ctx, data, len);
+}
+
+// Request one range. On success the range has been written to the local
+// file, *crc is the CRC32C of its bytes, and size/identity describe the
+// remote file. digests, if not NULL, receives the checksums the server has
+// for the whole file; such a first range is fetched before the workers
+// start, and is conditional on the cached copy: if the server says that is
+// current nothing is written and t->unchanged is set.
+static int fetch_range(ranged_t *t, int sock, uint64_t offset, uint64_t len, uint64_t *size,
+                       uint64_t *identity, RemoteDigests *digests, uint64_t *received,
+                       uint32_t *crc)
+{
+    unsigned char meta[1024];
+    MetaWriter w;
+    meta_writer_init(&w, meta, sizeof(meta));
+    meta_put_str(&w, t->req->remote_path);
+    meta_put_u64(&w, offset);
+    meta_put_u64(&w, len);
+
+    uint16_t flags = RFS_FLAG_RANGE;
+    CacheValidator cached;
+    if (digests && !t->skip_cache && client_cache_lookup(t->req->remote_path, 0, &cached) == 0)
+    {
+        flags |= RFS_FLAG_IF_CHANGED;
+        meta_put_u64(&w, cached.size);
+        meta_put_u64(&w, cached.tag);
+        meta_put_u32(&w, cached.crc32c);
+    }
+
+    if (send_simple(sock, OP_GET, flags, meta, w.len, 0) < 0)
+        return -1;
+
+    FrameHeader hdr;
+    unsigned char reply_meta[64];
+    int r = read_reply(sock, t->req, &hdr, reply_meta, sizeof(reply_meta), 0);
+    if (r != 0)
+        return r;
+
+    MetaReader mr;
+    meta_reader_init(&mr, reply_meta, hdr.meta_len);
+    *size = meta_get_u64(&mr);
+    *identity = meta_get_u64(&mr);
+    if (digests)
+    {
+        // Older servers stop after the identity; the reader then reports nothing present
+        memset(digests, 0, sizeof(*digests));
+        uint8_t present = meta_get_u8(&mr);
+        digests->crc32c = meta_get_u32(&mr);
+        if (present & RFS_DIGEST_SHA256)
+            meta_get_bytes(&mr, digests->sha256, SHA256_DIGEST_SIZE);
+        digests->present = mr.error ? 0 : present;
+    }
+
+    if (hdr.status == RFS_NOT_MODIFIED)
+    {
+        t->unchanged = 1;
+        *received = 0;
+        return 0;
+    }
+
+    // The range is checksummed as it lands. Only the range that continues
+    // the bytes hashed in order so far can extend the SHA-256.
+    ContentDigest digest;
+    content_digest_init(&digest, 0);
+    if (!digests)
+        pthread_mutex_lock(&t->lock);
+    if ((t->digests.present & RFS_DIGEST_SHA256) && offset == t->hashed && !t->hashing)
+    {
+        digest.strong = 1;
+        digest.sha256 = t->sha256;
+        t->hashing = 1;
+    }
+    if (!digests)
+        pthread_mutex_unlock(&t->lock);
+
+    uint64_t body_len = frame_body_len(&hdr);
+    int64_t got = recv_fd_data(sock, t->fd, offset, body_len, digest_tap, &digest);
+
+    if (!digests)
+        pthread_mutex_lock(&t->lock);
+    if (digest.strong)
+    {
+        if (got == (int64_t)body_len)
+        {
+            t->sha256 = digest.sha256;
+            t->hashed = offset + body_len;
+        }
+        t->hashing = 0;
+    }
+    if (!digests)
+        pthread_mutex_unlock(&t->lock);
+
+    if (got != (int64_t)body_len)
+    {
+        fprintf(stderr, "Incomplete range received: %lld/%llu bytes\n", (long long)got,
+                (unsigned long long)body_len);
+        return -1;
+    }
+    *received = body_len;
+    *crc = digest.crc32c;
+    return 0;
+}
+
+// Record how much of the download is complete from byte 0 on. Caller
+// holds lock (or runs before the workers start).
+static void save_progress(ranged_t *t)
+{
+    span_normalize(&t->done);
+    uint64_t prefix = 0;
+    uint32_t crc = 0;
+    if (t->done.count > 0 && t->done.items[0].start == 0)
+    {
+        prefix = t->done.items[0].end;
+        crc = t->done.items[0].crc32c;
+    }
+    if (prefix <= t->saved)
+        return;
+
+    char tag[80];
+    int len = snprintf(tag, sizeof(tag), "%llu %llu %llu %08x", (unsigned long long)t->size,
+                       (unsigned long long)t->identity, (unsigned long long)prefix, crc);
+    if (fsetxattr(t->fd, RESUME_XATTR, tag, len, 0) == 0)
+        t->saved = prefix;
+}
+
+static int download_range(ranged_t *t, int sock, uint64_t offset, uint64_t len)
+{
+    uint64_t size, identity, received;
+    uint32_t crc;
+    int r = fetch_range(t, sock, offset, len, &size, &identity, NULL, &received, &crc);
+    if (r != 0)
+        return r;
+
+    // Every range must come from the version the first one came from
+    if (size != t->size || identity != t->identity)
+    {
+        fprintf(stderr, "✗ GET '%s' failed: file was replaced during the download\n",
+                t->req->remote_path);
+        return 1;
+    }
+
+    pthread_mutex_lock(&t->lock);
+    r = span_append(&t->done, offset, offset + received, crc);
+    if (r == 0)
+        save_progress(t);
+    pthread_mutex_unlock(&t->lock);
+    return r == 0 ? 0 : 1;
+}
+
+// Check a finished download against the checksums the server recorded,
+// using the checksums taken as its ranges landed. The SHA-256 is checked
+// when the ranges arrived in order; the CRC32C always is. Returns 0 if it
+// matches or there is nothing to check against.
+static int verify_download(ranged_t *t)
+{
+    const RemoteDigests *d = &t->digests;
+    if (!(d->present & RFS_DIGEST_CRC32C))
+        return 0;
+
+    span_normalize(&t->done);
+    uint32_t crc = t->done.count > 0 ? t->done.items[0].crc32c : 0;
+
+    int strong = (d->present & RFS_DIGEST_SHA256) && t->hashed == t->size;
+    unsigned char sha[SHA256_DIGEST_SIZE];
+    if (strong)
+        sha256_final(&t->sha256, sha);
+
+    if (crc != d->crc32c || (strong && memcmp(sha, d->sha256, SHA256_DIGEST_SIZE) != 0))
+    {
+        fprintf(stderr, "✗ GET '%s' failed: checksum mismatch (CRC32C %08x, expected %08x)\n",
+                t->req->remote_path, crc, d->crc32c);
+        return -1;
+    }
+
+    printf("Verified CRC32C %08x%s\n", crc, strong ? " and SHA-256" : "");
+    return 0;
+}
+
+// Bytes of a partial download that can be trusted (and their CRC32C), or 0
+// if there is no record of what it holds
+static uint64_t resumable_bytes(int fd, uint64_t *size, uint64_t *identity, uint32_t *crc)
+{
+    char tag[80];
+    ssize_t n = fgetxattr(fd, RESUME_XATTR, tag, sizeof(tag) - 1);
+    if (n <= 0)
+        return 0;
+    tag[n] = '\0';
+
+    unsigned long long s, id, prefix;
+    unsigned int sum;
+    if (sscanf(tag, "%llu %llu %llu %x", &s, &id, &prefix, &sum) != 4)
+        return 0;
+    *size = s;
+    *identity = id;
+    *crc = sum;
+    return prefix;
+}
+
+int ranged_get(RfsRequest *req, int streams)
+{
+    ranged_t t;
+    memset(&t, 0, sizeof(t));
+    t.req = req;
+    sha256_init(&t.sha256);
+    req->result = -1;
+
+    // Bytes land in "<local>.part" and only take the real name when complete
+    char part_path[sizeof(req->local_path) + 8];
+    snprintf(part_path, sizeof(part_path), "%s.part", req->local_path);
+
+    int sock = session_open();
+    if (sock < 0)
+        return -1;
+
+    printf("Downloading '%s' from %s:%d to '%s'\n", req->remote_path, SERVER_IP, SERVER_PORT,
+           req->local_path);
+
+    t.fd = open(part_path, O_WRONLY | O_CREAT, 0644);
+    if (t.fd < 0)
+    {
+        perror("Failed to create local file");
+        session_close(sock);
+        return -1;
+    }
+
+    // Anything past the recorded prefix may have holes; drop it
+    uint64_t old_size = 0, old_identity = 0;
+    uint32_t have_crc = 0;
+    uint64_t have = resumable_bytes(t.fd, &old_size, &old_identity, &have_crc);
+    if (ftruncate(t.fd, (off_t)have) != 0)
+        perror("Failed to reset partial file");
+
+    // The first range tells how large the file is
+    uint64_t received = 0;
+    uint32_t crc = 0;
+    int r = fetch_range(&t, sock, have, TRANSFER_RANGE_SIZE, &t.size, &t.identity, &t.digests,
+                        &received, &crc);
+    if (r == 0 && t.unchanged)
+    {
+        int64_t copied = client_cache_restore(req->remote_path, 0, req->local_path);
+        if (copied >= 0)
+        {
+            session_close(sock);
+            close(t.fd);
+            remove(part_path);
+            req->bytes = 0;
+            req->result = 0;
+            printf("Not modified; copied %lld cached bytes to '%s'\n", (long long)copied,
+                   req->local_path);
+            return 0;
+        }
+
+        // The cached copy went away after the request was sent
+        t.unchanged = 0;
+        t.skip_cache = 1;
+        r = fetch_range(&t, sock, have, TRANSFER_RANGE_SIZE, &t.size, &t.identity, &t.digests,
+                        &received, &crc);
+    }
+    t.skip_cache = 1;
+    if (r == 0 && have > 0 && (t.size != old_size || t.identity != old_identity))
+    {
+        printf("Remote file changed since the partial download; starting over\n");
+        have = 0;
+        have_crc = 0;
+        r = ftruncate(t.fd, 0) == 0
+                ? fetch_range(&t, sock, 0, TRANSFER_RANGE_SIZE, &t.size, &t.identity,
+                              &t.digests, &received, &crc)
+                : 1;
+    }
+    else if (r == 0 && have > 0)
+    {
+        printf("Resuming download at byte %llu of %llu\n", (unsigned long long)have,
+               (unsigned long long)t.size);
+    }
+    if (r < 0)
+    {
+        close(sock);
+        sock = -1;
+    }
+
+    if (r == 0)
+    {
+        // Partial bytes plus the first range are done; everything else is todo
+        t.saved = have;
+        uint32_t first_crc = crc32c_combine(have_crc, crc, received);
+        if (span_append(&t.done, 0, have + received, first_crc) != 0 ||
+            span_complement(&t.done, t.size, &t.todo) != 0)
+            t.failed = 1;
+        save_progress(&t);
+
+        uint64_t missing = span_total(&t.todo);
+        if (t.size < PARALLEL_MIN_SIZE)
+            streams = 1;
+        if (missing > 0 && streams > 1)
+            printf("Fetching %llu bytes over %d connection(s)\n", (unsigned long long)missing,
+                   streams);
+
+        pthread_mutex_init(&t.lock, NULL);
+        for (int attempt = 1; !t.failed && missing > 0; attempt++)
+        {
+            sock = run_ranged(&t, sock, streams, download_range);
+            if (t.failed || !t.broken || attempt > TRANSFER_RETRIES)
+                break;
+
+            retry_pause(attempt);
+            if (sock < 0)
+                sock = session_open();
+            if (span_complement(&t.done, t.size, &t.todo) != 0)
+                t.failed = 1;
+            reset_claims(&t);
+        }
+        pthread_mutex_destroy(&t.lock);
+        r = (t.failed || t.broken) ? 1 : 0;
+    }
+    else
+    {
+        t.failed = r > 0;
+        t.broken = r < 0;
+        // The record of what was there stays; a later GET may still continue it
+        t.saved = have;
+    }
+
+    session_close(sock);
+    free(t.todo.items);
+
+    if (r != 0)
+    {
+        // After an error no retry can fix (e.g. the file is gone) the
+        // partial bytes are useless
+        uint64_t kept = t.failed ? 0 : t.saved;
+        close(t.fd);
+        free(t.done.items);
+        if (kept > 0)
+        {
+            fprintf(stderr, "Partial download kept in '%s' (%llu bytes); run GET again to resume\n",
+                    part_path, (unsigned long long)kept);
+        }
+        else
+        {
+            remove(part_path); // Clean up partial file
+        }
+        return -1;
+    }
+
+    fremovexattr(t.fd, RESUME_XATTR);
+    close(t.fd);
+
+    // Corrupt bytes are no use for resuming either
+    int verified = verify_download(&t);
+    free(t.done.items);
+    if (verified != 0)
+    {
+        remove(part_path);
+        return -1;
+    }
+
+    if (rename(part_path, req->local_path) != 0)
+    {
+        perror("Failed to move download into place");
+        return -1;
+    }
+
+    req->bytes = (int64_t)t.size;
+    req->result = 0;
+    printf("Received %lld bytes, saved to '%s'\n", (long long)req->bytes, req->local_path);
+
+    // Kept so that the next GET of the file can be conditional
+    CacheValidator v = {t.size, t.identity,
+                        (t.digests.present & RFS_DIGEST_CRC32C) ? t.digests.crc32c : 0};
+    client_cache_store(req->remote_path, 0, req->local_path, &v);
+    return 0;
+}
@@ -0,0 +1,37 @@
+/*
+ * ranged_transfer.h, Yehen Yan, CS5600 Practicum II
+ * Large-file transfers split into byte ranges over parallel connections
+ * Last modified: Dec 2025
+ */
+
+#ifndef RANGED_TRANSFER_H
+#define RANGED_TRANSFER_H
+
+#include "operations.h"
+
+/**
+ * @brief Upload a prepared WRITE request as ranges over several connections
+ *
+ * The server stages the ranges in a hidden part file and publishes it
+ * (with the usual backup of the previous version) only when every range
+ * has arrived, so readers never see a partially uploaded file.
+ *
+ * @param req Prepared WRITE request; result and bytes are filled in
+ * @param streams Number of parallel connections
+ * @return int 0 on success, -1 on failure
+ */
+int ranged_write(RfsRequest *req, int streams);
+
+/**
+ * @brief Download a prepared GET request as ranges over several connections
+ *
+ * The first range also reports the file size; further connections are
+ * only opened if the file is at least PARALLEL_MIN_SIZE bytes.
+ *
+ * @param req Prepared GET request; result and bytes are filled in
+ * @param streams Number of parallel connections
+ * @return int 0 on success, -1 on failure
+ */
+int ranged_get(RfsRequest *req, int streams);
+
+#endif // RANGED_TRANSFER_H
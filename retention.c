@@ -0,0 +1,232 @@
+/*
+ * retention.c, Yehen Yan, CS5600 Practicum II
+ * Background pruning of old versions
+ * Last modified: Dec 2025
+ */
+#define _XOPEN_SOURCE 700 // clock_gettime
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include "retention.h"
+#include "version_manifest.h"
+#include "lock_table.h"
+#include "chunk_store.h"
+#include "meta_cache.h"
+#include "dedup_index.h"
+#include "config.h"
+
+#define US_PER_SECOND 1000000LL
+
+static RetentionPolicy policy;
+static char storage_root[512];
+static pthread_t thread;
+static int running;
+static int stopping;
+static pthread_mutex_t stop_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t stop_signal = PTHREAD_COND_INITIALIZER;
+
+int retention_active(const RetentionPolicy *p)
+{
+    return p->keep_last > 0 || p->keep_within_s > 0 || p->thin;
+}
+
+size_t retention_select(const RetentionPolicy *p, const int64_t *written_us, size_t count,
+                        int64_t now_us, unsigned char *expired)
+{
+    size_t n = 0;
+    int64_t last_bucket = -1;
+    int64_t last_len = 0;
+
+    if (!retention_active(p))
+    {
+        memset(expired, 0, count);
+        return 0;
+    }
+
+    // Newest first, so thinning keeps the newest version of each bucket
+    for (size_t k = 0; k < count; k++)
+    {
+        size_t i = count - 1 - k;
+        int64_t age = now_us - written_us[i];
+        int keep = 0;
+
+        if (p->keep_last > 0 && k < p->keep_last)
+            keep = 1;
+        if (p->keep_within_s > 0 && age < p->keep_within_s * US_PER_SECOND)
+            keep = 1;
+        if (p->thin)
+        {
+            int64_t len = age < THIN_HOURLY_SECONDS * US_PER_SECOND  ? 3600 * US_PER_SECOND
+                          : age < THIN_DAILY_SECONDS * US_PER_SECOND ? 86400 * US_PER_SECOND
+                                                                     : 0;
+            if (len > 0)
+            {
+                int64_t bucket = written_us[i] / len;
+                if (len != last_len || bucket != last_bucket)
+                    keep = 1;
+                last_bucket = bucket;
+                last_len = len;
+            }
+        }
+
+        expired[i] = !keep;
+        n += !keep;
+    }
+    return n;
+}
+
+static int is_stopping(void)
+{
+    return __atomic_load_n(&stopping, __ATOMIC_RELAXED);
+}
+
+static int64_t now_us(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * US_PER_SECOND + tv.tv_usec;
+}
+
+// Spread deletions out so pruning a large backlog does not swamp the disk
+static void throttle(void)
+{
+    struct timespec pause = {0, 1000000000L / RETENTION_DELETES_PER_SECOND};
+    nanosleep(&pause, NULL);
+}
+
+static void delete_version_file(const char *dir, const VersionEntry *v)
+{
+    // A packed version leaves dead space for the repacker to reclaim
+    if (v->pack)
+        return;
+
+    char path[768];
+    snprintf(path, sizeof(path), "%s/%s", dir, v->name);
+    int result = v->chunked ? chunk_store_release(path) : unlink(path);
+    if (result != 0)
+        perror("Failed to delete expired version");
+    meta_cache_refresh(path);
+    dedup_index_forget(path);
+}
+
+// Delete the expired versions of one file
+static void prune_file(const char *full_path, const char *dir)
+{
+    VersionManifest m;
+    path_lock_shared(full_path);
+    int loaded = manifest_snapshot(full_path, &m) == 0;
+    path_unlock(full_path);
+    if (!loaded || m.count == 0)
+    {
+        if (loaded)
+            manifest_free(&m);
+        return;
+    }
+
+    // Decided on a copy; the exclusive lock is only held to drop a batch
+    int64_t *written = malloc(m.count * sizeof(int64_t));
+    unsigned char *expired = malloc(m.count);
+    VersionEntry *drop = malloc(m.count * sizeof(VersionEntry));
+    VersionEntry removed[RETENTION_BATCH];
+    size_t total = 0;
+
+    if (written && expired && drop)
+    {
+        for (size_t i = 0; i < m.count; i++)
+            written[i] = m.versions[i].written_us;
+        retention_select(&policy, written, m.count, now_us(), expired);
+        for (size_t i = 0; i < m.count; i++)
+        {
+            if (expired[i])
+                drop[total++] = m.versions[i];
+        }
+    }
+
+    size_t deleted = 0;
+    for (size_t off = 0; off < total && !is_stopping(); off += RETENTION_BATCH)
+    {
+        size_t batch = total - off < RETENTION_BATCH ? total - off : RETENTION_BATCH;
+
+        path_lock_exclusive(full_path);
+        int n = manifest_drop_versions(full_path, drop + off, batch, removed);
+        path_unlock(full_path);
+
+        // No request can find a dropped version, so its file goes unlocked
+        for (int i = 0; i < n; i++)
+        {
+            delete_version_file(dir, &removed[i]);
+            throttle();
+        }
+        deleted += n > 0 ? (size_t)n : 0;
+    }
+
+    if (deleted > 0)
+        printf("Retention: deleted %zu old version(s) of %s\n", deleted, full_path);
+
+    free(written);
+    free(expired);
+    free(drop);
+    manifest_free(&m);
+}
+
+static int prune_manifest(const char *full_path, const char *dir)
+{
+    prune_file(full_path, dir);
+    return is_stopping();
+}
+
+static void *retention_thread(void *arg)
+{
+    (void)arg;
+    for (;;)
+    {
+        manifest_walk(storage_root, prune_manifest);
+
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_sec += RETENTION_INTERVAL;
+
+        pthread_mutex_lock(&stop_lock);
+        while (!stopping && pthread_cond_timedwait(&stop_signal, &stop_lock, &until) == 0)
+            ;
+        int stop = stopping;
+        pthread_mutex_unlock(&stop_lock);
+        if (stop)
+            break;
+    }
+    return NULL;
+}
+
+int retention_start(const char *root, const RetentionPolicy *p)
+{
+    if (!retention_active(p))
+        return 0;
+
+    policy = *p;
+    snprintf(storage_root, sizeof(storage_root), "%s", root);
+    if (pthread_create(&thread, NULL, retention_thread, NULL) != 0)
+    {
+        perror("Failed to start retention thread");
+        return -1;
+    }
+    running = 1;
+    return 0;
+}
+
+void retention_stop(void)
+{
+    if (!running)
+        return;
+
+    pthread_mutex_lock(&stop_lock);
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELAXED);
+    pthread_cond_signal(&stop_signal);
+    pthread_mutex_unlock(&stop_lock);
+    pthread_join(thread, NULL);
+    running = 0;
+}
@@ -0,0 +1,62 @@
+/*
+ * retention.h, Yehen Yan, CS5600 Practicum II
+ * Background pruning of old versions
+ * Last modified: Dec 2025
+ */
+
+#ifndef RETENTION_H
+#define RETENTION_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Which versions to keep. Each enabled rule keeps some versions; a version
+// no rule keeps is deleted. With no rule enabled nothing is deleted.
+typedef struct
+{
+    uint32_t keep_last;    // the newest keep_last versions (0 = rule off)
+    int64_t keep_within_s; // versions younger than this (0 = rule off)
+    int thin;              // the newest version of each hour for THIN_HOURLY_SECONDS,
+                           // then of each day for THIN_DAILY_SECONDS
+} RetentionPolicy;
+
+/**
+ * @brief Whether a policy removes anything at all
+ *
+ * @param policy retention policy
+ * @return int 1 if any rule is set
+ */
+int retention_active(const RetentionPolicy *policy);
+
+/**
+ * @brief Pick the versions a policy expires
+ *
+ * @param policy retention policy
+ * @param written_us backup times of the versions, ascending (oldest first)
+ * @param count number of versions
+ * @param now_us current time, microseconds since the epoch
+ * @param expired set to 1 for each version to delete, 0 otherwise
+ * @return size_t number of versions expired
+ */
+size_t retention_select(const RetentionPolicy *policy, const int64_t *written_us, size_t count,
+                        int64_t now_us, unsigned char *expired);
+
+/**
+ * @brief Start the retention thread
+ *
+ * Every RETENTION_INTERVAL seconds the thread walks the version manifests
+ * under root and deletes expired versions, at most
+ * RETENTION_DELETES_PER_SECOND files per second.
+ *
+ * @param root storage root
+ * @param policy retention policy; nothing is started if it is inactive
+ * @return int 0 on success, -1 if the thread could not be started
+ */
+int retention_start(const char *root, const RetentionPolicy *policy);
+
+/**
+ * @brief Stop the retention thread, finishing the version being deleted
+ */
+void retention_stop(void);
+
+#endif // RETENTION_H
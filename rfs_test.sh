@@ -7,6 +7,9 @@ GREEN='\033[0;32m'
 BLUE='\033[0;34m'
 NC='\033[0m' # No Color
 
+# Keep the client's download cache out of the user's home directory
+export RFS_CACHE_DIR=$(mktemp -d)
+
 echo -e "${BLUE}=== Starting Server in Background ===${NC}"
 make && ./server > server.log 2>&1 &
 SERVER_PID=$!
@@ -43,6 +46,13 @@ diff test.txt remote.txt > /dev/null 2>&1
 if [ $? -eq 0 ]; then echo -e "${GREEN}✓ GET without local path passed${NC}"; else echo -e "${RED}✗ GET without local path failed${NC}";
 fi
 
+# Test 3c: an unchanged file comes from the client cache
+echo -e "${BLUE}Test 3c: Conditional GET${NC}"
+rm -f downloaded.txt
+./rfs GET remote.txt downloaded.txt | grep "Not modified" > /dev/null && diff test.txt downloaded.txt > /dev/null 2>&1
+if [ $? -eq 0 ]; then echo -e "${GREEN}✓ Conditional GET passed${NC}"; else echo -e "${RED}✗ Conditional GET failed${NC}";
+fi
+
 # Test 4
 echo -e "${BLUE}Test 4: Versioning${NC}"
 echo "version 1" > versioned.txt
@@ -62,6 +72,12 @@ echo -e "${BLUE}Test 4a: LS operation${NC}"
 if [ $? -eq 0 ]; then echo -e "${GREEN}✓ LS passed${NC}"; else echo -e "${RED}✗ LS failed${NC}";
 fi
 
+# Directory listings come back as records; the file above shows its 2 versions
+echo -e "${BLUE}Test 4a2: LS directory${NC}"
+./rfs LS . | grep "^remote_versioned.txt .*2 version(s)"
+if [ $? -eq 0 ]; then echo -e "${GREEN}✓ LS directory passed${NC}"; else echo -e "${RED}✗ LS directory failed${NC}";
+fi
+
 # Test 4b: GET specific version
 echo -e "${BLUE}Test 4b: GET specific version${NC}"
 ./rfs GETVERSION remote_versioned.txt 2
@@ -97,6 +113,64 @@ done
 
 echo -e "${GREEN}✓ All concurrent operations completed${NC}"
 
+# Test 6b: several operations over one session connection
+echo -e "${BLUE}Test 6b: SESSION with multiple operations${NC}"
+echo "session content" > session.txt
+printf "WRITE session.txt remote_session.txt\nGET remote_session.txt session_out.txt\nLS remote_session.txt\nRM remote_session.txt\n" | ./rfs SESSION
+if [ $? -eq 0 ] && diff session.txt session_out.txt > /dev/null 2>&1; then echo -e "${GREEN}✓ SESSION passed${NC}"; else echo -e "${RED}✗ SESSION failed${NC}";
+fi
+
+# Test 6c: independent operations from a manifest over a connection pool
+echo -e "${BLUE}Test 6c: BATCH from a manifest${NC}"
+for i in 1 2 3; do echo "batch content $i" > batch_$i.txt; done
+printf "WRITE batch_1.txt batch/b1.txt\nWRITE batch_2.txt batch/b2.txt\nWRITE batch_3.txt batch/b3.txt\n" > batch_manifest.txt
+./rfs BATCH -j 2 batch_manifest.txt && printf "GET batch/b1.txt batch_out_1.txt\nGET batch/b3.txt batch_out_3.txt\n" | ./rfs BATCH
+if [ $? -eq 0 ] && diff batch_1.txt batch_out_1.txt > /dev/null 2>&1 && diff batch_3.txt batch_out_3.txt > /dev/null 2>&1; then echo -e "${GREEN}✓ BATCH passed${NC}"; else echo -e "${RED}✗ BATCH failed${NC}";
+fi
+
+# Test 6c2: a directory tree up and back down
+echo -e "${BLUE}Test 6c2: Tree WRITE/GET${NC}"
+rm -rf tree_out && mkdir -p tree_src/a/b tree_src/empty
+for i in 1 2 3; do echo "tree content $i" > tree_src/a/t$i.txt; done
+echo "deep" > tree_src/a/b/deep.txt
+./rfs WRITE -r tree_src tree > /dev/null && ./rfs GET -r tree tree_out > /dev/null
+if [ $? -eq 0 ] && diff -r tree_src tree_out > /dev/null 2>&1; then echo -e "${GREEN}✓ Tree WRITE/GET passed${NC}"; else echo -e "${RED}✗ Tree WRITE/GET failed${NC}";
+fi
+
+# Test 6c3: a tree whose directories the server rejects is not uploaded at all
+echo -e "${BLUE}Test 6c3: Rejected tree WRITE${NC}"
+if ! ./rfs WRITE -r tree_src bad_tree/.rfs_tree > /dev/null 2>&1 && ! ./rfs LS bad_tree > /dev/null 2>&1; then echo -e "${GREEN}✓ Rejected tree WRITE passed${NC}"; else echo -e "${RED}✗ Rejected tree WRITE failed${NC}";
+fi
+
+# Test 6d: a large file in ranges over parallel connections, checked
+# against the checksum the server recorded
+echo -e "${BLUE}Test 6d: Parallel ranged WRITE/GET${NC}"
+head -c 80000000 /dev/urandom > ranged.bin
+./rfs WRITE -j 4 ranged.bin big/ranged.bin && ./rfs GET -j 4 big/ranged.bin ranged_out.bin | grep "Verified CRC32C" > /dev/null
+if [ $? -eq 0 ] && cmp -s ranged.bin ranged_out.bin; then echo -e "${GREEN}✓ Parallel ranged transfer passed${NC}"; else echo -e "${RED}✗ Parallel ranged transfer failed${NC}";
+fi
+./rfs RM big/ranged.bin > /dev/null
+
+# Test 6e: a small edit to a stored file goes as a delta
+echo -e "${BLUE}Test 6e: Delta WRITE${NC}"
+head -c 8000000 /dev/urandom > delta.bin
+./rfs WRITE delta.bin delta.bin > /dev/null
+printf 'edit' | dd of=delta.bin bs=1 seek=3000000 conv=notrunc 2> /dev/null
+./rfs WRITE delta.bin delta.bin | grep -q "delta" && ./rfs GET delta.bin delta_out.bin > /dev/null
+if [ $? -eq 0 ] && cmp -s delta.bin delta_out.bin; then echo -e "${GREEN}✓ Delta WRITE passed${NC}"; else echo -e "${RED}✗ Delta WRITE failed${NC}";
+fi
+./rfs RM delta.bin > /dev/null
+
+# Test 6f: a stored file changed behind the server's back fails its checksum
+echo -e "${BLUE}Test 6f: Corrupted download${NC}"
+echo "checked content" > corrupt.txt
+./rfs WRITE corrupt.txt corrupt.txt > /dev/null
+printf 'X' | dd of=rfs_storage/corrupt.txt bs=1 seek=0 conv=notrunc 2> /dev/null
+echo "GET corrupt.txt corrupt_out.txt" | ./rfs SESSION 2>&1 | grep -q "checksum mismatch"
+if [ $? -eq 0 ] && [ ! -e corrupt_out.txt ]; then echo -e "${GREEN}✓ Corrupted download passed${NC}"; else echo -e "${RED}✗ Corrupted download failed${NC}";
+fi
+./rfs RM corrupt.txt > /dev/null
+
 # Test 7
 echo -e "${BLUE}Test 7: STOP operation${NC}"
 ./rfs STOP
@@ -113,7 +187,8 @@ tail -20 server.log
 
 echo -e "${BLUE}=== Tests Completed ===${NC}"
 kill $SERVER_PID 2>/dev/null
-rm -f test.txt test2.txt downloaded.txt versioned.txt server.log concurrent_*.txt remote.txt remote_versioned.txt remote_versioned.txt.v2 remote_concurrent_*.txt
+rm -rf "$RFS_CACHE_DIR" tree_src tree_out
+rm -f test.txt test2.txt downloaded.txt versioned.txt server.log concurrent_*.txt remote.txt remote_versioned.txt remote_versioned.txt.v2 remote_concurrent_*.txt session.txt session_out.txt batch_*.txt ranged.bin ranged_out.bin delta.bin delta_out.bin corrupt.txt corrupt_out.txt
 make clean
 exit 0
 
@@ -3,32 +3,47 @@
  * Main server implementation
  * Last modified: Dec 2025
  */
-#define _POSIX_C_SOURCE 200809L // linux standard
+#define _GNU_SOURCE // accept4
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
-#include <sys/select.h>
+#include <sys/epoll.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <time.h>
 #include <pthread.h>
 #include <signal.h>
 #include "operations.h"
 #include "server_handlers.h"
+#include "connection.h"
+#include "worker_pool.h"
+#include "staging.h"
+#include "chunk_store.h"
+#include "compression.h"
+#include "retention.h"
+#include "dedup_index.h"
+#include "pack_store.h"
+#include "meta_cache.h"
+#include "content_cache.h"
+#include "checksum.h"
+#include "file_utils.h"
+#include "lock_table.h"
+#include "uring.h"
 #include "network.h"
+#include "protocol.h"
 #include "config.h"
 
-static int global_socket_desc = -1;
-
-// Structure to pass to thread
-typedef struct
-{
-  int client_sock;
-  struct sockaddr_in client_addr;
-} thread_args_t;
+// Every open client connection, for idle sweeps and shutdown. The list,
+// its count and each connection's queued flag are guarded by conn_lock.
+static Connection *connections = NULL;
+static unsigned int connection_count = 0;
+static unsigned int next_connection_id = 0;
+static pthread_mutex_t conn_lock = PTHREAD_MUTEX_INITIALIZER;
+static int epoll_fd = -1;
 
 // Signal handler for graceful shutdown
 void signal_handler(int signum)
@@ -36,106 +51,247 @@ void signal_handler(int signum)
   printf("\n\n[SIGNAL] Received signal %d (Ctrl+C)\n", signum);
   printf("[SIGNAL] Initiating graceful shutdown...\n");
 
-  // Set server to stop
+  // Set server to stop; the event loop notices on its next wakeup
   set_server_running(0);
 
-  // Close listening socket to unblock accept()
-  if (global_socket_desc >= 0)
-  {
-    printf("[SIGNAL] Closing listening socket\n");
-    close(global_socket_desc);
-    global_socket_desc = -1;
-  }
-
   printf("[SIGNAL] Server will shut down after current operations complete\n");
 }
 
-// Thread function to handle each client
-void *handle_client(void *arg)
+// Remove a connection from the list; caller holds conn_lock
+static void unlink_connection(Connection *conn)
+{
+  if (conn->prev)
+    conn->prev->next = conn->next;
+  else
+    connections = conn->next;
+  if (conn->next)
+    conn->next->prev = conn->prev;
+  conn->prev = conn->next = NULL;
+  connection_count--;
+}
+
+// Unlink and destroy a connection that no worker owns
+static void close_connection(Connection *conn)
+{
+  pthread_mutex_lock(&conn_lock);
+  unlink_connection(conn);
+  pthread_mutex_unlock(&conn_lock);
+
+  printf("[Conn %u] Connection ended after %u request(s)\n", conn->id, conn->served);
+  connection_destroy(conn);
+}
+
+// Watch a connection for the one direction it is blocked on. EPOLLONESHOT
+// disarms it after one event, so a connection belongs to at most one worker.
+static int arm_connection(Connection *conn, int op)
 {
-  thread_args_t *args = (thread_args_t *)arg;
-  int client_sock = args->client_sock;
-  struct sockaddr_in client_addr = args->client_addr;
-
-  printf("\n[Thread %lu] Client connected from %s:%d\n",
-         (unsigned long)pthread_self(),
-         inet_ntoa(client_addr.sin_addr),
-         ntohs(client_addr.sin_port));
-
-  // Receive operation length
-  int op_len;
-  if (recv(client_sock, &op_len, sizeof(int), 0) <= 0)
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = (connection_wants_write(conn) ? EPOLLOUT : EPOLLIN) |
+              EPOLLRDHUP | EPOLLET | EPOLLONESHOT;
+  ev.data.ptr = conn;
+  return epoll_ctl(epoll_fd, op, conn->sock, &ev);
+}
+
+// Worker body: advance one ready connection, then hand it back to epoll
+static void serve_ready_connection(void *item)
+{
+  Connection *conn = item;
+
+  if (connection_process(conn) != 0)
   {
-    printf("[Thread %lu] Failed to receive operation length\n",
-           (unsigned long)pthread_self());
-    close(client_sock);
-    free(args);
-    return NULL;
+    close_connection(conn);
+    return;
   }
 
-  // Receive operation string
-  char operation_str[10];
-  memset(operation_str, 0, sizeof(operation_str));
-  if (recv(client_sock, operation_str, op_len, 0) <= 0)
+  // Re-arm under the lock so the idle sweep never sees a connection that
+  // is neither queued nor watched
+  pthread_mutex_lock(&conn_lock);
+  conn->queued = 0;
+  int armed = arm_connection(conn, EPOLL_CTL_MOD);
+  pthread_mutex_unlock(&conn_lock);
+
+  if (armed < 0)
   {
-    printf("[Thread %lu] Failed to receive operation\n",
-           (unsigned long)pthread_self());
-    close(client_sock);
-    free(args);
-    return NULL;
+    perror("Failed to re-arm client socket");
+    close_connection(conn);
   }
+}
 
-  operation_str[op_len] = '\0';
-  Operation op = parse_operation(operation_str);
-  printf("[Thread %lu] Operation: %s\n",
-         (unsigned long)pthread_self(), operation_to_string(op));
+// Turn a connection away before it is served. Request id 0 marks a reply
+// that is about the connection rather than one request.
+static void reject_connection(int client_sock, const char *reason)
+{
+  unsigned char frame[RFS_HEADER_SIZE];
+  FrameHeader reply;
+  size_t len = strlen(reason);
+
+  memset(&reply, 0, sizeof(reply));
+  reply.version = RFS_PROTOCOL_VERSION;
+  reply.status = RFS_ERR_BUSY;
+  reply.payload_len = len;
+  frame_encode_header(&reply, frame);
+
+  // Best effort: a fresh socket has room for this, and nothing is retried
+  if (send_nb(client_sock, frame, sizeof(frame)) == (ssize_t)sizeof(frame))
+    send_nb(client_sock, reason, len);
+  close(client_sock);
+}
 
-  // Dispatch to handlers - ALL handlers are in server_handlers.c
-  switch (op)
+// Accept every pending connection (the listening socket is edge-triggered)
+static void accept_connections(int listen_sock)
+{
+  for (;;)
   {
-  case OP_WRITE:
-    handle_write_request(client_sock);
-    break;
-
-  case OP_GET:
-    handle_get_request(client_sock);
-    break;
-
-  case OP_GETVERSION:
-    handle_getversion_request(client_sock);
-    break;
-
-  case OP_RM:
-    handle_rm_request(client_sock);
-    break;
-
-  case OP_LS:
-    handle_ls_request(client_sock);
-    break;
-
-  case OP_STOP:
-    handle_stop_request();
-    break;
-
-  case OP_UNKNOWN:
-  default:
-    printf("[Thread %lu] Unknown operation: %s\n",
-           (unsigned long)pthread_self(), operation_str);
-    break;
+    struct sockaddr_in client_addr;
+    socklen_t client_size = sizeof(client_addr);
+    int client_sock = accept4(listen_sock, (struct sockaddr *)&client_addr, &client_size,
+                              SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (client_sock < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        perror("Accept failed");
+      return;
+    }
+
+    // Each connection occupies at most one queue slot, so admitting no more
+    // than MAX_CONNECTIONS keeps the work queue from ever overflowing
+    pthread_mutex_lock(&conn_lock);
+    unsigned int open_count = connection_count;
+    pthread_mutex_unlock(&conn_lock);
+
+    if (open_count >= MAX_CONNECTIONS)
+    {
+      printf("[INFO] %u connections open, rejecting %s:%d\n", open_count,
+             inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
+      reject_connection(client_sock, "Too many connections, try again later");
+      continue;
+    }
+
+    Connection *conn = connection_create(client_sock, ++next_connection_id);
+    if (!conn)
+    {
+      reject_connection(client_sock, "Out of memory");
+      continue;
+    }
+
+    pthread_mutex_lock(&conn_lock);
+    conn->next = connections;
+    if (connections)
+      connections->prev = conn;
+    connections = conn;
+    connection_count++;
+    int armed = arm_connection(conn, EPOLL_CTL_ADD);
+    pthread_mutex_unlock(&conn_lock);
+
+    if (armed < 0)
+    {
+      perror("Failed to watch client socket");
+      close_connection(conn);
+      continue;
+    }
+
+    printf("\n[Conn %u] Client connected from %s:%d\n", conn->id,
+           inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
   }
+}
 
-  close(client_sock);
-  printf("[Thread %lu] Client disconnected\n", (unsigned long)pthread_self());
-  free(args);
+// Close connections idle past the session timeout and, while shutting
+// down, every connection that has no request in progress. Connections a
+// worker owns are left alone.
+static void sweep_connections(time_t now, int stopping)
+{
+  Connection *expired = NULL;
 
-  return NULL;
+  pthread_mutex_lock(&conn_lock);
+  Connection *conn = connections;
+  while (conn)
+  {
+    Connection *next = conn->next;
+    if (!conn->queued &&
+        (now - conn->last_active >= SESSION_IDLE_TIMEOUT ||
+         (stopping && connection_is_idle(conn))))
+    {
+      if (now - conn->last_active >= SESSION_IDLE_TIMEOUT)
+        printf("[Conn %u] Idle for %d s, closing\n", conn->id, SESSION_IDLE_TIMEOUT);
+
+      // Destroyed once the lock is dropped
+      unlink_connection(conn);
+      conn->next = expired;
+      expired = conn;
+    }
+    conn = next;
+  }
+  pthread_mutex_unlock(&conn_lock);
+
+  while (expired)
+  {
+    Connection *next = expired->next;
+    printf("[Conn %u] Connection ended after %u request(s)\n", expired->id, expired->served);
+    connection_destroy(expired);
+    expired = next;
+  }
 }
 
-int main(void)
+int main(int argc, char *argv[])
 {
   int socket_desc;
-  socklen_t client_size;
-  struct sockaddr_in client_addr;
+  int use_uring = 0;
+  int use_chunks = 0;
+  int use_compression = 0;
+  int use_packs = 0;
+  int use_sha256 = 0;
+  int use_dedup = 0;
+  RetentionPolicy retention = {0, 0, 0};
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "--io-uring") == 0)
+    {
+      use_uring = 1;
+    }
+    else if (strcmp(argv[i], "--compress") == 0)
+    {
+      use_compression = 1;
+    }
+    else if (strcmp(argv[i], "--chunk-store") == 0)
+    {
+      use_chunks = 1;
+    }
+    else if (strcmp(argv[i], "--pack") == 0)
+    {
+      use_packs = 1;
+    }
+    else if (strcmp(argv[i], "--sha256") == 0)
+    {
+      use_sha256 = 1;
+    }
+    else if (strcmp(argv[i], "--dedup") == 0)
+    {
+      use_dedup = 1;
+    }
+    else if (strcmp(argv[i], "--keep-last") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+    {
+      retention.keep_last = (uint32_t)atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--keep-days") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+    {
+      retention.keep_within_s = (int64_t)atoi(argv[++i]) * 86400;
+    }
+    else if (strcmp(argv[i], "--thin") == 0)
+    {
+      retention.thin = 1;
+    }
+    else
+    {
+      fprintf(stderr, "Usage: %s [--io-uring] [--chunk-store] [--compress] [--pack] [--keep-last N] "
+                      "[--keep-days N] [--thin] [--sha256] [--dedup]\n",
+              argv[0]);
+      return 1;
+    }
+  }
 
   // Register signal handlers
   struct sigaction sa;
@@ -154,6 +310,17 @@ int main(void)
     perror("Failed to register SIGTERM handler");
   }
 
+  // sendfile() has no MSG_NOSIGNAL; a client that disconnects mid-GET must
+  // produce EPIPE, not kill the server
+  struct sigaction ignore;
+  memset(&ignore, 0, sizeof(ignore));
+  ignore.sa_handler = SIG_IGN;
+  sigemptyset(&ignore.sa_mask);
+  if (sigaction(SIGPIPE, &ignore, NULL) == -1)
+  {
+    perror("Failed to ignore SIGPIPE");
+  }
+
   printf("Signal handlers registered (Ctrl+C for graceful shutdown)\n");
 
   // Create storage root directory
@@ -164,6 +331,34 @@ int main(void)
   }
   printf("Storage root: %s\n", STORAGE_ROOT);
 
+  // Uploads in flight when the server last stopped can never be finished
+  int stale = remove_stale_uploads(STORAGE_ROOT);
+  if (stale > 0)
+  {
+    printf("Removed %d unfinished upload file(s)\n", stale);
+  }
+
+  // Storage backend: io_uring on request, blocking syscalls otherwise
+  if (use_uring && uring_enable() != 0)
+  {
+    fprintf(stderr, "io_uring backend unavailable, using blocking I/O\n");
+  }
+  printf("Storage I/O: %s\n", uring_enabled() ? "io_uring" : "blocking");
+
+  // Deduplication finds stored contents by their SHA-256
+  use_sha256 |= use_dedup;
+  set_strong_checksums(use_sha256);
+  printf("Checksums: CRC32C (%s)%s\n", crc32c_hardware() ? "SSE4.2" : "software",
+         use_sha256 ? " + SHA-256" : "");
+
+  // An existing chunk store is opened even when new uploads are not
+  // chunked, so its versions stay readable and deletable
+  if (chunk_store_init(STORAGE_ROOT, use_chunks) != 0)
+  {
+    fprintf(stderr, "Chunk store unavailable\n");
+    return -1;
+  }
+
   // Create and bind server socket using shared helper
   socket_desc = create_server_socket(SERVER_IP, SERVER_PORT);
   if (socket_desc < 0)
@@ -172,120 +367,170 @@ int main(void)
     return -1;
   }
 
-  global_socket_desc = socket_desc; // Save for signal handler
-  printf("Server listening on %s:%d\n", SERVER_IP, SERVER_PORT);
+  printf("Server listening on %s:%d (backlog %d)\n", SERVER_IP, SERVER_PORT, LISTEN_BACKLOG);
 
-  // Set socket timeout so accept() doesn't block forever
-  struct timeval timeout;
-  timeout.tv_sec = 1; // 1 second timeout
-  timeout.tv_usec = 0;
+  int epfd = epoll_create1(EPOLL_CLOEXEC);
+  epoll_fd = epfd;
+  if (epfd < 0 || set_nonblocking(socket_desc) < 0)
+  {
+    perror("Failed to set up event loop");
+    close(socket_desc);
+    return -1;
+  }
 
-  if (setsockopt(socket_desc, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0)
+  // The listening socket is the only entry without a connection pointer
+  struct epoll_event listen_ev;
+  memset(&listen_ev, 0, sizeof(listen_ev));
+  listen_ev.events = EPOLLIN | EPOLLET;
+  listen_ev.data.ptr = NULL;
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, socket_desc, &listen_ev) < 0)
   {
-    perror("Failed to set socket timeout");
+    perror("Failed to watch listening socket");
+    close(epfd);
+    close(socket_desc);
+    return -1;
   }
 
-  // Main server loop
-  while (is_server_running())
+  // Path locks are sized from the worker count, so the table is built
+  // before the workers start
+  int worker_count = pool_size(WORKER_THREADS);
+  if (lock_table_init(LOCK_STRIPES, worker_count) != 0)
   {
-    // Use select to wait for connection with timeout
-    fd_set read_fds;
+    close(epfd);
+    close(socket_desc);
+    return -1;
+  }
+  printf("Path locks: %zu stripes\n", lock_table_size());
 
-    FD_ZERO(&read_fds);
-    FD_SET(socket_desc, &read_fds);
+  meta_cache_init(META_CACHE_BYTES);
+  printf("Metadata cache: %d MB\n", (int)(META_CACHE_BYTES / (1024 * 1024)));
+  content_cache_init(CONTENT_CACHE_BYTES);
+  printf("Content cache: %d MB, files up to %d KB\n", (int)(CONTENT_CACHE_BYTES / (1024 * 1024)),
+         (int)(CONTENT_CACHE_MAX_OBJECT / 1024));
 
-    // Wait for socket to be readable (incoming connection) or timeout
-    int activity = select(socket_desc + 1, &read_fds, NULL, NULL, &timeout);
+  // Old versions are compressed in the background; compressed ones stay
+  // readable without the option
+  if (compression_start(STORAGE_ROOT, use_compression) != 0)
+  {
+    fprintf(stderr, "Version compression unavailable\n");
+  }
+  printf("Version compression: %s\n", compression_enabled() ? "zlib" : "off");
 
-    if (activity < 0)
-    {
-      // Check if interrupted by signal
-      if (errno == EINTR)
-      {
-        printf("[INFO] Select interrupted by signal\n");
-        continue;
-      }
+  // Old versions move into pack segments; packed ones stay readable
+  // without the option
+  if (pack_store_start(STORAGE_ROOT, use_packs) != 0)
+  {
+    fprintf(stderr, "Version packing unavailable\n");
+  }
+  printf("Version packing: %s\n", pack_store_enabled() ? "on" : "off");
 
-      if (!is_server_running())
-      {
-        break;
-      }
-      perror("Select error");
-      continue;
-    }
+  // Versions no retention rule keeps are pruned in the background
+  if (retention_start(STORAGE_ROOT, &retention) != 0)
+  {
+    fprintf(stderr, "Version retention unavailable\n");
+  }
+  else if (retention_active(&retention))
+  {
+    printf("Version retention: keep last %u, keep %d day(s), thin %s\n", retention.keep_last,
+           (int)(retention.keep_within_s / 86400), retention.thin ? "on" : "off");
+  }
 
-    if (activity == 0)
-    {
-      // Timeout - no incoming connection. Loop will check is_server_running() again
-      continue;
-    }
+  // Stored files are indexed by digest in the background; WRITEs of
+  // contents the index already has are linked instead of uploaded
+  if (dedup_index_start(STORAGE_ROOT, use_dedup) != 0)
+  {
+    fprintf(stderr, "Dedup index unavailable\n");
+  }
+  printf("Deduplicated WRITE: %s\n", dedup_index_enabled() ? "on" : "off");
 
-    // Check if we're still running (might have been stopped by signal)
-    if (!is_server_running())
-    {
-      break;
-    }
+  // Pre-started workers run the requests; this thread only waits for
+  // readiness and hands ready connections over
+  int workers = pool_start(worker_count, MAX_CONNECTIONS, serve_ready_connection);
+  if (workers < 0)
+  {
+    fprintf(stderr, "Failed to start worker pool\n");
+    close(epfd);
+    close(socket_desc);
+    return -1;
+  }
+  printf("Worker pool: %d thread(s), up to %d connections\n", workers, MAX_CONNECTIONS);
 
-    // Socket is readable, there's an incoming connection
-    client_size = sizeof(client_addr);
-    int client_sock = accept(socket_desc, (struct sockaddr *)&client_addr, &client_size);
+  struct epoll_event events[MAX_EVENTS];
+  time_t last_sweep = time(NULL);
 
-    if (client_sock < 0)
+  // Main event loop. After a stop the listener closes and the loop runs
+  // until in-flight requests have been answered.
+  for (;;)
+  {
+    pthread_mutex_lock(&conn_lock);
+    int open = connections != NULL;
+    pthread_mutex_unlock(&conn_lock);
+    if (socket_desc < 0 && !open)
+      break;
+
+    // Wake at least once a second to check for shutdown and idle sessions
+    int ready = epoll_wait(epfd, events, MAX_EVENTS, 1000);
+    if (ready < 0)
     {
-      // Check if we're shutting down
-      if (!is_server_running())
+      if (errno != EINTR)
       {
-        printf("[INFO] Accept interrupted - server shutting down\n");
+        perror("epoll_wait failed");
         break;
       }
+      ready = 0;
+    }
 
-      // Check if interrupted by signal
-      if (errno == EINTR)
+    for (int i = 0; i < ready; i++)
+    {
+      Connection *conn = events[i].data.ptr;
+      if (conn == NULL)
       {
+        if (socket_desc >= 0)
+          accept_connections(socket_desc);
         continue;
       }
 
-      perror("Accept failed");
-      continue;
+      pthread_mutex_lock(&conn_lock);
+      conn->queued = 1;
+      pthread_mutex_unlock(&conn_lock);
+
+      if (pool_submit(conn) != 0)
+      {
+        fprintf(stderr, "[Conn %u] Work queue full, closing\n", conn->id);
+        close_connection(conn);
+      }
     }
 
-    // Create thread arguments
-    thread_args_t *args = malloc(sizeof(thread_args_t));
-    if (!args)
+    int stopping = !is_server_running();
+    if (stopping && socket_desc >= 0)
     {
-      perror("Failed to allocate memory for thread args");
-      close(client_sock);
-      continue;
+      printf("Server shutting down gracefully...\n");
+      close(socket_desc);
+      socket_desc = -1;
+      printf("Listening socket closed\n");
+      printf("Active connections will complete\n");
     }
 
-    args->client_sock = client_sock;
-    args->client_addr = client_addr;
-
-    // Create thread to handle client
-    pthread_t thread_id;
-    if (pthread_create(&thread_id, NULL, handle_client, args) != 0)
+    time_t now = time(NULL);
+    if (stopping || now != last_sweep)
     {
-      perror("Failed to create thread");
-      close(client_sock);
-      free(args);
-      continue;
+      sweep_connections(now, stopping);
+      staging_sweep(now);
+      last_sweep = now;
     }
-
-    // Detach thread so it cleans up automatically
-    pthread_detach(thread_id);
   }
 
-  printf("Server shutting down gracefully...\n");
-
-  // Close listening socket if not already closed
-  if (global_socket_desc >= 0)
+  pool_shutdown();
+  compression_stop();
+  retention_stop();
+  pack_store_stop();
+  dedup_index_stop();
+  while (connections)
   {
-    close(global_socket_desc);
-    global_socket_desc = -1;
+    close_connection(connections);
   }
+  close(epfd);
 
-  printf("Listening socket closed\n");
-  printf("Active connections will complete\n");
   printf("Storage root preserved: %s\n", STORAGE_ROOT);
   printf("Server stopped successfully\n");
 
@@ -3,28 +3,54 @@
  * Server request handlers implementation
  * Last modified: Dec 2025
  */
+#define _POSIX_C_SOURCE 200809L // O_CLOEXEC
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/socket.h>
 #include <sys/stat.h>
-#include <sys/file.h>
+#include <fcntl.h>
 #include <dirent.h>
+#include <inttypes.h>
 #include <unistd.h>
+#include <errno.h>
 #include <pthread.h>
 #include "server_handlers.h"
 #include "file_utils.h"
 #include "path_utils.h"
 #include "version_manager.h"
+#include "version_manifest.h"
+#include "lock_table.h"
+#include "checksum.h"
+#include "chunk_store.h"
+#include "compression.h"
+#include "pack_store.h"
+#include "meta_cache.h"
+#include "content_cache.h"
+#include "dedup_index.h"
+#include "delta.h"
+#include "staging.h"
 #include "operations.h"
 #include "config.h"
-#include "network.h"
+#include "protocol.h"
+#include "connection.h"
+
+// Most received ranges one UPLOAD_STATUS reply lists; keeps the metadata
+// well under RFS_MAX_META. A client resends anything not listed.
+#define STATUS_MAX_RANGES 1024
 
 // Server state
 static volatile int server_running = 1;
 static pthread_mutex_t server_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+// Set once at startup, before any request is served
+static int strong_checksums = 0;
+
+void set_strong_checksums(int enable)
+{
+    strong_checksums = enable;
+}
+
 void set_server_running(int value)
 {
     pthread_mutex_lock(&server_mutex);
@@ -41,268 +67,1252 @@ int is_server_running(void)
     return running;
 }
 
-void handle_write_request(int client_sock)
+// Growable text buffer for replies whose size is not known up front (LS)
+typedef struct
+{
+    char *data;
+    size_t len;
+    size_t cap;
+} TextBuf;
+
+static void text_append(TextBuf *tb, const char *text)
+{
+    size_t n = strlen(text);
+    if (tb->len + n + 1 > tb->cap)
+    {
+        size_t cap = tb->cap ? tb->cap : BUFFER_SIZE;
+        while (tb->len + n + 1 > cap)
+            cap *= 2;
+
+        char *grown = realloc(tb->data, cap);
+        if (!grown)
+            return; // keep what we have; the listing is best effort
+        tb->data = grown;
+        tb->cap = cap;
+    }
+    memcpy(tb->data + tb->len, text, n + 1);
+    tb->len += n;
+}
+
+// Queue a text buffer as the body of an OK reply and release it
+static void reply_text(Connection *conn, TextBuf *tb, const unsigned char *meta, size_t meta_len)
+{
+    if (conn_reply(conn, RFS_OK, meta, meta_len, tb->len) == 0 && tb->len > 0)
+    {
+        conn_reply_data(conn, tb->data, tb->len);
+    }
+    free(tb->data);
+}
+
+// Read the remote path every request starts with and validate it.
+// On failure an error reply has been queued; returns -1.
+static int read_request_path(Connection *conn, MetaReader *meta, char *path, size_t size)
+{
+    if (meta_get_str(meta, path, size) < 0)
+    {
+        fprintf(stderr, "Malformed request metadata\n");
+        conn_reply_error(conn, RFS_ERR_BAD_REQUEST, "Malformed request");
+        return -1;
+    }
+
+    if (validate_path(path) != 0)
+    {
+        printf("Rejected invalid path: %s\n", path);
+        conn_reply_error(conn, RFS_ERR_INVALID_PATH, "Invalid path");
+        return -1;
+    }
+    return 0;
+}
+
+// What the client of a conditional GET or GETVERSION already has
+typedef struct
+{
+    uint64_t size;
+    uint64_t tag; // file identity, or when the version was written
+    uint32_t crc32c;
+} HaveInfo;
+
+// Read the validator of a conditional request. Returns 1 if there is one,
+// 0 for an unconditional request, -1 (error reply queued) if malformed.
+static int read_have(Connection *conn, MetaReader *meta, HaveInfo *have)
+{
+    if (!(conn->req.flags & RFS_FLAG_IF_CHANGED))
+        return 0;
+
+    have->size = meta_get_u64(meta);
+    have->tag = meta_get_u64(meta);
+    have->crc32c = meta_get_u32(meta);
+    if (meta->error)
+    {
+        conn_reply_error(conn, RFS_ERR_BAD_REQUEST, "Malformed request");
+        return -1;
+    }
+    return 1;
+}
+
+// Checksums recorded for the current contents of a file, or NULL if there
+// are none or the file was changed behind our back
+static const ContentInfo *current_content(const char *filepath, uint64_t size, ContentInfo *out)
+{
+    return manifest_current(filepath, out) == 0 && out->size == size ? out : NULL;
+}
+
+// Describe what a GET or GETVERSION reply sends: size, tag and the recorded
+// checksums, if any
+static void put_file_meta(MetaWriter *w, uint64_t size, uint64_t tag, const ContentInfo *content)
+{
+    uint8_t digests = 0;
+    if (content)
+        digests = (content->has_crc ? RFS_DIGEST_CRC32C : 0) |
+                  (content->has_sha256 ? RFS_DIGEST_SHA256 : 0);
+
+    meta_put_u64(w, size);
+    meta_put_u64(w, tag);
+    meta_put_u8(w, digests);
+    meta_put_u32(w, digests & RFS_DIGEST_CRC32C ? content->crc32c : 0);
+    if (digests & RFS_DIGEST_SHA256)
+        meta_put_bytes(w, content->sha256, SHA256_DIGEST_SIZE);
+}
+
+// Answer a conditional request whose copy is still the one described;
+// returns 1 if the reply was queued, 0 if the contents must be sent
+static int reply_if_unchanged(Connection *conn, const HaveInfo *have, uint64_t size, uint64_t tag,
+                              const ContentInfo *content, const char *what)
+{
+    // Without a recorded checksum, size and tag alone decide
+    if (have->size != size || have->tag != tag ||
+        (content && content->has_crc && have->crc32c != content->crc32c))
+        return 0;
+
+    unsigned char reply_meta[64];
+    MetaWriter w;
+    meta_writer_init(&w, reply_meta, sizeof(reply_meta));
+    put_file_meta(&w, size, tag, content);
+    conn_reply(conn, RFS_NOT_MODIFIED, reply_meta, w.len, 0);
+    printf("Not modified: %s\n", what);
+    return 1;
+}
+
+// Find a file's contents in the content cache, reading a small file into
+// it on a miss. Returns a cache reference, or NULL with *fd open on a file
+// too large to cache, or NULL with *fd -1 and an error reply queued.
+// Caller holds the path lock.
+static void *open_cached(Connection *conn, const char *filepath, const unsigned char **data,
+                         uint64_t *size, uint64_t *identity, int *fd)
+{
+    size_t len;
+    void *ref = content_cache_get(filepath, data, &len, identity);
+    *fd = -1;
+    if (ref)
+    {
+        *size = len;
+        return ref;
+    }
+
+    *fd = open_file_for_send(filepath, size);
+    if (*fd < 0)
+    {
+        conn_reply_error(conn, RFS_ERR_NOT_FOUND, "File not found");
+        return NULL;
+    }
+
+    struct stat st;
+    *identity = fstat(*fd, &st) == 0 ? file_identity(&st) : 0;
+
+    ref = content_cache_fill(filepath, *fd, *size, *identity, data, &len);
+    if (ref)
+    {
+        close(*fd);
+        *fd = -1;
+    }
+    return ref;
+}
+
+// Queue [offset, offset + length) of a file as the body of an OK reply. The
+// reply metadata carries the file size and identity (see file_identity()) so
+// that a client fetching several ranges notices if the file is replaced
+// between them, followed by the checksums recorded when the file was stored,
+// so the client can verify the whole download without the server rereading
+// it. Small files are sent from the content cache.
+static int reply_with_file_range(Connection *conn, const char *filepath, uint64_t offset,
+                                 uint64_t length)
+{
+    const unsigned char *data;
+    uint64_t size, identity;
+    int fd;
+    void *ref = open_cached(conn, filepath, &data, &size, &identity, &fd);
+    if (!ref && fd < 0)
+        return -1;
+
+    if (offset > size)
+        offset = size;
+    if (length > size - offset)
+        length = size - offset;
+
+    ContentInfo recorded;
+    unsigned char reply_meta[64];
+    MetaWriter w;
+    meta_writer_init(&w, reply_meta, sizeof(reply_meta));
+    put_file_meta(&w, size, identity, current_content(filepath, size, &recorded));
+
+    if (conn_reply(conn, RFS_OK, reply_meta, w.len, length) != 0)
+    {
+        if (ref)
+            content_cache_release(ref);
+        else
+            close(fd);
+        conn->close_after_reply = 1;
+        return -1;
+    }
+
+    if (ref)
+    {
+        // Header and cached contents leave in one vectored send
+        conn_reply_buffer(conn, data + offset, (size_t)length, content_cache_release, ref);
+    }
+    else
+    {
+        // Positional reads: ranges of one file are served concurrently
+        conn_reply_file(conn, fd, offset, length);
+    }
+    printf("Sending %s%s: bytes %llu-%llu of %llu\n", filepath, ref ? " from memory" : "",
+           (unsigned long long)offset, (unsigned long long)(offset + length),
+           (unsigned long long)size);
+    return 0;
+}
+
+// Queue an open file as the body of an OK reply; returns 0 on success
+static int reply_with_fd(Connection *conn, const char *filepath, int fd, uint64_t size,
+                         const unsigned char *meta, size_t meta_len)
+{
+    if (conn_reply(conn, RFS_OK, meta, meta_len, size) != 0)
+    {
+        close(fd);
+        conn->close_after_reply = 1;
+        return -1;
+    }
+
+    // The file goes to the socket kernel-to-kernel as the reply body
+    conn_reply_file(conn, fd, 0, size);
+    printf("Sending %s: %llu bytes\n", filepath, (unsigned long long)size);
+    return 0;
+}
+
+// Queue a file as the body of an OK reply; returns 0 on success
+static int reply_with_file(Connection *conn, const char *filepath, const unsigned char *meta,
+                           size_t meta_len)
+{
+    uint64_t size;
+    int fd = open_file_for_send(filepath, &size);
+    if (fd < 0)
+    {
+        conn_reply_error(conn, RFS_ERR_NOT_FOUND, "File not found");
+        return -1;
+    }
+    return reply_with_fd(conn, filepath, fd, size, meta, meta_len);
+}
+
+// Like reply_with_file(), but small files are sent from the content cache.
+// Caller holds the path lock.
+static int reply_with_cached_file(Connection *conn, const char *filepath)
+{
+    const unsigned char *data;
+    uint64_t size, identity;
+    int fd;
+    void *ref = open_cached(conn, filepath, &data, &size, &identity, &fd);
+    if (!ref && fd < 0)
+        return -1;
+
+    ContentInfo recorded;
+    unsigned char reply_meta[64];
+    MetaWriter w;
+    meta_writer_init(&w, reply_meta, sizeof(reply_meta));
+    put_file_meta(&w, size, identity, current_content(filepath, size, &recorded));
+    if (!ref)
+        return reply_with_fd(conn, filepath, fd, size, reply_meta, w.len);
+
+    if (conn_reply(conn, RFS_OK, reply_meta, w.len, size) != 0)
+    {
+        content_cache_release(ref);
+        conn->close_after_reply = 1;
+        return -1;
+    }
+
+    // Header and cached contents leave in one vectored send
+    conn_reply_buffer(conn, data, (size_t)size, content_cache_release, ref);
+    printf("Sending %s from memory: %llu bytes\n", filepath, (unsigned long long)size);
+    return 0;
+}
+
+// Queue a version stored in a pack segment as the body of an OK reply;
+// returns 0 on success. Caller holds the path lock.
+static int reply_with_packed(Connection *conn, const VersionEntry *v, const unsigned char *meta,
+                             size_t meta_len)
+{
+    int fd = pack_store_open(v->pack);
+    if (fd < 0)
+    {
+        conn_reply_error(conn, RFS_ERR_IO, "Failed to read version");
+        return -1;
+    }
+
+    if (conn_reply(conn, RFS_OK, meta, meta_len, v->pack_length) != 0)
+    {
+        close(fd);
+        conn->close_after_reply = 1;
+        return -1;
+    }
+
+    // Positional reads straight out of the segment
+    conn_reply_file(conn, fd, v->pack_offset, v->pack_length);
+    printf("Sending version %u from pack segment %u: %llu bytes\n", v->id, v->pack,
+           (unsigned long long)v->pack_length);
+    return 0;
+}
+
+// Queue a chunked or compressed version as the body of an OK reply,
+// assembled or decompressed block by block as the socket takes it; returns
+// 0 on success. Caller holds the path lock.
+static int reply_with_rebuilt(Connection *conn, const char *version_path, const VersionEntry *v,
+                              const unsigned char *meta, size_t meta_len)
+{
+    uint64_t size = v->content.size;
+    ReplyReadFn read_fn;
+    void (*release)(void *source);
+    void *source = NULL;
+    if (v->chunked)
+    {
+        uint64_t assembled;
+        source = chunk_store_open_recipe(version_path, &assembled);
+        if (source && assembled != size)
+        {
+            fprintf(stderr, "Recipe %s does not match its manifest\n", version_path);
+            chunk_store_close_recipe(source);
+            source = NULL;
+        }
+        read_fn = chunk_store_read;
+        release = chunk_store_close_recipe;
+    }
+    else
+    {
+        // Opened here, under the path lock; read while the reply is sent
+        uint64_t offset = v->pack ? v->pack_offset : 0, length = v->pack_length;
+        int fd = v->pack ? pack_store_open(v->pack) : open(version_path, O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (fd >= 0 && !v->pack)
+            length = fstat(fd, &st) == 0 ? (uint64_t)st.st_size : 0;
+        if (fd >= 0)
+            source = compression_stream_open(fd, offset, length);
+        read_fn = compression_stream_read;
+        release = compression_stream_close;
+    }
+    if (!source)
+    {
+        conn_reply_error(conn, RFS_ERR_IO, "Failed to read version");
+        return -1;
+    }
+
+    if (conn_reply(conn, RFS_OK, meta, meta_len, size) != 0 ||
+        conn_reply_stream(conn, size, read_fn, release, source) != 0)
+    {
+        release(source);
+        conn->close_after_reply = 1;
+        return -1;
+    }
+    printf("Sending %s from %s: %llu bytes\n", version_path, v->chunked ? "chunks" : "zlib",
+           (unsigned long long)size);
+    return 0;
+}
+
+void handle_request(Connection *conn, MetaReader *meta)
+{
+    switch ((Operation)conn->req.opcode)
+    {
+    case OP_WRITE:
+        handle_write_request(conn, meta);
+        break;
+
+    case OP_UPLOAD_OPEN:
+        handle_upload_open_request(conn, meta);
+        break;
+
+    case OP_UPLOAD_RANGE:
+        handle_upload_range_request(conn, meta);
+        break;
+
+    case OP_UPLOAD_COMMIT:
+        handle_upload_commit_request(conn, meta);
+        break;
+
+    case OP_UPLOAD_STATUS:
+        handle_upload_status_request(conn, meta);
+        break;
+
+    case OP_UPLOAD_ABORT:
+        handle_upload_abort_request(conn, meta);
+        break;
+
+    case OP_SIGNATURE:
+        handle_signature_request(conn, meta);
+        break;
+
+    case OP_DELTA_WRITE:
+        handle_delta_write_request(conn, meta);
+        break;
+
+    case OP_DEDUP_WRITE:
+        handle_dedup_write_request(conn, meta);
+        break;
+
+    case OP_MKDIRS:
+        handle_mkdirs_request(conn, meta);
+        break;
+
+    case OP_GET:
+        handle_get_request(conn, meta);
+        break;
+
+    case OP_GETVERSION:
+        handle_getversion_request(conn, meta);
+        break;
+
+    case OP_RM:
+        handle_rm_request(conn, meta);
+        break;
+
+    case OP_LS:
+        handle_ls_request(conn, meta);
+        break;
+
+    case OP_STOP:
+        handle_stop_request(conn);
+        break;
+
+    case OP_STATS:
+        handle_stats_request(conn);
+        break;
+
+    default:
+        // Frames are self-delimiting, so an unknown opcode can be answered and skipped
+        printf("[Conn %u] Unknown opcode: %u\n", conn->id, conn->req.opcode);
+        conn_reply_error(conn, RFS_ERR_UNSUPPORTED, "Unknown operation");
+        break;
+    }
+}
+
+// Checksums of an upload, from the digest its bytes were fed into
+static void digest_content(const ContentDigest *digest, uint64_t size, ContentInfo *out)
+{
+    memset(out, 0, sizeof(*out));
+    out->size = size;
+    out->crc32c = digest->crc32c;
+    out->has_crc = 1;
+    if (digest->strong)
+    {
+        Sha256 sha = digest->sha256;
+        sha256_final(&sha, out->sha256);
+        out->has_sha256 = 1;
+    }
+}
+
+// Back up the current file and move a fully received temp file into its
+// place, then queue the reply. This is the only part of an upload that
+// holds the path lock, so it never waits on the network. known holds the
+// checksums computed while the file was written, or is NULL.
+static void publish_upload(Connection *conn, const char *temp_path, const char *target_path,
+                           uint64_t size, const ContentInfo *known)
+{
+    // The contents reach the disk before the rename can expose them, so a
+    // crash leaves either the old file or the new one, never a torn one
+    if (sync_file(temp_path) != 0)
+    {
+        unlink(temp_path);
+        conn_reply_error(conn, RFS_ERR_IO, "Failed to store file");
+        return;
+    }
+
+    // The checksums and chunks are taken before locking; the manifest
+    // records the checksums and the recipe is kept with the file. Only an
+    // upload whose ranges overlapped arrives without checksums; it is read
+    // back once while it is still in the page cache.
+    ContentInfo content;
+    memset(&content, 0, sizeof(content));
+    content.size = size;
+    if (known && (known->has_sha256 || !strong_checksums))
+    {
+        content = *known;
+    }
+    else if (checksum_file(temp_path, &content.crc32c,
+                           strong_checksums ? content.sha256 : NULL) == 0)
+    {
+        content.has_crc = 1;
+        content.has_sha256 = strong_checksums;
+    }
+
+    char recipe_temp[680];
+    snprintf(recipe_temp, sizeof(recipe_temp), "%s.recipe", temp_path);
+    int chunked = chunk_store_enabled() && chunk_store_put_file(temp_path, recipe_temp) == 0;
+
+    path_lock_exclusive(target_path);
+    printf("[WRITE LOCKED] for %s\n", target_path);
+
+    int result = publish_file(temp_path, target_path, &content, chunked ? recipe_temp : NULL);
+
+    path_unlock(target_path);
+    printf("[WRITE UNLOCKED] for %s\n", target_path);
+
+    if (result != 0)
+    {
+        perror("Failed to publish file");
+        unlink(temp_path);
+        conn_reply_error(conn, RFS_ERR_IO, "Failed to store file");
+        return;
+    }
+
+    // Make the rename itself durable before the client hears it succeeded
+    sync_parent_dir(target_path);
+    printf("File saved successfully: %llu bytes to %s\n", (unsigned long long)size, target_path);
+
+    unsigned char reply_meta[8];
+    MetaWriter w;
+    meta_writer_init(&w, reply_meta, sizeof(reply_meta));
+    meta_put_u64(&w, size);
+    conn_reply(conn, RFS_OK, reply_meta, w.len, 0);
+}
+
+static void write_body_done(Connection *conn, int ok)
+{
+    UploadState *up = &conn->upload;
+
+    if (!ok)
+    {
+        unlink(up->temp_path);
+        printf("Partial upload deleted: %s\n", up->temp_path);
+        return;
+    }
+
+    // The body was checksummed on its way into the file
+    ContentInfo known;
+    digest_content(&conn->body_digest, up->size, &known);
+    publish_upload(conn, up->temp_path, up->target_path, up->size, &known);
+}
+
+// Resolve the storage path for an upload and create its directory.
+// On failure an error reply has been queued; returns -1.
+static int prepare_upload_target(Connection *conn, const char *filename, char *target_path,
+                                 size_t target_size, char *dir_path, size_t dir_size)
+{
+    build_storage_path(filename, target_path, target_size);
+    printf("Saving to: %s\n", target_path);
+
+    snprintf(dir_path, dir_size, "%s", target_path);
+    char *last_slash = strrchr(dir_path, '/');
+    if (!last_slash)
+    {
+        snprintf(dir_path, dir_size, ".");
+        return 0;
+    }
+
+    *last_slash = '\0';
+
+    // Trees create their directories up front with MKDIRS, so most uploads
+    // find theirs and skip the directory mutex
+    struct stat st;
+    if (stat(dir_path, &st) == 0 && S_ISDIR(st.st_mode))
+        return 0;
+
+    if (create_directories_safe(dir_path) != 0)
+    {
+        fprintf(stderr, "Failed to create directory structure\n");
+        conn_reply_error(conn, RFS_ERR_IO, "Failed to create directory structure");
+        return -1;
+    }
+    return 0;
+}
+
+void handle_write_request(Connection *conn, MetaReader *meta)
 {
     char filename[256];
-    long file_size;
+    UploadState *up = &conn->upload;
+    uint64_t file_size = frame_body_len(&conn->req);
 
-    // Receive filename using shared function
-    if (recv_string(client_sock, filename, sizeof(filename)) < 0)
+    // Early rejections leave the body unclaimed; the connection discards it
+    if (read_request_path(conn, meta, filename, sizeof(filename)) != 0)
     {
-        fprintf(stderr, "Failed to receive filename\n");
         return;
     }
 
     printf("Received path from client: %s\n", filename);
+    printf("File size: %llu bytes (%.2f MB)\n", (unsigned long long)file_size,
+           file_size / (1024.0 * 1024.0));
 
-    // Validate and build path
-    if (validate_path(filename) != 0)
+    char dir_path[512];
+    if (prepare_upload_target(conn, filename, up->target_path, sizeof(up->target_path),
+                              dir_path, sizeof(dir_path)) != 0)
     {
-        printf("Rejected invalid path: %s\n", filename);
         return;
     }
+    up->size = file_size;
 
-    char full_path[512];
-    build_storage_path(filename, full_path, sizeof(full_path));
-    printf("Saving to: %s\n", full_path);
+    // The body is received into a hidden file next to the target, so readers
+    // and other writers never see a partial upload and no lock is held while
+    // the client is still sending
+    snprintf(up->temp_path, sizeof(up->temp_path), "%s/%s%u_%u", dir_path,
+             RFS_TEMP_PREFIX, conn->id, conn->req.request_id);
 
-    // Receive file size using shared function
-    if (recv_all(client_sock, &file_size, sizeof(long)) < 0)
+    int fd = open(up->temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
     {
-        fprintf(stderr, "Failed to receive file size\n");
+        perror("Failed to create file");
+        conn_reply_error(conn, RFS_ERR_IO, "Failed to create file");
         return;
     }
 
-    printf("File size: %ld bytes (%.2f MB)\n", file_size, file_size / (1024.0 * 1024.0));
+    // The size is known up front: reserve it in one extent, then splice the
+    // body from the socket straight into the file
+    preallocate_file(fd, file_size);
+    conn_receive_body(conn, fd, 0, write_body_done);
 
-    // Create directories if needed
-    char *last_slash = strrchr(full_path, '/');
-    if (last_slash)
+    ContentDigest digest;
+    content_digest_init(&digest, strong_checksums);
+    conn_digest_body(conn, &digest);
+}
+
+// Queue the state of a staged upload: its id, size, and the byte ranges
+// received so far
+static void reply_upload_status(Connection *conn, uint64_t transfer_id)
+{
+    ByteRange ranges[STATUS_MAX_RANGES];
+    uint64_t size;
+    int count = staging_received(transfer_id, &size, ranges, STATUS_MAX_RANGES);
+    if (count < 0)
     {
-        char dir_path[512];
-        size_t dir_len = last_slash - full_path;
-        strncpy(dir_path, full_path, dir_len);
-        dir_path[dir_len] = '\0';
+        conn_reply_error(conn, RFS_ERR_NOT_FOUND, "Unknown transfer");
+        return;
+    }
 
-        if (create_directories_safe(dir_path) != 0)
-        {
-            fprintf(stderr, "Failed to create directory structure\n");
-            return;
-        }
+    unsigned char reply_meta[20 + STATUS_MAX_RANGES * 16];
+    MetaWriter w;
+    meta_writer_init(&w, reply_meta, sizeof(reply_meta));
+    meta_put_u64(&w, transfer_id);
+    meta_put_u64(&w, size);
+    meta_put_u32(&w, (uint32_t)count);
+    for (int i = 0; i < count; i++)
+    {
+        meta_put_u64(&w, ranges[i].start);
+        meta_put_u64(&w, ranges[i].end);
     }
+    conn_reply(conn, RFS_OK, reply_meta, w.len, 0);
+}
 
-    // Lock for entire write operation (backup + write)
-    unsigned int hash = hash_string(full_path);
-    pthread_mutex_lock(&version_mutexes[hash]);
-    printf("[WRITE MUTEX LOCKED] for %s\n", full_path);
+void handle_upload_open_request(Connection *conn, MetaReader *meta)
+{
+    char filename[256];
 
-    // Backup existing file
-    backup_file(full_path);
+    if (read_request_path(conn, meta, filename, sizeof(filename)) != 0)
+    {
+        return;
+    }
 
-    // Open file for writing
-    FILE *file = fopen(full_path, "wb");
-    if (!file)
+    uint64_t file_size = meta_get_u64(meta);
+    uint64_t resume_key = (conn->req.flags & RFS_FLAG_RESUME) ? meta_get_u64(meta) : 0;
+    if (meta->error)
+    {
+        conn_reply_error(conn, RFS_ERR_BAD_REQUEST, "Malformed request");
+        return;
+    }
+
+    printf("Ranged upload of %s: %llu bytes (%.2f MB)\n", filename,
+           (unsigned long long)file_size, file_size / (1024.0 * 1024.0));
+
+    char target_path[512];
+    char dir_path[512];
+    if (prepare_upload_target(conn, filename, target_path, sizeof(target_path),
+                              dir_path, sizeof(dir_path)) != 0)
     {
-        perror("Failed to create file");
-        pthread_mutex_unlock(&version_mutexes[hash]);
-        printf("[WRITE MUTEX UNLOCKED] for %s\n", full_path);
         return;
     }
 
-    // File-level lock (for coordination with readers)
-    int fd = fileno(file);
-    if (flock(fd, LOCK_EX) != 0)
+    uint64_t transfer_id;
+    int result = staging_create(target_path, dir_path, file_size, resume_key, &transfer_id);
+    if (result < 0)
     {
-        perror("Failed to lock file");
-        fclose(file);
-        pthread_mutex_unlock(&version_mutexes[hash]);
-        printf("[WRITE MUTEX UNLOCKED] for %s\n", full_path);
+        conn_reply_error(conn, RFS_ERR_IO, "Failed to create file");
         return;
     }
-    printf("[FILE LOCKED] %s for writing\n", full_path);
 
-    // Receive file data using shared function
-    long total_received = recv_file_data(client_sock, file, file_size);
+    printf("Transfer %" PRIx64 " %s for %s\n", transfer_id,
+           result == 1 ? "resumed" : "staged", target_path);
+    reply_upload_status(conn, transfer_id);
+}
 
-    int write_error = 0;
-    if (total_received < 0)
+void handle_upload_status_request(Connection *conn, MetaReader *meta)
+{
+    uint64_t transfer_id = meta_get_u64(meta);
+    if (meta->error)
     {
-        fprintf(stderr, "[ERROR] Failed to receive file data\n");
-        write_error = 1;
+        conn_reply_error(conn, RFS_ERR_BAD_REQUEST, "Malformed request");
+        return;
     }
-    else if (total_received != file_size)
+
+    reply_upload_status(conn, transfer_id);
+}
+
+static void range_body_done(Connection *conn, int ok)
+{
+    UploadState *up = &conn->upload;
+
+    // body_off is the file position reached, also when the range broke off
+    staging_range_done(up->transfer_id, up->offset, conn->body_off - up->offset,
+                       &conn->body_digest);
+    if (!ok)
     {
-        fprintf(stderr, "[ERROR] Incomplete file - expected %ld, got %ld bytes\n",
-                file_size, total_received);
-        write_error = 1;
+        return;
     }
-    else if (ferror(file))
+
+    unsigned char reply_meta[8];
+    MetaWriter w;
+    meta_writer_init(&w, reply_meta, sizeof(reply_meta));
+    meta_put_u64(&w, up->size);
+    conn_reply(conn, RFS_OK, reply_meta, w.len, 0);
+}
+
+void handle_upload_range_request(Connection *conn, MetaReader *meta)
+{
+    UploadState *up = &conn->upload;
+    up->transfer_id = meta_get_u64(meta);
+    up->offset = meta_get_u64(meta);
+    up->size = frame_body_len(&conn->req);
+
+    // Early rejections leave the body unclaimed; the connection discards it
+    if (meta->error)
     {
-        fprintf(stderr, "[ERROR] File write error occurred\n");
-        perror("File error");
-        write_error = 1;
+        conn_reply_error(conn, RFS_ERR_BAD_REQUEST, "Malformed request");
+        return;
     }
 
-    // Unlock and close file
-    flock(fd, LOCK_UN);
-    printf("[FILE UNLOCKED] %s\n", full_path);
-    fclose(file);
+    ContentDigest digest;
+    int fd = staging_open_range(up->transfer_id, up->offset, up->size, strong_checksums, &digest);
+    if (fd == -2)
+    {
+        conn_reply_error(conn, RFS_ERR_BAD_REQUEST, "Range outside the file");
+        return;
+    }
+    if (fd < 0)
+    {
+        conn_reply_error(conn, RFS_ERR_NOT_FOUND, "Unknown transfer");
+        return;
+    }
+
+    // Ranges land at their own offset, so any number of connections can
+    // fill one part file at once
+    conn_receive_body(conn, fd, up->offset, range_body_done);
+    conn_digest_body(conn, &digest);
+}
 
-    // Handle write errors
-    if (write_error)
+void handle_upload_commit_request(Connection *conn, MetaReader *meta)
+{
+    uint64_t transfer_id = meta_get_u64(meta);
+    if (meta->error)
     {
-        remove(full_path);
-        printf("Partial/corrupted file deleted\n");
-        pthread_mutex_unlock(&version_mutexes[hash]);
-        printf("[WRITE MUTEX UNLOCKED] for %s\n", full_path);
+        conn_reply_error(conn, RFS_ERR_BAD_REQUEST, "Malformed request");
         return;
     }
 
-    // UNLOCK WRITE MUTEX
-    pthread_mutex_unlock(&version_mutexes[hash]);
-    printf("[WRITE MUTEX UNLOCKED] for %s\n", full_path);
+    StagedFile staged;
+    int result = staging_commit(transfer_id, &staged);
+    if (result == -1)
+    {
+        conn_reply_error(conn, RFS_ERR_NOT_FOUND, "Unknown transfer");
+        return;
+    }
+    if (result == -2)
+    {
+        conn_reply_error(conn, RFS_ERR_BAD_REQUEST, "Upload has missing ranges");
+        return;
+    }
+    if (result == -3)
+    {
+        // An abandoned connection still holds a range; the client retries
+        conn_reply_error(conn, RFS_ERR_BUSY, "Ranges still in flight");
+        return;
+    }
 
-    printf("File saved successfully: %ld bytes to %s\n", total_received, full_path);
+    printf("Transfer %" PRIx64 " complete\n", transfer_id);
+
+    // The ranges' CRCs add up to the file's. Ranges that overtook the one
+    // extending the SHA-256 are the only bytes read back for it.
+    ContentInfo known;
+    ContentDigest digest;
+    content_digest_init(&digest, strong_checksums);
+    digest.sha256 = staged.sha256;
+    if (strong_checksums && staged.hashed < staged.size)
+    {
+        printf("Hashing the last %llu bytes, which arrived out of order\n",
+               (unsigned long long)(staged.size - staged.hashed));
+        if (content_digest_file(&digest, staged.temp_path, staged.hashed) != 0)
+            staged.crc_known = 0;
+    }
+    digest.crc32c = staged.crc32c;
+    digest_content(&digest, staged.size, &known);
+    publish_upload(conn, staged.temp_path, staged.target_path, staged.size,
+                   staged.crc_known ? &known : NULL);
 }
 
-void handle_get_request(int client_sock)
+void handle_upload_abort_request(Connection *conn, MetaReader *meta)
 {
-    char filename[256];
-    int filename_len;
+    uint64_t transfer_id = meta_get_u64(meta);
+    if (meta->error)
+    {
+        conn_reply_error(conn, RFS_ERR_BAD_REQUEST, "Malformed request");
+        return;
+    }
 
-    // Receive filename
-    if (recv(client_sock, &filename_len, sizeof(int), 0) <= 0 ||
-        recv(client_sock, filename, filename_len, 0) <= 0)
+    if (staging_abort(transfer_id) != 0)
     {
-        perror("Failed to receive filename");
+        conn_reply_error(conn, RFS_ERR_NOT_FOUND, "Unknown transfer");
         return;
     }
-    filename[filename_len] = '\0';
 
-    printf("GET request for: %s\n", filename);
+    printf("Transfer %" PRIx64 " aborted\n", transfer_id);
+    conn_reply(conn, RFS_OK, NULL, 0, 0);
+}
 
-    // Validate path
-    if (validate_path(filename) != 0)
+void handle_signature_request(Connection *conn, MetaReader *meta)
+{
+    char filename[256];
+
+    if (read_request_path(conn, meta, filename, sizeof(filename)) != 0)
     {
-        long error = -1;
-        send(client_sock, &error, sizeof(long), 0);
         return;
     }
 
-    // Build full storage path
     char full_path[512];
     build_storage_path(filename, full_path, sizeof(full_path));
-    printf("Reading from: %s\n", full_path);
 
-    // Use shared function to send file
-    long bytes_sent = send_file_with_lock(client_sock, full_path);
+    // Once open, the descriptor keeps this version even if it is replaced
+    uint64_t size;
+    path_lock_shared(full_path);
+    int fd = open_file_for_send(full_path, &size);
+    path_unlock(full_path);
+    if (fd < 0)
+    {
+        conn_reply_error(conn, RFS_ERR_NOT_FOUND, "File not found");
+        return;
+    }
+
+    // The identity names this exact version: a publish replaces the inode,
+    // an edit behind the server's back changes its times
+    struct stat st;
+    uint64_t identity = fstat(fd, &st) == 0 ? file_identity(&st) : 0;
+
+    uint32_t block_size = delta_block_size(size);
+    uint32_t count = (uint32_t)(size / block_size);
+    size_t sig_len = (size_t)count * DELTA_SIG_ENTRY_SIZE;
+    unsigned char *sig = malloc(sig_len ? sig_len : 1);
 
-    if (bytes_sent > 0)
+    if (!sig || delta_signature(fd, size, block_size, sig) != 0)
     {
-        printf("Sent file: %ld bytes\n", bytes_sent);
+        perror("Failed to build signature");
+        free(sig);
+        close(fd);
+        conn_reply_error(conn, RFS_ERR_IO, "Failed to read file");
+        return;
+    }
+    close(fd);
+
+    printf("SIGNATURE for %s: %u block(s) of %u bytes\n", full_path, count, block_size);
+
+    unsigned char reply_meta[24];
+    MetaWriter w;
+    meta_writer_init(&w, reply_meta, sizeof(reply_meta));
+    meta_put_u64(&w, size);
+    meta_put_u64(&w, identity);
+    meta_put_u32(&w, block_size);
+    meta_put_u32(&w, count);
+
+    if (conn_reply(conn, RFS_OK, reply_meta, w.len, sig_len) != 0 ||
+        conn_reply_data(conn, sig, sig_len) != 0)
+    {
+        conn->close_after_reply = 1;
+    }
+    free(sig);
+}
+
+static void delta_body_done(Connection *conn, int ok)
+{
+    UploadState *up = &conn->upload;
+    char delta_path[680];
+    snprintf(delta_path, sizeof(delta_path), "%s.delta", up->temp_path);
+
+    if (!ok)
+    {
+        unlink(delta_path);
+        printf("Partial delta deleted: %s\n", delta_path);
+        return;
+    }
+
+    // Publishing keeps the old inode alive for this descriptor, so the base
+    // cannot change under us once it is open and matches
+    struct stat base_st, delta_st;
+    int base_fd = open(up->target_path, O_RDONLY | O_CLOEXEC);
+    int delta_fd = open(delta_path, O_RDONLY | O_CLOEXEC);
+    int out_fd = open(up->temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    unlink(delta_path);
+
+    const char *error = NULL;
+    int32_t status = RFS_ERR_IO;
+    uint64_t size = 0;
+    ContentDigest digest;
+    content_digest_init(&digest, strong_checksums);
+
+    if (base_fd < 0 || fstat(base_fd, &base_st) != 0 ||
+        file_identity(&base_st) != up->base_identity)
+    {
+        status = RFS_ERR_NOT_FOUND;
+        error = "Stored file changed";
+    }
+    else if (delta_fd < 0 || out_fd < 0 || fstat(delta_fd, &delta_st) != 0)
+    {
+        error = "Failed to create file";
     }
     else
     {
-        printf("Failed to send file\n");
+        preallocate_file(out_fd, up->size);
+        if (delta_apply(base_fd, (uint64_t)base_st.st_size, up->block_size, delta_fd,
+                        (uint64_t)delta_st.st_size, out_fd, &size, &digest) != 0)
+        {
+            status = RFS_ERR_BAD_REQUEST;
+            error = "Malformed delta";
+        }
+        else if (size != up->size || digest.crc32c != up->crc32c)
+        {
+            status = RFS_ERR_BAD_REQUEST;
+            error = "Delta result does not match";
+        }
     }
+
+    if (base_fd >= 0)
+        close(base_fd);
+    if (delta_fd >= 0)
+        close(delta_fd);
+    if (out_fd >= 0)
+        close(out_fd);
+
+    if (error)
+    {
+        fprintf(stderr, "DELTA_WRITE to %s failed: %s\n", up->target_path, error);
+        unlink(up->temp_path);
+        conn_reply_error(conn, status, error);
+        return;
+    }
+
+    printf("Rebuilt %s from a %llu-byte delta\n", up->target_path,
+           (unsigned long long)delta_st.st_size);
+    // The rebuilt contents were checksummed as they were written
+    ContentInfo known;
+    digest_content(&digest, up->size, &known);
+    publish_upload(conn, up->temp_path, up->target_path, up->size, &known);
 }
 
-void handle_getversion_request(int client_sock)
+void handle_delta_write_request(Connection *conn, MetaReader *meta)
 {
-    char request[512];
-    int request_len;
+    char filename[256];
+    UploadState *up = &conn->upload;
 
-    // Receive request (format: "filename:version_number")
-    if (recv(client_sock, &request_len, sizeof(int), 0) <= 0 ||
-        recv(client_sock, request, request_len, 0) <= 0)
+    if (read_request_path(conn, meta, filename, sizeof(filename)) != 0)
     {
-        perror("Failed to receive version request");
         return;
     }
-    request[request_len] = '\0';
 
-    // Parse request
-    char *colon = strchr(request, ':');
-    if (!colon)
+    up->base_identity = meta_get_u64(meta);
+    up->size = meta_get_u64(meta);
+    up->crc32c = meta_get_u32(meta);
+    up->block_size = meta_get_u32(meta);
+    if (meta->error || up->block_size == 0)
     {
-        fprintf(stderr, "Invalid GETVERSION format\n");
-        long error = -1;
-        send(client_sock, &error, sizeof(long), 0);
+        conn_reply_error(conn, RFS_ERR_BAD_REQUEST, "Malformed request");
         return;
     }
 
-    *colon = '\0';
-    char *filename = request;
-    int version_number = atoi(colon + 1);
+    printf("DELTA_WRITE request: %s, %llu bytes from a %llu-byte delta\n", filename,
+           (unsigned long long)up->size, (unsigned long long)frame_body_len(&conn->req));
 
-    printf("GETVERSION request: %s, version %d\n", filename, version_number);
+    char dir_path[512];
+    if (prepare_upload_target(conn, filename, up->target_path, sizeof(up->target_path),
+                              dir_path, sizeof(dir_path)) != 0)
+    {
+        return;
+    }
+
+    // The delta lands next to the hidden file the result is rebuilt into
+    snprintf(up->temp_path, sizeof(up->temp_path), "%s/%s%u_%u", dir_path,
+             RFS_TEMP_PREFIX, conn->id, conn->req.request_id);
+    char delta_path[680];
+    snprintf(delta_path, sizeof(delta_path), "%s.delta", up->temp_path);
+
+    int fd = open(delta_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        perror("Failed to create file");
+        conn_reply_error(conn, RFS_ERR_IO, "Failed to create file");
+        return;
+    }
+
+    conn_receive_body(conn, fd, 0, delta_body_done);
+}
+
+void handle_dedup_write_request(Connection *conn, MetaReader *meta)
+{
+    char filename[256];
+    UploadState *up = &conn->upload;
+
+    // The client sends the contents with a plain WRITE instead
+    if (!dedup_index_enabled())
+    {
+        conn_reply_error(conn, RFS_ERR_UNSUPPORTED, "Deduplication is off");
+        return;
+    }
+    if (conn->req.flags & RFS_FLAG_PROBE)
+    {
+        conn_reply(conn, RFS_OK, NULL, 0, 0);
+        return;
+    }
+
+    if (read_request_path(conn, meta, filename, sizeof(filename)) != 0)
+    {
+        return;
+    }
+
+    unsigned char sha256[SHA256_DIGEST_SIZE];
+    up->size = meta_get_u64(meta);
+    up->crc32c = meta_get_u32(meta);
+    meta_get_bytes(meta, sha256, sizeof(sha256));
+    if (meta->error)
+    {
+        conn_reply_error(conn, RFS_ERR_BAD_REQUEST, "Malformed request");
+        return;
+    }
+
+    char digest[SHA256_HEX_SIZE];
+    sha256_hex(sha256, digest);
+    printf("DEDUP_WRITE request: %s, %llu bytes with SHA-256 %s\n", filename,
+           (unsigned long long)up->size, digest);
+
+    char dir_path[512];
+    if (prepare_upload_target(conn, filename, up->target_path, sizeof(up->target_path),
+                              dir_path, sizeof(dir_path)) != 0)
+    {
+        return;
+    }
+    snprintf(up->temp_path, sizeof(up->temp_path), "%s/%s%u_%u", dir_path,
+             RFS_TEMP_PREFIX, conn->id, conn->req.request_id);
+
+    // The stored copy becomes the new file through a hard link, which then
+    // goes through the same publish as an upload
+    ContentInfo content;
+    if (dedup_index_link(sha256, up->size, up->temp_path, &content) != 0 ||
+        content.crc32c != up->crc32c)
+    {
+        unlink(up->temp_path);
+        conn_reply_error(conn, RFS_ERR_NOT_FOUND, "Content not stored");
+        return;
+    }
+
+    printf("Linked %s to stored contents; nothing to receive\n", up->target_path);
+    publish_upload(conn, up->temp_path, up->target_path, up->size, &content);
 
-    // Validate path
-    if (validate_path(filename) != 0)
+    // Renaming a link over the file it links to leaves both names in place
+    unlink(up->temp_path);
+}
+
+void handle_mkdirs_request(Connection *conn, MetaReader *meta)
+{
+    uint32_t count = meta_get_u32(meta);
+    uint32_t created = 0, failed = 0;
+
+    // The whole batch is checked before anything is created, so a rejected
+    // request leaves no directories behind
+    MetaReader check = *meta;
+    for (uint32_t i = 0; i < count && !check.error; i++)
+    {
+        char path[256];
+        if (meta_get_str(&check, path, sizeof(path)) < 0)
+            break;
+        if (validate_path(path) != 0)
+        {
+            printf("Rejected invalid path: %s\n", path);
+            conn_reply_error(conn, RFS_ERR_INVALID_PATH, "Invalid path");
+            return;
+        }
+    }
+    if (check.error)
     {
-        long error = -1;
-        send(client_sock, &error, sizeof(long), 0);
+        conn_reply_error(conn, RFS_ERR_BAD_REQUEST, "Malformed request");
         return;
     }
 
+    for (uint32_t i = 0; i < count; i++)
+    {
+        char path[256], full_path[512];
+        meta_get_str(meta, path, sizeof(path));
+        build_storage_path(path, full_path, sizeof(full_path));
+        if (create_directories_safe(full_path) == 0)
+            created++;
+        else
+            failed++;
+    }
+    printf("MKDIRS: %u director(ies) ready, %u failed\n", created, failed);
+
+    unsigned char reply_meta[8];
+    MetaWriter w;
+    meta_writer_init(&w, reply_meta, sizeof(reply_meta));
+    meta_put_u32(&w, created);
+    meta_put_u32(&w, failed);
+    conn_reply(conn, RFS_OK, reply_meta, w.len, 0);
+}
+
+void handle_get_request(Connection *conn, MetaReader *meta)
+{
+    char filename[256];
+
+    if (read_request_path(conn, meta, filename, sizeof(filename)) != 0)
+    {
+        return;
+    }
+
+    uint64_t offset = 0, length = 0;
+    int ranged = (conn->req.flags & RFS_FLAG_RANGE) != 0;
+    if (ranged)
+    {
+        offset = meta_get_u64(meta);
+        length = meta_get_u64(meta);
+        if (meta->error)
+        {
+            conn_reply_error(conn, RFS_ERR_BAD_REQUEST, "Malformed request");
+            return;
+        }
+    }
+
+    HaveInfo have;
+    int conditional = read_have(conn, meta, &have);
+    if (conditional < 0)
+        return;
+
+    printf("GET request for: %s\n", filename);
+
+    // Build full storage path
+    char full_path[512];
+    build_storage_path(filename, full_path, sizeof(full_path));
+    printf("Reading from: %s\n", full_path);
+
+    // Held only while the file is opened; the reply is sent from the descriptor.
+    // A client whose copy is current only gets told so; the file is not even opened.
+    path_lock_shared(full_path);
+    struct stat st;
+    ContentInfo recorded;
+    int result = 0;
+    if (!(conditional && stat(full_path, &st) == 0 &&
+          reply_if_unchanged(conn, &have, (uint64_t)st.st_size, file_identity(&st),
+                             current_content(full_path, (uint64_t)st.st_size, &recorded),
+                             full_path)))
+        result = ranged ? reply_with_file_range(conn, full_path, offset, length)
+                        : reply_with_cached_file(conn, full_path);
+    path_unlock(full_path);
+    if (result != 0)
+    {
+        printf("Failed to send file\n");
+    }
+}
+
+void handle_getversion_request(Connection *conn, MetaReader *meta)
+{
+    char filename[256];
+
+    if (read_request_path(conn, meta, filename, sizeof(filename)) != 0)
+    {
+        return;
+    }
+
+    int version_number = (int)meta_get_u32(meta);
+    if (meta->error || version_number <= 0)
+    {
+        fprintf(stderr, "Invalid GETVERSION request\n");
+        conn_reply_error(conn, RFS_ERR_BAD_REQUEST, "Invalid version number");
+        return;
+    }
+
+    HaveInfo have;
+    int conditional = read_have(conn, meta, &have);
+    if (conditional < 0)
+        return;
+
+    printf("GETVERSION request: %s, version %d\n", filename, version_number);
+
     // Build full path and resolve version
     char full_path[512];
     build_storage_path(filename, full_path, sizeof(full_path));
 
+    // An RM cannot delete the version between resolving and opening it
     char version_path[512];
-    if (resolve_version_path(full_path, version_number, version_path, sizeof(version_path)) != 0)
+    VersionEntry version;
+    path_lock_shared(full_path);
+    if (resolve_version_path(full_path, version_number, version_path, sizeof(version_path),
+                             &version) != 0)
     {
+        path_unlock(full_path);
         fprintf(stderr, "Version %d not found\n", version_number);
-        long error = -1;
-        send(client_sock, &error, sizeof(long), 0);
+        conn_reply_error(conn, RFS_ERR_NOT_FOUND, "Version not found");
         return;
     }
 
     printf("Resolved to: %s\n", version_path);
 
-    long bytes_sent = send_file_with_lock(client_sock, version_path);
-
-    if (bytes_sent > 0)
+    // Versions never change, so the manifest alone answers a conditional
+    // request; a stored copy is only read (or rebuilt) when it is sent
+    uint64_t written = (uint64_t)version.written_us;
+    if (conditional && reply_if_unchanged(conn, &have, version.content.size, written,
+                                          &version.content, version_path))
     {
-        printf("Sent version %d: %ld bytes\n", version_number, bytes_sent);
+        path_unlock(full_path);
+        return;
     }
+
+    unsigned char reply_meta[64];
+    MetaWriter w;
+    meta_writer_init(&w, reply_meta, sizeof(reply_meta));
+    put_file_meta(&w, version.content.size, written, &version.content);
+
+    int result;
+    if (version.chunked || version.compressed > 0)
+        result = reply_with_rebuilt(conn, version_path, &version, reply_meta, w.len);
+    else if (version.pack)
+        result = reply_with_packed(conn, &version, reply_meta, w.len);
     else
+        result = reply_with_file(conn, version_path, reply_meta, w.len);
+    path_unlock(full_path);
+    if (result != 0)
     {
         printf("Failed to send version\n");
     }
 }
 
-void handle_rm_request(int client_sock)
+void handle_rm_request(Connection *conn, MetaReader *meta)
 {
     char filename[256];
-    int filename_len;
-    char response[1024];
 
-    // Receive filename
-    if (recv(client_sock, &filename_len, sizeof(int), 0) <= 0 ||
-        recv(client_sock, filename, filename_len, 0) <= 0)
+    if (read_request_path(conn, meta, filename, sizeof(filename)) != 0)
     {
-        perror("Failed to receive filename");
         return;
     }
-    filename[filename_len] = '\0';
 
     printf("Delete request for: %s\n", filename);
 
-    // Validate and build path
-    if (validate_path(filename) != 0)
-    {
-        snprintf(response, sizeof(response), "Invalid path: %s\n", filename);
-        send(client_sock, response, strlen(response), 0);
-        return;
-    }
-
     char full_path[512];
     build_storage_path(filename, full_path, sizeof(full_path));
 
     // Lock for deletion
-    unsigned int hash = hash_string(full_path);
-    pthread_mutex_lock(&version_mutexes[hash]);
+    path_lock_exclusive(full_path);
 
     // Delete main file and versions
     int deleted_count = 0;
@@ -313,254 +1323,461 @@ void handle_rm_request(int client_sock)
         deleted_count++;
     else if (result < 0)
         failed_count++;
+    meta_cache_refresh(full_path);
+    content_cache_invalidate(full_path);
+    dedup_index_forget(full_path);
 
-    delete_file_versions(full_path, &deleted_count, &failed_count);
+    char recipe_path[640];
+    make_recipe_path(full_path, recipe_path, sizeof(recipe_path));
+    if (file_exists(recipe_path))
+        chunk_store_release(recipe_path);
 
-    pthread_mutex_unlock(&version_mutexes[hash]);
+    manifest_delete_versions(full_path, &deleted_count, &failed_count);
 
-    // Send response
-    if (deleted_count > 0)
-    {
-        snprintf(response, sizeof(response),
-                 "Successfully deleted %d file(s) (main file + %d version(s))\n",
-                 deleted_count, deleted_count - 1);
-    }
-    else
-    {
-        snprintf(response, sizeof(response), "File not found: %s\n", filename);
-    }
+    path_unlock(full_path);
 
-    if (failed_count > 0)
+    if (deleted_count == 0 && failed_count == 0)
     {
-        char error_msg[256];
-        snprintf(error_msg, sizeof(error_msg),
-                 "Warning: Failed to delete %d file(s)\n", failed_count);
-        strncat(response, error_msg, sizeof(response) - strlen(response) - 1);
+        conn_reply_error(conn, RFS_ERR_NOT_FOUND, "File not found");
+        return;
     }
 
-    send(client_sock, response, strlen(response), 0);
+    // Reply with the counts; the client formats the message
+    unsigned char reply_meta[8];
+    MetaWriter w;
+    meta_writer_init(&w, reply_meta, sizeof(reply_meta));
+    meta_put_u32(&w, (uint32_t)deleted_count);
+    meta_put_u32(&w, (uint32_t)failed_count);
+    conn_reply(conn, RFS_OK, reply_meta, w.len, 0);
 }
 
-void handle_ls_request(int client_sock)
+static int compare_names(const void *a, const void *b)
 {
-    char path[256];
-    int path_len;
-    char buffer[BUFFER_SIZE];
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
 
-    // Receive path length
-    if (recv(client_sock, &path_len, sizeof(int), 0) <= 0)
+// Index of the first name that sorts after cursor
+static size_t page_start(char *const names[], size_t count, const char *after)
+{
+    size_t lo = 0, hi = count;
+    while (lo < hi)
     {
-        perror("Failed to receive path length");
-        return;
+        size_t mid = lo + (hi - lo) / 2;
+        if (strcmp(names[mid], after) <= 0)
+            lo = mid + 1;
+        else
+            hi = mid;
     }
+    return lo;
+}
 
-    // Receive path
-    if (recv(client_sock, path, path_len, 0) <= 0)
+// Read a directory from disk, cache it, and return one page of it (as
+// meta_cache_page() would). On failure an error reply has been queued;
+// returns -1.
+static int read_directory_page(Connection *conn, const char *full_path, const char *after,
+                               size_t max, ListedEntry **entries, size_t *page_count, int *more)
+{
+    uint64_t ticket = meta_cache_begin(full_path);
+    DIR *dir = opendir(full_path);
+    if (!dir)
     {
-        perror("Failed to receive path");
-        return;
+        conn_reply_error(conn, RFS_ERR_IO, "Failed to open directory");
+        return -1;
     }
-    path[path_len] = '\0';
-
-    printf("LS request for: %s\n", path);
 
-    // Validate path
-    if (validate_path(path) != 0)
+    // Gather the names first so that they can be stat'ed as one batch
+    char **names = NULL;
+    size_t count = 0, capacity = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
     {
-        snprintf(buffer, sizeof(buffer), "Invalid path: %s\n", path);
-        send(client_sock, buffer, strlen(buffer), 0);
-        return;
+        // Skip . and .. and in-flight uploads
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0 ||
+            is_internal_name(entry->d_name))
+        {
+            continue;
+        }
+
+        if (count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 64;
+            char **grown = realloc(names, capacity * sizeof(char *));
+            if (!grown)
+                break; // list what we have; the listing is best effort
+            names = grown;
+        }
+        names[count] = strdup(entry->d_name);
+        if (names[count])
+            count++;
     }
 
-    // Build full storage path
-    char full_path[512];
-    build_storage_path(path, full_path, sizeof(full_path));
+    closedir(dir);
 
-    printf("Listing: %s\n", full_path);
+    // Sorted, so that pages follow each other whether they were cached or not
+    if (count > 1)
+        qsort(names, count, sizeof(char *), compare_names);
 
-    struct stat st;
+    // The whole directory is stat'ed and cached, so the next pages come from memory
+    EntryStat *stats = count > 0 ? malloc(count * sizeof(EntryStat)) : NULL;
+    if (stats)
+    {
+        stat_dir_entries(full_path, names, stats, count);
+        meta_cache_store(full_path, ticket, names, stats, count);
+    }
+
+    size_t start = after[0] ? page_start(names, count, after) : 0;
+    size_t n = count - start;
+    if (max > 0 && n > max)
+        n = max;
+    *entries = n ? malloc(n * sizeof(ListedEntry)) : NULL;
+    if (n && !*entries)
+    {
+        // An empty page that promised more would never advance the cursor
+        for (size_t i = 0; i < count; i++)
+            free(names[i]);
+        free(stats);
+        free(names);
+        conn_reply_error(conn, RFS_ERR_IO, "Out of memory");
+        return -1;
+    }
+    *page_count = n;
+    *more = start + n < count;
 
-    // Check if path is a directory or file
-    if (stat(full_path, &st) == 0 && S_ISDIR(st.st_mode))
+    // Names on the page move into the entries; the rest are freed
+    for (size_t i = 0; i < count; i++)
     {
-        // It's a directory - list all files
-        DIR *dir = opendir(full_path);
-        if (!dir)
+        if (i >= start && i - start < n)
         {
-            snprintf(buffer, sizeof(buffer), "Failed to open directory: %s\n", path);
-            send(client_sock, buffer, strlen(buffer), 0);
-            return;
+            ListedEntry *e = &(*entries)[i - start];
+            EntryStat unknown = {-1, 0, 0, 0};
+            e->name = names[i];
+            e->st = stats ? stats[i] : unknown;
         }
+        else
+        {
+            free(names[i]);
+        }
+    }
+
+    free(stats);
+    free(names);
+    return 0;
+}
+
+// "<file>.v<seconds><microseconds>" is only a candidate: it is a stored
+// version if the manifest of <file> records one under that name
+static int is_stored_version(const char *dir_path, const char *name)
+{
+    const char *dot = strrchr(name, '.');
+    if (!dot || dot == name || dot[1] != 'v')
+        return 0;
+    size_t digits = strspn(dot + 2, "0123456789");
+    if (digits <= 6 || dot[2 + digits] != '\0')
+        return 0;
+
+    // Without the file there is no manifest to ask
+    char path[768];
+    EntryStat st;
+    struct stat sb;
+    snprintf(path, sizeof(path), "%s/%.*s", dir_path, (int)(dot - name), name);
+    if (meta_cache_stat(path, &st) == 0 ? st.result != 0 || st.is_dir
+                                        : stat(path, &sb) != 0 || S_ISDIR(sb.st_mode))
+        return 0;
+
+    path_lock_shared(path);
+    int found = manifest_has_version(path, name);
+    path_unlock(path);
+    return found;
+}
+
+// Queue one page of a directory as binary records; takes the entries
+static void reply_entries(Connection *conn, const char *full_path, ListedEntry *entries,
+                          size_t count, int more)
+{
+    // u8 type, u64 size, i64 mtime, u32 versions, then the name string
+    size_t body_len = 0;
+    for (size_t i = 0; i < count; i++)
+        body_len += 1 + 8 + 8 + 4 + 2 + strlen(entries[i].name);
+
+    unsigned char *body = body_len ? malloc(body_len) : NULL;
+    if (body_len && !body)
+    {
+        listed_entries_free(entries, count);
+        conn_reply_error(conn, RFS_ERR_IO, "Out of memory");
+        return;
+    }
 
-        struct dirent *entry;
-        while ((entry = readdir(dir)) != NULL)
+    MetaWriter w;
+    meta_writer_init(&w, body, body_len);
+    for (size_t i = 0; i < count; i++)
+    {
+        const ListedEntry *e = &entries[i];
+        uint8_t type = e->st.result != 0 ? RFS_ENTRY_UNKNOWN
+                       : e->st.is_dir    ? RFS_ENTRY_DIR
+                                         : RFS_ENTRY_FILE;
+        if (type == RFS_ENTRY_FILE && is_stored_version(full_path, e->name))
+            type = RFS_ENTRY_VERSION;
+
+        // Counted from the manifest cache; a page bounds how many are looked up
+        uint32_t versions = 0;
+        if (type == RFS_ENTRY_FILE)
         {
-            // Skip . and ..
-            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
-            {
-                continue;
-            }
-
-            // Get full path for the entry
-            char entry_full_path[512];
-            snprintf(entry_full_path, sizeof(entry_full_path), "%s/%s",
-                     full_path, entry->d_name);
-
-            // Get file stats
-            struct stat file_stat;
-            if (stat(entry_full_path, &file_stat) == 0)
-            {
-                char time_str[64];
-                format_timestamp(file_stat.st_mtime, time_str, sizeof(time_str));
-
-                snprintf(buffer, sizeof(buffer), "%s  %10lld bytes  %s\n",
-                         entry->d_name, (long long)file_stat.st_size, time_str);
-            }
-            else
-            {
-                snprintf(buffer, sizeof(buffer), "%s\n", entry->d_name);
-            }
-
-            send(client_sock, buffer, strlen(buffer), 0);
+            char path[768];
+            snprintf(path, sizeof(path), "%s/%s", full_path, e->name);
+            path_lock_shared(path);
+            manifest_version_count(path, &versions);
+            path_unlock(path);
         }
 
-        closedir(dir);
+        meta_put_u8(&w, type);
+        meta_put_u64(&w, (uint64_t)e->st.size);
+        meta_put_u64(&w, (uint64_t)(int64_t)e->st.mtime);
+        meta_put_u32(&w, versions);
+        meta_put_str(&w, e->name);
+    }
+
+    unsigned char reply_meta[8 + 256];
+    MetaWriter m;
+    meta_writer_init(&m, reply_meta, sizeof(reply_meta));
+    meta_put_u8(&m, RFS_LS_ENTRIES);
+    meta_put_u32(&m, (uint32_t)count);
+    meta_put_u8(&m, (uint8_t)more);
+    meta_put_str(&m, count ? entries[count - 1].name : "");
+    listed_entries_free(entries, count);
+
+    if (w.overflow || m.overflow)
+    {
+        free(body);
+        conn_reply_error(conn, RFS_ERR_IO, "Failed to encode listing");
+        return;
+    }
+    if (conn_reply(conn, RFS_OK, reply_meta, m.len, w.len) == 0 && w.len > 0)
+    {
+        conn_reply_data(conn, body, w.len);
     }
-    else if (file_exists(full_path))
+    free(body);
+}
+
+// Queue the version listing of a file as binary records: the file itself,
+// then its versions from the manifest, newest first
+static void reply_versions(Connection *conn, const char *full_path, const char *path,
+                           const EntryStat *st)
+{
+    VersionManifest snapshot;
+    path_lock_shared(full_path);
+    const VersionManifest *m = manifest_snapshot(full_path, &snapshot) == 0 ? &snapshot : NULL;
+    path_unlock(full_path);
+    size_t version_count = m ? m->count : 0;
+
+    // Type, id, size, time, digests, storage, then the name string
+    size_t record = 1 + 4 + 8 + 8 + 1 + 4 + SHA256_DIGEST_SIZE + 1 + 8 + 4 + 2;
+    size_t body_len = record + strlen(path);
+    for (size_t i = 0; i < version_count; i++)
+        body_len += record + strlen(m->versions[i].name);
+
+    unsigned char *body = malloc(body_len);
+    if (!body)
     {
-        // It's a file - list file and all its versions
-        time_t mtime = get_file_mtime(full_path);
-        char time_str[64];
-        format_timestamp(mtime, time_str, sizeof(time_str));
+        if (m)
+            manifest_free(&snapshot);
+        conn_reply_error(conn, RFS_ERR_IO, "Out of memory");
+        return;
+    }
 
-        snprintf(buffer, sizeof(buffer),
-                 "[CURRENT] %s\n"
-                 "  Size: %lld bytes\n"
-                 "  Last Modified: %s\n\n",
-                 path, (long long)st.st_size, time_str);
-        send(client_sock, buffer, strlen(buffer), 0);
-
-        // Find and list versions
-        char pattern[512];
-        snprintf(pattern, sizeof(pattern), "%s.v", full_path);
-
-        char dir_path[512];
-        strncpy(dir_path, full_path, sizeof(dir_path) - 1);
-        char *last_slash = strrchr(dir_path, '/');
-        if (last_slash)
+    // The recorded checksums only describe the file if it was not changed behind our back
+    MetaWriter w;
+    meta_writer_init(&w, body, body_len);
+    int described = m && m->has_current && m->current.size == (uint64_t)st->size;
+    meta_put_u8(&w, RFS_ENTRY_FILE);
+    meta_put_u32(&w, 0);
+    put_file_meta(&w, (uint64_t)st->size, (uint64_t)(int64_t)st->mtime,
+                  described ? &m->current : NULL);
+    meta_put_u8(&w, 0);
+    meta_put_u64(&w, 0);
+    meta_put_u32(&w, 0);
+    meta_put_str(&w, path);
+
+    char dir_path[512];
+    snprintf(dir_path, sizeof(dir_path), "%s", full_path);
+    char *last_slash = strrchr(dir_path, '/');
+    if (last_slash)
+        *last_slash = '\0';
+
+    for (size_t i = version_count; i-- > 0;)
+    {
+        // Sizes are of the contents; a compressed version also reports its footprint
+        const VersionEntry *v = &m->versions[i];
+        uint8_t stored = 0;
+        uint64_t stored_len = 0;
+        struct stat vst;
+        char version_path[768];
+        snprintf(version_path, sizeof(version_path), "%s/%s", dir_path, v->name);
+        if (v->pack)
         {
-            *last_slash = '\0';
+            stored = RFS_STORED_PACK | (v->compressed > 0 ? RFS_STORED_ZLIB : 0);
+            stored_len = v->pack_length;
         }
-        else
+        else if (v->compressed > 0 && stat(version_path, &vst) == 0)
         {
-            strcpy(dir_path, ".");
+            stored = RFS_STORED_ZLIB;
+            stored_len = (uint64_t)vst.st_size;
         }
 
-        DIR *dir = opendir(dir_path);
-        if (!dir)
-        {
-            return;
-        }
+        meta_put_u8(&w, RFS_ENTRY_VERSION);
+        meta_put_u32(&w, v->id);
+        put_file_meta(&w, v->content.size, (uint64_t)(v->written_us / 1000000), &v->content);
+        meta_put_u8(&w, stored);
+        meta_put_u64(&w, stored_len);
+        meta_put_u32(&w, v->pack);
+        meta_put_str(&w, v->name);
+    }
 
-        typedef struct
-        {
-            char filename[256];
-            time_t version_timestamp;
-            time_t file_mtime;
-            long size;
-        } VersionInfo;
+    if (m)
+        manifest_free(&snapshot);
 
-        VersionInfo versions[100];
-        int version_count = 0;
+    unsigned char reply_meta[8];
+    MetaWriter rm;
+    meta_writer_init(&rm, reply_meta, sizeof(reply_meta));
+    meta_put_u8(&rm, RFS_LS_VERSIONS);
+    meta_put_u32(&rm, (uint32_t)(version_count + 1));
 
-        struct dirent *entry;
-        while ((entry = readdir(dir)) != NULL && version_count < 100)
-        {
-            char full_entry_path[512];
-            snprintf(full_entry_path, sizeof(full_entry_path), "%s/%s",
-                     dir_path, entry->d_name);
-
-            if (strncmp(full_entry_path, pattern, strlen(pattern)) == 0)
-            {
-                struct stat version_stat;
-                if (stat(full_entry_path, &version_stat) == 0)
-                {
-                    strncpy(versions[version_count].filename, full_entry_path,
-                            sizeof(versions[version_count].filename) - 1);
-
-                    versions[version_count].version_timestamp =
-                        extract_version_timestamp(full_entry_path);
-
-                    versions[version_count].file_mtime = version_stat.st_mtime;
-                    versions[version_count].size = version_stat.st_size;
-                    version_count++;
-                }
-            }
-        }
+    if (w.overflow || rm.overflow)
+    {
+        free(body);
+        conn_reply_error(conn, RFS_ERR_IO, "Failed to encode listing");
+        return;
+    }
+    if (conn_reply(conn, RFS_OK, reply_meta, rm.len, w.len) == 0)
+        conn_reply_data(conn, body, w.len);
+    free(body);
+}
 
-        closedir(dir);
+void handle_ls_request(Connection *conn, MetaReader *meta)
+{
+    char path[256];
+    char cursor[256] = "";
+    size_t page_size = 0;
 
-        // Sort by version timestamp (newest first)
-        for (int i = 0; i < version_count - 1; i++)
-        {
-            for (int j = i + 1; j < version_count; j++)
-            {
-                if (versions[j].version_timestamp > versions[i].version_timestamp)
-                {
-                    VersionInfo temp = versions[i];
-                    versions[i] = versions[j];
-                    versions[j] = temp;
-                }
-            }
-        }
+    if (read_request_path(conn, meta, path, sizeof(path)) != 0)
+    {
+        return;
+    }
 
-        // Display versions
-        for (int i = 0; i < version_count; i++)
+    // A paged request resumes after the last name of the previous page
+    if (conn->req.flags & RFS_FLAG_PAGED)
+    {
+        page_size = meta_get_u32(meta);
+        meta_get_str(meta, cursor, sizeof(cursor));
+        if (meta->error)
         {
-            char written_time[64];
-
-            if (versions[i].version_timestamp > 0)
-            {
-                format_timestamp(versions[i].version_timestamp, written_time,
-                                 sizeof(written_time));
-            }
-            else
-            {
-                strcpy(written_time, "Unknown");
-            }
-
-            snprintf(buffer, sizeof(buffer),
-                     "[VERSION %d] %s\n"
-                     "  Size: %lld bytes\n"
-                     "  Written: %s\n\n",
-                     version_count - i,
-                     versions[i].filename,
-                     (long long)versions[i].size,
-                     written_time);
-            send(client_sock, buffer, strlen(buffer), 0);
+            conn_reply_error(conn, RFS_ERR_BAD_REQUEST, "Malformed request");
+            return;
         }
+        if (page_size == 0 || page_size > LS_MAX_PAGE_SIZE)
+            page_size = LS_MAX_PAGE_SIZE;
+    }
 
-        if (version_count == 0)
+    printf("LS request for: %s\n", path);
+
+    // Build full storage path
+    char full_path[512];
+    build_storage_path(path, full_path, sizeof(full_path));
+
+    printf("Listing: %s\n", full_path);
+
+    // A cached directory is answered without touching the disk
+    ListedEntry *entries;
+    size_t count;
+    int more;
+    if (meta_cache_page(full_path, cursor, page_size, &entries, &count, &more) == 0)
+    {
+        reply_entries(conn, full_path, entries, count, more);
+        return;
+    }
+
+    // Check if path is a directory or file, from its cached parent if possible
+    EntryStat st;
+    if (meta_cache_stat(full_path, &st) != 0)
+    {
+        struct stat sb;
+        memset(&st, 0, sizeof(st));
+        if (stat(full_path, &sb) == 0)
         {
-            snprintf(buffer, sizeof(buffer), "(No previous versions)\n");
-            send(client_sock, buffer, strlen(buffer), 0);
+            st.size = (int64_t)sb.st_size;
+            st.mtime = sb.st_mtime;
+            st.is_dir = S_ISDIR(sb.st_mode);
         }
         else
         {
-            snprintf(buffer, sizeof(buffer),
-                     "Total: 1 current + %d version(s)\n", version_count);
-            send(client_sock, buffer, strlen(buffer), 0);
+            st.result = -errno;
         }
     }
+
+    if (st.result == 0 && st.is_dir)
+    {
+        if (read_directory_page(conn, full_path, cursor, page_size, &entries, &count, &more) == 0)
+            reply_entries(conn, full_path, entries, count, more);
+        return;
+    }
+    else if (st.result == 0)
+    {
+        reply_versions(conn, full_path, path, &st);
+    }
     else
     {
-        snprintf(buffer, sizeof(buffer), "Path not found: %s\n", path);
-        send(client_sock, buffer, strlen(buffer), 0);
+        conn_reply_error(conn, RFS_ERR_NOT_FOUND, "Path not found");
     }
 }
 
-void handle_stop_request(void)
+void handle_stats_request(Connection *conn)
+{
+    StripeStats top[STATS_TOP_STRIPES];
+    StripeStats total;
+    size_t n = lock_table_stats(top, STATS_TOP_STRIPES, &total);
+
+    TextBuf report = {NULL, 0, 0};
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer),
+             "Path locks: %zu stripes\n"
+             "  Acquired: %" PRIu64 "\n"
+             "  Waited: %" PRIu64 " (%.3f ms total)\n",
+             lock_table_size(), total.acquired, total.waits, total.wait_ns / 1e6);
+    text_append(&report, buffer);
+
+    if (n > 0)
+    {
+        snprintf(buffer, sizeof(buffer), "Longest waits:\n");
+        text_append(&report, buffer);
+    }
+    for (size_t i = 0; i < n; i++)
+    {
+        snprintf(buffer, sizeof(buffer),
+                 "  [STRIPE %zu] %" PRIu64 " of %" PRIu64 " waited, %.3f ms\n", top[i].stripe,
+                 top[i].waits, top[i].acquired, top[i].wait_ns / 1e6);
+        text_append(&report, buffer);
+    }
+
+    ContentCacheStats cache;
+    content_cache_stats(&cache);
+    snprintf(buffer, sizeof(buffer),
+             "Content cache: %zu object(s), %zu bytes\n"
+             "  Hits: %" PRIu64 "\n"
+             "  Misses: %" PRIu64 "\n"
+             "  Evictions: %" PRIu64 "\n"
+             "  Invalidations: %" PRIu64 "\n",
+             cache.objects, cache.bytes, cache.hits, cache.misses, cache.evictions,
+             cache.invalidations);
+    text_append(&report, buffer);
+
+    reply_text(conn, &report, NULL, 0);
+}
+
+void handle_stop_request(Connection *conn)
 {
     printf("STOP command received. Shutting down server...\n");
     set_server_running(0);
-}
\ No newline at end of file
+    conn_reply(conn, RFS_OK, NULL, 0, 0);
+
+    // No further requests are served on this connection
+    conn->close_after_reply = 1;
+}
@@ -7,46 +7,167 @@
 #ifndef SERVER_HANDLERS_H
 #define SERVER_HANDLERS_H
 
+#include "protocol.h"
+#include "connection.h"
+
+/**
+ * @brief  Dispatch a fully read request frame to its handler
+ *
+ * Handlers run on the reactor and must not block on the network: they queue
+ * their reply on the connection, or claim the request body and reply from
+ * the completion callback. An unclaimed body is discarded.
+ *
+ * @param conn connection whose request header and metadata have been read
+ * @param meta request metadata
+ */
+void handle_request(Connection *conn, MetaReader *meta);
+
 /**
  * @brief  Handle WRITE request from client, copying file to server
  *
- * @param client_sock socket descriptor
+ * Claims the request body; the reply is queued once the upload is complete.
+ *
+ * @param conn connection carrying the request
+ * @param meta request metadata
+ */
+void handle_write_request(Connection *conn, MetaReader *meta);
+
+/**
+ * @brief  Handle UPLOAD_OPEN request, creating (or resuming) the staging file for a ranged upload
+ *
+ * @param conn connection carrying the request
+ * @param meta request metadata
+ */
+void handle_upload_open_request(Connection *conn, MetaReader *meta);
+
+/**
+ * @brief  Handle UPLOAD_RANGE request, writing one byte range of a ranged upload
+ *
+ * Claims the request body; the reply is queued once the range is stored.
+ *
+ * @param conn connection carrying the request
+ * @param meta request metadata
+ */
+void handle_upload_range_request(Connection *conn, MetaReader *meta);
+
+/**
+ * @brief  Handle UPLOAD_COMMIT request, publishing a ranged upload whose bytes all arrived
+ *
+ * @param conn connection carrying the request
+ * @param meta request metadata
+ */
+void handle_upload_commit_request(Connection *conn, MetaReader *meta);
+
+/**
+ * @brief  Handle UPLOAD_STATUS request, reporting which bytes of a ranged upload arrived
+ *
+ * @param conn connection carrying the request
+ * @param meta request metadata
+ */
+void handle_upload_status_request(Connection *conn, MetaReader *meta);
+
+/**
+ * @brief  Handle UPLOAD_ABORT request, discarding a ranged upload
+ *
+ * @param conn connection carrying the request
+ * @param meta request metadata
  */
-void handle_write_request(int client_sock);
+void handle_upload_abort_request(Connection *conn, MetaReader *meta);
 
 /**
- * @brief  Handle GET request from client, sending file to client
+ * @brief  Handle SIGNATURE request, sending block checksums of a stored file
  *
- * @param client_sock socket descriptor
+ * @param conn connection carrying the request
+ * @param meta request metadata
  */
-void handle_get_request(int client_sock);
+void handle_signature_request(Connection *conn, MetaReader *meta);
+
+/**
+ * @brief  Handle DELTA_WRITE request, rebuilding a file from its stored version and a delta
+ *
+ * Claims the request body; the reply is queued once the new file is published.
+ *
+ * @param conn connection carrying the request
+ * @param meta request metadata
+ */
+void handle_delta_write_request(Connection *conn, MetaReader *meta);
+
+/**
+ * @brief  Handle DEDUP_WRITE request, storing a file by linking contents the server already has
+ *
+ * Has no body. Replies RFS_ERR_NOT_FOUND if no stored file has the offered
+ * digest, and the client sends the contents after all.
+ *
+ * @param conn connection carrying the request
+ * @param meta request metadata
+ */
+void handle_dedup_write_request(Connection *conn, MetaReader *meta);
+
+/**
+ * @brief  Handle MKDIRS request, creating every listed directory
+ *
+ * The metadata holds a u32 count and that many paths. Invalid paths are
+ * counted as failures rather than failing the request.
+ *
+ * @param conn connection carrying the request
+ * @param meta request metadata
+ */
+void handle_mkdirs_request(Connection *conn, MetaReader *meta);
+
+/**
+ * @brief  Handle GET request from client, sending file (or a range of it) to client
+ *
+ * @param conn connection carrying the request
+ * @param meta request metadata
+ */
+void handle_get_request(Connection *conn, MetaReader *meta);
 
 /**
  * @brief  Handle GETVERSION request from client, sending specific file version to client
  *
- * @param client_sock socket descriptor
+ * @param conn connection carrying the request
+ * @param meta request metadata
  */
-void handle_getversion_request(int client_sock);
+void handle_getversion_request(Connection *conn, MetaReader *meta);
 
 /**
  * @brief  Handle RM request from client, deleting file and all its versions
  *
- * @param client_sock socket descriptor
+ * @param conn connection carrying the request
+ * @param meta request metadata
  */
-void handle_rm_request(int client_sock);
+void handle_rm_request(Connection *conn, MetaReader *meta);
 
 /**
  * @brief  Handle LS request from client, listing all versions of the file
  *
- * @param client_sock socket descriptor
+ * @param conn connection carrying the request
+ * @param meta request metadata
+ */
+void handle_ls_request(Connection *conn, MetaReader *meta);
+
+/**
+ * @brief  Handle STATS request, listing lock waits per stripe
+ *
+ * @param conn connection carrying the request
  */
-void handle_ls_request(int client_sock);
+void handle_stats_request(Connection *conn);
 
 /**
  * @brief  Handle STOP request from client, shutting down server
  *
+ * @param conn connection carrying the request; it is closed after the reply
+ */
+void handle_stop_request(Connection *conn);
+
+/**
+ * @brief Record a SHA-256 with every stored version, besides the CRC32C
+ *
+ * Call before serving requests.
+ *
+ * @param enable 1 to record strong hashes
  */
-void handle_stop_request(void);
+void set_strong_checksums(int enable);
 
 /**
  * @brief  Set server running state
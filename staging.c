@@ -0,0 +1,386 @@
+/*
+ * staging.c, Yehen Yan, CS5600 Practicum II
+ * Staging objects for uploads that arrive as byte ranges
+ * Last modified: Dec 2025
+ */
+#define _POSIX_C_SOURCE 200809L // O_CLOEXEC
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include "staging.h"
+#include "file_utils.h"
+#include "config.h"
+
+// A run of received bytes and its CRC32C
+typedef struct
+{
+    uint64_t start;
+    uint64_t end;
+    uint32_t crc32c;
+} Extent;
+
+typedef struct StagedUpload
+{
+    uint64_t id;
+    uint64_t resume_key;
+    StagedFile file; // hashed and sha256: the SHA-256 of the bytes received in order
+    Extent *have;    // received bytes, sorted and merged
+    size_t have_count;
+    size_t have_cap;
+    int crc_lost; // a range overlapped bytes already received
+    int hashing;  // the range continuing file.hashed is being received
+    int writers;  // ranges being received right now
+    time_t last_active;
+    struct StagedUpload *next;
+} StagedUpload;
+
+static StagedUpload *uploads = NULL;
+static uint64_t next_id = 0;
+static pthread_mutex_t staging_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Caller holds staging_lock
+static StagedUpload *find_upload(uint64_t id)
+{
+    for (StagedUpload *up = uploads; up; up = up->next)
+    {
+        if (up->id == id)
+            return up;
+    }
+    return NULL;
+}
+
+// Caller holds staging_lock
+static void unlink_upload(StagedUpload *up)
+{
+    StagedUpload **link = &uploads;
+    while (*link && *link != up)
+        link = &(*link)->next;
+    if (*link)
+        *link = up->next;
+}
+
+// Merge [start, end) with checksum crc into the received extents. Caller
+// holds staging_lock.
+static int add_extent(StagedUpload *up, uint64_t start, uint64_t end, uint32_t crc)
+{
+    // Ranges i..j-1 overlap or touch the new one and collapse into it. The
+    // ones that only touch it are joined by checksum; bytes received twice
+    // leave no way to do that.
+    size_t i = 0;
+    while (i < up->have_count && up->have[i].end < start)
+        i++;
+
+    uint64_t lo = start, hi = end;
+    size_t j = i;
+    while (j < up->have_count && up->have[j].start <= end)
+    {
+        const Extent *e = &up->have[j];
+        if (e->end == start)
+            crc = crc32c_combine(e->crc32c, crc, end - start);
+        else if (e->start == end)
+            crc = crc32c_combine(crc, e->crc32c, e->end - e->start);
+        else
+            up->crc_lost = 1;
+
+        if (e->start < lo)
+            lo = e->start;
+        if (e->end > hi)
+            hi = e->end;
+        j++;
+    }
+
+    if (i == j)
+    {
+        if (up->have_count == up->have_cap)
+        {
+            size_t cap = up->have_cap ? up->have_cap * 2 : 8;
+            Extent *grown = realloc(up->have, cap * sizeof(Extent));
+            if (!grown)
+                return -1;
+            up->have = grown;
+            up->have_cap = cap;
+        }
+        memmove(&up->have[i + 1], &up->have[i], (up->have_count - i) * sizeof(Extent));
+        up->have_count++;
+    }
+    else
+    {
+        memmove(&up->have[i + 1], &up->have[j], (up->have_count - j) * sizeof(Extent));
+        up->have_count -= j - i - 1;
+    }
+
+    up->have[i].start = lo;
+    up->have[i].end = hi;
+    up->have[i].crc32c = crc;
+    return 0;
+}
+
+// Caller holds staging_lock
+static int is_complete(const StagedUpload *up)
+{
+    if (up->file.size == 0)
+        return 1;
+    return up->have_count == 1 && up->have[0].start == 0 && up->have[0].end == up->file.size;
+}
+
+static void free_upload(StagedUpload *up)
+{
+    free(up->have);
+    free(up);
+}
+
+// Caller holds staging_lock
+static StagedUpload *find_resumable(const char *target_path, uint64_t size, uint64_t resume_key)
+{
+    for (StagedUpload *up = uploads; up; up = up->next)
+    {
+        if (up->resume_key == resume_key && up->file.size == size &&
+            strcmp(up->file.target_path, target_path) == 0)
+            return up;
+    }
+    return NULL;
+}
+
+int staging_create(const char *target_path, const char *dir_path, uint64_t size,
+                   uint64_t resume_key, uint64_t *id)
+{
+    if (resume_key != 0)
+    {
+        pthread_mutex_lock(&staging_lock);
+        StagedUpload *found = find_resumable(target_path, size, resume_key);
+        if (found)
+        {
+            found->last_active = time(NULL);
+            *id = found->id;
+        }
+        pthread_mutex_unlock(&staging_lock);
+        if (found)
+            return 1;
+    }
+
+    StagedUpload *up = calloc(1, sizeof(StagedUpload));
+    if (!up)
+    {
+        perror("Failed to allocate upload");
+        return -1;
+    }
+
+    pthread_mutex_lock(&staging_lock);
+    // Seeded from the clock so ids are not reused across server restarts
+    if (next_id == 0)
+        next_id = ((uint64_t)time(NULL) << 20) | 1;
+    up->id = next_id++;
+    pthread_mutex_unlock(&staging_lock);
+
+    up->resume_key = resume_key;
+    snprintf(up->file.target_path, sizeof(up->file.target_path), "%s", target_path);
+    snprintf(up->file.temp_path, sizeof(up->file.temp_path), "%s/%s%" PRIx64, dir_path,
+             RFS_PART_PREFIX, up->id);
+    up->file.size = size;
+    sha256_init(&up->file.sha256);
+    up->last_active = time(NULL);
+
+    int fd = open(up->file.temp_path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        perror("Failed to create part file");
+        free_upload(up);
+        return -1;
+    }
+
+    // Full size up front: ranges are written in place, in any order
+    preallocate_file(fd, size);
+    if (ftruncate(fd, (off_t)size) != 0)
+    {
+        perror("Failed to size part file");
+        close(fd);
+        unlink(up->file.temp_path);
+        free_upload(up);
+        return -1;
+    }
+    close(fd);
+
+    pthread_mutex_lock(&staging_lock);
+    up->next = uploads;
+    uploads = up;
+    pthread_mutex_unlock(&staging_lock);
+
+    *id = up->id;
+    return 0;
+}
+
+int staging_received(uint64_t id, uint64_t *size, ByteRange *out, int max)
+{
+    pthread_mutex_lock(&staging_lock);
+    StagedUpload *up = find_upload(id);
+    if (!up)
+    {
+        pthread_mutex_unlock(&staging_lock);
+        return -1;
+    }
+
+    int count = up->have_count < (size_t)max ? (int)up->have_count : max;
+    for (int i = 0; i < count; i++)
+    {
+        out[i].start = up->have[i].start;
+        out[i].end = up->have[i].end;
+    }
+    *size = up->file.size;
+    up->last_active = time(NULL);
+    pthread_mutex_unlock(&staging_lock);
+    return count;
+}
+
+int staging_open_range(uint64_t id, uint64_t offset, uint64_t len, int strong,
+                       ContentDigest *digest)
+{
+    pthread_mutex_lock(&staging_lock);
+    StagedUpload *up = find_upload(id);
+    if (!up)
+    {
+        pthread_mutex_unlock(&staging_lock);
+        return -1;
+    }
+
+    if (offset > up->file.size || len > up->file.size - offset)
+    {
+        pthread_mutex_unlock(&staging_lock);
+        return -2;
+    }
+
+    int fd = open(up->file.temp_path, O_WRONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        perror("Failed to open part file");
+        pthread_mutex_unlock(&staging_lock);
+        return -1;
+    }
+
+    // Only the range next in line can extend the SHA-256
+    content_digest_init(digest, 0);
+    if (strong && offset == up->file.hashed && !up->hashing)
+    {
+        digest->strong = 1;
+        digest->sha256 = up->file.sha256;
+        up->hashing = 1;
+    }
+
+    up->writers++;
+    up->last_active = time(NULL);
+    pthread_mutex_unlock(&staging_lock);
+    return fd;
+}
+
+void staging_range_done(uint64_t id, uint64_t offset, uint64_t received,
+                        const ContentDigest *digest)
+{
+    pthread_mutex_lock(&staging_lock);
+    StagedUpload *up = find_upload(id);
+    if (up)
+    {
+        // Bytes of a broken range that did land count too, so a resumed
+        // upload does not send them again
+        if (received > 0 && add_extent(up, offset, offset + received, digest->crc32c) != 0)
+        {
+            // The range stays missing; the client will be told at commit
+            fprintf(stderr, "Failed to record range of upload %" PRIx64 "\n", id);
+        }
+        else if (digest->strong)
+        {
+            up->file.sha256 = digest->sha256;
+            up->file.hashed = offset + received;
+        }
+        if (digest->strong)
+            up->hashing = 0;
+        up->writers--;
+        up->last_active = time(NULL);
+    }
+    pthread_mutex_unlock(&staging_lock);
+}
+
+int staging_commit(uint64_t id, StagedFile *out)
+{
+    pthread_mutex_lock(&staging_lock);
+    StagedUpload *up = find_upload(id);
+    if (!up)
+    {
+        pthread_mutex_unlock(&staging_lock);
+        return -1;
+    }
+
+    if (!is_complete(up))
+    {
+        pthread_mutex_unlock(&staging_lock);
+        return -2;
+    }
+
+    // A connection that died mid-range may still hold the part file open
+    // until the server notices; it must not write into the published file
+    if (up->writers > 0)
+    {
+        pthread_mutex_unlock(&staging_lock);
+        return -3;
+    }
+
+    unlink_upload(up);
+    pthread_mutex_unlock(&staging_lock);
+
+    *out = up->file;
+    out->crc_known = !up->crc_lost;
+    out->crc32c = up->have_count > 0 ? up->have[0].crc32c : 0;
+    free_upload(up);
+    return 0;
+}
+
+int staging_abort(uint64_t id)
+{
+    pthread_mutex_lock(&staging_lock);
+    StagedUpload *up = find_upload(id);
+    if (!up || up->writers > 0)
+    {
+        pthread_mutex_unlock(&staging_lock);
+        return -1;
+    }
+    unlink_upload(up);
+    pthread_mutex_unlock(&staging_lock);
+
+    unlink(up->file.temp_path);
+    free_upload(up);
+    return 0;
+}
+
+void staging_sweep(time_t now)
+{
+    StagedUpload *expired = NULL;
+
+    pthread_mutex_lock(&staging_lock);
+    StagedUpload *up = uploads;
+    while (up)
+    {
+        StagedUpload *next = up->next;
+        if (up->writers == 0 && now - up->last_active >= STAGING_IDLE_TIMEOUT)
+        {
+            unlink_upload(up);
+            up->next = expired;
+            expired = up;
+        }
+        up = next;
+    }
+    pthread_mutex_unlock(&staging_lock);
+
+    // File system work happens outside the lock
+    while (expired)
+    {
+        StagedUpload *next = expired->next;
+        printf("Dropping abandoned upload %" PRIx64 " for %s\n", expired->id,
+               expired->file.target_path);
+        unlink(expired->file.temp_path);
+        free_upload(expired);
+        expired = next;
+    }
+}
@@ -0,0 +1,128 @@
+/*
+ * staging.h, Yehen Yan, CS5600 Practicum II
+ * Staging objects for uploads that arrive as byte ranges
+ * Last modified: Dec 2025
+ */
+
+#ifndef STAGING_H
+#define STAGING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include "checksum.h"
+
+/*
+ * A ranged upload is received into a hidden, full-size part file next to
+ * its target. Ranges may arrive in any order and over any number of
+ * connections; the server records which bytes have landed and publishes
+ * the file only once every byte is present.
+ *
+ * Uploads outlive the connections that feed them. A client that lost its
+ * connections asks which bytes arrived and sends only the rest; a client
+ * that was restarted finds its upload again by target path, size and the
+ * resume key it chose for the local file.
+ *
+ * Every range is checksummed while it is received. The CRC32C of each run
+ * of received bytes is combined from the ranges that make it up; the
+ * SHA-256 can only be extended by the range that continues the bytes
+ * hashed so far, so ranges that overtake it are left for the publisher.
+ */
+
+// A run of bytes [start, end)
+typedef struct
+{
+    uint64_t start;
+    uint64_t end;
+} ByteRange;
+
+// What a committed upload needs for publishing
+typedef struct
+{
+    char target_path[512];
+    char temp_path[640];
+    uint64_t size;
+    int crc_known; // crc32c covers the whole file (no range arrived twice)
+    uint32_t crc32c;
+    uint64_t hashed; // bytes from the start that sha256 covers
+    Sha256 sha256;
+} StagedFile;
+
+/**
+ * @brief Create the part file for a new ranged upload, or find an unfinished one
+ *
+ * @param target_path final storage path
+ * @param dir_path existing directory of target_path
+ * @param size total file size
+ * @param resume_key client-chosen key; a nonzero key matching an unfinished
+ *                   upload of the same target and size resumes that upload
+ * @param id receives the transfer id
+ * @return int 0 for a new upload, 1 for a resumed one, -1 if the part file could not be created
+ */
+int staging_create(const char *target_path, const char *dir_path, uint64_t size,
+                   uint64_t resume_key, uint64_t *id);
+
+/**
+ * @brief Report which bytes of an upload have arrived
+ *
+ * @param id transfer id
+ * @param size receives the total file size
+ * @param out receives received ranges in ascending order
+ * @param max capacity of out
+ * @return int number of ranges stored (at most max; further ranges are left out), -1 if unknown
+ */
+int staging_received(uint64_t id, uint64_t *size, ByteRange *out, int max);
+
+/**
+ * @brief Open the part file to receive one range
+ *
+ * Every successful call must be paired with staging_range_done().
+ *
+ * @param id transfer id
+ * @param offset first byte of the range
+ * @param len range length
+ * @param strong the upload needs a SHA-256
+ * @param digest receives the digest to feed the range's bytes into; it
+ *               continues the upload's SHA-256 if the range is next in line
+ * @return int writable descriptor, -1 if the transfer is unknown, -2 if the range does not fit
+ */
+int staging_open_range(uint64_t id, uint64_t offset, uint64_t len, int strong,
+                       ContentDigest *digest);
+
+/**
+ * @brief Record the end of a range started with staging_open_range()
+ *
+ * @param id transfer id
+ * @param offset first byte of the range
+ * @param received bytes written from offset on (less than the range if it broke off)
+ * @param digest the digest from staging_open_range(), fed exactly those bytes
+ */
+void staging_range_done(uint64_t id, uint64_t offset, uint64_t received,
+                        const ContentDigest *digest);
+
+/**
+ * @brief Detach a complete upload from the table so the caller can publish it
+ *
+ * @param id transfer id
+ * @param out receives the paths, size and checksums
+ * @return int 0 on success, -1 if the transfer is unknown, -2 if ranges are missing,
+ *             -3 if ranges are still being received
+ */
+int staging_commit(uint64_t id, StagedFile *out);
+
+/**
+ * @brief Drop an upload and delete its part file
+ *
+ * @param id transfer id
+ * @return int 0 on success, -1 if the transfer is unknown or busy
+ */
+int staging_abort(uint64_t id);
+
+/**
+ * @brief Drop uploads that saw no range for STAGING_IDLE_TIMEOUT seconds
+ *
+ * @param now current time
+ */
+void staging_sweep(time_t now);
+
+#endif // STAGING_H
@@ -0,0 +1,568 @@
+/*
+ * tree_transfer.c, Yehen Yan, CS5600 Practicum II
+ * Recursive WRITE and GET of whole directory trees
+ * Last modified: Dec 2025
+ *
+ * A tree of many small files is dominated by round trips, not bytes. The
+ * directories are created first in a few MKDIRS requests, so no upload
+ * has to create its own. The small files are then pipelined over a pool of
+ * connections (the BATCH machinery), and files of at least
+ * PARALLEL_MIN_SIZE bytes are moved one at a time the way a single WRITE
+ * or GET moves them.
+ */
+#define _XOPEN_SOURCE 700 // nftw, strdup
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include "tree_transfer.h"
+#include "operations.h"
+#include "ranged_transfer.h"
+#include "dedup_transfer.h"
+#include "network.h"
+#include "protocol.h"
+#include "config.h"
+
+// Request ids only need to be unique per connection
+static uint32_t next_request_id = 1;
+
+// Growable list of paths, each malloc'd
+typedef struct
+{
+    char **paths;
+    size_t count;
+    size_t cap;
+} PathList;
+
+// One entry of a remote directory
+typedef struct
+{
+    char *name;
+    uint8_t type; // RFS_ENTRY_*
+    uint64_t size;
+} RemoteEntry;
+
+static int path_list_add(PathList *list, const char *path)
+{
+    if (list->count == list->cap)
+    {
+        size_t cap = list->cap ? list->cap * 2 : 64;
+        char **grown = realloc(list->paths, cap * sizeof(char *));
+        if (!grown)
+            return -1;
+        list->paths = grown;
+        list->cap = cap;
+    }
+    list->paths[list->count] = strdup(path);
+    if (!list->paths[list->count])
+        return -1;
+    list->count++;
+    return 0;
+}
+
+static void path_list_free(PathList *list)
+{
+    for (size_t i = 0; i < list->count; i++)
+        free(list->paths[i]);
+    free(list->paths);
+    memset(list, 0, sizeof(*list));
+}
+
+// Join a directory and a name below it. An empty name is the directory
+// itself; "." (the storage root) and "" add nothing in front of the name.
+static int join_path(char *out, size_t size, const char *dir, const char *name)
+{
+    int n;
+    if (name[0] == '\0')
+        n = snprintf(out, size, "%s", dir);
+    else if (dir[0] == '\0' || strcmp(dir, ".") == 0)
+        n = snprintf(out, size, "%s", name);
+    else
+        n = snprintf(out, size, "%s/%s", dir, name);
+
+    if (n < 0 || (size_t)n >= size)
+    {
+        fprintf(stderr, "Path too long: %s/%s\n", dir, name);
+        return -1;
+    }
+    return 0;
+}
+
+static int add_request(RfsRequest **reqs, size_t *count, size_t *cap)
+{
+    if (*count == *cap)
+    {
+        size_t grown_cap = *cap ? *cap * 2 : 64;
+        RfsRequest *grown = realloc(*reqs, grown_cap * sizeof(RfsRequest));
+        if (!grown)
+        {
+            perror("Failed to allocate requests");
+            return -1;
+        }
+        *reqs = grown;
+        *cap = grown_cap;
+    }
+    return 0;
+}
+
+// Move the prepared requests: small files pipelined over the pool, large
+// ones in ranges. Prints the failures and a summary; returns how many failed.
+static int run_transfers(RfsRequest *reqs, size_t count, size_t dirs, int connections)
+{
+    // Small files first, so the pool is busy while nothing else is
+    size_t small = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (reqs[i].file_size < PARALLEL_MIN_SIZE)
+        {
+            RfsRequest tmp = reqs[small];
+            reqs[small++] = reqs[i];
+            reqs[i] = tmp;
+        }
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // Per-file chatter would drown the report
+    set_verbose(0);
+    if (small > 0)
+        run_batch(reqs, small, connections);
+    set_verbose(1);
+
+    for (size_t i = small; i < count; i++)
+    {
+        if (reqs[i].result != 0)
+            continue; // preparation failed
+        if (reqs[i].op == OP_GET)
+        {
+            ranged_get(&reqs[i], connections);
+            continue;
+        }
+
+        // As for a single WRITE: link contents the server has, send a
+        // delta against the stored copy, and only then the whole file
+        int r = reuse_write(&reqs[i]);
+        if (r > 0)
+        {
+            reqs[i].result = 0;
+            ranged_write(&reqs[i], connections);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    int failures = 0;
+    long long total_bytes = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (reqs[i].result == 0)
+        {
+            total_bytes += reqs[i].bytes;
+            continue;
+        }
+        failures++;
+        if (reqs[i].op == OP_WRITE)
+            printf("FAIL %-10s %s -> %s\n", "WRITE", reqs[i].local_path, reqs[i].remote_path);
+        else
+            printf("FAIL %-10s %s -> %s\n", "GET", reqs[i].remote_path, reqs[i].local_path);
+    }
+
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    double mb = total_bytes / (1024.0 * 1024.0);
+    printf("Tree: %zu file(s) in %zu director(ies), %d failed, %.2f MB in %.2f s "
+           "(%.2f MB/s, %.0f files/s)\n",
+           count, dirs, failures, mb, seconds, seconds > 0 ? mb / seconds : 0.0,
+           seconds > 0 ? count / seconds : 0.0);
+    return failures;
+}
+
+// ========== WRITE ==========
+
+// What nftw() found under the local root, relative to it
+static PathList walk_dirs;
+static PathList walk_files;
+static size_t walk_root_len;
+static int walk_failed;
+
+static int collect_local(const char *path, const struct stat *st, int type, struct FTW *ftw)
+{
+    (void)st;
+    (void)ftw;
+    const char *rel = path + walk_root_len;
+    while (*rel == '/')
+        rel++;
+    if (*rel == '\0')
+        return 0;
+
+    if (type == FTW_D || type == FTW_F)
+    {
+        if (path_list_add(type == FTW_D ? &walk_dirs : &walk_files, rel) != 0)
+        {
+            perror("Failed to list local tree");
+            walk_failed = 1;
+            return 1;
+        }
+    }
+    else if (type == FTW_SL)
+    {
+        printf("Skipping symbolic link '%s'\n", path);
+    }
+    else
+    {
+        fprintf(stderr, "Cannot read '%s'\n", path);
+        walk_failed = 1;
+    }
+    return 0;
+}
+
+// Create remote directories, as many per request as fit in the metadata.
+// Returns 0 when every batch was accepted, 1 if the server rejected one and
+// -1 if the connection was lost.
+static int make_remote_dirs(int sock, char *const dirs[], size_t count)
+{
+    uint32_t failed = 0;
+    size_t i = 0;
+    while (i < count)
+    {
+        size_t n = 0, len = 4;
+        while (i + n < count && len + 2 + strlen(dirs[i + n]) <= RFS_MAX_META)
+            len += 2 + strlen(dirs[i + n++]);
+
+        unsigned char meta[RFS_MAX_META];
+        MetaWriter w;
+        meta_writer_init(&w, meta, sizeof(meta));
+        meta_put_u32(&w, (uint32_t)n);
+        for (size_t k = 0; k < n; k++)
+            meta_put_str(&w, dirs[i + k]);
+
+        FrameHeader hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.opcode = OP_MKDIRS;
+        hdr.request_id = next_request_id++;
+        if (send_frame(sock, &hdr, meta, w.len, 0) < 0 ||
+            recv_frame(sock, &hdr, meta, sizeof(meta)) < 0 ||
+            discard_data(sock, frame_body_len(&hdr)) < 0)
+        {
+            fprintf(stderr, "Connection to server lost\n");
+            return -1;
+        }
+        if (hdr.status != RFS_OK)
+        {
+            fprintf(stderr, "MKDIRS failed: %s\n", status_to_string(hdr.status));
+            return 1;
+        }
+
+        MetaReader r;
+        meta_reader_init(&r, meta, hdr.meta_len);
+        meta_get_u32(&r); // created
+        failed += meta_get_u32(&r);
+        i += n;
+    }
+
+    if (failed > 0)
+        fprintf(stderr, "Warning: %u remote director(ies) could not be created\n", failed);
+    return 0;
+}
+
+int tree_write(const char *local_dir, const char *remote_dir, int connections)
+{
+    struct stat st;
+    if (stat(local_dir, &st) != 0 || !S_ISDIR(st.st_mode))
+    {
+        fprintf(stderr, "Not a local directory: %s\n", local_dir);
+        return 1;
+    }
+
+    walk_root_len = strlen(local_dir);
+    walk_failed = 0;
+    if (nftw(local_dir, collect_local, 64, FTW_PHYS) != 0 || walk_failed)
+    {
+        path_list_free(&walk_dirs);
+        path_list_free(&walk_files);
+        return 1;
+    }
+    printf("Writing %zu file(s) in %zu director(ies) from '%s' to %s:%d as '%s'\n",
+           walk_files.count, walk_dirs.count, local_dir, SERVER_IP, SERVER_PORT, remote_dir);
+
+    // Every remote directory, parents first, in as few requests as fit
+    PathList remote_dirs = {NULL, 0, 0};
+    int failed = strcmp(remote_dir, ".") != 0 && path_list_add(&remote_dirs, remote_dir) != 0;
+    for (size_t i = 0; i < walk_dirs.count && !failed; i++)
+    {
+        char remote[256];
+        failed = join_path(remote, sizeof(remote), remote_dir, walk_dirs.paths[i]) != 0 ||
+                 path_list_add(&remote_dirs, remote) != 0;
+    }
+
+    int sock = failed ? -1 : session_open();
+    if (sock >= 0)
+    {
+        // A rejected batch means the uploads have nowhere to go
+        int rc = make_remote_dirs(sock, remote_dirs.paths, remote_dirs.count);
+        if (rc < 0)
+        {
+            close(sock);
+            sock = -1;
+        }
+        failed = rc != 0;
+        session_close(sock);
+    }
+    else
+    {
+        failed = 1;
+    }
+    size_t dir_count = walk_dirs.count;
+    path_list_free(&remote_dirs);
+    path_list_free(&walk_dirs);
+
+    RfsRequest *reqs = NULL;
+    size_t count = 0, cap = 0;
+    for (size_t i = 0; i < walk_files.count && !failed; i++)
+    {
+        char local[256], remote[256];
+        if (add_request(&reqs, &count, &cap) != 0 ||
+            join_path(local, sizeof(local), local_dir, walk_files.paths[i]) != 0)
+        {
+            failed = 1;
+            break;
+        }
+        if (join_path(remote, sizeof(remote), remote_dir, walk_files.paths[i]) == 0)
+            prepare_write(&reqs[count], local, remote);
+        else
+            reqs[count].result = -1;
+        count++;
+    }
+    path_list_free(&walk_files);
+
+    if (!failed)
+        failed = run_transfers(reqs, count, dir_count, connections) != 0;
+    free(reqs);
+    return failed ? 1 : 0;
+}
+
+// ========== GET ==========
+
+static void free_entries(RemoteEntry *entries, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        free(entries[i].name);
+    free(entries);
+}
+
+// Decode one page of LS records onto the end of entries
+static int read_records(int sock, uint64_t body_len, uint32_t n, RemoteEntry **entries,
+                        size_t *count, size_t *cap)
+{
+    unsigned char *body = body_len ? malloc((size_t)body_len) : NULL;
+    if (body_len && !body)
+        return -1;
+    if (recv_all(sock, body, (size_t)body_len) < 0)
+    {
+        free(body);
+        return -1;
+    }
+
+    MetaReader r;
+    meta_reader_init(&r, body, (size_t)body_len);
+    int result = 0;
+    for (uint32_t i = 0; i < n && result == 0; i++)
+    {
+        char name[256];
+        uint8_t type = meta_get_u8(&r);
+        uint64_t size = meta_get_u64(&r);
+        meta_get_u64(&r); // mtime
+        meta_get_u32(&r); // versions
+        if (meta_get_str(&r, name, sizeof(name)) < 0)
+        {
+            fprintf(stderr, "Malformed listing from server\n");
+            result = 1;
+            break;
+        }
+
+        if (*count == *cap)
+        {
+            size_t grown_cap = *cap ? *cap * 2 : 64;
+            RemoteEntry *grown = realloc(*entries, grown_cap * sizeof(RemoteEntry));
+            if (!grown)
+            {
+                result = 1;
+                break;
+            }
+            *entries = grown;
+            *cap = grown_cap;
+        }
+        (*entries)[*count].name = strdup(name);
+        if (!(*entries)[*count].name)
+        {
+            result = 1;
+            break;
+        }
+        (*entries)[*count].type = type;
+        (*entries)[*count].size = size;
+        (*count)++;
+    }
+    free(body);
+    return result;
+}
+
+// List a remote directory completely, a page per request. Returns 0 on
+// success, 1 if it is not a readable directory, -1 if the connection broke.
+static int list_remote_dir(int sock, const char *dir, RemoteEntry **entries, size_t *count)
+{
+    size_t cap = 0;
+    char cursor[256] = "";
+    int more = 1;
+    *entries = NULL;
+    *count = 0;
+
+    while (more)
+    {
+        unsigned char meta[RFS_MAX_META];
+        MetaWriter w;
+        meta_writer_init(&w, meta, sizeof(meta));
+        meta_put_str(&w, dir);
+        meta_put_u32(&w, LS_PAGE_SIZE);
+        meta_put_str(&w, cursor);
+
+        FrameHeader hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.opcode = OP_LS;
+        hdr.flags = RFS_FLAG_PAGED;
+        hdr.request_id = next_request_id++;
+        if (send_frame(sock, &hdr, meta, w.len, 0) < 0 ||
+            recv_frame(sock, &hdr, meta, sizeof(meta)) < 0)
+        {
+            fprintf(stderr, "Connection to server lost\n");
+            free_entries(*entries, *count);
+            return -1;
+        }
+
+        uint64_t body_len = frame_body_len(&hdr);
+        MetaReader r;
+        meta_reader_init(&r, meta, hdr.meta_len);
+        int is_dir = hdr.status == RFS_OK && meta_get_u8(&r) == RFS_LS_ENTRIES;
+        uint32_t n = meta_get_u32(&r);
+        more = meta_get_u8(&r);
+        meta_get_str(&r, cursor, sizeof(cursor));
+
+        int result = 0;
+        if (!is_dir || r.error)
+        {
+            fprintf(stderr, "✗ '%s' is not a remote directory%s%s\n", dir,
+                    hdr.status != RFS_OK ? ": " : "",
+                    hdr.status != RFS_OK ? status_to_string(hdr.status) : "");
+            result = discard_data(sock, body_len) < 0 ? -1 : 1;
+        }
+        else
+        {
+            result = read_records(sock, body_len, n, entries, count, &cap);
+        }
+        if (result != 0)
+        {
+            free_entries(*entries, *count);
+            *entries = NULL;
+            *count = 0;
+            return result;
+        }
+    }
+    return 0;
+}
+
+int tree_get(const char *remote_dir, const char *local_dir, int connections)
+{
+    if (mkdir(local_dir, 0755) != 0 && errno != EEXIST)
+    {
+        perror("Failed to create local directory");
+        return 1;
+    }
+
+    int sock = session_open();
+    if (sock < 0)
+        return 1;
+
+    // Directories relative to remote_dir, listed breadth first; "" is remote_dir itself
+    PathList dirs = {NULL, 0, 0};
+    RfsRequest *reqs = NULL;
+    size_t count = 0, cap = 0;
+    int failed = path_list_add(&dirs, "") != 0;
+
+    for (size_t d = 0; d < dirs.count && !failed; d++)
+    {
+        char remote[256];
+        RemoteEntry *entries;
+        size_t n;
+        if (join_path(remote, sizeof(remote), remote_dir, dirs.paths[d]) != 0)
+        {
+            failed = 1;
+            break;
+        }
+        int rc = list_remote_dir(sock, remote, &entries, &n);
+        if (rc != 0)
+        {
+            if (rc < 0)
+            {
+                close(sock);
+                sock = -1;
+            }
+            failed = 1;
+            break;
+        }
+
+        for (size_t i = 0; i < n && !failed; i++)
+        {
+            const RemoteEntry *e = &entries[i];
+            char rel[256], local[256], path[256];
+            if (e->type == RFS_ENTRY_UNKNOWN || e->type == RFS_ENTRY_VERSION)
+                continue;
+            if (join_path(rel, sizeof(rel), dirs.paths[d], e->name) != 0 ||
+                join_path(local, sizeof(local), local_dir, rel) != 0 ||
+                join_path(path, sizeof(path), remote_dir, rel) != 0)
+            {
+                failed = 1;
+                break;
+            }
+
+            if (e->type == RFS_ENTRY_DIR)
+            {
+                // Parents are listed before their children, so one mkdir suffices
+                if (mkdir(local, 0755) != 0 && errno != EEXIST)
+                {
+                    fprintf(stderr, "Failed to create '%s': %s\n", local, strerror(errno));
+                    failed = 1;
+                }
+                else if (path_list_add(&dirs, rel) != 0)
+                {
+                    failed = 1;
+                }
+                continue;
+            }
+
+            if (add_request(&reqs, &count, &cap) != 0)
+            {
+                failed = 1;
+                break;
+            }
+            prepare_get(&reqs[count], path, local);
+            reqs[count].file_size = e->size; // only to pick how it is fetched
+            count++;
+        }
+        free_entries(entries, n);
+    }
+    session_close(sock);
+
+    size_t dir_count = dirs.count - 1;
+    path_list_free(&dirs);
+    if (!failed)
+    {
+        printf("Fetching %zu file(s) in %zu director(ies) from '%s' into '%s'\n", count,
+               dir_count, remote_dir, local_dir);
+        failed = run_transfers(reqs, count, dir_count, connections) != 0;
+    }
+    free(reqs);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,38 @@
+/*
+ * tree_transfer.h, Yehen Yan, CS5600 Practicum II
+ * Recursive WRITE and GET of whole directory trees
+ * Last modified: Dec 2025
+ */
+
+#ifndef TREE_TRANSFER_H
+#define TREE_TRANSFER_H
+
+/**
+ * @brief Upload a local directory tree
+ *
+ * Creates every remote directory with batched MKDIRS requests, then
+ * pipelines the small files over a pool of connections and sends each
+ * large one in ranges.
+ *
+ * @param local_dir local directory to upload
+ * @param remote_dir remote directory it becomes ("." for the storage root)
+ * @param connections connections in the pool, and ranges in flight per large file
+ * @return int 0 if every file was stored, 1 otherwise
+ */
+int tree_write(const char *local_dir, const char *remote_dir, int connections);
+
+/**
+ * @brief Download a remote directory tree
+ *
+ * Lists the tree with paged LS requests, creates the local directories,
+ * then fetches the files like tree_write() sends them. Stored versions
+ * are not downloaded.
+ *
+ * @param remote_dir remote directory to download ("." for the storage root)
+ * @param local_dir local directory it becomes
+ * @param connections connections in the pool, and ranges in flight per large file
+ * @return int 0 if every file was fetched, 1 otherwise
+ */
+int tree_get(const char *remote_dir, const char *local_dir, int connections);
+
+#endif // TREE_TRANSFER_H
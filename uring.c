@@ -0,0 +1,335 @@
+/*
+ * uring.c, Yehen Yan, CS5600 Practicum II
+ * Optional io_uring backend for batched storage operations
+ * Last modified: Dec 2025
+ *
+ * Talks to the kernel through the raw io_uring syscalls, so no liburing
+ * is needed. Each worker thread owns one small ring; a batch is submitted
+ * with one io_uring_enter() that also waits for all of its completions.
+ */
+#define _GNU_SOURCE // struct statx, syscall
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "uring.h"
+
+#define URING_ENTRIES 64
+
+typedef struct
+{
+    int fd;
+    void *sq_ptr, *cq_ptr;
+    size_t sq_size, cq_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned entries;
+} Ring;
+
+static int enabled = 0;
+static pthread_key_t ring_key;
+
+// ========== RING SETUP ==========
+
+static void ring_destroy(void *arg)
+{
+    Ring *ring = arg;
+
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ptr != ring->sq_ptr)
+        munmap(ring->cq_ptr, ring->cq_size);
+    munmap(ring->sq_ptr, ring->sq_size);
+    close(ring->fd);
+    free(ring);
+}
+
+static Ring *ring_create(void)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+
+    int fd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+    if (fd < 0)
+        return NULL;
+
+    Ring *ring = calloc(1, sizeof(Ring));
+    if (!ring)
+    {
+        close(fd);
+        return NULL;
+    }
+    ring->fd = fd;
+    ring->entries = p.sq_entries;
+
+    ring->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (ring->cq_size > ring->sq_size)
+            ring->sq_size = ring->cq_size;
+        ring->cq_size = ring->sq_size;
+    }
+
+    ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED)
+    {
+        close(fd);
+        free(ring);
+        return NULL;
+    }
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        ring->cq_ptr = ring->sq_ptr;
+    }
+    else
+    {
+        ring->cq_ptr = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED)
+        {
+            munmap(ring->sq_ptr, ring->sq_size);
+            close(fd);
+            free(ring);
+            return NULL;
+        }
+    }
+
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+    {
+        if (ring->cq_ptr != ring->sq_ptr)
+            munmap(ring->cq_ptr, ring->cq_size);
+        munmap(ring->sq_ptr, ring->sq_size);
+        close(fd);
+        free(ring);
+        return NULL;
+    }
+
+    char *sq = ring->sq_ptr;
+    char *cq = ring->cq_ptr;
+    ring->sq_head = (unsigned *)(sq + p.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + p.sq_off.array);
+    ring->cq_head = (unsigned *)(cq + p.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return ring;
+}
+
+// The calling thread's ring, created on first use
+static Ring *thread_ring(void)
+{
+    Ring *ring = pthread_getspecific(ring_key);
+    if (!ring)
+    {
+        ring = ring_create();
+        if (!ring)
+        {
+            perror("io_uring setup failed");
+            return NULL;
+        }
+        pthread_setspecific(ring_key, ring);
+    }
+    return ring;
+}
+
+// Check that the kernel implements every opcode the backend uses
+static int probe_ops(int ring_fd)
+{
+    size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, size);
+    if (!probe)
+        return -1;
+
+    int ok = 0;
+    if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PROBE, probe, 256) == 0)
+    {
+        const int needed[] = {IORING_OP_STATX, IORING_OP_RENAMEAT, IORING_OP_LINKAT};
+        ok = 1;
+        for (size_t i = 0; i < sizeof(needed) / sizeof(needed[0]); i++)
+        {
+            if (needed[i] > probe->last_op ||
+                !(probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED))
+                ok = 0;
+        }
+    }
+
+    free(probe);
+    return ok ? 0 : -1;
+}
+
+int uring_enable(void)
+{
+    if (enabled)
+        return 0;
+
+    if (pthread_key_create(&ring_key, ring_destroy) != 0)
+        return -1;
+
+    Ring *ring = ring_create();
+    if (!ring)
+    {
+        perror("io_uring unavailable");
+        return -1;
+    }
+
+    int supported = probe_ops(ring->fd);
+    ring_destroy(ring);
+    if (supported != 0)
+    {
+        fprintf(stderr, "io_uring lacks statx/renameat support\n");
+        return -1;
+    }
+
+    enabled = 1;
+    return 0;
+}
+
+int uring_enabled(void)
+{
+    return enabled;
+}
+
+// ========== SUBMISSION ==========
+
+// Next free submission entry, cleared; the caller fills it in
+static struct io_uring_sqe *ring_get_sqe(Ring *ring, unsigned queued)
+{
+    unsigned tail = *ring->sq_tail + queued;
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[index] = index;
+    return sqe;
+}
+
+// Publish queued entries, wait until all of them complete, and store each
+// result by user_data index. Returns 0 on success, -1 if the ring failed.
+static int ring_submit_wait(Ring *ring, unsigned queued, int *results)
+{
+    __atomic_store_n(ring->sq_tail, *ring->sq_tail + queued, __ATOMIC_RELEASE);
+
+    unsigned done = 0;
+    unsigned to_submit = queued;
+    while (done < queued)
+    {
+        int ret = (int)syscall(__NR_io_uring_enter, ring->fd, to_submit, queued - done,
+                               IORING_ENTER_GETEVENTS, NULL, 0);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("io_uring_enter failed");
+            return -1;
+        }
+        to_submit -= (unsigned)ret < to_submit ? (unsigned)ret : to_submit;
+
+        unsigned head = *ring->cq_head;
+        unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        while (head != tail)
+        {
+            struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+            results[cqe->user_data] = cqe->res;
+            head++;
+            done++;
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+// ========== OPERATIONS ==========
+
+int uring_stat_entries(const char *dir_path, char *const names[], EntryStat *out, size_t count)
+{
+    Ring *ring = thread_ring();
+    if (!ring)
+        return -1;
+
+    int dirfd = open(dir_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirfd < 0)
+        return -1;
+
+    struct statx stx[URING_ENTRIES];
+    int results[URING_ENTRIES];
+    unsigned batch_max = ring->entries < URING_ENTRIES ? ring->entries : URING_ENTRIES;
+
+    for (size_t start = 0; start < count; start += batch_max)
+    {
+        unsigned n = count - start < batch_max ? (unsigned)(count - start) : batch_max;
+
+        for (unsigned i = 0; i < n; i++)
+        {
+            struct io_uring_sqe *sqe = ring_get_sqe(ring, i);
+            sqe->opcode = IORING_OP_STATX;
+            sqe->fd = dirfd;
+            sqe->addr = (uint64_t)(uintptr_t)names[start + i];
+            sqe->len = STATX_TYPE | STATX_SIZE | STATX_MTIME;
+            sqe->off = (uint64_t)(uintptr_t)&stx[i];
+            sqe->user_data = i;
+        }
+
+        if (ring_submit_wait(ring, n, results) != 0)
+        {
+            close(dirfd);
+            return -1;
+        }
+
+        for (unsigned i = 0; i < n; i++)
+        {
+            EntryStat *e = &out[start + i];
+            e->result = results[i];
+            e->size = results[i] == 0 ? (int64_t)stx[i].stx_size : 0;
+            e->mtime = results[i] == 0 ? (time_t)stx[i].stx_mtime.tv_sec : 0;
+            e->is_dir = results[i] == 0 && S_ISDIR(stx[i].stx_mode);
+        }
+    }
+
+    close(dirfd);
+    return 0;
+}
+
+int uring_backup_rename(const char *backup_from, const char *backup_to, int link_backup,
+                        const char *from, const char *to, int results[2])
+{
+    Ring *ring = thread_ring();
+    if (!ring)
+        return -1;
+
+    struct io_uring_sqe *sqe = ring_get_sqe(ring, 0);
+    sqe->opcode = link_backup ? IORING_OP_LINKAT : IORING_OP_RENAMEAT;
+    sqe->flags = IOSQE_IO_HARDLINK; // run the rename whatever happens here
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uint64_t)(uintptr_t)backup_from;
+    sqe->len = AT_FDCWD;
+    sqe->addr2 = (uint64_t)(uintptr_t)backup_to;
+    sqe->user_data = 0;
+
+    sqe = ring_get_sqe(ring, 1);
+    sqe->opcode = IORING_OP_RENAMEAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uint64_t)(uintptr_t)from;
+    sqe->len = AT_FDCWD;
+    sqe->addr2 = (uint64_t)(uintptr_t)to;
+    sqe->user_data = 1;
+
+    return ring_submit_wait(ring, 2, results);
+}
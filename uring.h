@@ -0,0 +1,68 @@
+/*
+ * uring.h, Yehen Yan, CS5600 Practicum II
+ * Optional io_uring backend for batched storage operations
+ * Last modified: Dec 2025
+ */
+
+#ifndef URING_H
+#define URING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+// What the server needs to know about a stored file
+typedef struct
+{
+    int result; // 0 on success, -errno on failure
+    int64_t size;
+    time_t mtime;
+    int is_dir;
+} EntryStat;
+
+/**
+ * @brief Switch the storage paths to io_uring if the kernel supports it
+ *
+ * Called once at startup. Every worker thread lazily sets up its own ring.
+ *
+ * @return int 0 if io_uring is in use, -1 if the blocking path stays active
+ */
+int uring_enable(void);
+
+/**
+ * @brief Check whether the io_uring backend is active
+ *
+ * @return int 1 if enabled, 0 if the blocking path is used
+ */
+int uring_enabled(void);
+
+/**
+ * @brief Stat many entries of one directory with a single submission per ring-full
+ *
+ * @param dir_path directory the names are relative to
+ * @param names entry names
+ * @param out per-entry results
+ * @param count number of entries
+ * @return int 0 if all entries were submitted, -1 if the ring failed (callers fall back)
+ */
+int uring_stat_entries(const char *dir_path, char *const names[], EntryStat *out, size_t count);
+
+/**
+ * @brief Back up a file and rename another into place in one submission
+ *
+ * The backup is a hard link when link_backup is set, a rename otherwise.
+ * The rename runs even if the backup fails (a hard io_uring link, not a
+ * soft one), so a missing file to back up does not stop the publish.
+ *
+ * @param backup_from file to back up
+ * @param backup_to backup path
+ * @param link_backup hard-link the backup instead of moving the file
+ * @param from file to publish
+ * @param to path to publish it under
+ * @param results receives 0 or -errno for the backup and the rename
+ * @return int 0 if both operations were executed, -1 if the ring failed (callers fall back)
+ */
+int uring_backup_rename(const char *backup_from, const char *backup_to, int link_backup,
+                        const char *from, const char *to, int results[2]);
+
+#endif // URING_H
@@ -7,149 +7,164 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
-#include <pthread.h>
-#include <dirent.h>
+#include <errno.h>
+#include <unistd.h>
 #include "version_manager.h"
+#include "version_manifest.h"
+#include "chunk_store.h"
+#include "compression.h"
+#include "meta_cache.h"
+#include "content_cache.h"
+#include "dedup_index.h"
 #include "file_utils.h"
+#include "uring.h"
 #include "config.h"
 
-// Hash table of mutexes for versioning
-pthread_mutex_t version_mutexes[HASH_SIZE] = {
-    [0 ... HASH_SIZE - 1] = PTHREAD_MUTEX_INITIALIZER};
-
-unsigned int hash_string(const char *str)
-{
-    unsigned int hash = 0;
-    while (*str)
-    {
-        hash = hash * 31 + *str++;
-    }
-    return hash % HASH_SIZE;
-}
-
-void backup_file(const char *filename)
+int64_t make_version_path(const char *filename, char *versioned_name, size_t size)
 {
-    if (!file_exists(filename))
-    {
-        return;
-    }
-
-    char versioned_name[512];
     struct timeval tv;
     gettimeofday(&tv, NULL);
 
     // Cast tv_usec to long to match format specifier
-    snprintf(versioned_name, sizeof(versioned_name),
-             "%s.v%ld%06ld", filename, (long)tv.tv_sec, (long)tv.tv_usec);
+    snprintf(versioned_name, size, "%s.v%ld%06ld", filename, (long)tv.tv_sec, (long)tv.tv_usec);
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
 
+int backup_file(const char *filename, const char *versioned_name)
+{
     printf("Backing up existing file to: %s\n", versioned_name);
 
-    if (rename(filename, versioned_name) == 0)
+    // A hard link leaves the file in place until the new contents replace it
+    if (link(filename, versioned_name) == 0)
     {
         printf("Previous version saved as: %s\n", versioned_name);
+        return 1;
     }
-    else
-    {
-        perror("Failed to create backup");
-    }
-}
-
-time_t extract_version_timestamp(const char *version_filename)
-{
-    const char *v_pos = strrchr(version_filename, 'v');
-    if (!v_pos || v_pos == version_filename || *(v_pos - 1) != '.')
+    if (errno == ENOENT)
     {
         return 0;
     }
 
-    char seconds_str[11];
-    strncpy(seconds_str, v_pos + 1, 10);
-    seconds_str[10] = '\0';
-
-    return (time_t)atol(seconds_str);
+    perror("Failed to create backup");
+    return -1;
 }
 
-int resolve_version_path(const char *full_path, int version_number, char *version_path, size_t size)
+void make_recipe_path(const char *filename, char *recipe_path, size_t size)
 {
-    char pattern[512];
-    snprintf(pattern, sizeof(pattern), "%s.v", full_path);
-
-    // Extract directory
-    char dir_path[512];
-    strncpy(dir_path, full_path, sizeof(dir_path) - 1);
-    char *last_slash = strrchr(dir_path, '/');
-    if (last_slash)
-    {
-        *last_slash = '\0';
-    }
+    const char *slash = strrchr(filename, '/');
+    if (slash)
+        snprintf(recipe_path, size, "%.*s/%s%s", (int)(slash - filename), filename,
+                 RFS_RECIPE_PREFIX, slash + 1);
     else
-    {
-        strcpy(dir_path, ".");
-    }
+        snprintf(recipe_path, size, "%s%s", RFS_RECIPE_PREFIX, filename);
+}
 
-    // Find all versions
-    DIR *dir = opendir(dir_path);
-    if (!dir)
+int publish_file(const char *temp_path, const char *filename, const ContentInfo *content,
+                 const char *recipe_temp)
+{
+    // Load the manifest before the backup appears, so a file without one
+    // does not find its new backup while building it
+    manifest_preload(filename);
+
+    // A live file with a recipe is backed up by moving the recipe; the full
+    // copy is dropped when the new contents replace it
+    char recipe_path[640];
+    make_recipe_path(filename, recipe_path, sizeof(recipe_path));
+    int chunked = file_exists(recipe_path);
+    if (chunked && !file_exists(filename))
     {
-        return -1;
+        chunk_store_release(recipe_path);
+        chunked = 0;
     }
+    const char *backup_source = chunked ? recipe_path : filename;
 
-    typedef struct
-    {
-        char filename[512];
-        time_t timestamp;
-    } VersionInfo;
-
-    VersionInfo versions[100];
-    int version_count = 0;
-
-    struct dirent *entry;
-    while ((entry = readdir(dir)) != NULL && version_count < 100)
+    char versioned_name[512];
+    int64_t backup_us = make_version_path(filename, versioned_name, sizeof(versioned_name));
+    int backed_up = 0;
+    int result;
+    int results[2];
+
+    // Backup and publish go to the kernel as one linked pair. The backup
+    // failing with ENOENT just means this is the first version.
+    if (uring_enabled() &&
+        uring_backup_rename(backup_source, versioned_name, !chunked, temp_path, filename,
+                            results) == 0)
     {
-        char full_entry_path[512];
-        snprintf(full_entry_path, sizeof(full_entry_path), "%s/%s",
-                 dir_path, entry->d_name);
-
-        if (strncmp(full_entry_path, pattern, strlen(pattern)) == 0)
+        if (results[0] == 0)
         {
-            strncpy(versions[version_count].filename, full_entry_path,
-                    sizeof(versions[version_count].filename) - 1);
-            versions[version_count].timestamp = extract_version_timestamp(full_entry_path);
-            version_count++;
+            printf("Previous version saved as: %s\n", versioned_name);
+            backed_up = 1;
+        }
+        else if (results[0] != -ENOENT)
+        {
+            fprintf(stderr, "Failed to create backup: %s\n", strerror(-results[0]));
         }
-    }
-    closedir(dir);
 
-    if (version_count == 0)
+        result = results[1] == 0 ? 0 : -1;
+        if (result != 0)
+            errno = -results[1];
+    }
+    else
     {
-        return -1; // No versions found
+        if (chunked)
+            backed_up = rename(recipe_path, versioned_name) == 0;
+        else
+            backed_up = backup_file(filename, versioned_name) == 1;
+        result = rename(temp_path, filename);
     }
+    int saved_errno = errno;
 
-    // Sort by timestamp (newest first)
-    for (int i = 0; i < version_count - 1; i++)
+    // The file is still the previous version: take the backup back
+    if (result != 0)
     {
-        for (int j = i + 1; j < version_count; j++)
-        {
-            if (versions[j].timestamp > versions[i].timestamp)
-            {
-                VersionInfo temp = versions[i];
-                versions[i] = versions[j];
-                versions[j] = temp;
-            }
-        }
+        if (backed_up && chunked)
+            rename(versioned_name, recipe_path);
+        else if (backed_up)
+            unlink(versioned_name);
+        if (recipe_temp)
+            chunk_store_release(recipe_temp);
+        errno = saved_errno;
+        return -1;
     }
 
-    // Get requested version (1-indexed from newest)
-    // Version 1 = newest, Version N = oldest
-    int index = version_count - version_number;
+    content_cache_invalidate(filename);
+    meta_cache_refresh(filename);
+    if (backed_up)
+        meta_cache_refresh(versioned_name);
+    dedup_index_publish(filename, backed_up && !chunked ? versioned_name : NULL, content);
+
+    // A recipe that was not moved no longer matches the live file
+    if (chunked && !backed_up)
+        chunk_store_release(recipe_path);
+
+    if (recipe_temp && rename(recipe_temp, recipe_path) != 0)
+        chunk_store_release(recipe_temp);
+
+    uint32_t backup_id = 0;
+    if (manifest_record_publish(filename, backed_up ? versioned_name : NULL, backup_us, chunked,
+                                content, &backup_id) == 0 &&
+        backup_id != 0 && !chunked)
+        compression_enqueue(filename, backup_id);
+    return 0;
+}
 
-    if (index < 0 || index >= version_count)
+int resolve_version_path(const char *full_path, int version_number, char *version_path, size_t size,
+                         VersionEntry *entry)
+{
+    VersionManifest m;
+    if (manifest_snapshot(full_path, &m) != 0)
+        return -1;
+
+    const VersionEntry *v = manifest_find_version(&m, (uint32_t)version_number);
+    if (v)
     {
-        return -1; // Version number out of range
+        const char *slash = strrchr(full_path, '/');
+        int dir_len = slash ? (int)(slash - full_path) : 1;
+        snprintf(version_path, size, "%.*s/%s", dir_len, slash ? full_path : ".", v->name);
+        *entry = *v;
     }
 
-    strncpy(version_path, versions[index].filename, size - 1);
-    version_path[size - 1] = '\0';
-
-    return 0; // Success
-}
\ No newline at end of file
+    int result = v ? 0 : -1;
+    manifest_free(&m);
+    return result;
+}
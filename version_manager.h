@@ -7,47 +7,75 @@
 #ifndef VERSION_MANAGER_H
 #define VERSION_MANAGER_H
 
-#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "version_manifest.h"
 #include "config.h"
 
-// Expose version mutexes for use in server_handlers
-extern pthread_mutex_t version_mutexes[HASH_SIZE];
+/**
+ * @brief Build the timestamped name a file is backed up under
+ *
+ * @param filename  Path to the file
+ * @param versioned_name  Buffer for "<filename>.v<seconds><microseconds>"
+ * @param size  Size of the buffer
+ * @return int64_t  The encoded time in microseconds since the epoch
+ */
+int64_t make_version_path(const char *filename, char *versioned_name, size_t size);
 
 /**
- * @brief Backup existing file by renaming it with a timestamped version suffix
+ * @brief Backup existing file by hard-linking it under its versioned name
+ *
+ * The file itself stays in place, so readers keep finding it until the
+ * new contents are renamed over it.
  *
  * @param filename  Path to the file to back up
+ * @param versioned_name  Name from make_version_path()
+ * @return int 1 if backed up, 0 if there was no file, -1 on failure
  */
-void backup_file(const char *filename);
+int backup_file(const char *filename, const char *versioned_name);
 
 /**
- * @brief Extract timestamp from versioned filename
+ * @brief Build the path of the chunk store recipe kept for a live file
  *
- * @param version_filename  Versioned filename
- * @return time_t  Extracted timestamp, or 0 if not found
+ * @param filename  Path to the file
+ * @param recipe_path  Buffer for "<dir>/.rfs_recipe_<name>"
+ * @param size  Size of the buffer
  */
-time_t extract_version_timestamp(const char *version_filename);
+void make_recipe_path(const char *filename, char *recipe_path, size_t size);
 
 /**
- * @brief Resolve the path of a specific version of a file
+ * @brief Back up the current file and move a fully written temp file into its place
  *
- * @param full_path       Full path to the main file
- * @param version_number  Version number to retrieve (1 = newest)
- * @param version_path    Buffer to store the resolved version path
- * @param size            Size of the version_path buffer
- * @return int 0 on success, -1 on failure
+ * The caller holds the file's path lock exclusive. The path always names a complete
+ * file: the backup is a hard link and the new contents replace the file with
+ * one rename. With the io_uring backend both are submitted together. If the
+ * publish fails, the backup is taken back and nothing changes. The backup and the new contents are
+ * recorded in the file's version manifest. If the current file has a chunk
+ * store recipe, the recipe becomes the backup instead of the file.
+ *
+ * @param temp_path  File holding the new contents
+ * @param filename  Path the new contents are published under
+ * @param content  Size and checksum of the new contents
+ * @param recipe_temp  Recipe of the new contents to keep with the file, or NULL
+ * @return int 0 on success, -1 on failure (errno set)
  */
-unsigned int hash_string(const char *str);
+int publish_file(const char *temp_path, const char *filename, const ContentInfo *content,
+                 const char *recipe_temp);
 
 /**
  * @brief Resolve the path of a specific version of a file
  *
+ * Looks the version up in the file's manifest. The caller holds the file's
+ * path lock, shared or exclusive.
+ *
  * @param full_path       Full path to the main file
- * @param version_number  Version number to retrieve (1 = newest)
+ * @param version_number  Version id to retrieve (1 = oldest; ids are never reused)
  * @param version_path    Buffer to store the resolved version path
  * @param size            Size of the version_path buffer
+ * @param entry           Receives the manifest entry of the version
  * @return int 0 on success, -1 on failure
  */
-int resolve_version_path(const char *full_path, int version_number, char *version_path, size_t size);
+int resolve_version_path(const char *full_path, int version_number, char *version_path, size_t size,
+                         VersionEntry *entry);
 
-#endif // VERSION_MANAGER_H
\ No newline at end of file
+#endif // VERSION_MANAGER_H
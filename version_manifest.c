@@ -0,0 +1,754 @@
+/*
+ * version_manifest.c, Yehen Yan, CS5600 Practicum II
+ * Per-file version manifests
+ * Last modified: Dec 2025
+ */
+#define _XOPEN_SOURCE 700 // nftw
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <dirent.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "version_manifest.h"
+#include "file_utils.h"
+#include "lock_table.h"
+#include "chunk_store.h"
+#include "meta_cache.h"
+#include "dedup_index.h"
+#include "config.h"
+
+/*
+ * On-disk format, one record per line:
+ *
+ *   RFSMANIFEST 4
+ *   next <id>
+ *   current <size> <crc32c|-> <sha256|->
+ *   v <id> <written_us> <size> <crc32c|-> <sha256|-> <f|c|z|u> <pack:offset:length|-> <version file name>
+ *
+ * The "current" line is absent while the file does not exist. A version is
+ * a full copy (f), a chunk store recipe (c), a zlib-compressed copy (z), or
+ * a full copy that did not compress well enough to keep compressed (u).
+ * A packed version lives at the given place in a pack segment instead of
+ * in its own file. Version 1 manifests predate the chunk store and have no
+ * kind field, version 2 ones predate packs and have no location, version 3
+ * ones predate strong hashes and have no SHA-256. The name
+ * is last so it may contain spaces. Sizes are always of the contents,
+ * not of the version file.
+ */
+#define MANIFEST_MAGIC "RFSMANIFEST "
+#define MANIFEST_VERSION 4
+
+typedef struct CachedManifest
+{
+    char path[512];
+    VersionManifest manifest;
+    struct CachedManifest *next;
+} CachedManifest;
+
+// Most recently used first. Readers of different files share a path
+// stripe, so the cache has locks of its own, held only inside this file.
+static CachedManifest *cache[MANIFEST_CACHE_STRIPES];
+static pthread_mutex_t cache_locks[MANIFEST_CACHE_STRIPES] = {
+    [0 ... MANIFEST_CACHE_STRIPES - 1] = PTHREAD_MUTEX_INITIALIZER};
+
+static unsigned int cache_stripe(const char *full_path)
+{
+    return (unsigned int)(path_hash(full_path) % MANIFEST_CACHE_STRIPES);
+}
+
+// Split "<dir>/<name>" into its directory and name
+static void split_path(const char *full_path, char *dir, size_t dir_size, const char **name)
+{
+    const char *slash = strrchr(full_path, '/');
+    if (slash)
+    {
+        snprintf(dir, dir_size, "%.*s", (int)(slash - full_path), full_path);
+        *name = slash + 1;
+    }
+    else
+    {
+        snprintf(dir, dir_size, ".");
+        *name = full_path;
+    }
+}
+
+static void manifest_file_path(const char *full_path, char *out, size_t size)
+{
+    char dir[512];
+    const char *name;
+    split_path(full_path, dir, sizeof(dir), &name);
+    snprintf(out, size, "%s/%s%s", dir, RFS_MANIFEST_PREFIX, name);
+}
+
+static void free_manifest(VersionManifest *m)
+{
+    free(m->versions);
+    memset(m, 0, sizeof(*m));
+}
+
+static VersionEntry *append_version(VersionManifest *m)
+{
+    if (m->count == m->cap)
+    {
+        size_t cap = m->cap ? m->cap * 2 : 8;
+        VersionEntry *grown = realloc(m->versions, cap * sizeof(VersionEntry));
+        if (!grown)
+            return NULL;
+        m->versions = grown;
+        m->cap = cap;
+    }
+    VersionEntry *v = &m->versions[m->count++];
+    memset(v, 0, sizeof(*v));
+    return v;
+}
+
+static void format_crc(const ContentInfo *c, char *out, size_t size)
+{
+    if (c->has_crc)
+        snprintf(out, size, "%08" PRIx32, c->crc32c);
+    else
+        snprintf(out, size, "-");
+}
+
+static void parse_crc(const char *text, ContentInfo *c)
+{
+    c->has_crc = strcmp(text, "-") != 0;
+    c->crc32c = c->has_crc ? (uint32_t)strtoul(text, NULL, 16) : 0;
+}
+
+static void format_sha256(const ContentInfo *c, char out[SHA256_HEX_SIZE])
+{
+    if (c->has_sha256)
+        sha256_hex(c->sha256, out);
+    else
+        snprintf(out, SHA256_HEX_SIZE, "-");
+}
+
+// Returns 0 unless the text is neither "-" nor a 64-digit hex digest
+static int parse_sha256(const char *text, ContentInfo *c)
+{
+    c->has_sha256 = 0;
+    if (strcmp(text, "-") == 0)
+        return 0;
+    if (strlen(text) != 2 * SHA256_DIGEST_SIZE)
+        return -1;
+    for (int i = 0; i < SHA256_DIGEST_SIZE; i++)
+    {
+        unsigned int byte;
+        if (sscanf(text + 2 * i, "%2x", &byte) != 1)
+            return -1;
+        c->sha256[i] = (unsigned char)byte;
+    }
+    c->has_sha256 = 1;
+    return 0;
+}
+
+// Returns 0 if the manifest file was read, -1 if it is missing or damaged
+static int load_manifest(const char *full_path, VersionManifest *m)
+{
+    char path[768];
+    manifest_file_path(full_path, path, sizeof(path));
+
+    FILE *fp = fopen(path, "r");
+    if (!fp)
+        return -1;
+
+    char line[512];
+    int format = 0;
+    int ok = fgets(line, sizeof(line), fp) && sscanf(line, MANIFEST_MAGIC "%d", &format) == 1 &&
+             format >= 1 && format <= MANIFEST_VERSION;
+
+    while (ok && fgets(line, sizeof(line), fp))
+    {
+        line[strcspn(line, "\n")] = '\0';
+
+        char crc[16];
+        char sha[SHA256_HEX_SIZE] = "-";
+        unsigned long long size;
+        if (strncmp(line, "next ", 5) == 0)
+        {
+            m->next_id = (uint32_t)strtoul(line + 5, NULL, 10);
+        }
+        else if (sscanf(line, "current %llu %15s %64s", &size, crc, sha) >= 2)
+        {
+            m->has_current = 1;
+            m->current.size = size;
+            parse_crc(crc, &m->current);
+            if (parse_sha256(sha, &m->current) != 0)
+            {
+                ok = 0;
+                break;
+            }
+        }
+        else if (line[0] == 'v')
+        {
+            unsigned int id;
+            long long written;
+            char kind = 'f';
+            int name_at = 0;
+            char where[64] = "-";
+            int parsed = format == 1
+                             ? sscanf(line, "v %u %lld %llu %15s %n", &id, &written, &size, crc,
+                                      &name_at) == 4
+                         : format == 2
+                             ? sscanf(line, "v %u %lld %llu %15s %c %n", &id, &written, &size, crc,
+                                      &kind, &name_at) == 5
+                         : format == 3
+                             ? sscanf(line, "v %u %lld %llu %15s %c %63s %n", &id, &written, &size,
+                                      crc, &kind, where, &name_at) == 6
+                             : sscanf(line, "v %u %lld %llu %15s %64s %c %63s %n", &id, &written,
+                                      &size, crc, sha, &kind, where, &name_at) == 7;
+            if (!parsed || name_at == 0)
+            {
+                ok = 0;
+                break;
+            }
+
+            VersionEntry *v = append_version(m);
+            if (!v)
+            {
+                ok = 0;
+                break;
+            }
+            v->id = id;
+            v->written_us = written;
+            v->content.size = size;
+            v->chunked = kind == 'c';
+            v->compressed = kind == 'z' ? 1 : kind == 'u' ? -1 : 0;
+            if (strcmp(where, "-") != 0)
+            {
+                unsigned int pack;
+                unsigned long long offset, length;
+                if (sscanf(where, "%u:%llu:%llu", &pack, &offset, &length) != 3 || pack == 0)
+                {
+                    ok = 0;
+                    break;
+                }
+                v->pack = pack;
+                v->pack_offset = offset;
+                v->pack_length = length;
+            }
+            parse_crc(crc, &v->content);
+            if (parse_sha256(sha, &v->content) != 0)
+            {
+                ok = 0;
+                break;
+            }
+            snprintf(v->name, sizeof(v->name), "%s", line + name_at);
+        }
+    }
+    fclose(fp);
+
+    if (!ok)
+    {
+        fprintf(stderr, "Ignoring damaged version manifest: %s\n", path);
+        free_manifest(m);
+        return -1;
+    }
+    if (m->next_id == 0)
+        m->next_id = m->count ? m->versions[m->count - 1].id + 1 : 1;
+    return 0;
+}
+
+// Write to a temp file and rename over the manifest, so a crash leaves
+// either the old manifest or the new one. Both the file and the rename are
+// synced before returning: callers delete version files the old manifest
+// still names once this succeeds.
+static int save_manifest(const char *full_path, const VersionManifest *m)
+{
+    char dir[512];
+    const char *name;
+    split_path(full_path, dir, sizeof(dir), &name);
+
+    char path[768], temp_path[768];
+    snprintf(path, sizeof(path), "%s/%s%s", dir, RFS_MANIFEST_PREFIX, name);
+    snprintf(temp_path, sizeof(temp_path), "%s/%sver_%s", dir, RFS_TEMP_PREFIX, name);
+
+    FILE *fp = fopen(temp_path, "w");
+    if (!fp)
+    {
+        perror("Failed to write version manifest");
+        return -1;
+    }
+
+    char crc[16];
+    char sha[SHA256_HEX_SIZE];
+    fprintf(fp, "%s%d\nnext %" PRIu32 "\n", MANIFEST_MAGIC, MANIFEST_VERSION, m->next_id);
+    if (m->has_current)
+    {
+        format_crc(&m->current, crc, sizeof(crc));
+        format_sha256(&m->current, sha);
+        fprintf(fp, "current %" PRIu64 " %s %s\n", m->current.size, crc, sha);
+    }
+    for (size_t i = 0; i < m->count; i++)
+    {
+        const VersionEntry *v = &m->versions[i];
+        format_crc(&v->content, crc, sizeof(crc));
+        format_sha256(&v->content, sha);
+        char kind = v->chunked ? 'c' : v->compressed > 0 ? 'z' : v->compressed < 0 ? 'u' : 'f';
+        char where[64] = "-";
+        if (v->pack)
+            snprintf(where, sizeof(where), "%" PRIu32 ":%" PRIu64 ":%" PRIu64, v->pack,
+                     v->pack_offset, v->pack_length);
+        fprintf(fp, "v %" PRIu32 " %" PRId64 " %" PRIu64 " %s %s %c %s %s\n", v->id,
+                v->written_us, v->content.size, crc, sha, kind, where, v->name);
+    }
+
+    int synced = fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+    if (fclose(fp) != 0 || !synced || rename(temp_path, path) != 0)
+    {
+        perror("Failed to write version manifest");
+        remove(temp_path);
+        return -1;
+    }
+    return sync_parent_dir(path);
+}
+
+static int compare_written(const void *a, const void *b)
+{
+    const VersionEntry *x = a, *y = b;
+    return (x->written_us > y->written_us) - (x->written_us < y->written_us);
+}
+
+// Build a manifest for a file stored before manifests existed, from the
+// "<name>.v<seconds><microseconds>" backups in its directory
+static void scan_versions(const char *full_path, VersionManifest *m)
+{
+    char dir_path[512];
+    const char *name;
+    split_path(full_path, dir_path, sizeof(dir_path), &name);
+    size_t name_len = strlen(name);
+
+    m->next_id = 1;
+
+    DIR *dir = opendir(dir_path);
+    if (!dir)
+        return;
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        const char *suffix = entry->d_name + name_len;
+        if (strncmp(entry->d_name, name, name_len) != 0 || strncmp(suffix, ".v", 2) != 0)
+            continue;
+
+        // Seconds and six digits of microseconds; anything else is another file
+        const char *digits = suffix + 2;
+        size_t n = strspn(digits, "0123456789");
+        if (n <= 6 || digits[n] != '\0')
+            continue;
+
+        VersionEntry *v = append_version(m);
+        if (!v)
+            break;
+
+        v->written_us = strtoll(digits, NULL, 10);
+        snprintf(v->name, sizeof(v->name), "%s", entry->d_name);
+
+        char version_path[768];
+        struct stat st;
+        snprintf(version_path, sizeof(version_path), "%s/%s", dir_path, entry->d_name);
+        if (stat(version_path, &st) == 0)
+            v->content.size = (uint64_t)st.st_size;
+    }
+    closedir(dir);
+
+    qsort(m->versions, m->count, sizeof(VersionEntry), compare_written);
+    for (size_t i = 0; i < m->count; i++)
+        m->versions[i].id = m->next_id++;
+
+    // Saved once, so the directory is not scanned again for this file
+    struct stat st;
+    if (m->count > 0 || stat(full_path, &st) == 0)
+    {
+        printf("Built version manifest for %s: %zu version(s)\n", full_path, m->count);
+        save_manifest(full_path, m);
+    }
+}
+
+// Caller holds cache_locks[cache_stripe(full_path)]
+static CachedManifest *cached_manifest(const char *full_path)
+{
+    unsigned int stripe = cache_stripe(full_path);
+
+    CachedManifest **link = &cache[stripe];
+    int depth = 0;
+    while (*link)
+    {
+        CachedManifest *c = *link;
+        if (strcmp(c->path, full_path) == 0)
+        {
+            // Move to the front
+            *link = c->next;
+            c->next = cache[stripe];
+            cache[stripe] = c;
+            return c;
+        }
+
+        // Past the cap: drop the least recently used entries
+        if (++depth >= MANIFEST_CACHE_PER_STRIPE)
+        {
+            *link = c->next;
+            free_manifest(&c->manifest);
+            free(c);
+            continue;
+        }
+        link = &c->next;
+    }
+
+    CachedManifest *c = calloc(1, sizeof(CachedManifest));
+    if (!c)
+    {
+        perror("Failed to allocate version manifest");
+        return NULL;
+    }
+    snprintf(c->path, sizeof(c->path), "%s", full_path);
+
+    if (load_manifest(full_path, &c->manifest) != 0)
+        scan_versions(full_path, &c->manifest);
+
+    c->next = cache[stripe];
+    cache[stripe] = c;
+    return c;
+}
+
+int manifest_preload(const char *full_path)
+{
+    unsigned int stripe = cache_stripe(full_path);
+    pthread_mutex_lock(&cache_locks[stripe]);
+    int result = cached_manifest(full_path) ? 0 : -1;
+    pthread_mutex_unlock(&cache_locks[stripe]);
+    return result;
+}
+
+int manifest_snapshot(const char *full_path, VersionManifest *out)
+{
+    memset(out, 0, sizeof(*out));
+
+    unsigned int stripe = cache_stripe(full_path);
+    pthread_mutex_lock(&cache_locks[stripe]);
+
+    int result = -1;
+    CachedManifest *c = cached_manifest(full_path);
+    if (c)
+    {
+        *out = c->manifest;
+        out->cap = out->count;
+        out->versions = out->count ? malloc(out->count * sizeof(VersionEntry)) : NULL;
+        if (out->count && !out->versions)
+        {
+            perror("Failed to copy version manifest");
+            memset(out, 0, sizeof(*out));
+        }
+        else
+        {
+            if (out->count)
+                memcpy(out->versions, c->manifest.versions, out->count * sizeof(VersionEntry));
+            result = 0;
+        }
+    }
+
+    pthread_mutex_unlock(&cache_locks[stripe]);
+    return result;
+}
+
+int manifest_current(const char *full_path, ContentInfo *out)
+{
+    unsigned int stripe = cache_stripe(full_path);
+    pthread_mutex_lock(&cache_locks[stripe]);
+
+    CachedManifest *c = cached_manifest(full_path);
+    int result = c && c->manifest.has_current ? 0 : -1;
+    if (result == 0)
+        *out = c->manifest.current;
+
+    pthread_mutex_unlock(&cache_locks[stripe]);
+    return result;
+}
+
+int manifest_version_count(const char *full_path, uint32_t *count)
+{
+    // Building a missing manifest scans the whole directory, too much to
+    // do for every entry of a listing
+    char path[768];
+    struct stat st;
+    *count = 0;
+    manifest_file_path(full_path, path, sizeof(path));
+    if (stat(path, &st) != 0)
+        return -1;
+
+    unsigned int stripe = cache_stripe(full_path);
+    pthread_mutex_lock(&cache_locks[stripe]);
+    CachedManifest *c = cached_manifest(full_path);
+    if (c)
+        *count = (uint32_t)c->manifest.count;
+    pthread_mutex_unlock(&cache_locks[stripe]);
+    return c ? 0 : -1;
+}
+
+int manifest_has_version(const char *full_path, const char *name)
+{
+    // Asked for entries of a listing, like manifest_version_count()
+    char path[768];
+    struct stat st;
+    manifest_file_path(full_path, path, sizeof(path));
+    if (stat(path, &st) != 0)
+        return 0;
+
+    unsigned int stripe = cache_stripe(full_path);
+    pthread_mutex_lock(&cache_locks[stripe]);
+
+    int found = 0;
+    CachedManifest *c = cached_manifest(full_path);
+    for (size_t i = 0; c && i < c->manifest.count && !found; i++)
+    {
+        const VersionEntry *v = &c->manifest.versions[i];
+        found = v->pack == 0 && strcmp(v->name, name) == 0;
+    }
+
+    pthread_mutex_unlock(&cache_locks[stripe]);
+    return found;
+}
+
+void manifest_free(VersionManifest *m)
+{
+    free_manifest(m);
+}
+
+const VersionEntry *manifest_find_version(const VersionManifest *m, uint32_t id)
+{
+    if (m->count == 0 || id < m->versions[0].id)
+        return NULL;
+
+    // Ids are dense unless versions were dropped, so try the direct index first
+    size_t guess = id - m->versions[0].id;
+    if (guess < m->count && m->versions[guess].id == id)
+        return &m->versions[guess];
+
+    size_t lo = 0, hi = m->count;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (m->versions[mid].id < id)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < m->count && m->versions[lo].id == id ? &m->versions[lo] : NULL;
+}
+
+// Caller holds cache_locks[cache_stripe(full_path)]
+static int record_publish(const char *full_path, const char *backup_path, int64_t backup_us,
+                          int chunked, const ContentInfo *current, uint32_t *backup_id)
+{
+    CachedManifest *c = cached_manifest(full_path);
+    if (!c)
+        return -1;
+    VersionManifest *m = &c->manifest;
+
+    if (backup_path)
+    {
+        VersionEntry *v = append_version(m);
+        if (!v)
+            return -1;
+
+        v->id = m->next_id++;
+        if (backup_id)
+            *backup_id = v->id;
+        v->written_us = backup_us;
+        v->chunked = chunked;
+
+        // The backup holds what was current; files stored before
+        // manifests existed have no record of it yet
+        if (m->has_current)
+        {
+            v->content = m->current;
+        }
+        else
+        {
+            struct stat st;
+            if (stat(backup_path, &st) == 0)
+                v->content.size = (uint64_t)st.st_size;
+        }
+
+        const char *slash = strrchr(backup_path, '/');
+        snprintf(v->name, sizeof(v->name), "%s", slash ? slash + 1 : backup_path);
+    }
+
+    m->has_current = current != NULL;
+    if (current)
+        m->current = *current;
+
+    return save_manifest(full_path, m);
+}
+
+int manifest_record_publish(const char *full_path, const char *backup_path, int64_t backup_us,
+                            int chunked, const ContentInfo *current, uint32_t *backup_id)
+{
+    unsigned int stripe = cache_stripe(full_path);
+    pthread_mutex_lock(&cache_locks[stripe]);
+    int result = record_publish(full_path, backup_path, backup_us, chunked, current, backup_id);
+    pthread_mutex_unlock(&cache_locks[stripe]);
+    return result;
+}
+
+int manifest_set_compressed(const char *full_path, uint32_t id, int compressed)
+{
+    unsigned int stripe = cache_stripe(full_path);
+    pthread_mutex_lock(&cache_locks[stripe]);
+
+    int result = -1;
+    CachedManifest *c = cached_manifest(full_path);
+    VersionEntry *v = c ? (VersionEntry *)manifest_find_version(&c->manifest, id) : NULL;
+    if (v)
+    {
+        v->compressed = compressed;
+        result = save_manifest(full_path, &c->manifest);
+    }
+
+    pthread_mutex_unlock(&cache_locks[stripe]);
+    return result;
+}
+
+int manifest_set_packed(const char *full_path, const VersionEntry *expected, uint32_t pack,
+                        uint64_t offset, uint64_t length)
+{
+    unsigned int stripe = cache_stripe(full_path);
+    pthread_mutex_lock(&cache_locks[stripe]);
+
+    int result = 1;
+    CachedManifest *c = cached_manifest(full_path);
+    VersionEntry *v = c ? (VersionEntry *)manifest_find_version(&c->manifest, expected->id) : NULL;
+    if (v && v->written_us == expected->written_us && v->pack == expected->pack &&
+        v->pack_offset == expected->pack_offset)
+    {
+        v->pack = pack;
+        v->pack_offset = offset;
+        v->pack_length = length;
+        result = save_manifest(full_path, &c->manifest) == 0 ? 0 : -1;
+    }
+
+    pthread_mutex_unlock(&cache_locks[stripe]);
+    return result;
+}
+
+int manifest_drop_versions(const char *full_path, const VersionEntry *drop, size_t count,
+                           VersionEntry *removed)
+{
+    unsigned int stripe = cache_stripe(full_path);
+    pthread_mutex_lock(&cache_locks[stripe]);
+
+    CachedManifest *c = cached_manifest(full_path);
+    if (!c)
+    {
+        pthread_mutex_unlock(&cache_locks[stripe]);
+        return -1;
+    }
+
+    // Both lists ascend by id, so one merge pass compacts the array
+    VersionManifest *m = &c->manifest;
+    size_t out = 0, next = 0, dropped = 0;
+    for (size_t i = 0; i < m->count; i++)
+    {
+        const VersionEntry *v = &m->versions[i];
+        while (next < count && drop[next].id < v->id)
+            next++;
+        if (next < count && drop[next].id == v->id && drop[next].written_us == v->written_us)
+            removed[dropped++] = *v;
+        else
+            m->versions[out++] = m->versions[i];
+    }
+    m->count = out;
+
+    int result = dropped > 0 && save_manifest(full_path, m) != 0 ? -1 : (int)dropped;
+    pthread_mutex_unlock(&cache_locks[stripe]);
+    return result;
+}
+
+void manifest_delete_versions(const char *full_path, int *deleted, int *failed)
+{
+    unsigned int stripe = cache_stripe(full_path);
+    pthread_mutex_lock(&cache_locks[stripe]);
+
+    CachedManifest *c = cached_manifest(full_path);
+    if (!c)
+    {
+        pthread_mutex_unlock(&cache_locks[stripe]);
+        (*failed)++;
+        return;
+    }
+
+    char dir[512];
+    const char *name;
+    split_path(full_path, dir, sizeof(dir), &name);
+
+    for (size_t i = 0; i < c->manifest.count; i++)
+    {
+        char version_path[768];
+        snprintf(version_path, sizeof(version_path), "%s/%s", dir, c->manifest.versions[i].name);
+
+        // A packed version leaves dead space for the repacker to reclaim
+        const VersionEntry *v = &c->manifest.versions[i];
+        printf("Deleting version: %s\n", version_path);
+        int result = v->pack          ? 0
+                     : v->chunked ? chunk_store_release(version_path)
+                                  : remove(version_path);
+        if (result == 0)
+        {
+            (*deleted)++;
+            meta_cache_refresh(version_path);
+            dedup_index_forget(version_path);
+        }
+        else
+        {
+            perror("Failed to delete version");
+            (*failed)++;
+        }
+    }
+
+    char path[768];
+    manifest_file_path(full_path, path, sizeof(path));
+    remove(path);
+
+    // The file starts over with version 1 if it is written again
+    free_manifest(&c->manifest);
+    c->manifest.next_id = 1;
+
+    pthread_mutex_unlock(&cache_locks[stripe]);
+}
+
+// Each background thread walks with its own visitor
+static __thread ManifestVisitFn walk_visit;
+
+static int visit_manifest(const char *path, const struct stat *st, int type, struct FTW *ftw)
+{
+    (void)st;
+    const char *name = path + ftw->base;
+    size_t prefix = strlen(RFS_MANIFEST_PREFIX);
+    if (type != FTW_F || strncmp(name, RFS_MANIFEST_PREFIX, prefix) != 0)
+        return 0;
+
+    // A path that does not fit would name some other file
+    char dir[512], full_path[512];
+    size_t dir_len = ftw->base > 0 ? (size_t)ftw->base - 1 : 0;
+    int n = snprintf(full_path, sizeof(full_path), "%.*s/%s", (int)dir_len, path, name + prefix);
+    if (dir_len >= sizeof(dir) || n < 0 || (size_t)n >= sizeof(full_path))
+    {
+        fprintf(stderr, "Skipping %s: path too long\n", path);
+        return 0;
+    }
+    memcpy(dir, path, dir_len);
+    dir[dir_len] = '\0';
+    return walk_visit(full_path, dir);
+}
+
+int manifest_walk(const char *root, ManifestVisitFn visit)
+{
+    walk_visit = visit;
+    return nftw(root, visit_manifest, 16, FTW_PHYS);
+}
@@ -0,0 +1,216 @@
+/*
+ * version_manifest.h, Yehen Yan, CS5600 Practicum II
+ * Per-file version manifests
+ * Last modified: Dec 2025
+ */
+
+#ifndef VERSION_MANIFEST_H
+#define VERSION_MANIFEST_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "checksum.h"
+
+/*
+ * Every stored file has a manifest next to it, "<dir>/.rfs_ver_<name>",
+ * listing the versions it has been backed up under. Version ids start at 1
+ * (the oldest) and grow by one per backup, so GETVERSION is an index into
+ * the manifest rather than a scan of the directory.
+ *
+ * Manifests are cached in memory behind locks of their own. Callers hold
+ * the file's path lock (lock_table.h): shared for manifest_snapshot(),
+ * exclusive for the functions that change a manifest.
+ */
+
+// Size and checksums of one stored copy of a file
+typedef struct
+{
+    uint64_t size;
+    uint32_t crc32c;
+    int has_crc; // 0 for copies stored before checksums were recorded
+    unsigned char sha256[SHA256_DIGEST_SIZE];
+    int has_sha256; // 1 if the server was recording strong hashes when it was stored
+} ContentInfo;
+
+typedef struct
+{
+    uint32_t id;
+    int64_t written_us; // when this copy was replaced, microseconds since the epoch
+    ContentInfo content;
+    int chunked;    // the version file is a chunk store recipe, not the contents
+    int compressed; // 1 if the version file is zlib-compressed, -1 if compressing
+                    // it did not pay, 0 if not tried yet
+    uint32_t pack;        // pack segment holding the version, 0 if it has a file of its own
+    uint64_t pack_offset; // where its stored bytes start in the pack
+    uint64_t pack_length; // stored bytes (compressed if compressed is 1)
+    char name[256]; // version file, in the same directory as the file; the
+                    // name it was stored under once packed
+} VersionEntry;
+
+typedef struct
+{
+    uint32_t next_id;
+    int has_current; // whether current describes the live file
+    ContentInfo current;
+    VersionEntry *versions; // ascending id
+    size_t count;
+    size_t cap;
+} VersionManifest;
+
+/**
+ * @brief Load the manifest of a file, building it on first use
+ *
+ * Files stored before manifests existed get one built from a single scan of
+ * their directory.
+ *
+ * @param full_path storage path of the file
+ * @return int 0 on success, -1 if out of memory
+ */
+int manifest_preload(const char *full_path);
+
+/**
+ * @brief Copy the manifest of a file, loading or building it on first use
+ *
+ * @param full_path storage path of the file
+ * @param out receives the copy (empty if the file has no history); free it
+ *            with manifest_free()
+ * @return int 0 on success, -1 if out of memory
+ */
+int manifest_snapshot(const char *full_path, VersionManifest *out);
+
+/**
+ * @brief Size and checksums recorded for the current contents of a file
+ *
+ * Cheaper than manifest_snapshot() when only the current copy matters.
+ *
+ * @param full_path storage path of the file
+ * @param out receives the recorded content
+ * @return int 0 on success, -1 if nothing is recorded for the current file
+ */
+int manifest_current(const char *full_path, ContentInfo *out);
+
+/**
+ * @brief Number of versions recorded for a file
+ *
+ * Never builds a missing manifest; a file without one counts as having none.
+ *
+ * @param full_path storage path of the file
+ * @param count receives the number of versions
+ * @return int 0 on success, -1 if the file has no manifest
+ */
+int manifest_version_count(const char *full_path, uint32_t *count);
+
+/**
+ * @brief Whether a file's manifest records a version stored under a name
+ *
+ * Never builds a missing manifest; a file without one has no versions.
+ * Packed versions no longer have a file of their own, so their names never
+ * match.
+ *
+ * @param full_path storage path of the file
+ * @param name version file name, in the same directory as the file
+ * @return int 1 if a version file of the file has that name, 0 if not
+ */
+int manifest_has_version(const char *full_path, const char *name);
+
+/**
+ * @brief Free a copy made by manifest_snapshot()
+ *
+ * @param m manifest copy
+ */
+void manifest_free(VersionManifest *m);
+
+/**
+ * @brief Find a version by id
+ *
+ * @param m manifest from manifest_snapshot()
+ * @param id version id
+ * @return const VersionEntry* the version, or NULL if there is none with that id
+ */
+const VersionEntry *manifest_find_version(const VersionManifest *m, uint32_t id);
+
+/**
+ * @brief Record that a file was replaced
+ *
+ * Call manifest_preload() before moving anything, so that building a missing
+ * manifest does not pick up the new backup on its own.
+ *
+ * @param full_path storage path of the file
+ * @param backup_path path the previous contents were moved to, NULL if there were none
+ * @param backup_us time encoded in backup_path
+ * @param chunked backup_path is a chunk store recipe
+ * @param current the new contents, NULL if the file is gone
+ * @param backup_id receives the id given to the backup (may be NULL)
+ * @return int 0 on success, -1 if the manifest could not be updated
+ */
+int manifest_record_publish(const char *full_path, const char *backup_path, int64_t backup_us,
+                            int chunked, const ContentInfo *current, uint32_t *backup_id);
+
+/**
+ * @brief Record the outcome of compressing a version
+ *
+ * @param full_path storage path of the file
+ * @param id version id
+ * @param compressed new value of the version's compressed field
+ * @return int 0 on success, -1 if there is no such version or the manifest could not be saved
+ */
+int manifest_set_compressed(const char *full_path, uint32_t id, int compressed);
+
+/**
+ * @brief Record that a version moved into a pack segment
+ *
+ * @param full_path storage path of the file
+ * @param expected the version as it was read; it only moves if its id, backup
+ *                 time and location still match
+ * @param pack pack segment now holding the version
+ * @param offset where its stored bytes start in the pack
+ * @param length number of stored bytes
+ * @return int 0 if moved, 1 if the version changed or is gone, -1 if the manifest could not be saved
+ */
+int manifest_set_packed(const char *full_path, const VersionEntry *expected, uint32_t pack,
+                        uint64_t offset, uint64_t length);
+
+/**
+ * @brief Drop versions from a manifest without touching their files
+ *
+ * The caller deletes the version files afterwards, outside the path lock:
+ * once dropped, no request can find them.
+ *
+ * @param full_path storage path of the file
+ * @param drop versions to drop, ascending by id; an entry is only dropped if
+ *             its id and backup time still match (an RM restarts the ids)
+ * @param count number of entries in drop
+ * @param removed receives the dropped entries, in id order
+ * @return int number of entries dropped, -1 if the manifest could not be saved
+ */
+int manifest_drop_versions(const char *full_path, const VersionEntry *drop, size_t count,
+                           VersionEntry *removed);
+
+/**
+ * @brief Delete every version of a file along with its manifest
+ *
+ * Chunked versions release their chunks.
+ *
+ * @param full_path storage path of the file
+ * @param deleted incremented per deleted version
+ * @param failed incremented per version that could not be deleted
+ */
+void manifest_delete_versions(const char *full_path, int *deleted, int *failed);
+
+// Called per file by manifest_walk(); returning nonzero ends the walk
+typedef int (*ManifestVisitFn)(const char *full_path, const char *dir);
+
+/**
+ * @brief Visit every file under a storage root that has a manifest
+ *
+ * Symbolic links are not followed, and manifests whose paths do not fit a
+ * storage path are skipped. Takes no locks; visit locks each file itself.
+ *
+ * @param root storage root
+ * @param visit called with the storage path of the file and its directory
+ * @return int 0 once every manifest was visited, visit's nonzero result if it
+ *             ended the walk, -1 if the root could not be read
+ */
+int manifest_walk(const char *root, ManifestVisitFn visit);
+
+#endif // VERSION_MANIFEST_H
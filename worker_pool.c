@@ -0,0 +1,135 @@
+/*
+ * worker_pool.c, Yehen Yan, CS5600 Practicum II
+ * Fixed-size worker thread pool fed by a bounded queue
+ * Last modified: Dec 2025
+ */
+#define _POSIX_C_SOURCE 200809L // sysconf
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "worker_pool.h"
+
+// Ring buffer of pending items, protected by lock
+static void **queue = NULL;
+static size_t queue_cap = 0;
+static size_t queue_head = 0;
+static size_t queue_len = 0;
+static int stopping = 0;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t not_empty = PTHREAD_COND_INITIALIZER;
+
+static pthread_t *workers = NULL;
+static int worker_count = 0;
+static WorkFn work_fn = NULL;
+
+static void *worker_main(void *arg)
+{
+    (void)arg;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&lock);
+        while (queue_len == 0 && !stopping)
+        {
+            pthread_cond_wait(&not_empty, &lock);
+        }
+        if (queue_len == 0)
+        {
+            // Stopping and drained
+            pthread_mutex_unlock(&lock);
+            return NULL;
+        }
+
+        void *item = queue[queue_head];
+        queue_head = (queue_head + 1) % queue_cap;
+        queue_len--;
+        pthread_mutex_unlock(&lock);
+
+        work_fn(item);
+    }
+}
+
+int pool_size(int threads)
+{
+    if (threads <= 0)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (int)cpus : 1;
+    }
+    return threads;
+}
+
+int pool_start(int threads, size_t capacity, WorkFn work)
+{
+    threads = pool_size(threads);
+
+    queue = malloc(capacity * sizeof(void *));
+    workers = malloc(threads * sizeof(pthread_t));
+    if (!queue || !workers)
+    {
+        perror("Failed to allocate worker pool");
+        free(queue);
+        free(workers);
+        return -1;
+    }
+    queue_cap = capacity;
+    work_fn = work;
+
+    for (int i = 0; i < threads; i++)
+    {
+        if (pthread_create(&workers[worker_count], NULL, worker_main, NULL) != 0)
+        {
+            perror("Failed to create worker thread");
+            break;
+        }
+        worker_count++;
+    }
+
+    if (worker_count == 0)
+    {
+        free(queue);
+        free(workers);
+        queue = NULL;
+        workers = NULL;
+        return -1;
+    }
+    return worker_count;
+}
+
+int pool_submit(void *item)
+{
+    pthread_mutex_lock(&lock);
+    if (queue_len == queue_cap)
+    {
+        pthread_mutex_unlock(&lock);
+        return -1;
+    }
+
+    queue[(queue_head + queue_len) % queue_cap] = item;
+    queue_len++;
+    pthread_cond_signal(&not_empty);
+    pthread_mutex_unlock(&lock);
+    return 0;
+}
+
+void pool_shutdown(void)
+{
+    pthread_mutex_lock(&lock);
+    stopping = 1;
+    pthread_cond_broadcast(&not_empty);
+    pthread_mutex_unlock(&lock);
+
+    for (int i = 0; i < worker_count; i++)
+    {
+        pthread_join(workers[i], NULL);
+    }
+
+    free(queue);
+    free(workers);
+    queue = NULL;
+    workers = NULL;
+    worker_count = 0;
+}
@@ -0,0 +1,50 @@
+/*
+ * worker_pool.h, Yehen Yan, CS5600 Practicum II
+ * Fixed-size worker thread pool fed by a bounded queue
+ * Last modified: Dec 2025
+ */
+
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <stddef.h>
+
+// Work function run by a worker for every submitted item
+typedef void (*WorkFn)(void *item);
+
+/**
+ * @brief Number of workers pool_start() creates for a requested count
+ *
+ * @param threads requested number of workers, 0 for one per online CPU
+ * @return int number of workers
+ */
+int pool_size(int threads);
+
+/**
+ * @brief Start the worker threads
+ *
+ * Threads are created once, up front, and live until pool_shutdown().
+ *
+ * @param threads number of workers, 0 for one per online CPU
+ * @param capacity maximum number of queued items
+ * @param work function every worker runs on each item
+ * @return int number of workers started, -1 if none could be started
+ */
+int pool_start(int threads, size_t capacity, WorkFn work);
+
+/**
+ * @brief Queue an item for the next free worker
+ *
+ * Never blocks: a full queue is reported to the caller instead.
+ *
+ * @param item item passed to the work function
+ * @return int 0 on success, -1 if the queue is full
+ */
+int pool_submit(void *item);
+
+/**
+ * @brief Let the workers finish queued items, then join them
+ */
+void pool_shutdown(void);
+
+#endif // WORKER_POOL_H